@@ -0,0 +1,158 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+#ifndef MCBEREPAIR_ARCHIVE_HPP
+#define MCBEREPAIR_ARCHIVE_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <string>
+#include <string_view>
+
+// Key-value archive format
+//
+// An archive is a stream of (key, value) records that can be written and
+// read in one pass. It starts with a 16-byte header: the magic "MCBEKVAR", a
+// uint32 version, and a reserved uint32. Each record is the uint32 key size,
+// the uint32 value size, the raw key, and the value. A record whose key size
+// is 0xFFFFFFFF ends the archive, so a truncated stream can be detected.
+//
+// All integers are little-endian, like the chunk keys themselves.
+
+namespace mcberepair {
+
+constexpr char kArchiveMagic[8] = {'M', 'C', 'B', 'E', 'K', 'V', 'A', 'R'};
+constexpr uint32_t kArchiveVersion = 1;
+constexpr uint32_t kArchiveEnd = 0xFFFFFFFF;
+
+namespace detail {
+inline void append_archive_u32(std::string *out, uint32_t u) {
+    char buffer[4] = {static_cast<char>(u), static_cast<char>(u >> 8),
+                      static_cast<char>(u >> 16), static_cast<char>(u >> 24)};
+    out->append(buffer, 4);
+}
+
+inline uint32_t load_archive_u32(const char *p) {
+    auto q = reinterpret_cast<const unsigned char *>(p);
+    return uint32_t{q[0]} | uint32_t{q[1]} << 8 | uint32_t{q[2]} << 16 |
+           uint32_t{q[3]} << 24;
+}
+// Read exactly `size` bytes into `out`. The string grows as the bytes
+// arrive, so a corrupt size fails at the end of the stream instead of
+// allocating up to 4 GB up front.
+inline bool read_archive_bytes(std::istream &in, uint32_t size,
+                               std::string *out) {
+    constexpr size_t kStep = 1 << 20;
+    out->clear();
+    while(out->size() < size) {
+        size_t old_size = out->size();
+        size_t step = std::min<size_t>(size - old_size, kStep);
+        out->resize(old_size + step);
+        if(!in.read(out->data() + old_size, step)) {
+            return false;
+        }
+    }
+    return true;
+}
+}  // namespace detail
+
+inline void write_archive_header(std::string *out) {
+    assert(out != nullptr);
+    out->append(kArchiveMagic, 8);
+    detail::append_archive_u32(out, kArchiveVersion);
+    detail::append_archive_u32(out, 0);
+}
+
+inline void write_archive_record(std::string *out, std::string_view key,
+                                 std::string_view value) {
+    assert(out != nullptr);
+    detail::append_archive_u32(out, static_cast<uint32_t>(key.size()));
+    detail::append_archive_u32(out, static_cast<uint32_t>(value.size()));
+    out->append(key);
+    out->append(value);
+}
+
+// The record that ends an archive.
+inline void write_archive_footer(std::string *out) {
+    assert(out != nullptr);
+    detail::append_archive_u32(out, kArchiveEnd);
+    detail::append_archive_u32(out, 0);
+}
+
+// Reads records from an archive one at a time, so an archive of any size can
+// be processed in bounded memory.
+class ArchiveReader {
+   public:
+    explicit ArchiveReader(std::istream &in) : in_{in} {
+        char header[16];
+        if(!in_.read(header, 16) ||
+           std::memcmp(header, kArchiveMagic, sizeof(kArchiveMagic)) != 0) {
+            return;
+        }
+        uint32_t version = detail::load_archive_u32(header + 8);
+        if(version != kArchiveVersion) {
+            return;
+        }
+        ok_ = true;
+    }
+
+    explicit operator bool() const { return ok_; }
+
+    // Read the next record. Returns false at the end of the archive or if
+    // the archive is malformed; check done() to tell them apart.
+    bool next(std::string *key, std::string *value) {
+        assert(key != nullptr && value != nullptr);
+        if(!ok_ || done_) {
+            return false;
+        }
+        char header[8];
+        if(!in_.read(header, 8)) {
+            ok_ = false;
+            return false;
+        }
+        uint32_t key_size = detail::load_archive_u32(header + 0);
+        uint32_t value_size = detail::load_archive_u32(header + 4);
+        if(key_size == kArchiveEnd) {
+            done_ = true;
+            return false;
+        }
+        if(!detail::read_archive_bytes(in_, key_size, key) ||
+           !detail::read_archive_bytes(in_, value_size, value)) {
+            ok_ = false;
+            return false;
+        }
+        return true;
+    }
+
+    bool done() const { return done_; }
+
+   protected:
+    std::istream &in_;
+    bool ok_{false};
+    bool done_{false};
+};
+
+}  // namespace mcberepair
+
+#endif  // MCBEREPAIR_ARCHIVE_HPP
@@ -0,0 +1,153 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+#ifndef MCBEREPAIR_ARGS_HPP
+#define MCBEREPAIR_ARGS_HPP
+
+#include <cerrno>
+#include <cstdlib>
+#include <initializer_list>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace mcberepair {
+
+// Splits the arguments that follow a command name into positional arguments
+// and long options. Options look like `--name` or `--name=value` and may be
+// mixed with positional arguments. Everything after a bare `--` is treated
+// as positional, which allows keys that begin with `--`.
+class Args {
+   public:
+    Args(int argc, char* argv[], int first = 2) {
+        bool options_done = false;
+        for(int i = first; i < argc; ++i) {
+            std::string_view arg{argv[i]};
+            if(options_done || arg.size() < 2 || arg.substr(0, 2) != "--") {
+                positional_.push_back(argv[i]);
+                continue;
+            }
+            if(arg.size() == 2) {
+                options_done = true;
+                continue;
+            }
+            arg.remove_prefix(2);
+            auto pos = arg.find('=');
+            if(pos == std::string_view::npos) {
+                options_.emplace_back(arg, std::string_view{});
+                has_value_.push_back(false);
+            } else {
+                options_.emplace_back(arg.substr(0, pos), arg.substr(pos + 1));
+                has_value_.push_back(true);
+            }
+        }
+    }
+
+    size_t size() const { return positional_.size(); }
+
+    const char* operator[](size_t n) const { return positional_[n]; }
+
+    bool has(std::string_view name) const { return find(name) != -1; }
+
+    // returns the value of an option or `def` if the option is missing or
+    // was given without a value.
+    std::string_view value(std::string_view name,
+                           std::string_view def = {}) const {
+        int pos = find(name);
+        if(pos == -1 || !has_value_[pos]) {
+            return def;
+        }
+        return options_[pos].second;
+    }
+
+    // parses an integer-valued option; returns false if it is malformed or
+    // does not fit in T.
+    template <typename T>
+    bool number(std::string_view name, T* out) const {
+        static_assert(std::is_integral_v<T>, "options are integers");
+        int pos = find(name);
+        if(pos == -1) {
+            return true;
+        }
+        std::string str{options_[pos].second};
+        char* end = nullptr;
+        errno = 0;
+        long long v = std::strtoll(str.c_str(), &end, 10);
+        if(str.empty() || *end != '\0' || errno == ERANGE) {
+            return false;
+        }
+        if constexpr(std::is_unsigned_v<T>) {
+            if(v < 0 || static_cast<unsigned long long>(v) >
+                            std::numeric_limits<T>::max()) {
+                return false;
+            }
+        } else {
+            if(v < std::numeric_limits<T>::min() ||
+               v > std::numeric_limits<T>::max()) {
+                return false;
+            }
+        }
+        *out = static_cast<T>(v);
+        return true;
+    }
+
+    // returns true and stores the name of the first option that is not in
+    // `known` if an unrecognized option was given.
+    bool unknown(std::initializer_list<std::string_view> known,
+                 std::string* name) const {
+        for(auto&& opt : options_) {
+            bool found = false;
+            for(auto&& k : known) {
+                if(opt.first == k) {
+                    found = true;
+                    break;
+                }
+            }
+            if(!found) {
+                name->assign(opt.first);
+                return true;
+            }
+        }
+        return false;
+    }
+
+   protected:
+    int find(std::string_view name) const {
+        // the last occurrence of an option wins
+        for(int i = static_cast<int>(options_.size()) - 1; i >= 0; --i) {
+            if(options_[i].first == name) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    std::vector<const char*> positional_;
+    std::vector<std::pair<std::string_view, std::string_view>> options_;
+    std::vector<bool> has_value_;
+};
+
+}  // namespace mcberepair
+
+#endif  // MCBEREPAIR_ARGS_HPP
@@ -0,0 +1,383 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+
+// Benchmarks mcberepair commands against a deterministic synthetic world.
+// Each command is run as a separate process with --stats=json, so the
+// results include its own counts and peak memory. The NBT reader is timed
+// in-process on the block entities and entities of the world, and
+// ChunkIterator on the world itself.
+//
+//   mcberepair_bench [options] <mcberepair_exe> <work_dir>
+//
+// Results are printed to stdout as one JSON object.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "args.hpp"
+#include "chunkiter.hpp"
+#include "db.hpp"
+#include "leveldb/env.h"
+#include "nbt.hpp"
+#include "nbtpath.hpp"
+#include "slurp.hpp"
+#include "worldgen.hpp"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// The timings of one benchmark.
+struct result_t {
+    std::string name;
+    std::vector<double> ms;
+    uint64_t keys = 0;
+    uint64_t bytes = 0;
+    uint64_t peak_rss = 0;
+
+    double percentile(double q) const {
+        if(ms.empty()) {
+            return 0.0;
+        }
+        std::vector<double> v = ms;
+        std::sort(v.begin(), v.end());
+        auto i = static_cast<size_t>(std::ceil(q * v.size()));
+        return v[std::min(std::max<size_t>(i, 1), v.size()) - 1];
+    }
+};
+
+std::string quote(const std::string &str) { return "\"" + str + "\""; }
+
+uint64_t json_number(const std::string &json, const char *name) {
+    std::string needle = std::string{"\""} + name + "\": ";
+    auto pos = json.rfind(needle);
+    if(pos == std::string::npos) {
+        return 0;
+    }
+    return std::strtoull(json.c_str() + pos + needle.size(), nullptr, 10);
+}
+
+// Runs commands and collects the statistics they report.
+class Runner {
+   public:
+    Runner(std::string exe, std::string work)
+        : exe_{std::move(exe)}, work_{std::move(work)} {}
+
+    // Run `mcberepair --stats=json <args>` and add its timing to `result`.
+    // `input` is redirected to stdin if it is not empty.
+    bool Run(const std::string &args, const std::string &input,
+             result_t *result) {
+        std::string out = work_ + "/stdout.bin";
+        std::string err = work_ + "/stderr.txt";
+        std::string cmd = quote(exe_) + " --stats=json " + args;
+        if(!input.empty()) {
+            cmd += " < " + quote(input);
+        }
+        cmd += " > " + quote(out) + " 2> " + quote(err);
+        auto start = clock_type::now();
+        int status = std::system(cmd.c_str());
+        std::chrono::duration<double, std::milli> elapsed =
+            clock_type::now() - start;
+        std::ifstream in{err};
+        std::string json = mcberepair::slurp_string(in);
+        if(status != 0) {
+            fprintf(stderr, "ERROR: '%s' failed:\n%s", cmd.c_str(),
+                    json.c_str());
+            return false;
+        }
+        result->ms.push_back(elapsed.count());
+        result->keys += json_number(json, "keys");
+        result->bytes += json_number(json, "bytes");
+        result->peak_rss =
+            std::max(result->peak_rss, json_number(json, "peak_rss"));
+        return true;
+    }
+
+   protected:
+    std::string exe_;
+    std::string work_;
+};
+
+void print_result(const result_t &r, bool last) {
+    double seconds = 0.0;
+    for(double ms : r.ms) {
+        seconds += ms / 1000.0;
+    }
+    double keys_per_sec = seconds > 0 ? r.keys / seconds : 0.0;
+    double mb_per_sec = seconds > 0 ? r.bytes / (1024.0 * 1024.0) / seconds : 0.0;
+    printf(
+        "    {\"name\": \"%s\", \"runs\": %zu, \"keys\": %llu, \"bytes\": "
+        "%llu, \"keys_per_sec\": %.1f, \"mb_per_sec\": %.2f, \"latency_ms\": "
+        "{\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}, "
+        "\"peak_rss\": %llu}%s\n",
+        r.name.c_str(), r.ms.size(), static_cast<unsigned long long>(r.keys),
+        static_cast<unsigned long long>(r.bytes), keys_per_sec, mb_per_sec,
+        r.percentile(0.5), r.percentile(0.9), r.percentile(0.99),
+        r.percentile(1.0), static_cast<unsigned long long>(r.peak_rss),
+        last ? "" : ",");
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    mcberepair::Args args{argc, argv, 1};
+    if(args.size() < 2) {
+        fprintf(stderr,
+                "Usage: %s [options] <mcberepair_exe> <work_dir>\n"
+                "\n"
+                "Options:\n"
+                "  --chunks=N   Number of chunks in the world (default 1000).\n"
+                "  --seed=N     Seed of the world (default 1).\n"
+                "  --reps=N     Times to run each benchmark (default 5).\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::string bad_option;
+    if(args.unknown({"chunks", "seed", "reps"}, &bad_option)) {
+        fprintf(stderr, "ERROR: Unknown option '--%s'.\n", bad_option.c_str());
+        return EXIT_FAILURE;
+    }
+    mcberepair::world_spec_t spec;
+    int reps = 5;
+    if(!args.number("chunks", &spec.chunks) || !args.number("seed", &spec.seed) ||
+       !args.number("reps", &reps) || spec.chunks == 0 || reps <= 0) {
+        fprintf(stderr, "ERROR: Invalid option value.\n");
+        return EXIT_FAILURE;
+    }
+    std::string exe = args[0];
+    std::string work = args[1];
+    std::string world = work + "/world";
+    std::string copy = work + "/copy";
+
+    // start from a fresh world every time
+    leveldb::Env *env = leveldb::Env::Default();
+    leveldb::Options options;
+    env->CreateDir(work);
+    env->CreateDir(world);
+    env->CreateDir(copy);
+    leveldb::DestroyDB(world + "/db", options);
+
+    mcberepair::world_summary_t summary;
+    auto start = clock_type::now();
+    leveldb::Status status =
+        mcberepair::generate_world((world + "/db").c_str(), spec, &summary);
+    std::chrono::duration<double> generate = clock_type::now() - start;
+    if(!status.ok()) {
+        fprintf(stderr, "ERROR: Generating the world failed: %s\n",
+                status.ToString().c_str());
+        return EXIT_FAILURE;
+    }
+
+    Runner runner{exe, work};
+    // a deque, so references to earlier results stay valid
+    std::deque<result_t> results;
+    auto bench = [&](const char *name) -> result_t & {
+        results.push_back({});
+        results.back().name = name;
+        return results.back();
+    };
+
+    auto &listkeys = bench("listkeys");
+    for(int r = 0; r < reps; ++r) {
+        if(!runner.Run("listkeys " + quote(world), {}, &listkeys)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    auto &census = bench("census");
+    for(int r = 0; r < reps; ++r) {
+        if(!runner.Run("census " + quote(world), {}, &census)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    auto &blockcount = bench("blockcount");
+    for(int r = 0; r < reps; ++r) {
+        if(!runner.Run("blockcount " + quote(world), {}, &blockcount)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    auto &findbiome = bench("findbiome");
+    for(int r = 0; r < reps; ++r) {
+        if(!runner.Run("findbiome " + quote(world) + " forest", {},
+                       &findbiome)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    auto &fsck = bench("fsck");
+    for(int r = 0; r < reps; ++r) {
+        if(!runner.Run("fsck " + quote(world), {}, &fsck)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    // single-key commands pay for opening the database every time, which is
+    // what scripts that call them in a loop see
+    std::string value = work + "/value.bin";
+    auto &dumpkey = bench("dumpkey");
+    for(int r = 0; r < reps; ++r) {
+        for(auto &&key : summary.sample_keys) {
+            auto encoded = mcberepair::encode_key(key);
+            if(!runner.Run("dumpkey " + quote(world) + " " + quote(encoded), {},
+                           &dumpkey)) {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    env->RenameFile(work + "/stdout.bin", value);
+
+    // copyall creates the world that writekey and rmkeys modify
+    auto &copyall = bench("copyall");
+    auto &bulk = bench("copyall --bulk");
+    auto &writekey = bench("writekey");
+    auto &rmkeys = bench("rmkeys");
+    for(int r = 0; r < reps * 2; ++r) {
+        leveldb::DestroyDB(copy + "/db", options);
+        env->DeleteFile(copy + "/copyall.checkpoint");
+        bool is_bulk = (r % 2 == 1);
+        if(!runner.Run(std::string{"copyall "} + (is_bulk ? "--bulk " : "") +
+                           quote(world) + " " + quote(copy),
+                       {}, is_bulk ? &bulk : &copyall)) {
+            return EXIT_FAILURE;
+        }
+        if(is_bulk) {
+            continue;
+        }
+        for(auto &&key : summary.sample_keys) {
+            auto encoded = mcberepair::encode_key(key);
+            if(!runner.Run("writekey " + quote(copy) + " " + quote(encoded),
+                           value, &writekey)) {
+                return EXIT_FAILURE;
+            }
+        }
+        // about a quarter of the overworld
+        std::string side = std::to_string(
+            static_cast<int>(std::sqrt(static_cast<double>(spec.chunks))));
+        if(!runner.Run("rmkeys " + quote(copy) +
+                           " --quiet --dimension=0 --xmin=0 --zmin=0 --xmax=" +
+                           side + " --zmax=" + side,
+                       {}, &rmkeys)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    // salvaging reads every table of the world and writes them into the copy
+    auto &salvage = bench("repair --salvage");
+    for(int r = 0; r < reps; ++r) {
+        leveldb::DestroyDB(copy + "/db", options);
+        if(!runner.Run("repair " + quote(world) + " --salvage=" + quote(copy),
+                       {}, &salvage)) {
+            return EXIT_FAILURE;
+        }
+    }
+    leveldb::DestroyDB(copy + "/db", options);
+
+    // the reader is reused, as it would be when scanning a world
+    auto &nbt = bench("read_nbt");
+    mcberepair::NbtReader reader;
+    std::string buffer;
+    for(int r = 0; r < reps; ++r) {
+        for(auto &&v : summary.nbt_values) {
+            buffer.assign(v);
+            auto t0 = clock_type::now();
+            bool ok = reader.Read(buffer.data(), buffer.size());
+            std::chrono::duration<double, std::milli> elapsed =
+                clock_type::now() - t0;
+            if(!ok) {
+                fprintf(stderr, "ERROR: The NBT reader rejected a value.\n");
+                return EXIT_FAILURE;
+            }
+            nbt.ms.push_back(elapsed.count());
+            nbt.keys += 1;
+            nbt.bytes += buffer.size();
+        }
+    }
+
+    // a path query on the same values skips what it does not need
+    auto &query = bench("query_nbt identifier");
+    mcberepair::nbt_path_t path;
+    mcberepair::parse_nbt_path("identifier", &path);
+    for(int r = 0; r < reps; ++r) {
+        for(auto &&v : summary.nbt_values) {
+            mcberepair::nbt_value_t match;
+            auto t0 = clock_type::now();
+            mcberepair::find_nbt(v.data(), v.size(), path, &match);
+            std::chrono::duration<double, std::milli> elapsed =
+                clock_type::now() - t0;
+            query.ms.push_back(elapsed.count());
+            query.keys += 1;
+            query.bytes += v.size();
+        }
+    }
+
+    // chunk iteration with every tag and with only subchunks
+    mcberepair::DB db{(world + "/db").c_str()};
+    if(!db) {
+        fprintf(stderr, "ERROR: Opening '%s/db' failed.\n", world.c_str());
+        return EXIT_FAILURE;
+    }
+    for(int only_tag : {-1, 47}) {
+        auto &chunks =
+            bench(only_tag < 0 ? "chunk_iterator" : "chunk_iterator subchunks");
+        for(int r = 0; r < reps; ++r) {
+            mcberepair::ChunkIterator it{&db(), leveldb::ReadOptions{}};
+            if(only_tag >= 0) {
+                it.SetTags({only_tag});
+            }
+            auto t0 = clock_type::now();
+            for(it.SeekToFirst(); it.Valid(); it.Next()) {
+                for(auto &&record : it.records()) {
+                    chunks.keys += 1;
+                    chunks.bytes += record.key.size() + record.value.size();
+                }
+            }
+            std::chrono::duration<double, std::milli> elapsed =
+                clock_type::now() - t0;
+            chunks.ms.push_back(elapsed.count());
+        }
+    }
+
+    printf("{\n");
+    printf(
+        "  \"world\": {\"chunks\": %llu, \"seed\": %llu, \"keys\": %llu, "
+        "\"bytes\": %llu, \"generate_sec\": %.3f},\n",
+        static_cast<unsigned long long>(spec.chunks),
+        static_cast<unsigned long long>(spec.seed),
+        static_cast<unsigned long long>(summary.keys),
+        static_cast<unsigned long long>(summary.bytes), generate.count());
+    printf("  \"results\": [\n");
+    for(size_t i = 0; i < results.size(); ++i) {
+        print_result(results[i], i + 1 == results.size());
+    }
+    printf("  ]\n}\n");
+    return EXIT_SUCCESS;
+}
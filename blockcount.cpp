@@ -0,0 +1,267 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "args.hpp"
+#include "db.hpp"
+#include "mcbekey.hpp"
+#include "parallel.hpp"
+#include "shard.hpp"
+#include "subchunk.hpp"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// The histogram one thread fills while it scans its shards. Palette entries
+// are counted by their raw bytes and only named when the threads are done,
+// so each distinct entry is decoded once per thread instead of once per
+// subchunk.
+struct histogram_t {
+    std::unordered_map<std::string, size_t> ids;
+    std::vector<uint64_t> counts;
+    uint64_t subchunks = 0;
+    uint64_t bytes = 0;
+    uint64_t blocks = 0;
+    // subchunks that are malformed or in a format before version 1
+    uint64_t skipped = 0;
+    // blocks whose index is past the end of their palette
+    uint64_t invalid = 0;
+    std::string key;
+
+    void Add(std::string_view entry, uint64_t n) {
+        // looking up through a reused string does not allocate
+        key.assign(entry);
+        auto it = ids.find(key);
+        if(it == ids.end()) {
+            it = ids.emplace(key, counts.size()).first;
+            counts.push_back(0);
+        }
+        counts[it->second] += n;
+        blocks += n;
+    }
+};
+
+struct options_t {
+    int dimension;
+    bool all_layers;
+};
+
+leveldb::Status count_range(leveldb::DB *db,
+                            const mcberepair::key_range_t &range,
+                            const options_t &options, histogram_t *hist) {
+    leveldb::ReadOptions readOptions;
+    leveldb::DecompressAllocator decompress_allocator;
+    readOptions.decompress_allocator = &decompress_allocator;
+    readOptions.verify_checksums = true;
+    readOptions.fill_cache = false;
+    auto it = std::unique_ptr<leveldb::Iterator>{db->NewIterator(readOptions)};
+
+    mcberepair::subchunk_t subchunk;
+    std::vector<uint16_t> indices(mcberepair::kSubchunkBlocks);
+    std::vector<uint32_t> per_index;
+    mcberepair::scan_ranges(it.get(), {range}, [&](leveldb::Iterator *iter) {
+        auto key = iter->key();
+        std::string_view skey{key.data(), key.size()};
+        if(!mcberepair::is_chunk_key(skey)) {
+            return true;
+        }
+        auto chunk = mcberepair::parse_chunk_key(skey);
+        if(chunk.tag != 47 ||
+           (options.dimension >= 0 && chunk.dimension != options.dimension)) {
+            return true;
+        }
+        auto value = iter->value();
+        hist->subchunks += 1;
+        hist->bytes += key.size() + value.size();
+        if(!mcberepair::parse_subchunk(value.data(), value.size(),
+                                       &subchunk)) {
+            hist->skipped += 1;
+            return true;
+        }
+        size_t layers = options.all_layers ? subchunk.layers.size() : 1;
+        for(size_t i = 0; i < layers && i < subchunk.layers.size(); ++i) {
+            auto &layer = subchunk.layers[i];
+            if(layer.bits == 0) {
+                hist->Add(layer.palette[0], mcberepair::kSubchunkBlocks);
+                continue;
+            }
+            // count each index first, then each palette entry once
+            mcberepair::unpack_block_indices(layer, indices.data());
+            per_index.assign(layer.palette.size(), 0);
+            for(uint16_t index : indices) {
+                if(index < per_index.size()) {
+                    per_index[index] += 1;
+                } else {
+                    hist->invalid += 1;
+                }
+            }
+            for(size_t p = 0; p < per_index.size(); ++p) {
+                if(per_index[p] != 0) {
+                    hist->Add(layer.palette[p], per_index[p]);
+                }
+            }
+        }
+        return true;
+    });
+    return it->status();
+}
+
+}  // namespace
+
+int blockcount_main(int argc, char *argv[]) {
+    mcberepair::Args args{argc, argv};
+    if(args.size() < 1 || strcmp("help", argv[1]) == 0) {
+        printf("Usage: %s blockcount <minecraft_world_dir>\n", argv[0]);
+        printf("\n");
+        printf("Options:\n");
+        printf(
+            "  --threads=N      Split the keyspace into shards and count them "
+            "with N threads.\n"
+            "                   Use 0 for one thread per core (default 0).\n");
+        printf(
+            "  --dimension=N    Only count blocks in dimension N (0=overworld, "
+            "1=nether,\n"
+            "                   2=end).\n");
+        printf(
+            "  --all-layers     Also count the extra layers of subchunks, "
+            "which mostly hold\n"
+            "                   the water of waterlogged blocks.\n");
+        return EXIT_FAILURE;
+    }
+    std::string bad_option;
+    if(args.unknown({"threads", "dimension", "all-layers"}, &bad_option)) {
+        fprintf(stderr, "ERROR: Unknown option '--%s'.\n", bad_option.c_str());
+        return EXIT_FAILURE;
+    }
+    unsigned int threads = 0;
+    if(!args.number("threads", &threads)) {
+        fprintf(stderr, "ERROR: Invalid value for '--threads'.\n");
+        return EXIT_FAILURE;
+    }
+    if(threads == 0) {
+        threads = mcberepair::default_threads();
+    }
+    options_t options{-1, args.has("all-layers")};
+    if(!args.number("dimension", &options.dimension) ||
+       (args.has("dimension") && options.dimension < 0)) {
+        fprintf(stderr, "ERROR: Invalid value for '--dimension'.\n");
+        return EXIT_FAILURE;
+    }
+
+    // construct path for Minecraft BE database
+    std::string path = std::string(args[0]) + "/db";
+
+    // open the database
+    mcberepair::DB db{path.c_str()};
+
+    if(!db) {
+        fprintf(stderr, "ERROR: Opening '%s' failed.\n", path.c_str());
+        return EXIT_FAILURE;
+    }
+
+    auto start = clock_type::now();
+    std::vector<histogram_t> histograms(threads);
+    {
+        mcberepair::ScopedPhase scan_phase{mcberepair::Phase::kScan};
+
+        // use several shards per thread so that uneven shards balance out
+        auto shards =
+            mcberepair::shard_keyspace(&db(), threads > 1 ? threads * 4 : 1);
+
+        // each thread fills its own histogram, so workers never share a lock
+        std::vector<leveldb::Status> statuses(shards.size());
+        mcberepair::parallel_for_workers(
+            shards.size(), threads, [&](size_t i, unsigned int worker) {
+                statuses[i] = count_range(&db(), shards[i], options,
+                                          &histograms[worker]);
+            });
+        for(auto &&s : statuses) {
+            if(!s.ok()) {
+                // LCOV_EXCL_START
+                fprintf(stderr, "ERROR: Reading '%s' failed: %s\n",
+                        path.c_str(), s.ToString().c_str());
+                return EXIT_FAILURE;
+                // LCOV_EXCL_STOP
+            }
+        }
+    }
+
+    // name the palette entries of every thread and merge them
+    std::unordered_map<std::string, uint64_t> states;
+    mcberepair::NbtReader reader;
+    std::string buffer;
+    std::string name;
+    histogram_t total;
+    for(auto &&hist : histograms) {
+        for(auto &&id : hist.ids) {
+            if(!mcberepair::block_state_name(id.first, &reader, &buffer,
+                                             &name) ||
+               name.empty()) {
+                name = "unknown";
+            }
+            states[name] += hist.counts[id.second];
+        }
+        total.subchunks += hist.subchunks;
+        total.bytes += hist.bytes;
+        total.blocks += hist.blocks;
+        total.skipped += hist.skipped;
+        total.invalid += hist.invalid;
+    }
+    mcberepair::stats().AddKeys(total.subchunks, total.bytes);
+
+    std::vector<std::pair<std::string, uint64_t>> sorted(states.begin(),
+                                                         states.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+    printf("Counted %llu blocks in %llu subchunks in %.3f s with %u threads.\n",
+           static_cast<unsigned long long>(total.blocks),
+           static_cast<unsigned long long>(total.subchunks), elapsed.count(),
+           threads);
+    if(total.skipped > 0) {
+        printf("%llu subchunks were malformed or in an older format.\n",
+               static_cast<unsigned long long>(total.skipped));
+    }
+    if(total.invalid > 0) {
+        printf("%llu blocks had an index past the end of their palette.\n",
+               static_cast<unsigned long long>(total.invalid));
+    }
+    printf("\n  %12s  %s\n", "count", "block");
+    for(auto &&s : sorted) {
+        printf("  %12llu  %s\n", static_cast<unsigned long long>(s.second),
+               s.first.c_str());
+    }
+    return EXIT_SUCCESS;
+}
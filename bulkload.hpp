@@ -0,0 +1,254 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+#ifndef MCBEREPAIR_BULKLOAD_HPP
+#define MCBEREPAIR_BULKLOAD_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// leveldb does not expose an API for writing table files into a database, so
+// the bulk loader uses a few of its internal headers.
+#include "db/dbformat.h"
+#include "db/filename.h"
+#include "db/log_writer.h"
+#include "db/version_edit.h"
+#include "db.hpp"
+#include "leveldb/env.h"
+#include "leveldb/filter_policy.h"
+#include "leveldb/table_builder.h"
+#include "leveldb/zlib_compressor.h"
+
+namespace mcberepair {
+
+// Write a MANIFEST that holds a single version edit and make it current.
+inline leveldb::Status write_manifest(leveldb::Env* env,
+                                      const std::string& path,
+                                      uint64_t number,
+                                      const leveldb::VersionEdit& edit) {
+    leveldb::WritableFile* pfile = nullptr;
+    leveldb::Status status =
+        env->NewWritableFile(leveldb::DescriptorFileName(path, number), &pfile);
+    if(!status.ok()) {
+        return status;  // LCOV_EXCL_LINE
+    }
+    std::unique_ptr<leveldb::WritableFile> manifest{pfile};
+    {
+        leveldb::log::Writer log{manifest.get()};
+        std::string record;
+        edit.EncodeTo(&record);
+        status = log.AddRecord(record);
+    }
+    if(status.ok()) {
+        status = manifest->Sync();
+    }
+    if(status.ok()) {
+        status = manifest->Close();
+    }
+    if(status.ok()) {
+        status = leveldb::SetCurrentFile(env, path, number);
+    }
+    return status;
+}
+
+// Build a new database directly from keys that arrive in sorted order. Keys
+// are written straight into table files on the bottommost level and a fresh
+// MANIFEST is written when loading finishes. Nothing goes through the log or
+// the memtable, so the result needs no compaction.
+class BulkLoader {
+   public:
+    explicit BulkLoader(const char* path)
+        : path_{path},
+          env_{db_env()},
+          icmp_{leveldb::BytewiseComparator()},
+          filter_policy_{db_options().bloom_bits > 0
+                             ? leveldb::NewBloomFilterPolicy(
+                                   db_options().bloom_bits)
+                             : nullptr},
+          ipolicy_{filter_policy_.get()} {
+        // tables store internal keys, so they must be built with the same
+        // comparator and filter wrappers that leveldb uses internally
+        options_.comparator = &icmp_;
+        options_.filter_policy = filter_policy_ ? &ipolicy_ : nullptr;
+        options_.block_size = db_options().block_size;
+        options_.compressors[0] = &zlib_raw_;
+        options_.compressors[1] = &zlib_;
+        options_.env = env_;
+
+        // the directory may already exist, but it must not hold a database
+        env_->CreateDir(path_);
+        leveldb::Status status =
+            env_->LockFile(leveldb::LockFileName(path_), &lock_);
+        if(!status.ok()) {
+            lock_ = nullptr;
+            return;
+        }
+        if(env_->FileExists(leveldb::CurrentFileName(path_))) {
+            return;
+        }
+        ok_ = true;
+    }
+
+    ~BulkLoader() {
+        if(builder_) {
+            builder_->Abandon();
+        }
+        builder_.reset();
+        file_.reset();
+        if(lock_ != nullptr) {
+            env_->UnlockFile(lock_);
+        }
+    }
+
+    BulkLoader(const BulkLoader&) = delete;
+    BulkLoader& operator=(const BulkLoader&) = delete;
+
+    explicit operator bool() { return ok_; }
+
+    // Add a key-value pair. Keys must be strictly increasing.
+    leveldb::Status Add(const leveldb::Slice& key,
+                        const leveldb::Slice& value) {
+        if(num_entries_ > 0 && key.compare(last_key_) <= 0) {
+            return leveldb::Status::InvalidArgument(
+                "bulk load keys are not in sorted order", key);
+        }
+        leveldb::Status status;
+        if(!builder_) {
+            status = NewTable();
+            if(!status.ok()) {
+                return status;  // LCOV_EXCL_LINE
+            }
+            files_.back().smallest =
+                leveldb::InternalKey(key, 0, leveldb::kTypeValue);
+        }
+        internal_key_.clear();
+        leveldb::AppendInternalKey(
+            &internal_key_, leveldb::ParsedInternalKey(key, 0,
+                                                       leveldb::kTypeValue));
+        builder_->Add(internal_key_, value);
+        last_key_.assign(key.data(), key.size());
+        num_entries_ += 1;
+
+        if(builder_->FileSize() >= options_.max_file_size) {
+            return FinishTable();
+        }
+        return builder_->status();
+    }
+
+    // Finish the last table and install all tables in a new MANIFEST.
+    leveldb::Status Finish() {
+        leveldb::Status status;
+        if(builder_) {
+            status = FinishTable();
+            if(!status.ok()) {
+                return status;  // LCOV_EXCL_LINE
+            }
+        }
+
+        uint64_t manifest_number = next_file_++;
+
+        // describe the new database in a single version edit
+        leveldb::VersionEdit edit;
+        edit.SetComparatorName(leveldb::BytewiseComparator()->Name());
+        edit.SetLogNumber(0);
+        edit.SetNextFile(next_file_);
+        edit.SetLastSequence(0);
+        for(auto&& f : files_) {
+            edit.AddFile(kLevel, f.number, f.size, f.smallest, f.largest);
+        }
+
+        return write_manifest(env_, path_, manifest_number, edit);
+    }
+
+    uint64_t num_entries() const { return num_entries_; }
+    uint64_t num_files() const { return files_.size(); }
+    uint64_t file_bytes() const { return file_bytes_; }
+
+   protected:
+    // tables are placed on the last level because they never overlap
+    static constexpr int kLevel = leveldb::config::kNumLevels - 1;
+
+    struct file_t {
+        uint64_t number;
+        uint64_t size;
+        leveldb::InternalKey smallest;
+        leveldb::InternalKey largest;
+    };
+
+    leveldb::Status NewTable() {
+        uint64_t number = next_file_++;
+        leveldb::WritableFile* pfile = nullptr;
+        leveldb::Status status = env_->NewWritableFile(
+            leveldb::TableFileName(path_, number), &pfile);
+        if(!status.ok()) {
+            return status;  // LCOV_EXCL_LINE
+        }
+        file_.reset(pfile);
+        builder_ = std::make_unique<leveldb::TableBuilder>(options_, pfile);
+        files_.push_back({number, 0, {}, {}});
+        return status;
+    }
+
+    leveldb::Status FinishTable() {
+        leveldb::Status status = builder_->Finish();
+        auto& f = files_.back();
+        f.size = builder_->FileSize();
+        f.largest = leveldb::InternalKey(last_key_, 0, leveldb::kTypeValue);
+        file_bytes_ += f.size;
+        builder_.reset();
+        if(status.ok()) {
+            status = file_->Sync();
+        }
+        if(status.ok()) {
+            status = file_->Close();
+        }
+        file_.reset();
+        return status;
+    }
+
+    std::string path_;
+    leveldb::Env* env_;
+    leveldb::FileLock* lock_{nullptr};
+    bool ok_{false};
+
+    leveldb::InternalKeyComparator icmp_;
+    std::unique_ptr<const leveldb::FilterPolicy> filter_policy_;
+    leveldb::InternalFilterPolicy ipolicy_;
+    leveldb::ZlibCompressorRaw zlib_raw_;
+    leveldb::ZlibCompressor zlib_;
+    leveldb::Options options_;
+
+    std::unique_ptr<leveldb::WritableFile> file_;
+    std::unique_ptr<leveldb::TableBuilder> builder_;
+    std::vector<file_t> files_;
+
+    uint64_t next_file_{1};
+    uint64_t num_entries_{0};
+    uint64_t file_bytes_{0};
+    std::string last_key_;
+    std::string internal_key_;
+};
+
+}  // namespace mcberepair
+
+#endif  // MCBEREPAIR_BULKLOAD_HPP
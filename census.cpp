@@ -0,0 +1,510 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "args.hpp"
+#include "chunkiter.hpp"
+#include "db.hpp"
+#include "nbtpath.hpp"
+#include "parallel.hpp"
+#include "shard.hpp"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+enum kind_t { kEntity, kBlockEntity };
+
+const char *const kind_names[] = {"entity", "block_entity"};
+
+// Newer worlds store entities under "actorprefix" keys. Each chunk lists the
+// entities it owns in a "digp" key that holds 8-byte actor ids.
+const char actor_prefix[] = "actorprefix";
+const char digp_prefix[] = "digp";
+
+// regions are 32x32 chunks
+constexpr int kRegionShift = 5;
+
+bool starts_with(const leveldb::Slice &key, std::string_view prefix) {
+    return key.size() >= prefix.size() &&
+           memcmp(key.data(), prefix.data(), prefix.size()) == 0;
+}
+
+// Things of one kind and identifier in a chunk or region of a dimension.
+struct group_t {
+    std::string identifier;
+    int kind;
+    int dimension;
+    int x;
+    int z;
+
+    bool operator==(const group_t &other) const {
+        return kind == other.kind && dimension == other.dimension &&
+               x == other.x && z == other.z && identifier == other.identifier;
+    }
+};
+
+struct group_hash {
+    size_t operator()(const group_t &g) const {
+        size_t h = std::hash<std::string>{}(g.identifier);
+        for(int v : {g.kind, g.dimension, g.x, g.z}) {
+            h = h * 31 + static_cast<size_t>(static_cast<unsigned int>(v));
+        }
+        return h;
+    }
+};
+
+using group_counts_t = std::unordered_map<group_t, uint64_t, group_hash>;
+
+struct offender_t {
+    group_t group;
+    uint64_t count;
+};
+
+// the most common group first, with ties broken so output is stable
+bool worse_offender(const offender_t &a, const offender_t &b) {
+    if(a.count != b.count) {
+        return a.count > b.count;
+    }
+    return std::tie(a.group.identifier, a.group.kind, a.group.dimension,
+                    a.group.x, a.group.z) < std::tie(b.group.identifier,
+                                                     b.group.kind,
+                                                     b.group.dimension,
+                                                     b.group.x, b.group.z);
+}
+
+// Keeps the `limit` largest chunk groups offered to it.
+class TopChunks {
+   public:
+    explicit TopChunks(size_t limit) : limit_{limit} {}
+
+    void Offer(const group_t &group, uint64_t count) {
+        if(limit_ == 0) {
+            return;
+        }
+        offender_t o{group, count};
+        if(heap_.size() == limit_) {
+            if(!worse_offender(o, heap_.front())) {
+                return;
+            }
+            std::pop_heap(heap_.begin(), heap_.end(), worse_offender);
+            heap_.pop_back();
+        }
+        heap_.push_back(std::move(o));
+        std::push_heap(heap_.begin(), heap_.end(), worse_offender);
+    }
+
+    void Merge(const TopChunks &other) {
+        for(auto &&o : other.heap_) {
+            Offer(o.group, o.count);
+        }
+    }
+
+    // the groups, worst first
+    std::vector<offender_t> Sorted() const {
+        auto ret = heap_;
+        std::sort(ret.begin(), ret.end(), worse_offender);
+        return ret;
+    }
+
+   protected:
+    size_t limit_;
+    // a heap whose front is the least offender kept
+    std::vector<offender_t> heap_;
+};
+
+// an entity stored under an actorprefix key, placed once its owner is known
+struct actor_t {
+    uint64_t uid;
+    std::string identifier;
+    int x;
+    int z;
+};
+
+struct owner_t {
+    uint64_t uid;
+    int dimension;
+    int x;
+    int z;
+};
+
+// The tables one thread fills while it scans its shards.
+struct census_t {
+    explicit census_t(size_t top) : chunks{top} {}
+
+    group_counts_t regions;
+    TopChunks chunks;
+    std::vector<actor_t> actors;
+    std::vector<owner_t> owners;
+    uint64_t values = 0;
+    uint64_t bytes = 0;
+    uint64_t malformed = 0;
+    uint64_t counts[2] = {0, 0};
+
+    // Count `n` things of a group of one chunk.
+    void Add(group_t group, uint64_t n) {
+        counts[group.kind] += n;
+        chunks.Offer(group, n);
+        group.x >>= kRegionShift;
+        group.z >>= kRegionShift;
+        regions[std::move(group)] += n;
+    }
+};
+
+// The paths that are read from each entity and block entity.
+struct paths_t {
+    mcberepair::nbt_path_t root;
+    mcberepair::nbt_path_t identifier;
+    mcberepair::nbt_path_t id;
+    mcberepair::nbt_path_t pos_x;
+    mcberepair::nbt_path_t pos_z;
+
+    paths_t() {
+        mcberepair::parse_nbt_path("identifier", &identifier);
+        mcberepair::parse_nbt_path("id", &id);
+        mcberepair::parse_nbt_path("Pos[0]", &pos_x);
+        mcberepair::parse_nbt_path("Pos[2]", &pos_z);
+    }
+};
+
+// Entities are named by "identifier" and block entities by "id". Old worlds
+// name entities by a numeric "id" instead.
+std::string identifier_of(const mcberepair::nbt_value_t &root,
+                          const paths_t &paths) {
+    mcberepair::nbt_value_t match;
+    if((mcberepair::find_nbt(root, paths.identifier, &match) ||
+        mcberepair::find_nbt(root, paths.id, &match)) &&
+       match.type == mcberepair::nbt_type::STRING) {
+        return std::string{match.as_string()};
+    }
+    if(mcberepair::find_nbt(root, paths.id, &match) &&
+       mcberepair::detail::nbt_fixed_size(match.type) != 0) {
+        return "#" + std::to_string(match.as_integer());
+    }
+    return "unknown";
+}
+
+int chunk_of(double coord) {
+    return static_cast<int>(std::floor(coord / 16.0));
+}
+
+// Count the roots of a value of a chunk stored under tag 49 or 50.
+void count_chunk_value(const mcberepair::ChunkIterator &chunk,
+                       const mcberepair::chunk_record_t &record,
+                       const paths_t &paths, census_t *census) {
+    const leveldb::Slice &value = record.value;
+    // a chunk rarely holds many kinds of things, so a vector is enough
+    std::vector<std::pair<std::string, uint64_t>> counts;
+    bool ok = mcberepair::query_nbt(
+        value.data(), value.size(), paths.root,
+        [&](const mcberepair::nbt_value_t &root) {
+            auto identifier = identifier_of(root, paths);
+            auto it = std::find_if(counts.begin(), counts.end(),
+                                   [&](const auto &c) {
+                                       return c.first == identifier;
+                                   });
+            if(it == counts.end()) {
+                counts.emplace_back(std::move(identifier), 1);
+            } else {
+                it->second += 1;
+            }
+            return true;
+        });
+    if(!ok) {
+        census->malformed += 1;
+    }
+    int kind = record.tag == 49 ? kBlockEntity : kEntity;
+    for(auto &&c : counts) {
+        census->Add({std::move(c.first), kind, chunk.dimension(), chunk.x(),
+                     chunk.z()},
+                    c.second);
+    }
+}
+
+void count_actor(const leveldb::Slice &key, const leveldb::Slice &value,
+                 const paths_t &paths, census_t *census) {
+    actor_t actor{0, {}, 0, 0};
+    std::memcpy(&actor.uid, key.data() + key.size() - 8, 8);
+    bool found = false;
+    bool ok = mcberepair::query_nbt(
+        value.data(), value.size(), paths.root,
+        [&](const mcberepair::nbt_value_t &root) {
+            actor.identifier = identifier_of(root, paths);
+            mcberepair::nbt_value_t x, z;
+            if(mcberepair::find_nbt(root, paths.pos_x, &x) &&
+               mcberepair::find_nbt(root, paths.pos_z, &z)) {
+                actor.x = chunk_of(x.as_double());
+                actor.z = chunk_of(z.as_double());
+            }
+            found = true;
+            return false;
+        });
+    if(!ok || !found) {
+        census->malformed += 1;
+        return;
+    }
+    census->actors.push_back(std::move(actor));
+}
+
+leveldb::Status census_range(leveldb::DB *db,
+                             const mcberepair::key_range_t &range,
+                             const paths_t &paths, census_t *census) {
+    leveldb::ReadOptions readOptions;
+    leveldb::DecompressAllocator decompress_allocator;
+    readOptions.decompress_allocator = &decompress_allocator;
+    readOptions.verify_checksums = true;
+    readOptions.fill_cache = false;
+
+    // block entities and the entities of older worlds, a chunk at a time
+    mcberepair::ChunkIterator chunks{db, readOptions, range};
+    chunks.SetTags({49, 50});
+    for(chunks.SeekToFirst(); chunks.Valid(); chunks.Next()) {
+        for(auto &&record : chunks.records()) {
+            count_chunk_value(chunks, record, paths, census);
+            census->values += 1;
+            census->bytes += record.key.size() + record.value.size();
+        }
+    }
+    if(!chunks.status().ok()) {
+        return chunks.status();  // LCOV_EXCL_LINE
+    }
+
+    // the entities of newer worlds and the chunks that own them
+    std::vector<mcberepair::key_range_t> ranges;
+    for(const char *prefix : {actor_prefix, digp_prefix}) {
+        mcberepair::key_range_t r;
+        if(mcberepair::intersect_ranges(range, mcberepair::prefix_range(prefix),
+                                        &r)) {
+            ranges.push_back(std::move(r));
+        }
+    }
+    auto it = std::unique_ptr<leveldb::Iterator>{db->NewIterator(readOptions)};
+    mcberepair::scan_ranges(it.get(), ranges, [&](leveldb::Iterator *iter) {
+        auto key = iter->key();
+        if(starts_with(key, actor_prefix) &&
+           key.size() == sizeof(actor_prefix) - 1 + 8) {
+            count_actor(key, iter->value(), paths, census);
+        } else if(starts_with(key, digp_prefix) &&
+                  (key.size() == 12 || key.size() == 16)) {
+            owner_t owner{0, 0, 0, 0};
+            std::memcpy(&owner.x, key.data() + 4, 4);
+            std::memcpy(&owner.z, key.data() + 8, 4);
+            if(key.size() == 16) {
+                std::memcpy(&owner.dimension, key.data() + 12, 4);
+            }
+            auto value = iter->value();
+            for(size_t i = 0; i + 8 <= value.size(); i += 8) {
+                std::memcpy(&owner.uid, value.data() + i, 8);
+                census->owners.push_back(owner);
+            }
+        } else {
+            return true;
+        }
+        census->values += 1;
+        census->bytes += key.size() + iter->value().size();
+        return true;
+    });
+    return it->status();
+}
+
+void print_groups(const std::vector<offender_t> &groups) {
+    printf("  %10s  %-12s  %9s  %6s  %6s  %s\n", "count", "kind", "dimension",
+           "x", "z", "identifier");
+    for(auto &&o : groups) {
+        printf("  %10llu  %-12s  %9d  %6d  %6d  %s\n",
+               static_cast<unsigned long long>(o.count),
+               kind_names[o.group.kind], o.group.dimension, o.group.x,
+               o.group.z, o.group.identifier.c_str());
+    }
+}
+
+}  // namespace
+
+int census_main(int argc, char *argv[]) {
+    mcberepair::Args args{argc, argv};
+    if(args.size() < 1 || strcmp("help", argv[1]) == 0) {
+        printf("Usage: %s census <minecraft_world_dir>\n", argv[0]);
+        printf("\n");
+        printf("Options:\n");
+        printf(
+            "  --threads=N    Split the keyspace into shards and count them "
+            "with N threads.\n"
+            "                 Use 0 for one thread per core (default 0).\n");
+        printf(
+            "  --top=N        Print the N largest groups of regions and "
+            "chunks (default 10).\n");
+        return EXIT_FAILURE;
+    }
+    std::string bad_option;
+    if(args.unknown({"threads", "top"}, &bad_option)) {
+        fprintf(stderr, "ERROR: Unknown option '--%s'.\n", bad_option.c_str());
+        return EXIT_FAILURE;
+    }
+    unsigned int threads = 0;
+    if(!args.number("threads", &threads)) {
+        fprintf(stderr, "ERROR: Invalid value for '--threads'.\n");
+        return EXIT_FAILURE;
+    }
+    if(threads == 0) {
+        threads = mcberepair::default_threads();
+    }
+    size_t top = 10;
+    if(!args.number("top", &top)) {
+        fprintf(stderr, "ERROR: Invalid value for '--top'.\n");
+        return EXIT_FAILURE;
+    }
+
+    // construct path for Minecraft BE database
+    std::string path = std::string(args[0]) + "/db";
+
+    // open the database
+    mcberepair::DB db{path.c_str()};
+
+    if(!db) {
+        fprintf(stderr, "ERROR: Opening '%s' failed.\n", path.c_str());
+        return EXIT_FAILURE;
+    }
+
+    auto start = clock_type::now();
+    paths_t paths;
+    std::vector<census_t> censuses(threads, census_t{top});
+    {
+        mcberepair::ScopedPhase scan_phase{mcberepair::Phase::kScan};
+
+        // use several shards per thread so that uneven shards balance out
+        auto shards =
+            mcberepair::shard_keyspace(&db(), threads > 1 ? threads * 4 : 1);
+
+        // each thread fills its own tables, so workers never share a lock
+        std::vector<leveldb::Status> statuses(shards.size());
+        mcberepair::parallel_for_workers(
+            shards.size(), threads, [&](size_t i, unsigned int worker) {
+                statuses[i] =
+                    census_range(&db(), shards[i], paths, &censuses[worker]);
+            });
+        for(auto &&s : statuses) {
+            if(!s.ok()) {
+                // LCOV_EXCL_START
+                fprintf(stderr, "ERROR: Reading '%s' failed: %s\n",
+                        path.c_str(), s.ToString().c_str());
+                return EXIT_FAILURE;
+                // LCOV_EXCL_STOP
+            }
+        }
+    }
+
+    // merge the tables of every thread into the first
+    census_t &total = censuses[0];
+    for(size_t t = 1; t < censuses.size(); ++t) {
+        auto &c = censuses[t];
+        for(auto &&r : c.regions) {
+            total.regions[r.first] += r.second;
+        }
+        total.chunks.Merge(c.chunks);
+        std::move(c.actors.begin(), c.actors.end(),
+                  std::back_inserter(total.actors));
+        total.owners.insert(total.owners.end(), c.owners.begin(),
+                            c.owners.end());
+        total.values += c.values;
+        total.bytes += c.bytes;
+        total.malformed += c.malformed;
+        total.counts[kEntity] += c.counts[kEntity];
+        total.counts[kBlockEntity] += c.counts[kBlockEntity];
+    }
+
+    // Actors are placed in the chunk whose digp key lists them, which may be
+    // in another shard. Actors without an owner are placed by position.
+    std::unordered_map<uint64_t, owner_t> owners;
+    owners.reserve(total.owners.size());
+    for(auto &&o : total.owners) {
+        owners.emplace(o.uid, o);
+    }
+    group_counts_t actor_chunks;
+    for(auto &&a : total.actors) {
+        group_t group{std::move(a.identifier), kEntity, 0, a.x, a.z};
+        auto it = owners.find(a.uid);
+        if(it != owners.end()) {
+            group.dimension = it->second.dimension;
+            group.x = it->second.x;
+            group.z = it->second.z;
+        }
+        actor_chunks[std::move(group)] += 1;
+    }
+    for(auto &&c : actor_chunks) {
+        total.Add(c.first, c.second);
+    }
+    mcberepair::stats().AddKeys(total.values, total.bytes);
+
+    // totals by kind and identifier
+    group_counts_t identifiers;
+    std::vector<offender_t> regions;
+    regions.reserve(total.regions.size());
+    for(auto &&r : total.regions) {
+        identifiers[{r.first.identifier, r.first.kind, 0, 0, 0}] += r.second;
+        regions.push_back({r.first, r.second});
+    }
+    std::vector<offender_t> sorted;
+    for(auto &&i : identifiers) {
+        sorted.push_back({i.first, i.second});
+    }
+    std::sort(sorted.begin(), sorted.end(), worse_offender);
+    std::sort(regions.begin(), regions.end(), worse_offender);
+    regions.resize(std::min(regions.size(), top));
+
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+    printf(
+        "Counted %llu entities and %llu block entities in %llu values in "
+        "%.3f s with %u threads.\n",
+        static_cast<unsigned long long>(total.counts[kEntity]),
+        static_cast<unsigned long long>(total.counts[kBlockEntity]),
+        static_cast<unsigned long long>(total.values), elapsed.count(),
+        threads);
+    if(total.malformed > 0) {
+        printf("%llu values were malformed.\n",
+               static_cast<unsigned long long>(total.malformed));
+    }
+    printf("\nTotals:\n");
+    printf("  %10s  %-12s  %s\n", "count", "kind", "identifier");
+    for(auto &&o : sorted) {
+        printf("  %10llu  %-12s  %s\n", static_cast<unsigned long long>(o.count),
+               kind_names[o.group.kind], o.group.identifier.c_str());
+    }
+    printf("\nTop regions (32x32 chunks):\n");
+    print_groups(regions);
+    printf("\nTop chunks:\n");
+    print_groups(total.chunks.Sorted());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,388 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "args.hpp"
+#include "chunkindex.hpp"
+#include "mcbekey.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "tablefile.hpp"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// Add the chunk keys of one table or log to an index.
+struct collector_t {
+    uint64_t file;
+    std::vector<mcberepair::chunk_index_entry_t> *entries;
+    uint64_t keys{0};
+    uint64_t bytes{0};
+
+    void operator()(const leveldb::ParsedInternalKey &ikey,
+                    const leveldb::Slice &value) {
+        std::string_view key{ikey.user_key.data(), ikey.user_key.size()};
+        keys += 1;
+        bytes += key.size() + value.size();
+        if(!mcberepair::is_chunk_key(key)) {
+            return;
+        }
+        auto chunk = mcberepair::parse_chunk_key(key);
+        mcberepair::chunk_index_record_t r;
+        r.sequence = ikey.sequence;
+        r.file = file;
+        r.size = static_cast<uint32_t>(value.size());
+        r.tag = static_cast<int8_t>(chunk.tag);
+        r.subtag = static_cast<int8_t>(chunk.subtag);
+        r.deleted = ikey.type == leveldb::kTypeDeletion;
+        r.reserved = 0;
+        entries->push_back({chunk.dimension, chunk.x, chunk.z, r});
+    }
+};
+
+struct refresh_t {
+    uint64_t new_tables{0};
+    uint64_t old_tables{0};
+    uint64_t dropped_tables{0};
+    uint64_t logs{0};
+    uint64_t chunks{0};
+    uint64_t records{0};
+};
+
+// Bring the index at `index_path` up to date with the tables of the
+// database at `path`. Only tables that the index has not seen are read.
+// Logs are always read, because they are still being written.
+int refresh_index(const std::string &path, const std::string &index_path,
+                  bool rebuild, unsigned int threads, refresh_t *result) {
+    mcberepair::TableFiles files{path};
+    leveldb::Env *env = files.env();
+
+    mcberepair::manifest_t manifest;
+    leveldb::Status status = mcberepair::read_manifest(env, path, &manifest);
+    if(!status.ok()) {
+        fprintf(stderr, "ERROR: Reading the MANIFEST of '%s' failed: %s\n",
+                path.c_str(), status.ToString().c_str());
+        return EXIT_FAILURE;
+    }
+    std::vector<uint64_t> logs;
+    status = mcberepair::live_log_files(env, path, manifest, &logs);
+    if(!status.ok()) {
+        // LCOV_EXCL_START
+        fprintf(stderr, "ERROR: Listing '%s' failed: %s\n", path.c_str(),
+                status.ToString().c_str());
+        return EXIT_FAILURE;
+        // LCOV_EXCL_STOP
+    }
+
+    // load the existing index, if there is a usable one
+    std::vector<uint64_t> indexed;
+    std::vector<mcberepair::chunk_index_entry_t> entries;
+    if(!rebuild && env->FileExists(index_path)) {
+        mcberepair::ChunkIndex index;
+        status = index.Open(env, index_path);
+        if(status.ok()) {
+            status = index.ReadAll(&indexed, &entries);
+        }
+        if(!status.ok()) {
+            fprintf(stderr, "WARNING: Rebuilding the chunk index: %s\n",
+                    status.ToString().c_str());
+            indexed.clear();
+            entries.clear();
+        }
+    }
+    std::sort(indexed.begin(), indexed.end());
+
+    // Records from tables that compaction removed are dropped. Anything
+    // still live in them was rewritten into new tables, which are read below.
+    std::vector<uint64_t> live;
+    for(auto &&t : manifest.tables) {
+        live.push_back(t.number);
+    }
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                 [&](const auto &e) {
+                                     return !std::binary_search(
+                                         live.begin(), live.end(),
+                                         e.record.file);
+                                 }),
+                  entries.end());
+    std::vector<uint64_t> todo;
+    for(uint64_t number : live) {
+        if(std::binary_search(indexed.begin(), indexed.end(), number)) {
+            result->old_tables += 1;
+        } else {
+            todo.push_back(number);
+        }
+    }
+    result->new_tables = todo.size();
+    result->dropped_tables = indexed.size() - result->old_tables;
+    result->logs = logs.size();
+
+    // read new tables in parallel, each thread into its own list
+    mcberepair::ScopedPhase scan_phase{mcberepair::Phase::kScan};
+    std::vector<std::vector<mcberepair::chunk_index_entry_t>> found(threads);
+    std::vector<leveldb::Status> failed(todo.size());
+    std::vector<uint64_t> keys(threads, 0), bytes(threads, 0);
+    mcberepair::parallel_for_workers(
+        todo.size(), threads, [&](size_t i, unsigned int w) {
+            collector_t collect{todo[i], &found[w]};
+            failed[i] = files.ForEach(todo[i], collect);
+            keys[w] += collect.keys;
+            bytes[w] += collect.bytes;
+        });
+    for(size_t i = 0; i < todo.size(); ++i) {
+        if(!failed[i].ok()) {
+            fprintf(stderr, "ERROR: Reading table %llu failed: %s\n",
+                    static_cast<unsigned long long>(todo[i]),
+                    failed[i].ToString().c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    for(uint64_t number : logs) {
+        collector_t collect{number, &found[0]};
+        status = files.ForEachLogged(number, collect);
+        keys[0] += collect.keys;
+        bytes[0] += collect.bytes;
+        if(!status.ok()) {
+            fprintf(stderr, "WARNING: Log %llu is damaged: %s\n",
+                    static_cast<unsigned long long>(number),
+                    status.ToString().c_str());
+        }
+    }
+    for(unsigned int w = 0; w < threads; ++w) {
+        entries.insert(entries.end(), found[w].begin(), found[w].end());
+        found[w] = {};
+        mcberepair::stats().AddKeys(keys[w], bytes[w]);
+    }
+
+    // keep only the newest version of each key
+    std::sort(entries.begin(), entries.end(),
+              mcberepair::chunk_index_entry_less);
+    auto same_key = [](const auto &a, const auto &b) {
+        return a.dimension == b.dimension && a.x == b.x && a.z == b.z &&
+               a.record.tag == b.record.tag &&
+               a.record.subtag == b.record.subtag;
+    };
+    entries.erase(std::unique(entries.begin(), entries.end(), same_key),
+                  entries.end());
+    result->records = entries.size();
+
+    mcberepair::ScopedPhase write_phase{mcberepair::Phase::kWrite};
+    std::string contents;
+    mcberepair::write_chunk_index(entries, live, manifest.last_sequence,
+                                  &contents);
+    result->chunks =
+        mcberepair::detail::decode_header(contents.data()).chunk_count;
+    std::string tmp = index_path + ".tmp";
+    status = leveldb::WriteStringToFile(env, contents, tmp);
+    if(status.ok()) {
+        status = env->RenameFile(tmp, index_path);
+    }
+    if(!status.ok()) {
+        // LCOV_EXCL_START
+        fprintf(stderr, "ERROR: Writing '%s' failed: %s\n",
+                index_path.c_str(), status.ToString().c_str());
+        return EXIT_FAILURE;
+        // LCOV_EXCL_STOP
+    }
+    return EXIT_SUCCESS;
+}
+
+}  // namespace
+
+int chunkindex_main(int argc, char *argv[]) {
+    mcberepair::Args args{argc, argv};
+    if(args.size() < 1 || strcmp("help", argv[1]) == 0) {
+        printf("Usage: %s chunkindex <minecraft_world_dir>\n", argv[0]);
+        printf("\n");
+        printf(
+            "Build or refresh the chunk index stored in "
+            "<minecraft_world_dir>/mcberepair.chunkindex.\n");
+        printf(
+            "Lookups read only the index, so they work while the world is "
+            "open.\n");
+        printf("\n");
+        printf("Options:\n");
+        printf(
+            "  --rebuild        Read every table instead of only new "
+            "ones.\n");
+        printf(
+            "  --threads=N      Read new tables with N threads (default 0, "
+            "one per core).\n");
+        printf(
+            "  --x=N --z=N      Print the records of one chunk instead.\n");
+        printf(
+            "  --list           Print every indexed chunk instead.\n");
+        printf(
+            "  --dimension=N    The dimension of --x and --z, or the only "
+            "one to --list.\n");
+        printf(
+            "  --tag=N          Only --list chunks that have records with "
+            "this tag.\n");
+        return EXIT_FAILURE;
+    }
+    std::string bad_option;
+    if(args.unknown(
+           {"rebuild", "threads", "x", "z", "list", "dimension", "tag"},
+           &bad_option)) {
+        fprintf(stderr, "ERROR: Unknown option '--%s'.\n", bad_option.c_str());
+        return EXIT_FAILURE;
+    }
+    unsigned int threads = 0;
+    if(!args.number("threads", &threads)) {
+        fprintf(stderr, "ERROR: Invalid value for '--threads'.\n");
+        return EXIT_FAILURE;
+    }
+    if(threads == 0) {
+        threads = mcberepair::default_threads();
+    }
+    int x = 0, z = 0, dimension = -1, tag = -1;
+    if(!args.number("x", &x)) {
+        fprintf(stderr, "ERROR: Invalid value for '--x'.\n");
+        return EXIT_FAILURE;
+    }
+    if(!args.number("z", &z)) {
+        fprintf(stderr, "ERROR: Invalid value for '--z'.\n");
+        return EXIT_FAILURE;
+    }
+    if(!args.number("dimension", &dimension) ||
+       (args.has("dimension") && dimension < 0)) {
+        fprintf(stderr, "ERROR: Invalid value for '--dimension'.\n");
+        return EXIT_FAILURE;
+    }
+    if(!args.number("tag", &tag) ||
+       (args.has("tag") && (tag < 0 || tag > 127))) {
+        fprintf(stderr, "ERROR: Invalid value for '--tag'.\n");
+        return EXIT_FAILURE;
+    }
+    bool lookup = args.has("x") || args.has("z");
+    if(lookup && args.has("list")) {
+        fprintf(stderr, "ERROR: Use either --x and --z or --list.\n");
+        return EXIT_FAILURE;
+    }
+
+    std::string path = std::string(args[0]) + "/db";
+    std::string index_path =
+        std::string(args[0]) + "/mcberepair.chunkindex";
+
+    if(!lookup && !args.has("list")) {
+        auto start = clock_type::now();
+        refresh_t result;
+        int ret = refresh_index(path, index_path, args.has("rebuild"),
+                                threads, &result);
+        if(ret != EXIT_SUCCESS) {
+            return ret;
+        }
+        std::chrono::duration<double> elapsed = clock_type::now() - start;
+        printf(
+            "Indexed %llu chunks with %llu records in %.3f s. Read %llu new "
+            "tables and %llu logs; %llu tables were already indexed and "
+            "%llu were compacted away.\n",
+            static_cast<unsigned long long>(result.chunks),
+            static_cast<unsigned long long>(result.records), elapsed.count(),
+            static_cast<unsigned long long>(result.new_tables),
+            static_cast<unsigned long long>(result.logs),
+            static_cast<unsigned long long>(result.old_tables),
+            static_cast<unsigned long long>(result.dropped_tables));
+        return EXIT_SUCCESS;
+    }
+
+    mcberepair::ChunkIndex index;
+    leveldb::Status status =
+        index.Open(leveldb::Env::Default(), index_path);
+    if(!status.ok()) {
+        fprintf(stderr,
+                "ERROR: Reading '%s' failed: %s\n"
+                "Run '%s chunkindex %s' to build it.\n",
+                index_path.c_str(), status.ToString().c_str(), argv[0],
+                args[0]);
+        return EXIT_FAILURE;
+    }
+
+    if(lookup) {
+        mcberepair::chunk_index_slot_t slot;
+        std::vector<mcberepair::chunk_index_record_t> records;
+        status = index.Find(std::max(dimension, 0), x, z, &slot);
+        if(status.ok()) {
+            status = index.Records(slot, &records);
+        }
+        if(status.IsNotFound()) {
+            records.clear();
+        } else if(!status.ok()) {
+            fprintf(stderr, "ERROR: Reading '%s' failed: %s\n",
+                    index_path.c_str(), status.ToString().c_str());
+            return EXIT_FAILURE;
+        }
+        printf("tag\tsubtag\tbytes\n");
+        for(auto &&r : records) {
+            if(r.deleted) {
+                continue;
+            }
+            printf("%d\t", static_cast<int>(r.tag));
+            if(r.subtag != -1) {
+                printf("%d", static_cast<int>(r.subtag));
+            }
+            printf("\t%u\n", r.size);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    std::vector<mcberepair::chunk_index_slot_t> chunks;
+    status = index.ForEachChunk([&](const auto &slot) {
+        if(dimension != -1 && slot.dimension != dimension) {
+            return;
+        }
+        if(tag != -1 ? !slot.has_tag(tag)
+                     : slot.tags[0] == 0 && slot.tags[1] == 0) {
+            return;
+        }
+        chunks.push_back(slot);
+    });
+    if(!status.ok()) {
+        // LCOV_EXCL_START
+        fprintf(stderr, "ERROR: Reading '%s' failed: %s\n",
+                index_path.c_str(), status.ToString().c_str());
+        return EXIT_FAILURE;
+        // LCOV_EXCL_STOP
+    }
+    std::sort(chunks.begin(), chunks.end(), [](const auto &a, const auto &b) {
+        return std::tie(a.dimension, a.x, a.z) <
+               std::tie(b.dimension, b.x, b.z);
+    });
+    printf("x\tz\tdimension\tsubchunks\n");
+    for(auto &&c : chunks) {
+        int subchunks = 0;
+        for(uint32_t bits = c.subchunks; bits != 0; bits &= bits - 1) {
+            subchunks += 1;
+        }
+        printf("%d\t%d\t%d\t%d\n", c.x, c.z, c.dimension, subchunks);
+    }
+    return EXIT_SUCCESS;
+}
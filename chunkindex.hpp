@@ -0,0 +1,480 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+#ifndef MCBEREPAIR_CHUNKINDEX_HPP
+#define MCBEREPAIR_CHUNKINDEX_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "leveldb/env.h"
+
+// Chunk index format
+//
+// A chunk index is a sidecar file that tells which records each chunk has
+// without opening the database. It starts with a 40-byte header: the magic
+// "MCBECIDX", a uint32 version, the uint32 number of hash slots (a power of
+// two), the uint32 number of chunks, the uint32 number of records, the
+// uint32 number of indexed table files, a reserved uint32, and the uint64
+// last sequence number seen. Then come
+//
+//   uint64 file[file_count]        numbers of the tables already indexed
+//   slot_t slot[slot_count]        an open-addressing hash table of chunks
+//   record_t record[record_count]  the records of each chunk, in key order
+//
+// A slot is 40 bytes: int32 dimension, x, and z, the uint32 index of the
+// chunk's first record and its uint32 record count (0 for an empty slot),
+// a uint32 bitmap of the subchunks (tag 47) present, with bit n for subtag
+// n - 8, and a 128-bit bitmap of the tags present. A record is 24 bytes:
+// the uint64 sequence number and uint64 file number it was read from, the
+// uint32 value size, the tag, the subtag (-1 if none), a flag that is 1 for
+// deletions, and a reserved byte. Deletions are kept so that older values
+// found in later tables do not come back; they are not in the bitmaps.
+//
+// Chunks are found by hashing (dimension, x, z) and probing linearly, so a
+// lookup reads the header, a few slots, and the chunk's records. All
+// integers are little-endian on every host; the structs below are the
+// decoded form and are never copied to or from the file as they are.
+
+namespace mcberepair {
+
+constexpr char kChunkIndexMagic[8] = {'M', 'C', 'B', 'E', 'C', 'I', 'D', 'X'};
+constexpr uint32_t kChunkIndexVersion = 1;
+
+struct chunk_index_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t chunk_count;
+    uint32_t record_count;
+    uint32_t file_count;
+    uint32_t reserved;
+    uint64_t last_sequence;
+};
+static_assert(sizeof(chunk_index_header_t) == 40);
+
+struct chunk_index_slot_t {
+    int32_t dimension;
+    int32_t x;
+    int32_t z;
+    uint32_t first;
+    uint32_t count;
+    uint32_t subchunks;
+    uint64_t tags[2];
+
+    bool empty() const { return count == 0; }
+    bool has_tag(int tag) const {
+        return 0 <= tag && tag < 128 && ((tags[tag / 64] >> (tag % 64)) & 1);
+    }
+    bool has_subchunk(int subtag) const {
+        return -8 <= subtag && subtag < 24 && ((subchunks >> (subtag + 8)) & 1);
+    }
+};
+static_assert(sizeof(chunk_index_slot_t) == 40);
+
+struct chunk_index_record_t {
+    uint64_t sequence;
+    uint64_t file;
+    uint32_t size;
+    int8_t tag;
+    int8_t subtag;
+    uint8_t deleted;
+    uint8_t reserved;
+};
+static_assert(sizeof(chunk_index_record_t) == 24);
+
+// The in-memory form of an index entry while it is being built.
+struct chunk_index_entry_t {
+    int32_t dimension;
+    int32_t x;
+    int32_t z;
+    chunk_index_record_t record;
+};
+
+// Order entries by key, with the newest version of each key first.
+inline bool chunk_index_entry_less(const chunk_index_entry_t &a,
+                                   const chunk_index_entry_t &b) {
+    return std::make_tuple(a.dimension, a.x, a.z, a.record.tag,
+                           a.record.subtag, b.record.sequence) <
+           std::make_tuple(b.dimension, b.x, b.z, b.record.tag,
+                           b.record.subtag, a.record.sequence);
+}
+
+namespace detail {
+// The slot a chunk hashes to. This is part of the file format.
+inline uint64_t chunk_index_hash(int32_t dimension, int32_t x, int32_t z) {
+    uint64_t h = static_cast<uint32_t>(x) * 0x9E3779B97F4A7C15ull;
+    h ^= static_cast<uint32_t>(z) * 0xC2B2AE3D27D4EB4Full;
+    h ^= static_cast<uint32_t>(dimension) * 0x165667B19E3779F9ull;
+    return h ^ (h >> 29);
+}
+
+// Append `v` as little-endian bytes.
+template <typename T>
+void append_le(std::string *out, T v) {
+    auto u = static_cast<std::make_unsigned_t<T>>(v);
+    for(size_t i = 0; i < sizeof(T); ++i) {
+        out->push_back(static_cast<char>((u >> (8 * i)) & 0xFF));
+    }
+}
+
+// Read a little-endian `T` from `p`.
+template <typename T>
+T load_le(const char *p) {
+    std::make_unsigned_t<T> u = 0;
+    for(size_t i = 0; i < sizeof(T); ++i) {
+        u |= static_cast<std::make_unsigned_t<T>>(
+                 static_cast<unsigned char>(p[i]))
+             << (8 * i);
+    }
+    return static_cast<T>(u);
+}
+
+inline void encode_header(const chunk_index_header_t &h, std::string *out) {
+    out->append(h.magic, 8);
+    append_le(out, h.version);
+    append_le(out, h.slot_count);
+    append_le(out, h.chunk_count);
+    append_le(out, h.record_count);
+    append_le(out, h.file_count);
+    append_le(out, h.reserved);
+    append_le(out, h.last_sequence);
+}
+
+inline chunk_index_header_t decode_header(const char *p) {
+    chunk_index_header_t h;
+    std::memcpy(h.magic, p, 8);
+    h.version = load_le<uint32_t>(p + 8);
+    h.slot_count = load_le<uint32_t>(p + 12);
+    h.chunk_count = load_le<uint32_t>(p + 16);
+    h.record_count = load_le<uint32_t>(p + 20);
+    h.file_count = load_le<uint32_t>(p + 24);
+    h.reserved = load_le<uint32_t>(p + 28);
+    h.last_sequence = load_le<uint64_t>(p + 32);
+    return h;
+}
+
+inline void encode_slot(const chunk_index_slot_t &s, std::string *out) {
+    append_le(out, s.dimension);
+    append_le(out, s.x);
+    append_le(out, s.z);
+    append_le(out, s.first);
+    append_le(out, s.count);
+    append_le(out, s.subchunks);
+    append_le(out, s.tags[0]);
+    append_le(out, s.tags[1]);
+}
+
+inline chunk_index_slot_t decode_slot(const char *p) {
+    chunk_index_slot_t s;
+    s.dimension = load_le<int32_t>(p);
+    s.x = load_le<int32_t>(p + 4);
+    s.z = load_le<int32_t>(p + 8);
+    s.first = load_le<uint32_t>(p + 12);
+    s.count = load_le<uint32_t>(p + 16);
+    s.subchunks = load_le<uint32_t>(p + 20);
+    s.tags[0] = load_le<uint64_t>(p + 24);
+    s.tags[1] = load_le<uint64_t>(p + 32);
+    return s;
+}
+
+inline void encode_record(const chunk_index_record_t &r, std::string *out) {
+    append_le(out, r.sequence);
+    append_le(out, r.file);
+    append_le(out, r.size);
+    out->push_back(static_cast<char>(r.tag));
+    out->push_back(static_cast<char>(r.subtag));
+    out->push_back(static_cast<char>(r.deleted));
+    out->push_back(static_cast<char>(r.reserved));
+}
+
+inline chunk_index_record_t decode_record(const char *p) {
+    chunk_index_record_t r;
+    r.sequence = load_le<uint64_t>(p);
+    r.file = load_le<uint64_t>(p + 8);
+    r.size = load_le<uint32_t>(p + 16);
+    r.tag = static_cast<int8_t>(p[20]);
+    r.subtag = static_cast<int8_t>(p[21]);
+    r.deleted = static_cast<uint8_t>(p[22]);
+    r.reserved = static_cast<uint8_t>(p[23]);
+    return r;
+}
+
+inline size_t chunk_index_slots_offset(const chunk_index_header_t &header) {
+    return sizeof(header) + header.file_count * sizeof(uint64_t);
+}
+
+inline size_t chunk_index_records_offset(const chunk_index_header_t &header) {
+    return chunk_index_slots_offset(header) +
+           size_t{header.slot_count} * sizeof(chunk_index_slot_t);
+}
+
+inline leveldb::Status read_exact(leveldb::RandomAccessFile *file,
+                                  uint64_t offset, size_t n, void *out) {
+    leveldb::Slice result;
+    leveldb::Status status =
+        file->Read(offset, n, &result, static_cast<char *>(out));
+    if(status.ok() && result.size() != n) {
+        return leveldb::Status::Corruption("chunk index is truncated");
+    }
+    if(status.ok() && result.data() != out) {
+        std::memcpy(out, result.data(), n);
+    }
+    return status;
+}
+
+// Read `count` encoded items of `size` bytes each at `offset` and decode
+// them into `out`.
+template <typename T, typename Decode>
+leveldb::Status read_decoded(leveldb::RandomAccessFile *file, uint64_t offset,
+                             size_t count, size_t size, Decode &&decode,
+                             std::vector<T> *out) {
+    std::string buffer(count * size, '\0');
+    leveldb::Status status =
+        read_exact(file, offset, buffer.size(), buffer.data());
+    out->resize(count);
+    for(size_t i = 0; status.ok() && i < count; ++i) {
+        (*out)[i] = decode(buffer.data() + i * size);
+    }
+    return status;
+}
+}  // namespace detail
+
+// Serialize entries that are sorted with chunk_index_entry_less and hold
+// one version of each key. `files` are the tables the entries came from.
+inline void write_chunk_index(const std::vector<chunk_index_entry_t> &entries,
+                              const std::vector<uint64_t> &files,
+                              uint64_t last_sequence, std::string *out) {
+    assert(out != nullptr);
+    // group the records of each chunk into a slot
+    std::vector<chunk_index_slot_t> chunks;
+    for(uint32_t i = 0; i < entries.size(); ++i) {
+        const auto &e = entries[i];
+        if(chunks.empty() || chunks.back().dimension != e.dimension ||
+           chunks.back().x != e.x || chunks.back().z != e.z) {
+            chunks.push_back({e.dimension, e.x, e.z, i, 0, 0, {0, 0}});
+        }
+        auto &slot = chunks.back();
+        slot.count += 1;
+        if(e.record.deleted) {
+            continue;
+        }
+        int tag = static_cast<uint8_t>(e.record.tag);
+        if(tag < 128) {
+            slot.tags[tag / 64] |= uint64_t{1} << (tag % 64);
+        }
+        if(tag == 47 && -8 <= e.record.subtag && e.record.subtag < 24) {
+            slot.subchunks |= uint32_t{1} << (e.record.subtag + 8);
+        }
+    }
+
+    // keep the table at most half full so probes stay short
+    uint32_t slot_count = 16;
+    while(slot_count < 2 * chunks.size()) {
+        slot_count *= 2;
+    }
+    std::vector<chunk_index_slot_t> slots(slot_count,
+                                          chunk_index_slot_t{0, 0, 0, 0, 0, 0,
+                                                             {0, 0}});
+    for(auto &&c : chunks) {
+        uint64_t h = detail::chunk_index_hash(c.dimension, c.x, c.z);
+        size_t i = h & (slot_count - 1);
+        while(!slots[i].empty()) {
+            i = (i + 1) & (slot_count - 1);
+        }
+        slots[i] = c;
+    }
+
+    chunk_index_header_t header;
+    std::memcpy(header.magic, kChunkIndexMagic, 8);
+    header.version = kChunkIndexVersion;
+    header.slot_count = slot_count;
+    header.chunk_count = static_cast<uint32_t>(chunks.size());
+    header.record_count = static_cast<uint32_t>(entries.size());
+    header.file_count = static_cast<uint32_t>(files.size());
+    header.reserved = 0;
+    header.last_sequence = last_sequence;
+
+    out->clear();
+    out->reserve(detail::chunk_index_records_offset(header) +
+                 entries.size() * sizeof(chunk_index_record_t));
+    detail::encode_header(header, out);
+    for(uint64_t file : files) {
+        detail::append_le(out, file);
+    }
+    for(auto &&slot : slots) {
+        detail::encode_slot(slot, out);
+    }
+    for(auto &&e : entries) {
+        detail::encode_record(e.record, out);
+    }
+}
+
+// Reads a chunk index in place. Open() reads only the header, and each
+// Find() reads the slots it probes and the records of the chunk.
+class ChunkIndex {
+   public:
+    leveldb::Status Open(leveldb::Env *env, const std::string &path) {
+        leveldb::RandomAccessFile *pfile = nullptr;
+        leveldb::Status status = env->NewRandomAccessFile(path, &pfile);
+        if(!status.ok()) {
+            return status;
+        }
+        file_.reset(pfile);
+        status = env->GetFileSize(path, &size_);
+        char buffer[sizeof(header_)];
+        if(status.ok()) {
+            status =
+                detail::read_exact(file_.get(), 0, sizeof(buffer), buffer);
+        }
+        if(!status.ok()) {
+            return status;
+        }
+        header_ = detail::decode_header(buffer);
+        if(std::memcmp(header_.magic, kChunkIndexMagic, 8) != 0 ||
+           header_.version != kChunkIndexVersion ||
+           (header_.slot_count & (header_.slot_count - 1)) != 0 ||
+           detail::chunk_index_records_offset(header_) +
+                   uint64_t{header_.record_count} *
+                       sizeof(chunk_index_record_t) !=
+               size_) {
+            return leveldb::Status::Corruption("not a chunk index", path);
+        }
+        return status;
+    }
+
+    const chunk_index_header_t &header() const { return header_; }
+
+    // Find the slot of a chunk. Returns NotFound if the chunk has no records.
+    leveldb::Status Find(int32_t dimension, int32_t x, int32_t z,
+                         chunk_index_slot_t *out) const {
+        if(header_.slot_count == 0) {
+            return leveldb::Status::NotFound("chunk is not indexed");
+        }
+        uint64_t h = detail::chunk_index_hash(dimension, x, z);
+        size_t offset = detail::chunk_index_slots_offset(header_);
+        char buffer[sizeof(chunk_index_slot_t)];
+        for(uint32_t n = 0; n < header_.slot_count; ++n) {
+            size_t i = (h + n) & (header_.slot_count - 1);
+            leveldb::Status status = detail::read_exact(
+                file_.get(), offset + i * sizeof(buffer), sizeof(buffer),
+                buffer);
+            if(!status.ok()) {
+                return status;
+            }
+            *out = detail::decode_slot(buffer);
+            if(out->empty()) {
+                break;
+            }
+            if(out->dimension == dimension && out->x == x && out->z == z) {
+                return status;
+            }
+        }
+        return leveldb::Status::NotFound("chunk is not indexed");
+    }
+
+    // Read the records of a chunk that Find() returned.
+    leveldb::Status Records(const chunk_index_slot_t &slot,
+                            std::vector<chunk_index_record_t> *out) const {
+        if(uint64_t{slot.first} + slot.count > header_.record_count) {
+            return leveldb::Status::Corruption("chunk index is malformed");
+        }
+        return detail::read_decoded(
+            file_.get(),
+            detail::chunk_index_records_offset(header_) +
+                uint64_t{slot.first} * sizeof(chunk_index_record_t),
+            slot.count, sizeof(chunk_index_record_t), detail::decode_record,
+            out);
+    }
+
+    // Read the whole index back into entries, to be refreshed.
+    leveldb::Status ReadAll(std::vector<uint64_t> *files,
+                            std::vector<chunk_index_entry_t> *entries) const {
+        leveldb::Status status = detail::read_decoded(
+            file_.get(), sizeof(header_), header_.file_count,
+            sizeof(uint64_t), detail::load_le<uint64_t>, files);
+        if(!status.ok()) {
+            return status;
+        }
+        std::vector<chunk_index_slot_t> slots;
+        status = ReadSlots(&slots);
+        if(!status.ok()) {
+            return status;
+        }
+        std::vector<chunk_index_record_t> records;
+        entries->clear();
+        entries->reserve(header_.record_count);
+        for(auto &&slot : slots) {
+            if(slot.empty()) {
+                continue;
+            }
+            status = Records(slot, &records);
+            if(!status.ok()) {
+                return status;
+            }
+            for(auto &&r : records) {
+                entries->push_back({slot.dimension, slot.x, slot.z, r});
+            }
+        }
+        std::sort(entries->begin(), entries->end(), chunk_index_entry_less);
+        return status;
+    }
+
+    // Call func(slot) for every chunk, in no particular order.
+    template <typename F>
+    leveldb::Status ForEachChunk(F &&func) const {
+        std::vector<chunk_index_slot_t> slots;
+        leveldb::Status status = ReadSlots(&slots);
+        if(!status.ok()) {
+            return status;
+        }
+        for(auto &&slot : slots) {
+            if(!slot.empty()) {
+                func(slot);
+            }
+        }
+        return status;
+    }
+
+   protected:
+    leveldb::Status ReadSlots(std::vector<chunk_index_slot_t> *slots) const {
+        return detail::read_decoded(
+            file_.get(), detail::chunk_index_slots_offset(header_),
+            header_.slot_count, sizeof(chunk_index_slot_t),
+            detail::decode_slot, slots);
+    }
+
+    std::unique_ptr<leveldb::RandomAccessFile> file_;
+    uint64_t size_{0};
+    chunk_index_header_t header_{};
+};
+
+}  // namespace mcberepair
+
+#endif  // MCBEREPAIR_CHUNKINDEX_HPP
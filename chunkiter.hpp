@@ -0,0 +1,232 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+#ifndef MCBEREPAIR_CHUNKITER_HPP
+#define MCBEREPAIR_CHUNKITER_HPP
+
+#include <algorithm>
+#include <bitset>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "leveldb/db.h"
+#include "leveldb/iterator.h"
+#include "mcbekey.hpp"
+#include "seekplan.hpp"
+
+namespace mcberepair {
+
+// One record of a chunk. `key` and `value` point into the iterator that
+// returned it and stay valid until it moves to another chunk.
+struct chunk_record_t {
+    int tag;
+    int subtag;
+    leveldb::Slice key;
+    leveldb::Slice value;
+};
+
+// Iterates over a database one chunk at a time. Each chunk is the run of
+// keys that share its x, z, and dimension, which are adjacent in key order,
+// and its records are sorted by tag, then subtag.
+//
+// leveldb only guarantees that a key and value stay valid until its
+// iterator moves, so the records of a chunk are copied into one buffer that
+// is reused from chunk to chunk. Records whose tags were not requested are
+// stepped over without reading their values at all.
+class ChunkIterator {
+   public:
+    // Iterate over the chunks in `range` of `db`. An empty range covers the
+    // whole database.
+    ChunkIterator(leveldb::DB *db, const leveldb::ReadOptions &options,
+                  key_range_t range = {})
+        : it_{db->NewIterator(options)}, range_{std::move(range)} {
+        tags_.set();
+    }
+
+    ChunkIterator(const ChunkIterator &) = delete;
+    ChunkIterator &operator=(const ChunkIterator &) = delete;
+
+    // Only read records with these tags. Chunks without any are skipped.
+    void SetTags(std::initializer_list<int> tags) {
+        tags_.reset();
+        for(int tag : tags) {
+            tags_.set(static_cast<uint8_t>(tag));
+        }
+    }
+
+    // Only visit chunks in one dimension. A negative dimension visits all.
+    void SetDimension(int dimension) { dimension_ = dimension; }
+
+    void SeekToFirst() {
+        if(range_.start.empty()) {
+            it_->SeekToFirst();
+        } else {
+            it_->Seek(range_.start);
+        }
+        Load();
+    }
+
+    // Move to the first chunk at or after chunk (x, z). Keys sort by the
+    // bytes of x and z, so this is not the next chunk in numeric order.
+    void Seek(int x, int z) {
+        std::string prefix;
+        append_chunk_prefix(x, z, &prefix);
+        if(prefix < range_.start) {
+            prefix = range_.start;
+        }
+        it_->Seek(prefix);
+        Load();
+    }
+
+    bool Valid() const { return valid_; }
+
+    void Next() {
+        assert(valid_);
+        Load();
+    }
+
+    int x() const { return chunk_.x; }
+    int z() const { return chunk_.z; }
+    int dimension() const { return chunk_.dimension; }
+
+    const std::vector<chunk_record_t> &records() const { return records_; }
+
+    // The record with a tag and subtag (-1 for none), or null.
+    const chunk_record_t *Find(int tag, int subtag = -1) const {
+        auto it = std::lower_bound(
+            records_.begin(), records_.end(), std::make_pair(tag, subtag),
+            [](const chunk_record_t &r, const std::pair<int, int> &k) {
+                return std::make_pair(r.tag, r.subtag) < k;
+            });
+        if(it == records_.end() || it->tag != tag || it->subtag != subtag) {
+            return nullptr;
+        }
+        return &*it;
+    }
+
+    leveldb::Status status() const { return it_->status(); }
+
+   protected:
+    bool InRange() const {
+        return it_->Valid() && (range_.limit.empty() ||
+                                it_->key().compare(range_.limit) < 0);
+    }
+
+    // Read the records of the next chunk with a requested tag, leaving the
+    // iterator on the first key after it.
+    void Load() {
+        valid_ = false;
+        records_.clear();
+        while(InRange()) {
+            // find the first key of a chunk
+            leveldb::Slice key = it_->key();
+            std::string_view skey{key.data(), key.size()};
+            if(!is_chunk_key(skey)) {
+                it_->Next();
+                continue;
+            }
+            chunk_ = parse_chunk_key(skey);
+            bool wanted = dimension_ < 0 || chunk_.dimension == dimension_;
+
+            // Store offsets while the buffer grows, and make slices once
+            // the chunk is complete.
+            buffer_.clear();
+            spans_.clear();
+            for(; InRange(); it_->Next()) {
+                key = it_->key();
+                skey = {key.data(), key.size()};
+                if(!is_chunk_key(skey)) {
+                    // other keys can only fall inside a chunk if they start
+                    // with its coordinates
+                    if(skey.size() >= 8 &&
+                       std::memcmp(skey.data(), &chunk_.x, 4) == 0 &&
+                       std::memcmp(skey.data() + 4, &chunk_.z, 4) == 0) {
+                        continue;
+                    }
+                    break;
+                }
+                chunk_t c = parse_chunk_key(skey);
+                if(c.x != chunk_.x || c.z != chunk_.z ||
+                   c.dimension != chunk_.dimension) {
+                    break;
+                }
+                if(!wanted || !tags_.test(static_cast<uint8_t>(c.tag))) {
+                    continue;
+                }
+                leveldb::Slice value = it_->value();
+                spans_.push_back({c.tag, c.subtag, buffer_.size(), key.size(),
+                                  value.size()});
+                buffer_.append(key.data(), key.size());
+                buffer_.append(value.data(), value.size());
+            }
+            if(spans_.empty()) {
+                continue;
+            }
+            for(auto &&s : spans_) {
+                const char *p = buffer_.data() + s.offset;
+                records_.push_back(
+                    {static_cast<uint8_t>(s.tag), static_cast<int8_t>(s.subtag),
+                     leveldb::Slice{p, s.key_size},
+                     leveldb::Slice{p + s.key_size, s.value_size}});
+            }
+            // subtags sort as unsigned bytes in keys, so negative ones
+            // come last
+            std::sort(records_.begin(), records_.end(),
+                      [](const chunk_record_t &a, const chunk_record_t &b) {
+                          return std::tie(a.tag, a.subtag) <
+                                 std::tie(b.tag, b.subtag);
+                      });
+            valid_ = true;
+            return;
+        }
+    }
+
+    struct span_t {
+        char tag;
+        char subtag;
+        size_t offset;
+        size_t key_size;
+        size_t value_size;
+    };
+
+    std::unique_ptr<leveldb::Iterator> it_;
+    key_range_t range_;
+    std::bitset<256> tags_;
+    int dimension_{-1};
+
+    bool valid_{false};
+    chunk_t chunk_{};
+    std::string buffer_;
+    std::vector<span_t> spans_;
+    std::vector<chunk_record_t> records_;
+};
+
+}  // namespace mcberepair
+
+#endif  // MCBEREPAIR_CHUNKITER_HPP
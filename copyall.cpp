@@ -20,26 +20,535 @@
 # SOFTWARE.
 */
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <vector>
 
+#include "args.hpp"
+#include "bulkload.hpp"
 #include "db.hpp"
+#include "leveldb/write_batch.h"
 #include "mcbekey.hpp"
+#include "seekplan.hpp"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// sum the sizes of all files in a database directory
+uint64_t directory_size(const std::string &path) {
+    leveldb::Env *env = leveldb::Env::Default();
+    std::vector<std::string> children;
+    if(!env->GetChildren(path, &children).ok()) {
+        return 0;  // LCOV_EXCL_LINE
+    }
+    uint64_t total = 0;
+    for(auto &&child : children) {
+        uint64_t size = 0;
+        if(env->GetFileSize(path + "/" + child, &size).ok()) {
+            total += size;
+        }
+    }
+    return total;
+}
+
+// Reports how far a copy has progressed through the source keyspace. Sizes
+// are estimated with GetApproximateSizes, so they count compressed bytes on
+// disk rather than the bytes that are copied.
+class Progress {
+   public:
+    Progress(leveldb::DB *db, bool enabled) : db_{db}, enabled_{enabled} {
+        if(!enabled_) {
+            return;
+        }
+        auto it = std::unique_ptr<leveldb::Iterator>{db_->NewIterator({})};
+        it->SeekToFirst();
+        if(!it->Valid()) {
+            return;
+        }
+        first_ = it->key().ToString();
+        it->SeekToLast();
+        // the limit of a range is exclusive, so extend the last key by a byte
+        last_ = it->key().ToString() + '\0';
+        leveldb::Range range{first_, last_};
+        db_->GetApproximateSizes(&range, 1, &total_);
+    }
+
+    // call once the starting key is known to measure the rate of this session
+    void Start(const leveldb::Slice &key) {
+        start_time_ = clock_type::now();
+        last_print_ = start_time_;
+        start_done_ = Done(key);
+    }
+
+    void Update(const leveldb::Slice &key, uint64_t keys) {
+        if(!enabled_) {
+            return;
+        }
+        auto now = clock_type::now();
+        if(now - last_print_ < std::chrono::seconds{1}) {
+            return;
+        }
+        last_print_ = now;
+        Print(Done(key), keys, now);
+    }
+
+    void Finish(uint64_t keys) {
+        if(!enabled_) {
+            return;
+        }
+        Print(total_, keys, clock_type::now());
+        fprintf(stderr, "\n");
+    }
+
+   protected:
+    // approximate number of source bytes before `key`
+    uint64_t Done(const leveldb::Slice &key) {
+        if(!enabled_ || first_.empty()) {
+            return 0;
+        }
+        uint64_t done = 0;
+        leveldb::Range range{first_, key};
+        db_->GetApproximateSizes(&range, 1, &done);
+        return done;
+    }
+
+    void Print(uint64_t done, uint64_t keys, clock_type::time_point now) {
+        std::chrono::duration<double> elapsed = now - start_time_;
+        double mb = done / (1024.0 * 1024.0);
+        double total_mb = total_ / (1024.0 * 1024.0);
+        double pct = total_ > 0 ? 100.0 * done / total_ : 100.0;
+        double rate =
+            elapsed.count() > 0 ? (done - start_done_) / elapsed.count() : 0.0;
+        fprintf(stderr, "\rCopied %llu keys, %.1f of ~%.1f MB (%.1f%%)",
+                static_cast<unsigned long long>(keys), mb, total_mb, pct);
+        if(rate > 0 && done < total_) {
+            auto eta = static_cast<unsigned long long>((total_ - done) / rate);
+            fprintf(stderr, ", ETA %llu:%02llu:%02llu", eta / 3600,
+                    (eta / 60) % 60, eta % 60);
+        }
+        fprintf(stderr, "    ");
+        fflush(stderr);
+    }
+
+    leveldb::DB *db_;
+    bool enabled_;
+    std::string first_;
+    std::string last_;
+    uint64_t total_{0};
+    uint64_t start_done_{0};
+    clock_type::time_point start_time_;
+    clock_type::time_point last_print_;
+};
+
+// The state shared by the copy routines.
+struct copy_t {
+    leveldb::Iterator *it;
+    std::string copy_path;
+    std::string checkpoint_path;
+    bool resume;
+    size_t batch_size;
+    Progress *progress;
+    uint64_t keys{0};
+    uint64_t bytes{0};
+};
+
+// Atomically record the last key that has been committed to the copy.
+leveldb::Status write_checkpoint(const std::string &path,
+                                 const std::string &key) {
+    leveldb::Env *env = leveldb::Env::Default();
+    std::string tmp = path + ".tmp";
+    leveldb::Status status = leveldb::WriteStringToFile(
+        env, mcberepair::encode_key(key) + "\n", tmp);
+    if(status.ok()) {
+        status = env->RenameFile(tmp, path);
+    }
+    return status;
+}
+
+// Read a checkpoint. Returns false if there is no usable checkpoint.
+bool read_checkpoint(const std::string &path, std::string *key) {
+    std::string contents;
+    leveldb::Env *env = leveldb::Env::Default();
+    if(!leveldb::ReadFileToString(env, path, &contents).ok()) {
+        return false;
+    }
+    while(!contents.empty() && contents.back() == '\n') {
+        contents.pop_back();
+    }
+    return mcberepair::decode_key(contents, key);
+}
+
+// copy by writing batches of keys through the memtable and log of a new
+// database, checkpointing after every committed batch
+int copy_with_writes(copy_t *copy) {
+    leveldb::Iterator *it = copy->it;
+
+    // open the destination database; it must be new unless resuming
+    mcberepair::DB copy_db{copy->copy_path.c_str(), true, !copy->resume};
+
+    if(!copy_db) {
+        fprintf(stderr, "ERROR: Opening '%s' failed.\n",
+                copy->copy_path.c_str());
+        if(leveldb::Env::Default()->FileExists(copy->checkpoint_path)) {
+            fprintf(stderr,
+                    "ERROR: An interrupted copy was found. Use --resume to "
+                    "continue it.\n");
+        }
+        return EXIT_FAILURE;
+    }
+
+    // find where to start
+    std::string start_key;
+    if(copy->resume && read_checkpoint(copy->checkpoint_path, &start_key)) {
+        it->Seek(start_key);
+        if(it->Valid() && it->key() == leveldb::Slice{start_key}) {
+            it->Next();
+        }
+    } else {
+        it->SeekToFirst();
+    }
+    copy->progress->Start(it->Valid() ? it->key() : leveldb::Slice{});
+
+    leveldb::WriteBatch batch;
+    std::string last_key;
+    leveldb::WriteOptions write_options;
+    // the checkpoint must never get ahead of what is on disk
+    write_options.sync = true;
+
+    auto commit = [&]() -> bool {
+        mcberepair::ScopedPhase phase{mcberepair::Phase::kWrite};
+        leveldb::Status status = copy_db().Write(write_options, &batch);
+        if(status.ok()) {
+            status = write_checkpoint(copy->checkpoint_path, last_key);
+        }
+        if(!status.ok()) {
+            // LCOV_EXCL_START
+            fprintf(stderr, "ERROR: Writing '%s' failed: %s\n",
+                    copy->copy_path.c_str(), status.ToString().c_str());
+            return false;
+            // LCOV_EXCL_STOP
+        }
+        batch.Clear();
+        return true;
+    };
+
+    for(; it->Valid(); it->Next()) {
+        auto key = it->key();
+        auto value = it->value();
+        batch.Put(key, value);
+        // the checkpoint of every commit names the last key put
+        last_key.assign(key.data(), key.size());
+        copy->keys += 1;
+        copy->bytes += key.size() + value.size();
+        if(batch.ApproximateSize() >= copy->batch_size) {
+            if(!commit()) {
+                return EXIT_FAILURE;  // LCOV_EXCL_LINE
+            }
+            copy->progress->Update(key, copy->keys);
+        }
+    }
+    if(!it->status().ok()) {
+        // LCOV_EXCL_START
+        fprintf(stderr, "ERROR: copying into '%s' failed: %s\n",
+                copy->copy_path.c_str(), it->status().ToString().c_str());
+        return EXIT_FAILURE;
+        // LCOV_EXCL_STOP
+    }
+    if(!commit()) {
+        return EXIT_FAILURE;  // LCOV_EXCL_LINE
+    }
+    {
+        mcberepair::ScopedPhase phase{mcberepair::Phase::kCompaction};
+        copy_db().CompactRange(nullptr, nullptr);
+    }
+
+    // the copy is complete, so the checkpoint is no longer needed
+    leveldb::Env::Default()->DeleteFile(copy->checkpoint_path);
+
+    return EXIT_SUCCESS;
+}
+
+// copy by streaming sorted keys directly into table files
+int copy_with_bulkload(copy_t *copy) {
+    leveldb::Iterator *it = copy->it;
+
+    mcberepair::BulkLoader loader{copy->copy_path.c_str()};
+
+    if(!loader) {
+        fprintf(stderr, "ERROR: Opening '%s' failed.\n",
+                copy->copy_path.c_str());
+        return EXIT_FAILURE;
+    }
+
+    leveldb::Status status;
+
+    it->SeekToFirst();
+    copy->progress->Start(it->Valid() ? it->key() : leveldb::Slice{});
+    for(; it->Valid(); it->Next()) {
+        auto key = it->key();
+        auto value = it->value();
+        status = loader.Add(key, value);
+        if(!status.ok()) {
+            // LCOV_EXCL_START
+            fprintf(stderr, "ERROR: copying key '%s' failed: %s\n",
+                    key.ToString().c_str(), status.ToString().c_str());
+            return EXIT_FAILURE;
+            // LCOV_EXCL_STOP
+        }
+        copy->keys += 1;
+        copy->bytes += key.size() + value.size();
+        if((copy->keys & 0xFFF) == 0) {
+            copy->progress->Update(key, copy->keys);
+        }
+    }
+    if(!it->status().ok()) {
+        // LCOV_EXCL_START
+        fprintf(stderr, "ERROR: copying into '%s' failed: %s\n",
+                copy->copy_path.c_str(), it->status().ToString().c_str());
+        return EXIT_FAILURE;
+        // LCOV_EXCL_STOP
+    }
+    {
+        mcberepair::ScopedPhase phase{mcberepair::Phase::kWrite};
+        status = loader.Finish();
+    }
+    if(!status.ok()) {
+        // LCOV_EXCL_START
+        fprintf(stderr, "ERROR: Writing '%s' failed: %s\n",
+                copy->copy_path.c_str(), status.ToString().c_str());
+        return EXIT_FAILURE;
+        // LCOV_EXCL_STOP
+    }
+    return EXIT_SUCCESS;
+}
+
+}  // namespace
 
 int copyall_main(int argc, char *argv[]) {
-    if(argc < 4 || strcmp("help", argv[1]) == 0) {
+    mcberepair::Args args{argc, argv};
+    if(args.size() < 2 || strcmp("help", argv[1]) == 0) {
         printf(
             "Usage: %s copyall <source_minecraft_world_dir> "
             "<dest_minecraft_world_dir>\n",
             argv[0]);
+        printf("\n");
+        printf("Options:\n");
+        printf(
+            "  --bulk            Write sorted table files directly, bypassing "
+            "the log and memtable.\n");
+        printf(
+            "  --resume          Continue an interrupted copy from its "
+            "checkpoint.\n");
+        printf("  --progress        Print progress and an ETA to stderr.\n");
+        printf(
+            "  --batch-size=N    Commit and checkpoint every N bytes "
+            "(default 4194304).\n");
+        return EXIT_FAILURE;
+    }
+    std::string bad_option;
+    if(args.unknown({"bulk", "resume", "progress", "batch-size"},
+                    &bad_option)) {
+        fprintf(stderr, "ERROR: Unknown option '--%s'.\n", bad_option.c_str());
+        return EXIT_FAILURE;
+    }
+    bool bulk = args.has("bulk");
+    size_t batch_size = 4 * 1024 * 1024;
+    if(!args.number("batch-size", &batch_size) || batch_size == 0) {
+        fprintf(stderr, "ERROR: Invalid value for '--batch-size'.\n");
+        return EXIT_FAILURE;
+    }
+    if(bulk && args.has("resume")) {
+        fprintf(stderr, "ERROR: A bulk copy cannot be resumed.\n");
+        return EXIT_FAILURE;
+    }
+
+    // construct path for Minecraft BE database
+    std::string path = std::string(args[0]) + "/db";
+    std::string copy_path = std::string(args[1]) + "/db";
+
+    // open the input database
+    mcberepair::DB db{path.c_str()};
+
+    if(!db) {
+        fprintf(stderr, "ERROR: Opening '%s' failed.\n", path.c_str());
+        return EXIT_FAILURE;
+    }
+
+    // create a reusable memory space for decompression so it allocates less
+    leveldb::ReadOptions readOptions;
+    leveldb::DecompressAllocator decompress_allocator;
+    readOptions.decompress_allocator = &decompress_allocator;
+    readOptions.verify_checksums = true;
+    readOptions.fill_cache = false;
+
+    // create an iterator for the database
+    auto it = std::unique_ptr<leveldb::Iterator>{db().NewIterator(readOptions)};
+
+    Progress progress{&db(), args.has("progress")};
+
+    copy_t copy{it.get(),
+                copy_path,
+                std::string(args[1]) + "/copyall.checkpoint",
+                args.has("resume"),
+                batch_size,
+                &progress};
+
+    auto start = clock_type::now();
+
+    int ret;
+    {
+        mcberepair::ScopedPhase phase{mcberepair::Phase::kScan};
+        ret = bulk ? copy_with_bulkload(&copy) : copy_with_writes(&copy);
+    }
+    mcberepair::stats().AddKeys(copy.keys, copy.bytes);
+    if(ret != EXIT_SUCCESS) {
+        return ret;
+    }
+
+    progress.Finish(copy.keys);
+
+    // report throughput and the size of the new database
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+    double mb = copy.bytes / (1024.0 * 1024.0);
+    double out_mb = directory_size(copy_path) / (1024.0 * 1024.0);
+    printf("Copied %llu keys (%.1f MB) in %.2f s (%.1f MB/s) using %s.\n",
+           static_cast<unsigned long long>(copy.keys), mb, elapsed.count(),
+           elapsed.count() > 0 ? mb / elapsed.count() : 0.0,
+           bulk ? "bulk load" : "writes");
+    printf("Output size: %.1f MB\n", out_mb);
+
+    return EXIT_SUCCESS;
+}
+
+namespace {
+
+// Non-chunk keys that hold world-wide state the game needs to load a world.
+// Keys are matched by prefix.
+const char *const global_key_prefixes[] = {
+    "~local_player",
+    "player_",
+    "AutonomousEntities",
+    "BiomeData",
+    "DynamicProperties",
+    "LevelChunkMetaDataDictionary",
+    "Nether",
+    "Overworld",
+    "PosTrackDB-",
+    "PositionTrackDB-",
+    "TheEnd",
+    "VILLAGE_",
+    "dimension",
+    "game_flatworldlayers",
+    "map_",
+    "mobevents",
+    "mVillages",
+    "portals",
+    "schedulerWT",
+    "scoreboard",
+    "structuretemplate_",
+    "tickingarea_",
+};
+
+// Newer worlds store entities under "actorprefix" keys. Each chunk lists the
+// entities it owns in a "digp" key that holds 8-byte actor ids.
+const char actor_prefix[] = "actorprefix";
+const char digp_prefix[] = "digp";
+
+bool starts_with(const leveldb::Slice &key, std::string_view prefix) {
+    return key.size() >= prefix.size() &&
+           memcmp(key.data(), prefix.data(), prefix.size()) == 0;
+}
+
+bool is_global_key(const leveldb::Slice &key) {
+    for(auto &&prefix : global_key_prefixes) {
+        if(starts_with(key, prefix)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The chunks selected by an extraction.
+struct selection_t {
+    bool have_box;
+    mcberepair::chunk_box_t box;
+    int dimension;
+
+    bool contains(int x, int z, int dimension) const {
+        if(this->dimension >= 0 && dimension != this->dimension) {
+            return false;
+        }
+        return !have_box || box.contains(x, z);
+    }
+};
+
+}  // namespace
+
+int extract_main(int argc, char *argv[]) {
+    mcberepair::Args args{argc, argv};
+    if(args.size() < 2 || strcmp("help", argv[1]) == 0) {
+        printf(
+            "Usage: %s extract <source_minecraft_world_dir> "
+            "<dest_minecraft_world_dir> [options]\n",
+            argv[0]);
+        printf("\n");
+        printf("Options:\n");
+        printf(
+            "  --xmin=N --xmax=N --zmin=N --zmax=N\n"
+            "                    Extract the chunks inside this box "
+            "(inclusive).\n");
+        printf(
+            "  --dimension=N     Only extract chunks of dimension N "
+            "(0=overworld, 1=nether,\n"
+            "                    2=end).\n");
+        printf(
+            "  --all-globals     Scan the whole world for non-chunk keys "
+            "instead of only\n"
+            "                    copying known global keys.\n");
+        return EXIT_FAILURE;
+    }
+    std::string bad_option;
+    if(args.unknown(
+           {"xmin", "xmax", "zmin", "zmax", "dimension", "all-globals"},
+           &bad_option)) {
+        fprintf(stderr, "ERROR: Unknown option '--%s'.\n", bad_option.c_str());
         return EXIT_FAILURE;
     }
 
+    selection_t selection{false, {0, 0, 0, 0}, -1};
+    int bounds = args.has("xmin") + args.has("xmax") + args.has("zmin") +
+                 args.has("zmax");
+    if(bounds != 0 && bounds != 4) {
+        fprintf(stderr,
+                "ERROR: --xmin, --xmax, --zmin, and --zmax must be used "
+                "together.\n");
+        return EXIT_FAILURE;
+    }
+    selection.have_box = (bounds == 4);
+    if(!args.number("xmin", &selection.box.x_min) ||
+       !args.number("xmax", &selection.box.x_max) ||
+       !args.number("zmin", &selection.box.z_min) ||
+       !args.number("zmax", &selection.box.z_max) ||
+       !args.number("dimension", &selection.dimension)) {
+        fprintf(stderr, "ERROR: Chunk bounds must be integers.\n");
+        return EXIT_FAILURE;
+    }
+    if(selection.have_box && (selection.box.x_min > selection.box.x_max ||
+                              selection.box.z_min > selection.box.z_max)) {
+        fprintf(stderr, "ERROR: The chunk box is empty.\n");
+        return EXIT_FAILURE;
+    }
+    bool all_globals = args.has("all-globals");
+
     // construct path for Minecraft BE database
-    std::string path = std::string(argv[2]) + "/db";
-    std::string copy_path = std::string(argv[3]) + "/db";
+    std::string path = std::string(args[0]) + "/db";
+    std::string copy_path = std::string(args[1]) + "/db";
 
     // open the input database
     mcberepair::DB db{path.c_str()};
@@ -64,31 +573,153 @@ int copyall_main(int argc, char *argv[]) {
     readOptions.verify_checksums = true;
     readOptions.fill_cache = false;
 
-    // create an iterator for the database
-    auto it = std::unique_ptr<leveldb::Iterator>{db().NewIterator(readOptions)};
+    mcberepair::ScopedPhase scan_phase{mcberepair::Phase::kScan};
+    auto start = clock_type::now();
+    uint64_t keys = 0;
+    uint64_t bytes = 0;
 
+    leveldb::WriteBatch batch;
     leveldb::Status status;
+    auto put = [&](const leveldb::Slice &key,
+                   const leveldb::Slice &value) -> bool {
+        batch.Put(key, value);
+        keys += 1;
+        bytes += key.size() + value.size();
+        if(batch.ApproximateSize() >= 4 * 1024 * 1024) {
+            mcberepair::ScopedPhase phase{mcberepair::Phase::kWrite};
+            status = copy_db().Write({}, &batch);
+            batch.Clear();
+        }
+        return status.ok();
+    };
+
+    // actors owned by the extracted chunks
+    std::vector<std::string> actor_keys;
 
-    for(it->SeekToFirst(); it->Valid(); it->Next()) {
+    // decide whether a key belongs in the extracted world
+    auto visit = [&](leveldb::Iterator *it) -> bool {
         auto key = it->key();
-        auto value = it->value();
-        status = copy_db().Put({}, key, value);
+        std::string_view skey{key.data(), key.size()};
+        if(mcberepair::is_chunk_key(skey)) {
+            auto chunk = mcberepair::parse_chunk_key(skey);
+            if(selection.contains(chunk.x, chunk.z, chunk.dimension)) {
+                return put(key, it->value());
+            }
+            return true;
+        }
+        if(starts_with(key, digp_prefix) &&
+           (key.size() == 12 || key.size() == 16)) {
+            int x, z, dimension = 0;
+            std::memcpy(&x, key.data() + 4, 4);
+            std::memcpy(&z, key.data() + 8, 4);
+            if(key.size() == 16) {
+                std::memcpy(&dimension, key.data() + 12, 4);
+            }
+            if(!selection.contains(x, z, dimension)) {
+                return true;
+            }
+            auto value = it->value();
+            for(size_t i = 0; i + 8 <= value.size(); i += 8) {
+                actor_keys.push_back(std::string{actor_prefix} +
+                                     std::string{value.data() + i, 8});
+            }
+            return put(key, value);
+        }
+        if(starts_with(key, actor_prefix)) {
+            // actors are copied after their owners are known
+            return true;
+        }
+        if(all_globals || is_global_key(key)) {
+            return put(key, it->value());
+        }
+        return true;
+    };
+
+    auto it = std::unique_ptr<leveldb::Iterator>{db().NewIterator(readOptions)};
+    uint64_t seeks = 0;
+
+    // A box is turned into seeks over the chunks it covers. Very large boxes
+    // and a dimension-only selection are cheaper to handle with one scan.
+    const uint64_t max_box_chunks = 4 * 1024 * 1024;
+    if(selection.have_box && selection.box.size() <= max_box_chunks &&
+       !all_globals) {
+        auto ranges = mcberepair::plan_chunk_box(selection.box,
+                                                 selection.dimension);
+        for(int64_t x = selection.box.x_min; x <= selection.box.x_max; ++x) {
+            for(int64_t z = selection.box.z_min; z <= selection.box.z_max;
+                ++z) {
+                std::string prefix{digp_prefix};
+                mcberepair::append_chunk_prefix(static_cast<int>(x),
+                                                static_cast<int>(z), &prefix);
+                if(selection.dimension < 0) {
+                    ranges.push_back(mcberepair::prefix_range(prefix));
+                } else {
+                    mcberepair::append_dimension(selection.dimension,
+                                                 &prefix);
+                    ranges.push_back({prefix, prefix + '\0'});
+                }
+            }
+        }
+        for(auto &&prefix : global_key_prefixes) {
+            ranges.push_back(mcberepair::prefix_range(prefix));
+        }
+        mcberepair::normalize_ranges(&ranges);
+        seeks = mcberepair::scan_ranges(it.get(), ranges, visit);
+    } else {
+        for(it->SeekToFirst(); it->Valid(); it->Next()) {
+            if(!visit(it.get())) {
+                break;
+            }
+        }
+        seeks = 1;
+    }
+
+    if(!it->status().ok()) {
+        // LCOV_EXCL_START
+        fprintf(stderr, "ERROR: Reading '%s' failed: %s\n", path.c_str(),
+                it->status().ToString().c_str());
+        return EXIT_FAILURE;
+        // LCOV_EXCL_STOP
+    }
+
+    // copy the actors owned by the extracted chunks in key order
+    std::sort(actor_keys.begin(), actor_keys.end());
+    actor_keys.erase(std::unique(actor_keys.begin(), actor_keys.end()),
+                     actor_keys.end());
+    std::string value;
+    for(auto &&key : actor_keys) {
         if(!status.ok()) {
-            // LCOV_EXCL_START
-            fprintf(stderr, "ERROR: copying key '%s' failed: %s\n",
-                    key.ToString().c_str(), status.ToString().c_str());
-            return EXIT_FAILURE;
-            // LCOV_EXCL_STOP
+            break;  // LCOV_EXCL_LINE
+        }
+        leveldb::Status s = db().Get(readOptions, key, &value);
+        if(s.ok()) {
+            put(key, value);
+        } else if(!s.IsNotFound()) {
+            status = s;  // LCOV_EXCL_LINE
         }
     }
-    copy_db().CompactRange(nullptr, nullptr);
+    if(status.ok()) {
+        mcberepair::ScopedPhase phase{mcberepair::Phase::kWrite};
+        status = copy_db().Write({}, &batch);
+    }
 
     if(!status.ok()) {
         // LCOV_EXCL_START
-        fprintf(stderr, "ERROR: copying '%s' to '%s' failed: %s\n",
+        fprintf(stderr, "ERROR: extracting '%s' to '%s' failed: %s\n",
                 path.c_str(), copy_path.c_str(), status.ToString().c_str());
         return EXIT_FAILURE;
         // LCOV_EXCL_STOP
     }
+    {
+        mcberepair::ScopedPhase phase{mcberepair::Phase::kCompaction};
+        copy_db().CompactRange(nullptr, nullptr);
+    }
+    mcberepair::stats().AddKeys(keys, bytes);
+
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+    printf("Extracted %llu keys (%.1f MB) in %.2f s using %llu seeks.\n",
+           static_cast<unsigned long long>(keys), bytes / (1024.0 * 1024.0),
+           elapsed.count(), static_cast<unsigned long long>(seeks));
+
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,221 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+
+#ifndef MCBEREPAIR_CRC32C_HPP
+#define MCBEREPAIR_CRC32C_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define MCBEREPAIR_CRC32C_SSE42 1
+#include <nmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#if defined(__linux__) || defined(__APPLE__)
+#define MCBEREPAIR_CRC32C_ARMV8 1
+#include <arm_acle.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+#endif
+#endif
+
+// The instructions are only enabled for the functions that use them, so
+// the rest of the program still runs on CPUs without them.
+#if defined(MCBEREPAIR_CRC32C_SSE42) && !defined(_MSC_VER)
+#define MCBEREPAIR_TARGET_SSE42 __attribute__((target("sse4.2")))
+#else
+#define MCBEREPAIR_TARGET_SSE42
+#endif
+#if defined(MCBEREPAIR_CRC32C_ARMV8) && !defined(__ARM_FEATURE_CRC32)
+#if defined(__clang__)
+#define MCBEREPAIR_TARGET_ARMV8 __attribute__((target("crc")))
+#else
+#define MCBEREPAIR_TARGET_ARMV8 __attribute__((target("+crc")))
+#endif
+#else
+#define MCBEREPAIR_TARGET_ARMV8
+#endif
+
+namespace mcberepair {
+namespace crc32c {
+
+// CRC32C (Castagnoli), as leveldb checksums its blocks and log records.
+// The CPU's crc32 instructions are used where it has them; otherwise a
+// slicing-by-8 table does eight bytes per step.
+
+namespace detail {
+
+struct tables_t {
+    uint32_t t[8][256];
+
+    constexpr tables_t() : t{} {
+        for(uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for(int k = 0; k < 8; ++k) {
+                crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1u)));
+            }
+            t[0][i] = crc;
+        }
+        for(int k = 1; k < 8; ++k) {
+            for(uint32_t i = 0; i < 256; ++i) {
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+inline constexpr tables_t kTables{};
+
+inline uint64_t load64(const uint8_t *p) {
+    return uint64_t{p[0]} | uint64_t{p[1]} << 8 | uint64_t{p[2]} << 16 |
+           uint64_t{p[3]} << 24 | uint64_t{p[4]} << 32 |
+           uint64_t{p[5]} << 40 | uint64_t{p[6]} << 48 |
+           uint64_t{p[7]} << 56;
+}
+
+inline uint32_t extend_software(uint32_t crc, const char *data, size_t n) {
+    const auto &t = kTables.t;
+    auto p = reinterpret_cast<const uint8_t *>(data);
+    uint32_t l = ~crc;
+    for(; n >= 8; n -= 8, p += 8) {
+        uint64_t v = load64(p) ^ l;
+        l = t[7][v & 0xff] ^ t[6][(v >> 8) & 0xff] ^ t[5][(v >> 16) & 0xff] ^
+            t[4][(v >> 24) & 0xff] ^ t[3][(v >> 32) & 0xff] ^
+            t[2][(v >> 40) & 0xff] ^ t[1][(v >> 48) & 0xff] ^ t[0][v >> 56];
+    }
+    for(; n > 0; --n, ++p) {
+        l = t[0][(l ^ *p) & 0xff] ^ (l >> 8);
+    }
+    return ~l;
+}
+
+#if defined(MCBEREPAIR_CRC32C_SSE42)
+MCBEREPAIR_TARGET_SSE42
+inline uint32_t extend_sse42(uint32_t crc, const char *data, size_t n) {
+    auto p = reinterpret_cast<const uint8_t *>(data);
+    uint64_t l = ~crc;
+    for(; n >= 8; n -= 8, p += 8) {
+        l = _mm_crc32_u64(l, load64(p));
+    }
+    uint32_t l32 = static_cast<uint32_t>(l);
+    for(; n > 0; --n, ++p) {
+        l32 = _mm_crc32_u8(l32, *p);
+    }
+    return ~l32;
+}
+
+inline bool has_sse42() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#endif
+
+#if defined(MCBEREPAIR_CRC32C_ARMV8)
+MCBEREPAIR_TARGET_ARMV8
+inline uint32_t extend_armv8(uint32_t crc, const char *data, size_t n) {
+    auto p = reinterpret_cast<const uint8_t *>(data);
+    uint32_t l = ~crc;
+    for(; n >= 8; n -= 8, p += 8) {
+        l = __crc32cd(l, load64(p));
+    }
+    for(; n > 0; --n, ++p) {
+        l = __crc32cb(l, *p);
+    }
+    return ~l;
+}
+
+inline bool has_armv8() {
+#if defined(__APPLE__)
+    // every 64-bit Apple CPU has the crc32 instructions
+    return true;
+#else
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+}
+#endif
+
+using extend_t = uint32_t (*)(uint32_t, const char *, size_t);
+
+struct implementation_t {
+    extend_t extend;
+    const char *name;
+};
+
+inline implementation_t select() {
+#if defined(MCBEREPAIR_CRC32C_SSE42)
+    if(has_sse42()) {
+        return {extend_sse42, "SSE4.2"};
+    }
+#elif defined(MCBEREPAIR_CRC32C_ARMV8)
+    if(has_armv8()) {
+        return {extend_armv8, "ARMv8"};
+    }
+#endif
+    return {extend_software, "software"};
+}
+
+inline const implementation_t &implementation() {
+    static const implementation_t impl = select();
+    return impl;
+}
+
+}  // namespace detail
+
+// Return the crc of data[0, n) appended to data whose crc is `crc`.
+inline uint32_t Extend(uint32_t crc, const char *data, size_t n) {
+    return detail::implementation().extend(crc, data, n);
+}
+
+inline uint32_t Value(const char *data, size_t n) { return Extend(0, data, n); }
+
+// the name of the implementation that Extend uses on this CPU
+inline const char *Implementation() { return detail::implementation().name; }
+
+// leveldb stores masked crcs, since computing the crc of data that holds
+// crcs is problematic
+constexpr uint32_t kMaskDelta = 0xa282ead8u;
+
+inline uint32_t Mask(uint32_t crc) {
+    return ((crc >> 15) | (crc << 17)) + kMaskDelta;
+}
+
+inline uint32_t Unmask(uint32_t masked) {
+    uint32_t rot = masked - kMaskDelta;
+    return (rot >> 17) | (rot << 15);
+}
+
+}  // namespace crc32c
+}  // namespace mcberepair
+
+#endif  // MCBEREPAIR_CRC32C_HPP
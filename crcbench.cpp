@@ -0,0 +1,193 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+
+// Microbenchmark for the CRC32C that fsck and repair check blocks with. It
+// checks every implementation the CPU has against known answers and the
+// software tables, then reports the throughput of each.
+//
+//   mcberepair_crcbench [num_bytes] [num_rounds]
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "crc32c.hpp"
+
+namespace {
+
+namespace crc32c = mcberepair::crc32c;
+
+// crcs of standard test strings, from RFC 3720 and leveldb's tests
+struct known_answer_t {
+    std::string data;
+    uint32_t crc;
+};
+
+std::vector<known_answer_t> known_answers() {
+    std::vector<known_answer_t> answers;
+    answers.push_back({"123456789", 0xe3069283u});
+    answers.push_back({std::string(32, '\0'), 0x8a9136aau});
+    answers.push_back({std::string(32, '\xff'), 0x62a8ab43u});
+    std::string ascending, descending;
+    for(int i = 0; i < 32; ++i) {
+        ascending.push_back(static_cast<char>(i));
+        descending.push_back(static_cast<char>(31 - i));
+    }
+    answers.push_back({ascending, 0x46dd794eu});
+    answers.push_back({descending, 0x113fdb5cu});
+    answers.push_back({"hello world", 0xc99465aau});
+    return answers;
+}
+
+// Check one implementation: the known answers, extending a crc at every
+// split of them, and random buffers of every length and alignment up to a
+// few words against the software tables.
+bool check_implementation(const char *name, crc32c::detail::extend_t extend) {
+    for(auto &&a : known_answers()) {
+        const char *p = a.data.data();
+        size_t n = a.data.size();
+        if(extend(0, p, n) != a.crc) {
+            fprintf(stderr,
+                    "ERROR: The %s CRC32C of a %zu-byte string is %08x, not "
+                    "%08x.\n",
+                    name, n, extend(0, p, n), a.crc);
+            return false;
+        }
+        for(size_t i = 0; i <= n; ++i) {
+            if(extend(extend(0, p, i), p + i, n - i) != a.crc) {
+                fprintf(stderr,
+                        "ERROR: Extending the %s CRC32C after %zu of %zu bytes "
+                        "gives the wrong crc.\n",
+                        name, i, n);
+                return false;
+            }
+        }
+    }
+    std::mt19937 rng{1};
+    std::string buffer(64 + 8, '\0');
+    for(auto &&c : buffer) {
+        c = static_cast<char>(rng());
+    }
+    for(size_t offset = 0; offset < 8; ++offset) {
+        for(size_t n = 0; n <= 64; ++n) {
+            const char *p = buffer.data() + offset;
+            if(extend(0, p, n) != crc32c::detail::extend_software(0, p, n)) {
+                fprintf(stderr,
+                        "ERROR: The %s CRC32C of %zu bytes at offset %zu "
+                        "differs from the software one.\n",
+                        name, n, offset);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// leveldb stores masked crcs, which must unmask to the crc they came from
+bool check_mask() {
+    for(auto &&a : known_answers()) {
+        uint32_t crc = a.crc;
+        if(crc32c::Unmask(crc32c::Mask(crc)) != crc ||
+           crc32c::Mask(crc) == crc ||
+           crc32c::Mask(crc32c::Mask(crc)) == crc ||
+           crc32c::Unmask(crc32c::Unmask(crc32c::Mask(crc32c::Mask(crc)))) !=
+               crc) {
+            fprintf(stderr,
+                    "ERROR: Masking the crc %08x does not round-trip.\n", crc);
+            return false;
+        }
+    }
+    return true;
+}
+
+double gb_per_s(const std::string &data, int rounds,
+                crc32c::detail::extend_t extend, uint32_t *sink) {
+    auto start = std::chrono::steady_clock::now();
+    for(int r = 0; r < rounds; ++r) {
+        *sink += extend(*sink, data.data(), data.size());
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return static_cast<double>(data.size()) * rounds / elapsed.count() / 1e9;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1 << 24;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 5;
+    if(n == 0 || rounds <= 0) {
+        fprintf(stderr, "usage: %s [num_bytes] [num_rounds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // the implementations this CPU can run
+    std::vector<crc32c::detail::implementation_t> implementations;
+    implementations.push_back({crc32c::detail::extend_software, "software"});
+#if defined(MCBEREPAIR_CRC32C_SSE42)
+    if(crc32c::detail::has_sse42()) {
+        implementations.push_back({crc32c::detail::extend_sse42, "SSE4.2"});
+    }
+#endif
+#if defined(MCBEREPAIR_CRC32C_ARMV8)
+    if(crc32c::detail::has_armv8()) {
+        implementations.push_back({crc32c::detail::extend_armv8, "ARMv8"});
+    }
+#endif
+
+    // verify every implementation, and the one Value uses, before timing
+    for(auto &&impl : implementations) {
+        if(!check_implementation(impl.name, impl.extend)) {
+            return EXIT_FAILURE;
+        }
+    }
+    if(crc32c::Value("123456789", 9) != 0xe3069283u) {
+        fprintf(stderr, "ERROR: Value gives the wrong CRC32C using %s.\n",
+                crc32c::Implementation());
+        return EXIT_FAILURE;
+    }
+    if(!check_mask()) {
+        return EXIT_FAILURE;
+    }
+
+    std::mt19937 rng{2};
+    std::string data(n, '\0');
+    for(auto &&c : data) {
+        c = static_cast<char>(rng());
+    }
+    // prevent the compiler from discarding results
+    uint32_t sink = 0;
+    printf("bytes\t%zu\n", n);
+    printf("implementation\tGB/s\n");
+    for(auto &&impl : implementations) {
+        printf("%s\t%.2f\n", impl.name,
+               gb_per_s(data, rounds, impl.extend, &sink));
+    }
+    printf("selected\t%s\n", crc32c::Implementation());
+    printf("checksum\t%08x\n", sink);
+
+    return EXIT_SUCCESS;
+}
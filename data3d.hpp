@@ -0,0 +1,287 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+#ifndef MCBEREPAIR_DATA3D_HPP
+#define MCBEREPAIR_DATA3D_HPP
+
+#include <bitset>
+#include <cassert>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "nbtpath.hpp"
+#include "subchunk.hpp"
+
+// Decoding of the per-chunk height and biome records: Data3D (chunk tag 43)
+// in worlds since 1.18 and Data2D (chunk tag 45) before that.
+//
+// Data3D holds 256 little-endian int16 heights followed by one biome storage
+// per subchunk, from the bottom of the world up. A storage packs a palette
+// index for each block like a subchunk layer does, but its palette holds
+// int32 biome ids, and a storage of 0 bits holds a single id without a
+// palette size. A header byte of 0xFF repeats the storage below it.
+//
+// Data2D holds the same heights followed by one biome id byte per column.
+
+namespace mcberepair {
+
+constexpr int kData3DHeightBytes = 512;
+
+// the index of column (x, z) in the heights and in Data2D biomes
+constexpr int data2d_column_index(int x, int z) { return z * 16 + x; }
+
+struct biome_storage_t {
+    int bits;
+    const char *words;
+    std::vector<int32_t> palette;
+};
+
+struct data3d_t {
+    const char *heights;
+    // the storage of each subchunk from the bottom up
+    std::vector<biome_storage_t> subchunks;
+
+    int16_t height(int x, int z) const {
+        int16_t h;
+        std::memcpy(&h, heights + 2 * data2d_column_index(x, z), 2);
+        return h;
+    }
+};
+
+// Parse a Data3D value. `out` can be reused between calls to avoid
+// allocating. Returns false if the value is malformed.
+inline bool parse_data3d(const char *data, size_t size, data3d_t *out) {
+    using namespace detail;
+    assert(out != nullptr);
+    const char *p = data;
+    const char *last = data + size;
+    out->heights = p;
+    if(!nbt_skip(&p, last, kData3DHeightBytes)) {
+        return false;
+    }
+    size_t n = 0;
+    while(p != last) {
+        uint8_t header;
+        nbt_read(&p, last, &header);
+        // resizing keeps the palettes of reused storages allocated
+        if(out->subchunks.size() <= n) {
+            out->subchunks.resize(n + 1);
+        }
+        auto &storage = out->subchunks[n];
+        if(header == 0xFF) {
+            if(n == 0) {
+                return false;
+            }
+            storage.bits = out->subchunks[n - 1].bits;
+            storage.words = out->subchunks[n - 1].words;
+            storage.palette = out->subchunks[n - 1].palette;
+            n += 1;
+            continue;
+        }
+        storage.bits = header >> 1;
+        if(!subchunk_valid_bits(storage.bits)) {
+            return false;
+        }
+        storage.words = p;
+        int32_t count = 1;
+        if(!nbt_skip(&p, last, 4 * subchunk_word_count(storage.bits)) ||
+           (storage.bits != 0 && !nbt_read(&p, last, &count)) || count < 1 ||
+           static_cast<size_t>(last - p) / 4 < static_cast<size_t>(count)) {
+            return false;
+        }
+        storage.palette.resize(count);
+        std::memcpy(storage.palette.data(), p, 4 * count);
+        p += 4 * count;
+        n += 1;
+    }
+    out->subchunks.resize(n);
+    return true;
+}
+
+// Set bit data2d_column_index(x, z) of `columns` for every column of a chunk
+// that holds `biome` at any height. Storages whose palette lacks the biome
+// are not unpacked. `indices` is scratch space for kSubchunkBlocks indices.
+inline void find_biome_columns(const data3d_t &data, int32_t biome,
+                               uint16_t *indices, std::bitset<256> *columns) {
+    for(auto &&storage : data.subchunks) {
+        int want = -1;
+        for(size_t i = 0; i < storage.palette.size(); ++i) {
+            if(storage.palette[i] == biome) {
+                want = static_cast<int>(i);
+                break;
+            }
+        }
+        if(want < 0) {
+            continue;
+        }
+        if(storage.bits == 0) {
+            columns->set();
+            return;
+        }
+        unpack_packed_indices(storage.bits, storage.words, indices);
+        for(int b = 0; b < kSubchunkBlocks; ++b) {
+            if(indices[b] == want) {
+                // indices are in xzy order
+                columns->set(data2d_column_index(b >> 8, (b >> 4) & 15));
+            }
+        }
+    }
+}
+
+// The same for a Data2D value. Returns false if the value is malformed.
+inline bool find_biome_columns_2d(const char *data, size_t size,
+                                  int32_t biome, std::bitset<256> *columns) {
+    if(size != kData3DHeightBytes + 256) {
+        return false;
+    }
+    const char *biomes = data + kData3DHeightBytes;
+    for(int i = 0; i < 256; ++i) {
+        if(static_cast<uint8_t>(biomes[i]) == biome) {
+            columns->set(i);
+        }
+    }
+    return true;
+}
+
+struct biome_t {
+    int32_t id;
+    const char *name;
+};
+
+// The ids of Bedrock biomes, named as in the /locate command.
+constexpr biome_t kBiomes[] = {
+    {0, "ocean"},
+    {1, "plains"},
+    {2, "desert"},
+    {3, "extreme_hills"},
+    {4, "forest"},
+    {5, "taiga"},
+    {6, "swampland"},
+    {7, "river"},
+    {8, "hell"},
+    {9, "the_end"},
+    {10, "legacy_frozen_ocean"},
+    {11, "frozen_river"},
+    {12, "ice_plains"},
+    {13, "ice_mountains"},
+    {14, "mushroom_island"},
+    {15, "mushroom_island_shore"},
+    {16, "beach"},
+    {17, "desert_hills"},
+    {18, "forest_hills"},
+    {19, "taiga_hills"},
+    {20, "extreme_hills_edge"},
+    {21, "jungle"},
+    {22, "jungle_hills"},
+    {23, "jungle_edge"},
+    {24, "deep_ocean"},
+    {25, "stone_beach"},
+    {26, "cold_beach"},
+    {27, "birch_forest"},
+    {28, "birch_forest_hills"},
+    {29, "roofed_forest"},
+    {30, "cold_taiga"},
+    {31, "cold_taiga_hills"},
+    {32, "mega_taiga"},
+    {33, "mega_taiga_hills"},
+    {34, "extreme_hills_plus_trees"},
+    {35, "savanna"},
+    {36, "savanna_plateau"},
+    {37, "mesa"},
+    {38, "mesa_plateau_stone"},
+    {39, "mesa_plateau"},
+    {40, "warm_ocean"},
+    {41, "deep_warm_ocean"},
+    {42, "lukewarm_ocean"},
+    {43, "deep_lukewarm_ocean"},
+    {44, "cold_ocean"},
+    {45, "deep_cold_ocean"},
+    {46, "frozen_ocean"},
+    {47, "deep_frozen_ocean"},
+    {48, "bamboo_jungle"},
+    {49, "bamboo_jungle_hills"},
+    {129, "sunflower_plains"},
+    {130, "desert_mutated"},
+    {131, "extreme_hills_mutated"},
+    {132, "flower_forest"},
+    {133, "taiga_mutated"},
+    {134, "swampland_mutated"},
+    {140, "ice_plains_spikes"},
+    {149, "jungle_mutated"},
+    {151, "jungle_edge_mutated"},
+    {155, "birch_forest_mutated"},
+    {156, "birch_forest_hills_mutated"},
+    {157, "roofed_forest_mutated"},
+    {158, "cold_taiga_mutated"},
+    {160, "redwood_taiga_mutated"},
+    {161, "redwood_taiga_hills_mutated"},
+    {162, "extreme_hills_plus_trees_mutated"},
+    {163, "savanna_mutated"},
+    {164, "savanna_plateau_mutated"},
+    {165, "mesa_bryce"},
+    {166, "mesa_plateau_stone_mutated"},
+    {167, "mesa_plateau_mutated"},
+    {178, "soulsand_valley"},
+    {179, "crimson_forest"},
+    {180, "warped_forest"},
+    {181, "basalt_deltas"},
+    {182, "jagged_peaks"},
+    {183, "frozen_peaks"},
+    {184, "snowy_slopes"},
+    {185, "grove"},
+    {186, "meadow"},
+    {187, "lush_caves"},
+    {188, "dripstone_caves"},
+    {189, "stony_peaks"},
+    {190, "deep_dark"},
+    {191, "mangrove_swamp"},
+    {192, "cherry_grove"},
+};
+
+// The name of a biome id, or nullptr if it is unknown.
+inline const char *biome_name(int32_t id) {
+    for(auto &&biome : kBiomes) {
+        if(biome.id == id) {
+            return biome.name;
+        }
+    }
+    return nullptr;
+}
+
+// Look up a biome by name or by numeric id. Returns false if it is neither.
+inline bool parse_biome(std::string_view text, int32_t *id) {
+    for(auto &&biome : kBiomes) {
+        if(text == biome.name) {
+            *id = biome.id;
+            return true;
+        }
+    }
+    auto res = std::from_chars(text.data(), text.data() + text.size(), *id);
+    return !text.empty() && res.ec == std::errc{} &&
+           res.ptr == text.data() + text.size() && *id >= 0;
+}
+
+}  // namespace mcberepair
+
+#endif  // MCBEREPAIR_DATA3D_HPP
@@ -22,15 +22,177 @@
 #ifndef MCBEREPAIR_DB_HPP
 #define MCBEREPAIR_DB_HPP
 
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+
 #include "leveldb/cache.h"
 #include "leveldb/db.h"
 #include "leveldb/decompress_allocator.h"
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
 #include "leveldb/zlib_compressor.h"
+#include "iotrace.hpp"
+#include "stats.hpp"
 
 namespace mcberepair {
 
+// Tuning knobs for opening databases. Every database a command opens uses
+// the process-wide settings returned by db_options().
+struct db_options_t {
+    std::string profile;
+    size_t cache_size;
+    size_t write_buffer_size;
+    int max_open_files;
+    size_t block_size;
+    int bloom_bits;
+};
+
+// Fill `out` with a named profile. Returns false if there is no such profile.
+//
+// low-memory  small caches and few open files for devices with ~512 MB
+// balanced    the settings Minecraft uses on ~1 GB devices (the default)
+// throughput  large caches and write buffers for batch jobs on big hosts
+inline bool db_profile(std::string_view name, db_options_t* out) {
+    if(name == "low-memory") {
+        *out = {"low-memory", 8 * 1024 * 1024, 1024 * 1024, 64, 4 * 1024, 10};
+    } else if(name == "balanced") {
+        *out = {"balanced", 40 * 1024 * 1024, 4 * 1024 * 1024, 1000, 4 * 1024,
+                10};
+    } else if(name == "throughput") {
+        *out = {"throughput", 512 * 1024 * 1024, 64 * 1024 * 1024, 10000,
+                16 * 1024, 10};
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline db_options_t& db_options() {
+    static db_options_t options = []() {
+        db_options_t ret;
+        db_profile("balanced", &ret);
+        return ret;
+    }();
+    return options;
+}
+
+// Parse a byte count with an optional K, M, or G suffix.
+inline bool parse_size(std::string_view str, size_t* out) {
+    size_t scale = 1;
+    if(!str.empty()) {
+        switch(str.back()) {
+            case 'k':
+            case 'K':
+                scale = size_t{1} << 10;
+                break;
+            case 'm':
+            case 'M':
+                scale = size_t{1} << 20;
+                break;
+            case 'g':
+            case 'G':
+                scale = size_t{1} << 30;
+                break;
+            default:
+                break;
+        }
+        if(scale != 1) {
+            str.remove_suffix(1);
+        }
+    }
+    std::string buf{str};
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long v = std::strtoull(buf.c_str(), &end, 10);
+    if(buf.empty() || *end != '\0' || buf[0] == '-' || errno == ERANGE ||
+       v > std::numeric_limits<size_t>::max() / scale) {
+        return false;
+    }
+    *out = static_cast<size_t>(v) * scale;
+    return true;
+}
+
+// Parse a count that must fit in an int. Counts take no suffix.
+inline bool parse_count(std::string_view str, int* out) {
+    std::string buf{str};
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long v = std::strtoull(buf.c_str(), &end, 10);
+    if(buf.empty() || *end != '\0' || buf[0] == '-' || errno == ERANGE ||
+       v > static_cast<unsigned long long>(std::numeric_limits<int>::max())) {
+        return false;
+    }
+    *out = static_cast<int>(v);
+    return true;
+}
+
+// The names of the options that override a profile.
+constexpr const char* kDBOptionNames[] = {"cache-size", "write-buffer-size",
+                                          "max-open-files", "block-size",
+                                          "bloom-bits"};
+
+// Set one option by name. Returns false if the name is unknown or the value
+// is malformed.
+inline bool set_db_option(std::string_view name, std::string_view value,
+                          db_options_t* out) {
+    if(name == "cache-size") {
+        return parse_size(value, &out->cache_size);
+    } else if(name == "write-buffer-size") {
+        return parse_size(value, &out->write_buffer_size);
+    } else if(name == "max-open-files") {
+        return parse_count(value, &out->max_open_files);
+    } else if(name == "block-size") {
+        return parse_size(value, &out->block_size);
+    } else if(name == "bloom-bits") {
+        return parse_count(value, &out->bloom_bits);
+    }
+    return false;
+}
+
+// Apply the settings in `options` to leveldb options. The filter policy and
+// cache are created here and must outlive the database.
+inline void apply_db_options(
+    const db_options_t& options, leveldb::Options* out,
+    std::unique_ptr<const leveldb::FilterPolicy>* filter_policy,
+    std::unique_ptr<leveldb::Cache>* block_cache) {
+    // a bloom filter quickly tells if a key is in the database or not
+    if(options.bloom_bits > 0) {
+        filter_policy->reset(leveldb::NewBloomFilterPolicy(options.bloom_bits));
+    }
+    out->filter_policy = filter_policy->get();
+    if(block_cache != nullptr) {
+        block_cache->reset(leveldb::NewLRUCache(options.cache_size));
+        out->block_cache = block_cache->get();
+    }
+    // a large write buffer improves compression and touches the disk less
+    out->write_buffer_size = options.write_buffer_size;
+    out->max_open_files = options.max_open_files;
+    out->block_size = options.block_size;
+    // route file access through the tracer when --io-stats is on
+    out->env = db_env();
+}
+
+// A compressor that counts the bytes it decompresses for --stats.
+template <typename Base>
+class CountingCompressor : public Base {
+   public:
+    using Base::decompress;
+
+    bool decompress(const char* input, size_t length,
+                    std::string& output) const override {
+        bool ok = Base::decompress(input, length, output);
+        if(ok) {
+            stats().AddDecompressed(output.size());
+        }
+        return ok;
+    }
+};
+
 class NullLogger : public leveldb::Logger {
    public:
     void Logv(const char*, va_list) override {}
@@ -40,21 +202,10 @@ class DB {
    public:
     explicit DB(const char* path, bool create_if_missing = false,
                 bool error_if_exists = false)
-        : options_{},
-          filter_policy_{leveldb::NewBloomFilterPolicy(10)},
-          block_cache_{leveldb::NewLRUCache(40 * 1024 * 1024)},
-          info_log{},
-          zlib_raw_{},
-          zlib_{},
-          db_{} {
-        // create a bloom filter to quickly tell if a key is in the database or
-        // not
-        options_.filter_policy = filter_policy_.get();
-        // create a 40 mb cache (we use this on ~1gb devices)
-        options_.block_cache = block_cache_.get();
-        // create a 4mb write buffer, to improve compression and touch the disk
-        // less
-        options_.write_buffer_size = 4 * 1024 * 1024;
+        : path_{path}, options_{}, info_log{}, zlib_raw_{}, zlib_{}, db_{} {
+        ScopedPhase phase{Phase::kOpen};
+        apply_db_options(db_options(), &options_, &filter_policy_,
+                         &block_cache_);
         // disable internal logging.
         options_.info_log = &info_log;
         // use the new raw-zip compressor to write (and read)
@@ -73,19 +224,41 @@ class DB {
         }
     }
 
+    ~DB() {
+        if(!db_) {
+            return;
+        }
+        if(stats().enabled()) {
+            for(const char* name :
+                {"leveldb.approximate-memory-usage", "leveldb.sstables",
+                 "leveldb.stats"}) {
+                std::string value;
+                if(db_->GetProperty(name, &value)) {
+                    stats().AddProperty(path_, name, std::move(value));
+                }
+            }
+        }
+        ScopedPhase phase{Phase::kClose};
+        db_.reset();
+    }
+
+    DB(const DB&) = delete;
+    DB& operator=(const DB&) = delete;
+
     explicit operator bool() { return static_cast<bool>(db_); }
 
     leveldb::DB& operator()() { return *db_; }
 
    protected:
+    std::string path_;
     leveldb::Options options_;
 
     std::unique_ptr<const leveldb::FilterPolicy> filter_policy_;
     std::unique_ptr<leveldb::Cache> block_cache_;
 
     NullLogger info_log;
-    leveldb::ZlibCompressorRaw zlib_raw_;
-    leveldb::ZlibCompressor zlib_;
+    CountingCompressor<leveldb::ZlibCompressorRaw> zlib_raw_;
+    CountingCompressor<leveldb::ZlibCompressor> zlib_;
 
     std::unique_ptr<leveldb::DB> db_;
 };
@@ -20,31 +20,182 @@
 # SOFTWARE.
 */
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
+#include <iostream>
 #include <memory>
+#include <vector>
 
 #ifdef _WIN32
 #include <fcntl.h>
 #include <io.h>
 #endif
 
+#include "archive.hpp"
+#include "args.hpp"
 #include "db.hpp"
 #include "mcbekey.hpp"
 
+namespace {
+
+// A requested key and the form it was given in, for messages.
+struct request_t {
+    std::string key;
+    std::string encoded;
+};
+
+// Write every requested key that exists to stdout as an archive. Keys are
+// visited in sorted order with a single iterator, so values are read from
+// sequential blocks instead of a random Get per key.
+int dump_batch(leveldb::DB* db, const std::string& path,
+               std::vector<request_t>* requests) {
+    std::sort(requests->begin(), requests->end(),
+              [](const request_t& a, const request_t& b) {
+                  return a.key < b.key;
+              });
+    requests->erase(std::unique(requests->begin(), requests->end(),
+                                [](const request_t& a, const request_t& b) {
+                                    return a.key == b.key;
+                                }),
+                    requests->end());
+
+    mcberepair::ScopedPhase scan_phase{mcberepair::Phase::kScan};
+
+    // create a reusable memory space for decompression so it allocates less
+    leveldb::ReadOptions readOptions;
+    leveldb::DecompressAllocator decompress_allocator;
+    readOptions.decompress_allocator = &decompress_allocator;
+    readOptions.verify_checksums = true;
+    readOptions.fill_cache = false;
+    auto it = std::unique_ptr<leveldb::Iterator>{db->NewIterator(readOptions)};
+
+#ifdef _WIN32
+    fflush(stdout);
+    _setmode(_fileno(stdout), O_BINARY);
+#endif
+
+    // flush output in pieces of about this size
+    constexpr size_t chunk_size = 1024 * 1024;
+    // nearby keys are reached by stepping instead of seeking
+    constexpr int max_steps = 16;
+
+    std::string buffer;
+    mcberepair::write_archive_header(&buffer);
+    uint64_t missing = 0;
+    for(auto&& request : *requests) {
+        leveldb::Slice target{request.key};
+        int steps = 0;
+        while(it->Valid() && it->key().compare(target) < 0 &&
+              steps < max_steps) {
+            it->Next();
+            steps += 1;
+        }
+        if(!it->Valid() || it->key().compare(target) < 0) {
+            it->Seek(target);
+        }
+        if(!it->Valid() || it->key() != target) {
+            fprintf(stderr, "Skipping missing key '%s'...\n",
+                    request.encoded.c_str());
+            missing += 1;
+            if(!it->status().ok()) {
+                break;  // LCOV_EXCL_LINE
+            }
+            continue;
+        }
+        auto value = it->value();
+        mcberepair::write_archive_record(&buffer, request.key,
+                                         {value.data(), value.size()});
+        mcberepair::stats().AddKeys(1, request.key.size() + value.size());
+        if(buffer.size() >= chunk_size) {
+            if(fwrite(buffer.data(), buffer.size(), 1, stdout) < 1) {
+                return EXIT_FAILURE;  // LCOV_EXCL_LINE
+            }
+            buffer.clear();
+        }
+    }
+    if(!it->status().ok()) {
+        // LCOV_EXCL_START
+        fprintf(stderr, "ERROR: Reading '%s' failed: %s\n", path.c_str(),
+                it->status().ToString().c_str());
+        return EXIT_FAILURE;
+        // LCOV_EXCL_STOP
+    }
+    mcberepair::write_archive_footer(&buffer);
+    if(fwrite(buffer.data(), buffer.size(), 1, stdout) < 1) {
+        return EXIT_FAILURE;  // LCOV_EXCL_LINE
+    }
+    return EXIT_SUCCESS;
+}
+
+}  // namespace
+
 int dumpkey_main(int argc, char* argv[]) {
-    if(argc < 4 || strcmp("help", argv[1]) == 0) {
+    mcberepair::Args args{argc, argv};
+    bool batch = args.has("batch");
+    if((batch ? args.size() < 1 : args.size() < 2) ||
+       strcmp("help", argv[1]) == 0) {
         printf("Usage: %s dumpkey <minecraft_world_dir> <key> > output.bin\n",
                argv[0]);
+        printf(
+            "       %s dumpkey <minecraft_world_dir> --batch < keys.txt > "
+            "values.mckv\n",
+            argv[0]);
+        printf(
+            "       %s dumpkey <minecraft_world_dir> --batch <key> <key> ... > "
+            "values.mckv\n",
+            argv[0]);
         return EXIT_FAILURE;
     }
+    std::string bad_option;
+    if(args.unknown({"batch"}, &bad_option)) {
+        fprintf(stderr, "ERROR: Unknown option '--%s'.\n", bad_option.c_str());
+        return EXIT_FAILURE;
+    }
+
+    // construct path for Minecraft BE database
+    std::string path = std::string(args[0]) + "/db";
+
+    if(batch) {
+        // decode every key before opening the database
+        std::vector<request_t> requests;
+        auto add_request = [&](std::string line) -> bool {
+            std::string key;
+            if(!mcberepair::decode_key(line, &key)) {
+                fprintf(stderr, "ERROR: key '%s' is malformed\n",
+                        line.c_str());
+                return false;
+            }
+            requests.push_back({std::move(key), std::move(line)});
+            return true;
+        };
+        if(args.size() > 1) {
+            for(size_t i = 1; i < args.size(); ++i) {
+                if(!add_request(args[i])) {
+                    return EXIT_FAILURE;
+                }
+            }
+        } else {
+            std::string line;
+            while(std::getline(std::cin, line)) {
+                if(!add_request(line)) {
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+
+        mcberepair::DB db{path.c_str()};
+        if(!db) {
+            fprintf(stderr, "ERROR: Opening '%s' failed.\n", path.c_str());
+            return EXIT_FAILURE;
+        }
+        return dump_batch(&db(), path, &requests);
+    }
+
     std::string value;
 
     // use RAII to close the db before dumping value
     {
-        // construct path for Minecraft BE database
-        std::string path = std::string(argv[2]) + "/db";
-
         // open the database
         mcberepair::DB db{path.c_str()};
 
@@ -61,15 +212,15 @@ int dumpkey_main(int argc, char* argv[]) {
         readOptions.verify_checksums = true;
 
         std::string key;
-        if(!mcberepair::decode_key(argv[3], &key)) {
-            fprintf(stderr, "ERROR: key '%s' is malformed\n", argv[3]);
+        if(!mcberepair::decode_key(args[1], &key)) {
+            fprintf(stderr, "ERROR: key '%s' is malformed\n", args[1]);
             return EXIT_FAILURE;
         }
 
         leveldb::Status status = db().Get(readOptions, key, &value);
 
         if(!status.ok()) {
-            fprintf(stderr, "ERROR: Reading key '%s' failed --- %s\n", argv[3],
+            fprintf(stderr, "ERROR: Reading key '%s' failed --- %s\n", args[1],
                     status.ToString().c_str());
             return EXIT_FAILURE;
         }
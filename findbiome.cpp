@@ -0,0 +1,233 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "args.hpp"
+#include "data3d.hpp"
+#include "db.hpp"
+#include "mcbekey.hpp"
+
+namespace {
+
+// Worlds end at a border 30 million blocks from the origin, so no search
+// needs to go further. This also keeps chunk coordinates from overflowing.
+constexpr int kWorldBorder = 30000000;
+constexpr int kMaxRadius = kWorldBorder / 16;
+
+int floor_div(int a, int b) { return a / b - ((a % b != 0) && ((a < 0) != (b < 0))); }
+
+// The distance from (x, z) to the nearest column of chunk (cx, cz).
+double chunk_distance(int x, int z, int cx, int cz) {
+    auto axis = [](int v, int c) {
+        int lo = c * 16;
+        int hi = lo + 15;
+        return v < lo ? lo - v : (v > hi ? v - hi : 0);
+    };
+    return std::hypot(axis(x, cx), axis(z, cz));
+}
+
+}  // namespace
+
+int findbiome_main(int argc, char *argv[]) {
+    mcberepair::Args args{argc, argv};
+    if(args.size() < 2 || strcmp("help", argv[1]) == 0) {
+        printf("Usage: %s findbiome <minecraft_world_dir> <biome>\n", argv[0]);
+        printf("\n");
+        printf(
+            "Biomes are given by name, such as 'plains' or 'mesa', or by "
+            "numeric id.\n");
+        printf("\n");
+        printf("Options:\n");
+        printf(
+            "  --x=N --z=N      The block to search from (default 0, 0).\n");
+        printf(
+            "  --dimension=N    The dimension to search (default 0, the "
+            "overworld).\n");
+        printf(
+            "  --radius=N       Give up after N rings of chunks (default "
+            "64).\n");
+        return EXIT_FAILURE;
+    }
+    std::string bad_option;
+    if(args.unknown({"x", "z", "dimension", "radius"}, &bad_option)) {
+        fprintf(stderr, "ERROR: Unknown option '--%s'.\n", bad_option.c_str());
+        return EXIT_FAILURE;
+    }
+    int x = 0, z = 0, dimension = 0, radius = 64;
+    if(!args.number("x", &x) || x < -kWorldBorder || x > kWorldBorder) {
+        fprintf(stderr, "ERROR: Invalid value for '--x'.\n");
+        return EXIT_FAILURE;
+    }
+    if(!args.number("z", &z) || z < -kWorldBorder || z > kWorldBorder) {
+        fprintf(stderr, "ERROR: Invalid value for '--z'.\n");
+        return EXIT_FAILURE;
+    }
+    if(!args.number("dimension", &dimension) || dimension < 0) {
+        fprintf(stderr, "ERROR: Invalid value for '--dimension'.\n");
+        return EXIT_FAILURE;
+    }
+    if(!args.number("radius", &radius) || radius < 0) {
+        fprintf(stderr, "ERROR: Invalid value for '--radius'.\n");
+        return EXIT_FAILURE;
+    }
+    radius = std::min(radius, kMaxRadius);
+    int32_t biome;
+    if(!mcberepair::parse_biome(args[1], &biome)) {
+        fprintf(stderr, "ERROR: Unknown biome '%s'.\n", args[1]);
+        return EXIT_FAILURE;
+    }
+    const char *name = mcberepair::biome_name(biome);
+    std::string biome_label =
+        name != nullptr ? name : "biome " + std::to_string(biome);
+
+    // construct path for Minecraft BE database
+    std::string path = std::string(args[0]) + "/db";
+
+    // open the database
+    mcberepair::DB db{path.c_str()};
+
+    if(!db) {
+        fprintf(stderr, "ERROR: Opening '%s' failed.\n", path.c_str());
+        return EXIT_FAILURE;
+    }
+
+    mcberepair::ScopedPhase scan_phase{mcberepair::Phase::kScan};
+    leveldb::ReadOptions readOptions;
+    readOptions.verify_checksums = true;
+
+    int cx = floor_div(x, 16);
+    int cz = floor_div(z, 16);
+    double best = std::numeric_limits<double>::infinity();
+    int best_x = 0, best_z = 0;
+    uint64_t reads = 0, bytes = 0, missing = 0, malformed = 0;
+
+    mcberepair::data3d_t data;
+    std::vector<uint16_t> indices(mcberepair::kSubchunkBlocks);
+    std::vector<mcberepair::chunk_t> ring;
+    std::string key, value;
+
+    // Rings of chunks are searched outward. Only the Data3D key of each
+    // chunk is read, with a Get, falling back to Data2D in older worlds.
+    // The search stops once a ring cannot hold anything closer than the
+    // best column found.
+    for(int r = 0; r <= radius; ++r) {
+        if(r * 16 - 15 > best) {
+            break;
+        }
+        ring.clear();
+        for(int i = -r; i <= r; ++i) {
+            // only the 8r chunks on the edge of the square are in the ring:
+            // its first and last rows, and both ends of every other row
+            int step = (i == -r || i == r) ? 1 : 2 * r;
+            for(int j = -r; j <= r; j += step) {
+                mcberepair::chunk_t chunk{dimension, cx + i, cz + j, 43, -1};
+                if(chunk_distance(x, z, chunk.x, chunk.z) <= best) {
+                    ring.push_back(chunk);
+                }
+            }
+        }
+        for(auto &&chunk : ring) {
+            std::bitset<256> columns;
+            mcberepair::create_chunk_key(chunk, &key);
+            leveldb::Status status = db().Get(readOptions, key, &value);
+            reads += 1;
+            if(status.IsNotFound()) {
+                chunk.tag = 45;
+                mcberepair::create_chunk_key(chunk, &key);
+                status = db().Get(readOptions, key, &value);
+                reads += 1;
+                if(status.IsNotFound()) {
+                    missing += 1;
+                    continue;
+                }
+                if(status.ok() &&
+                   !mcberepair::find_biome_columns_2d(value.data(),
+                                                      value.size(), biome,
+                                                      &columns)) {
+                    malformed += 1;
+                    continue;
+                }
+            } else if(status.ok()) {
+                if(!mcberepair::parse_data3d(value.data(), value.size(),
+                                             &data)) {
+                    malformed += 1;
+                    continue;
+                }
+                mcberepair::find_biome_columns(data, biome, indices.data(),
+                                               &columns);
+            }
+            if(!status.ok()) {
+                // LCOV_EXCL_START
+                fprintf(stderr, "ERROR: Reading '%s' failed: %s\n",
+                        path.c_str(), status.ToString().c_str());
+                return EXIT_FAILURE;
+                // LCOV_EXCL_STOP
+            }
+            bytes += key.size() + value.size();
+            if(columns.none()) {
+                continue;
+            }
+            for(int col_x = 0; col_x < 16; ++col_x) {
+                for(int col_z = 0; col_z < 16; ++col_z) {
+                    if(!columns.test(
+                           mcberepair::data2d_column_index(col_x, col_z))) {
+                        continue;
+                    }
+                    int bx = chunk.x * 16 + col_x;
+                    int bz = chunk.z * 16 + col_z;
+                    double d = std::hypot(bx - x, bz - z);
+                    if(d < best) {
+                        best = d;
+                        best_x = bx;
+                        best_z = bz;
+                    }
+                }
+            }
+        }
+    }
+    mcberepair::stats().AddKeys(reads - missing, bytes);
+
+    if(std::isinf(best)) {
+        printf("No %s within %d chunks of x=%d, z=%d; read %llu keys.\n",
+               biome_label.c_str(), radius, x, z,
+               static_cast<unsigned long long>(reads));
+    } else {
+        printf(
+            "The nearest %s is at x=%d, z=%d, %.1f blocks away; read %llu "
+            "keys.\n",
+            biome_label.c_str(), best_x, best_z, best,
+            static_cast<unsigned long long>(reads));
+    }
+    if(malformed > 0) {
+        printf("%llu chunks had malformed biome data.\n",
+               static_cast<unsigned long long>(malformed));
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,258 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "args.hpp"
+#include "crc32c.hpp"
+#include "mcbekey.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "tablefile.hpp"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// A block that failed a check. Its keys are bounded by the index: every key
+// in it comes after `after` and is at most `through`.
+struct bad_block_t {
+    uint64_t offset;
+    uint64_t size;
+    std::string error;
+    std::string after;
+    std::string through;
+};
+
+struct table_check_t {
+    explicit table_check_t(uint64_t n) : number{n} {}
+
+    uint64_t number;
+    uint64_t bytes{0};
+    uint64_t blocks{0};
+    uint64_t entries{0};
+    std::vector<bad_block_t> bad;
+};
+
+// What each thread reuses from one table to the next.
+struct worker_t {
+    std::string file;
+    std::string buffer;
+};
+
+std::string user_key(const std::string &internal_key) {
+    if(internal_key.size() < 8) {
+        return {};  // LCOV_EXCL_LINE
+    }
+    return internal_key.substr(0, internal_key.size() - 8);
+}
+
+// Check every block of a table: its checksum, that it decompresses, and
+// that its entries parse. After the footer and index are read, the rest of
+// the file is read at once and its blocks are checked from memory.
+void check_table(const mcberepair::TableFiles &files, worker_t *w,
+                 table_check_t *t) {
+    std::unique_ptr<leveldb::RandomAccessFile> file;
+    uint64_t size = 0;
+    leveldb::Status status = files.OpenFile(t->number, &file, &size);
+    std::vector<mcberepair::table_block_t> blocks;
+    if(status.ok()) {
+        status = files.ReadIndex(file.get(), size, false, &blocks);
+    }
+    leveldb::Slice data;
+    if(status.ok()) {
+        w->file.resize(size);
+        status = file->Read(0, size, &data, &w->file[0]);
+    }
+    if(status.ok() && data.size() != size) {
+        status = leveldb::Status::Corruption("truncated table read");
+    }
+    if(!status.ok()) {
+        t->bad.push_back({0, size, status.ToString(), {}, {}});
+        return;
+    }
+    t->bytes = size;
+    t->blocks = blocks.size();
+    std::string after;
+    for(auto &&b : blocks) {
+        std::string through = user_key(b.last_key);
+        mcberepair::block_read_t block;
+        if(b.offset + b.size + leveldb::kBlockTrailerSize > data.size()) {
+            // LCOV_EXCL_START
+            block.status = leveldb::Status::Corruption("block is out of range");
+            // LCOV_EXCL_STOP
+        } else {
+            block = files.CheckBlock(
+                leveldb::Slice{data.data() + b.offset,
+                               b.size + leveldb::kBlockTrailerSize},
+                false, &w->buffer);
+        }
+        if(block.status.ok() &&
+           !mcberepair::parse_block(
+               block.contents, mcberepair::block_trust_t::kChecked,
+               [&](const leveldb::Slice &, const leveldb::Slice &) {
+                   t->entries += 1;
+                   return true;
+               })) {
+            block.status = leveldb::Status::Corruption("malformed block");
+        }
+        if(!block.status.ok()) {
+            t->bad.push_back(
+                {b.offset, b.size, block.status.ToString(), after, through});
+        }
+        after = std::move(through);
+    }
+}
+
+}  // namespace
+
+int fsck_main(int argc, char *argv[]) {
+    mcberepair::Args args{argc, argv};
+    if(args.size() < 1 || strcmp("help", argv[1]) == 0) {
+        printf("Usage: %s fsck <minecraft_world_dir> > corrupt.tsv\n",
+               argv[0]);
+        printf("\n");
+        printf(
+            "Checks the checksum and compression of every block of every "
+            "table, reading the\n"
+            "table files directly without opening or locking the database. "
+            "Corrupt blocks\n"
+            "are listed with the range of keys they hold.\n");
+        printf("\n");
+        printf("Options:\n");
+        printf(
+            "  --threads=N    Check N tables at a time. Use 0 for one thread "
+            "per core\n"
+            "                 (default 0).\n");
+        return EXIT_FAILURE;
+    }
+    std::string bad_option;
+    if(args.unknown({"threads"}, &bad_option)) {
+        fprintf(stderr, "ERROR: Unknown option '--%s'.\n", bad_option.c_str());
+        return EXIT_FAILURE;
+    }
+    unsigned int threads = 0;
+    if(!args.number("threads", &threads)) {
+        fprintf(stderr, "ERROR: Invalid value for '--threads'.\n");
+        return EXIT_FAILURE;
+    }
+    if(threads == 0) {
+        threads = mcberepair::default_threads();
+    }
+
+    // construct path for Minecraft BE database
+    std::string path = std::string(args[0]) + "/db";
+
+    mcberepair::TableFiles files{path};
+    leveldb::Env *env = files.env();
+
+    // The tables of the current version are checked. If the MANIFEST
+    // cannot be read, every table in the directory is checked instead.
+    std::vector<table_check_t> tables;
+    mcberepair::manifest_t manifest;
+    leveldb::Status manifest_status =
+        mcberepair::read_manifest(env, path, &manifest);
+    if(manifest_status.ok()) {
+        for(auto &&t : manifest.tables) {
+            tables.emplace_back(t.number);
+        }
+    } else {
+        std::vector<std::string> children;
+        leveldb::Status status = env->GetChildren(path, &children);
+        if(!status.ok()) {
+            fprintf(stderr, "ERROR: Reading '%s' failed: %s\n", path.c_str(),
+                    status.ToString().c_str());
+            return EXIT_FAILURE;
+        }
+        fprintf(stderr,
+                "Reading the MANIFEST failed: %s\nChecking every table in "
+                "'%s' instead.\n",
+                manifest_status.ToString().c_str(), path.c_str());
+        uint64_t number;
+        leveldb::FileType type;
+        for(auto &&child : children) {
+            if(leveldb::ParseFileName(child, &number, &type) &&
+               type == leveldb::kTableFile) {
+                tables.emplace_back(number);
+            }
+        }
+        std::sort(tables.begin(), tables.end(),
+                  [](const table_check_t &a, const table_check_t &b) {
+                      return a.number < b.number;
+                  });
+    }
+
+    auto start = clock_type::now();
+    {
+        mcberepair::ScopedPhase phase{mcberepair::Phase::kScan};
+        std::vector<worker_t> workers(threads);
+        mcberepair::parallel_for_workers(
+            tables.size(), threads, [&](size_t i, unsigned int w) {
+                check_table(files, &workers[w], &tables[i]);
+            });
+    }
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+
+    printf("table\toffset\tbytes\terror\tafter\tthrough\n");
+    uint64_t bytes = 0, blocks = 0, entries = 0, bad = 0;
+    for(auto &&t : tables) {
+        bytes += t.bytes;
+        blocks += t.blocks;
+        entries += t.entries;
+        bad += t.bad.size();
+        std::string name = files.FileName(t.number);
+        name = name.substr(name.rfind('/') + 1);
+        for(auto &&b : t.bad) {
+            printf("%s\t%llu\t%llu\t%s\t%s\t%s\n", name.c_str(),
+                   static_cast<unsigned long long>(b.offset),
+                   static_cast<unsigned long long>(b.size), b.error.c_str(),
+                   mcberepair::encode_key(b.after).c_str(),
+                   mcberepair::encode_key(b.through).c_str());
+        }
+    }
+    mcberepair::stats().AddKeys(entries, bytes);
+
+    // the summary goes to stderr so stdout holds only rows
+    double seconds = std::max(elapsed.count(), 1e-9);
+    fprintf(stderr,
+            "Checked %llu blocks in %llu tables (%.1f MB) in %.3f s: %.2f "
+            "GB/s with %u threads and %s CRC32C.\n",
+            static_cast<unsigned long long>(blocks),
+            static_cast<unsigned long long>(tables.size()),
+            bytes / (1024.0 * 1024.0), elapsed.count(), bytes / seconds / 1e9,
+            threads, mcberepair::crc32c::Implementation());
+    if(bad > 0) {
+        fprintf(stderr, "Found %llu corrupt blocks.\n",
+                static_cast<unsigned long long>(bad));
+    }
+    if(!manifest_status.ok()) {
+        fprintf(stderr, "The MANIFEST is unreadable.\n");
+    }
+    return bad > 0 || !manifest_status.ok() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
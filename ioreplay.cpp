@@ -0,0 +1,237 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "iotrace.hpp"
+
+namespace {
+
+// One line of an I/O trace.
+struct trace_op_t {
+    mcberepair::IoOp op;
+    std::string file;
+    uint64_t offset;
+    uint64_t bytes;
+    // for opens, whether the file is opened for writing
+    bool write;
+    // for renames, the new name of the file
+    std::string new_file;
+};
+
+bool parse_op(const std::string &line, trace_op_t *out) {
+    std::istringstream in{line};
+    long long at;
+    std::string op;
+    uint64_t latency;
+    if(!(in >> at >> op >> out->file >> out->offset >> out->bytes >>
+         latency)) {
+        return false;
+    }
+    for(int i = 0; i < static_cast<int>(mcberepair::IoOp::kCount); ++i) {
+        if(op == mcberepair::kIoOpNames[i]) {
+            out->op = static_cast<mcberepair::IoOp>(i);
+            out->write = false;
+            return out->op != mcberepair::IoOp::kRename ||
+                   static_cast<bool>(in >> out->new_file);
+        }
+    }
+    return false;
+}
+
+}  // namespace
+
+int ioreplay_main(int argc, char *argv[]) {
+    if(argc < 4 || strcmp("help", argv[1]) == 0) {
+        printf("Usage: %s ioreplay <trace_file> <scratch_dir>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *trace_path = argv[2];
+    std::string dir = argv[3];
+
+    std::ifstream in{trace_path};
+    if(!in) {
+        fprintf(stderr, "ERROR: Opening '%s' failed.\n", trace_path);
+        return EXIT_FAILURE;
+    }
+    std::vector<trace_op_t> ops;
+    std::string line;
+    for(size_t n = 1; std::getline(in, line); ++n) {
+        trace_op_t op;
+        if(!parse_op(line, &op)) {
+            fprintf(stderr, "ERROR: line %zu of '%s' is malformed.\n", n,
+                    trace_path);
+            return EXIT_FAILURE;
+        }
+        ops.push_back(std::move(op));
+    }
+
+    // The trace does not say how a file was opened, so look at what happens
+    // to it next. Files that are read before anything writes them must exist
+    // before replay starts and be large enough for every read. Any other
+    // file that is opened is created, like the empty log of a new database.
+    std::map<std::string, size_t> pending;
+    std::map<std::string, uint64_t> extents;
+    std::set<std::string> written;
+    size_t buffer_size = 0;
+    for(size_t i = 0; i < ops.size(); ++i) {
+        auto &op = ops[i];
+        buffer_size = std::max<size_t>(buffer_size, op.bytes);
+        if(op.op == mcberepair::IoOp::kOpen) {
+            pending[op.file] = i;
+            continue;
+        }
+        auto it = pending.find(op.file);
+        bool write = (op.op != mcberepair::IoOp::kRead);
+        if(it != pending.end()) {
+            ops[it->second].write = write;
+            pending.erase(it);
+        }
+        if(op.op == mcberepair::IoOp::kRename) {
+            // the new name holds whatever the replay wrote to the old one
+            if(written.count(op.file) != 0 || extents.count(op.file) == 0) {
+                written.insert(op.new_file);
+            }
+        } else if(write) {
+            // a file appended to before anything writes it already held
+            // the bytes before the first write
+            if(op.op == mcberepair::IoOp::kWrite && op.offset > 0 &&
+               written.count(op.file) == 0) {
+                auto &extent = extents[op.file];
+                extent = std::max(extent, op.offset);
+            }
+            written.insert(op.file);
+        } else if(written.count(op.file) == 0) {
+            auto &extent = extents[op.file];
+            extent = std::max(extent, op.offset + op.bytes);
+        }
+    }
+    for(auto &&[name, i] : pending) {
+        ops[i].write = (extents.count(name) == 0);
+    }
+
+    // each database directory of the trace gets its own scratch directory
+    leveldb::Env *env = leveldb::Env::Default();
+    env->CreateDir(dir);
+    for(auto &&op : ops) {
+        for(auto *name : {&op.file, &op.new_file}) {
+            auto pos = name->rfind('/');
+            if(pos != std::string::npos) {
+                env->CreateDir(dir + "/" + name->substr(0, pos));
+            }
+        }
+    }
+    std::string buffer(buffer_size, '\0');
+    for(auto &&[name, size] : extents) {
+        leveldb::WritableFile *pfile = nullptr;
+        leveldb::Status status = env->NewWritableFile(dir + "/" + name, &pfile);
+        std::unique_ptr<leveldb::WritableFile> file{pfile};
+        for(uint64_t done = 0; status.ok() && done < size;) {
+            size_t n = std::min<uint64_t>(size - done, buffer.size());
+            status = file->Append({buffer.data(), n});
+            done += n;
+        }
+        if(status.ok()) {
+            status = file->Close();
+        }
+        if(!status.ok()) {
+            fprintf(stderr, "ERROR: Preparing '%s' failed: %s\n", name.c_str(),
+                    status.ToString().c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Replay every operation in order through a tracing Env, so the summary
+    // can be compared with the one printed when the trace was recorded.
+    mcberepair::TracingEnv tracer{env};
+    std::map<std::string, std::unique_ptr<leveldb::RandomAccessFile>> readers;
+    std::map<std::string, std::unique_ptr<leveldb::WritableFile>> writers;
+    auto begin = std::chrono::steady_clock::now();
+    for(auto &&op : ops) {
+        std::string path = dir + "/" + op.file;
+        leveldb::Status status;
+        leveldb::Slice result;
+        switch(op.op) {
+            case mcberepair::IoOp::kOpen:
+                if(op.write) {
+                    leveldb::WritableFile *pfile = nullptr;
+                    status = extents.count(op.file) != 0
+                                 ? tracer.NewAppendableFile(path, &pfile)
+                                 : tracer.NewWritableFile(path, &pfile);
+                    writers[op.file].reset(pfile);
+                } else {
+                    leveldb::RandomAccessFile *pfile = nullptr;
+                    status = tracer.NewRandomAccessFile(path, &pfile);
+                    readers[op.file].reset(pfile);
+                }
+                break;
+            case mcberepair::IoOp::kRead:
+                if(readers[op.file]) {
+                    status = readers[op.file]->Read(op.offset, op.bytes,
+                                                    &result, buffer.data());
+                }
+                break;
+            case mcberepair::IoOp::kWrite:
+                if(writers[op.file]) {
+                    status = writers[op.file]->Append({buffer.data(), op.bytes});
+                }
+                break;
+            case mcberepair::IoOp::kSync:
+                if(writers[op.file]) {
+                    status = writers[op.file]->Sync();
+                }
+                break;
+            case mcberepair::IoOp::kRename:
+                status = tracer.RenameFile(path, dir + "/" + op.new_file);
+                break;
+            default:
+                break;  // LCOV_EXCL_LINE
+        }
+        if(!status.ok()) {
+            fprintf(stderr, "ERROR: Replaying %s of '%s' failed: %s\n",
+                    mcberepair::kIoOpNames[static_cast<int>(op.op)],
+                    op.file.c_str(), status.ToString().c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    for(auto &&[name, file] : writers) {
+        if(file) {
+            file->Close();
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    printf("Replayed %zu operations in %.3f ms.\n", ops.size(),
+           std::chrono::duration<double, std::milli>(end - begin).count());
+    tracer.io_stats().Report(stdout);
+    return EXIT_SUCCESS;
+}
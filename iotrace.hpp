@@ -0,0 +1,400 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+#ifndef MCBEREPAIR_IOTRACE_HPP
+#define MCBEREPAIR_IOTRACE_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "leveldb/env.h"
+
+namespace mcberepair {
+
+// I/O is grouped by the kind of file leveldb uses it for.
+enum class FileType { kTable, kLog, kManifest, kOther, kCount };
+enum class IoOp { kOpen, kRead, kWrite, kSync, kRename, kCount };
+
+constexpr const char* kFileTypeNames[] = {"table", "log", "manifest", "other"};
+constexpr const char* kIoOpNames[] = {"open", "read", "write", "sync",
+                                      "rename"};
+
+inline FileType classify_file(std::string_view name) {
+    auto pos = name.find_last_of("/\\");
+    if(pos != std::string_view::npos) {
+        name.remove_prefix(pos + 1);
+    }
+    auto ends_with = [&](std::string_view suffix) {
+        return name.size() >= suffix.size() &&
+               name.substr(name.size() - suffix.size()) == suffix;
+    };
+    if(ends_with(".ldb") || ends_with(".sst")) {
+        return FileType::kTable;
+    }
+    if(ends_with(".log")) {
+        return FileType::kLog;
+    }
+    if(name.substr(0, 9) == "MANIFEST-") {
+        return FileType::kManifest;
+    }
+    return FileType::kOther;
+}
+
+// Counts, byte totals, and a latency histogram for one kind of operation.
+// Bucket i holds latencies in [2^(i-1), 2^i) microseconds; bucket 0 holds
+// latencies under one microsecond.
+class IoCounter {
+   public:
+    static constexpr int kBuckets = 32;
+
+    void Add(uint64_t bytes, uint64_t micros) {
+        count_.fetch_add(1, std::memory_order_relaxed);
+        bytes_.fetch_add(bytes, std::memory_order_relaxed);
+        micros_.fetch_add(micros, std::memory_order_relaxed);
+        int b = 0;
+        while(micros != 0 && b < kBuckets - 1) {
+            micros >>= 1;
+            b += 1;
+        }
+        buckets_[b].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const { return count_.load(); }
+    uint64_t bytes() const { return bytes_.load(); }
+    uint64_t micros() const { return micros_.load(); }
+    uint64_t bucket(int b) const { return buckets_[b].load(); }
+
+    // An upper bound on the latency below which a fraction `q` of the
+    // operations completed.
+    uint64_t Percentile(double q) const {
+        uint64_t total = count();
+        uint64_t seen = 0;
+        for(int b = 0; b < kBuckets; ++b) {
+            seen += bucket(b);
+            if(total > 0 && seen >= q * total) {
+                return uint64_t{1} << b;
+            }
+        }
+        return 0;
+    }
+
+   protected:
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> bytes_{0};
+    std::atomic<uint64_t> micros_{0};
+    std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+};
+
+// Counters for every file type and operation.
+class IoStats {
+   public:
+    IoCounter& operator()(FileType type, IoOp op) {
+        return counters_[static_cast<int>(type)][static_cast<int>(op)];
+    }
+    const IoCounter& operator()(FileType type, IoOp op) const {
+        return counters_[static_cast<int>(type)][static_cast<int>(op)];
+    }
+
+    void Report(FILE* out) const {
+        fprintf(out, "I/O summary:\n");
+        fprintf(out, "  %-9s %-6s %10s %14s %12s %8s %8s\n", "file", "op",
+                "count", "bytes", "total (ms)", "p50 (us)", "p99 (us)");
+        for(int t = 0; t < kNumTypes; ++t) {
+            for(int o = 0; o < kNumOps; ++o) {
+                auto& c = counters_[t][o];
+                if(c.count() == 0) {
+                    continue;
+                }
+                fprintf(out, "  %-9s %-6s %10llu %14llu %12.3f %8llu %8llu\n",
+                        kFileTypeNames[t], kIoOpNames[o],
+                        static_cast<unsigned long long>(c.count()),
+                        static_cast<unsigned long long>(c.bytes()),
+                        c.micros() / 1000.0,
+                        static_cast<unsigned long long>(c.Percentile(0.5)),
+                        static_cast<unsigned long long>(c.Percentile(0.99)));
+            }
+        }
+        fprintf(out, "Latency histograms (us, upper bound: count):\n");
+        for(int t = 0; t < kNumTypes; ++t) {
+            for(int o = 0; o < kNumOps; ++o) {
+                auto& c = counters_[t][o];
+                if(c.count() == 0) {
+                    continue;
+                }
+                fprintf(out, "  %s %s:", kFileTypeNames[t], kIoOpNames[o]);
+                for(int b = 0; b < IoCounter::kBuckets; ++b) {
+                    if(c.bucket(b) != 0) {
+                        fprintf(out, " %llu:%llu", 1ULL << b,
+                                static_cast<unsigned long long>(c.bucket(b)));
+                    }
+                }
+                fprintf(out, "\n");
+            }
+        }
+    }
+
+   protected:
+    static constexpr int kNumTypes = static_cast<int>(FileType::kCount);
+    static constexpr int kNumOps = static_cast<int>(IoOp::kCount);
+
+    IoCounter counters_[kNumTypes][kNumOps];
+};
+
+// An Env that measures every file operation leveldb makes and can log them
+// to a trace file for replay. Trace lines are
+//
+//   <start_us> <op> <file> <offset> <bytes> <latency_us>
+//
+// where <file> is `<dir>/<name>`: the number of the file's directory, in the
+// order the directories were first used, and the file name. A command that
+// opens two databases, each with its own CURRENT and numbered files, thus
+// keeps them apart without the trace holding any paths. Renames end with the
+// new name of the file.
+class TracingEnv : public leveldb::EnvWrapper {
+   public:
+    explicit TracingEnv(leveldb::Env* target)
+        : leveldb::EnvWrapper{target},
+          start_{std::chrono::steady_clock::now()} {}
+
+    ~TracingEnv() override {
+        if(trace_ != nullptr) {
+            fclose(trace_);
+        }
+    }
+
+    // Log operations to `path`. Returns false if the file cannot be opened.
+    bool OpenTrace(const char* path) {
+        trace_ = fopen(path, "w");
+        return trace_ != nullptr;
+    }
+
+    const IoStats& io_stats() const { return stats_; }
+
+    leveldb::Status NewSequentialFile(const std::string& f,
+                                      leveldb::SequentialFile** r) override {
+        auto begin = Now();
+        leveldb::Status s = target()->NewSequentialFile(f, r);
+        Record(f, IoOp::kOpen, 0, 0, begin);
+        if(s.ok()) {
+            *r = new SequentialFile{this, f, *r};
+        }
+        return s;
+    }
+
+    leveldb::Status NewRandomAccessFile(
+        const std::string& f, leveldb::RandomAccessFile** r) override {
+        auto begin = Now();
+        leveldb::Status s = target()->NewRandomAccessFile(f, r);
+        Record(f, IoOp::kOpen, 0, 0, begin);
+        if(s.ok()) {
+            *r = new RandomAccessFile{this, f, *r};
+        }
+        return s;
+    }
+
+    leveldb::Status NewWritableFile(const std::string& f,
+                                    leveldb::WritableFile** r) override {
+        auto begin = Now();
+        leveldb::Status s = target()->NewWritableFile(f, r);
+        Record(f, IoOp::kOpen, 0, 0, begin);
+        if(s.ok()) {
+            *r = new WritableFile{this, f, *r, 0};
+        }
+        return s;
+    }
+
+    leveldb::Status NewAppendableFile(const std::string& f,
+                                      leveldb::WritableFile** r) override {
+        // appends continue at the end of whatever the file already holds
+        uint64_t size = 0;
+        if(!target()->GetFileSize(f, &size).ok()) {
+            size = 0;
+        }
+        auto begin = Now();
+        leveldb::Status s = target()->NewAppendableFile(f, r);
+        Record(f, IoOp::kOpen, 0, 0, begin);
+        if(s.ok()) {
+            *r = new WritableFile{this, f, *r, size};
+        }
+        return s;
+    }
+
+    leveldb::Status RenameFile(const std::string& src,
+                               const std::string& target) override {
+        auto begin = Now();
+        leveldb::Status s = this->target()->RenameFile(src, target);
+        Record(src, IoOp::kRename, 0, 0, begin, target);
+        return s;
+    }
+
+   protected:
+    using clock_type = std::chrono::steady_clock;
+
+    clock_type::time_point Now() const { return clock_type::now(); }
+
+    void Record(const std::string& file, IoOp op, uint64_t offset,
+                uint64_t bytes, clock_type::time_point begin,
+                const std::string& new_file = {}) {
+        auto end = Now();
+        auto micros = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(end - begin)
+                .count());
+        stats_(classify_file(file), op).Add(bytes, micros);
+        if(trace_ == nullptr) {
+            return;
+        }
+        auto at = std::chrono::duration_cast<std::chrono::microseconds>(
+                      begin - start_)
+                      .count();
+        std::lock_guard<std::mutex> lock{mutex_};
+        fprintf(trace_, "%lld %s %s %llu %llu %llu", static_cast<long long>(at),
+                kIoOpNames[static_cast<int>(op)], TraceName(file).c_str(),
+                static_cast<unsigned long long>(offset),
+                static_cast<unsigned long long>(bytes),
+                static_cast<unsigned long long>(micros));
+        if(!new_file.empty()) {
+            fprintf(trace_, " %s", TraceName(new_file).c_str());
+        }
+        fprintf(trace_, "\n");
+    }
+
+    // The name of a file in the trace. Must be called with mutex_ held.
+    std::string TraceName(const std::string& path) {
+        auto pos = path.find_last_of("/\\");
+        std::string dir =
+            pos == std::string::npos ? std::string{} : path.substr(0, pos);
+        auto it = dirs_.emplace(std::move(dir), dirs_.size()).first;
+        return std::to_string(it->second) + "/" +
+               path.substr(pos == std::string::npos ? 0 : pos + 1);
+    }
+
+    class SequentialFile : public leveldb::SequentialFile {
+       public:
+        SequentialFile(TracingEnv* env, std::string name,
+                       leveldb::SequentialFile* file)
+            : env_{env}, name_{std::move(name)}, file_{file} {}
+
+        leveldb::Status Read(size_t n, leveldb::Slice* result,
+                             char* scratch) override {
+            auto begin = env_->Now();
+            leveldb::Status s = file_->Read(n, result, scratch);
+            env_->Record(name_, IoOp::kRead, offset_, result->size(), begin);
+            offset_ += result->size();
+            return s;
+        }
+
+        leveldb::Status Skip(uint64_t n) override {
+            offset_ += n;
+            return file_->Skip(n);
+        }
+
+       protected:
+        TracingEnv* env_;
+        std::string name_;
+        std::unique_ptr<leveldb::SequentialFile> file_;
+        uint64_t offset_{0};
+    };
+
+    class RandomAccessFile : public leveldb::RandomAccessFile {
+       public:
+        RandomAccessFile(TracingEnv* env, std::string name,
+                         leveldb::RandomAccessFile* file)
+            : env_{env}, name_{std::move(name)}, file_{file} {}
+
+        leveldb::Status Read(uint64_t offset, size_t n, leveldb::Slice* result,
+                             char* scratch) const override {
+            auto begin = env_->Now();
+            leveldb::Status s = file_->Read(offset, n, result, scratch);
+            env_->Record(name_, IoOp::kRead, offset, result->size(), begin);
+            return s;
+        }
+
+       protected:
+        TracingEnv* env_;
+        std::string name_;
+        std::unique_ptr<leveldb::RandomAccessFile> file_;
+    };
+
+    class WritableFile : public leveldb::WritableFile {
+       public:
+        WritableFile(TracingEnv* env, std::string name,
+                     leveldb::WritableFile* file, uint64_t offset)
+            : env_{env}, name_{std::move(name)}, file_{file}, offset_{offset} {}
+
+        leveldb::Status Append(const leveldb::Slice& data) override {
+            auto begin = env_->Now();
+            leveldb::Status s = file_->Append(data);
+            env_->Record(name_, IoOp::kWrite, offset_, data.size(), begin);
+            offset_ += data.size();
+            return s;
+        }
+
+        leveldb::Status Close() override { return file_->Close(); }
+
+        leveldb::Status Flush() override { return file_->Flush(); }
+
+        leveldb::Status Sync() override {
+            auto begin = env_->Now();
+            leveldb::Status s = file_->Sync();
+            env_->Record(name_, IoOp::kSync, offset_, 0, begin);
+            return s;
+        }
+
+       protected:
+        TracingEnv* env_;
+        std::string name_;
+        std::unique_ptr<leveldb::WritableFile> file_;
+        uint64_t offset_;
+    };
+
+    clock_type::time_point start_;
+    IoStats stats_;
+    std::mutex mutex_;
+    FILE* trace_{nullptr};
+    // the number of each directory named in the trace
+    std::map<std::string, size_t> dirs_;
+};
+
+// The process-wide tracing Env, or nullptr when I/O is not being traced.
+inline std::unique_ptr<TracingEnv>& io_tracer() {
+    static std::unique_ptr<TracingEnv> tracer;
+    return tracer;
+}
+
+// The Env that databases should use.
+inline leveldb::Env* db_env() {
+    if(io_tracer()) {
+        return io_tracer().get();
+    }
+    return leveldb::Env::Default();
+}
+
+}  // namespace mcberepair
+
+#endif  // MCBEREPAIR_IOTRACE_HPP
@@ -0,0 +1,343 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+
+// Microbenchmark for the key codec. It compares the buffer-based codec in
+// mcbekey.hpp to the stringstream codec it replaced and verifies that both
+// produce identical output on a set of synthetic keys.
+//
+//   mcberepair_keybench [num_keys] [num_rounds]
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "mcbekey.hpp"
+
+namespace {
+
+// The original implementation, kept as a reference. The per-byte percent
+// codec is copied too, so the baseline does not pick up the vectorized one.
+namespace legacy {
+using mcberepair::chunk_t;
+
+std::string percent_encode(std::string_view str) {
+    auto is_notgraph = [](unsigned char c) {
+        return std::isgraph(c) == 0 || c == '%' || c == '@';
+    };
+
+    // optimize for situation in which no encoding is needed
+    auto it = std::find_if(str.begin(), str.end(), is_notgraph);
+    if(it == str.end()) {
+        return std::string{str};
+    }
+    char buffer[8];
+    // setup return value
+    std::string ret;
+    ret.reserve(str.size());
+    auto bit = str.begin();
+    do {
+        // Append sequences and encoded character
+        unsigned char c = *it;
+        std::snprintf(buffer, 8, "%%%02hhX", c);
+        ret.append(bit, it);
+        ret.append(buffer);
+        // Find next character to encode
+        bit = ++it;
+        it = std::find_if(it, str.end(), is_notgraph);
+    } while(it != str.end());
+    // Append tail
+    ret.append(bit, str.end());
+
+    return ret;
+}
+
+int hex_decode(char x) {
+    if('0' <= x && x <= '9') {
+        return x - '0';
+    }
+    if('A' <= x && x <= 'F') {
+        return x - 'A' + 10;
+    }
+    if('a' <= x && x <= 'f') {
+        return x - 'a' + 10;
+    }
+    return -1;
+}
+
+bool percent_decode_core(std::string *str, size_t start) {
+    assert(str != nullptr);
+    assert(start < str->size());
+    assert((*str)[start] == '%');
+    auto p = str->begin() + start;
+    auto q = p;
+    do {
+        assert(*p == '%');
+        if(++p == str->end()) {
+            return false;
+        }
+        int a = hex_decode(*p);
+        if(++p == str->end()) {
+            return false;
+        }
+        int b = hex_decode(*p);
+        if(a == -1 || b == -1) {
+            return false;
+        }
+        *q++ = a * 16 + b;
+        for(++p; p != str->end(); ++p) {
+            if(*p == '%') {
+                break;
+            }
+            *q++ = *p;
+        }
+    } while(p != str->end());
+    str->erase(q, str->end());
+    return true;
+}
+
+bool percent_decode(std::string *str) {
+    assert(str != nullptr);
+    auto pos = str->find('%');
+    if(pos != std::string::npos) {
+        return percent_decode_core(str, pos);
+    }
+    return true;
+}
+
+
+std::string encode_key(std::string_view key) {
+    if(!mcberepair::is_chunk_key(key)) {
+        return percent_encode(key);
+    }
+    auto chunk = mcberepair::parse_chunk_key(key);
+    std::stringstream str;
+    str << "@" << chunk.x << ":" << chunk.z << ":" << chunk.dimension << ":"
+        << static_cast<unsigned int>(chunk.tag);
+
+    if(chunk.subtag != -1) {
+        str << "-" << static_cast<unsigned int>(chunk.subtag);
+    }
+
+    return str.str();
+}
+
+bool decode_key(std::string_view key, std::string *out) {
+    if(key.empty()) {
+        out->assign(key);
+        return true;
+    }
+    if(key[0] != '@') {
+        out->assign(key);
+        return percent_decode(out);
+    }
+    std::string buf{key.substr(1)};
+    std::stringstream str(buf);
+    chunk_t chunk;
+    if(!(str >> chunk.x)) {
+        return false;
+    }
+    if(str.peek() == ':') {
+        str.ignore();
+    }
+    if(!(str >> chunk.z)) {
+        return false;
+    }
+    if(str.peek() == ':') {
+        str.ignore();
+    }
+    if(!(str >> chunk.dimension)) {
+        return false;
+    }
+    unsigned int tag;
+    if(str.peek() == ':') {
+        str.ignore();
+    }
+    if(!(str >> tag)) {
+        return false;
+    }
+    chunk.tag = tag;
+    chunk.subtag = -1;
+    if(str.peek() == '-') {
+        str.ignore();
+        if(!(str >> tag)) {
+            return false;
+        }
+        chunk.subtag = tag;
+    }
+    if(!str.eof()) {
+        return false;
+    }
+    mcberepair::create_chunk_key(chunk, out);
+    return true;
+}
+}  // namespace legacy
+
+// Build keys that resemble a real world: mostly chunk keys in several
+// dimensions, plus some global keys with bytes that need escaping.
+std::vector<std::string> make_keys(size_t n) {
+    std::mt19937 rng{1234};
+    std::uniform_int_distribution<int> coord{-2000, 2000};
+    std::uniform_int_distribution<int> pick{0, 99};
+    const char tags[] = {44, 45, 47, 49, 50, 51, 54, 58, 59, 118};
+    std::vector<std::string> keys;
+    keys.reserve(n);
+    for(size_t i = 0; i < n; ++i) {
+        int p = pick(rng);
+        if(p < 5) {
+            std::string key = "actorprefix";
+            for(int j = 0; j < 8; ++j) {
+                key += static_cast<char>(rng());
+            }
+            keys.push_back(std::move(key));
+            continue;
+        }
+        if(p < 8) {
+            keys.push_back("map_-" + std::to_string(rng()));
+            continue;
+        }
+        mcberepair::chunk_t chunk;
+        chunk.x = coord(rng);
+        chunk.z = coord(rng);
+        chunk.dimension = p % 10 == 0 ? 1 : (p % 10 == 1 ? 2 : 0);
+        chunk.tag = tags[rng() % sizeof(tags)];
+        chunk.subtag = chunk.tag == 47 ? static_cast<char>(rng() % 24 - 4)
+                                       : -1;
+        std::string key;
+        mcberepair::create_chunk_key(chunk, &key);
+        keys.push_back(std::move(key));
+    }
+    return keys;
+}
+
+template <typename F>
+double time_ns_per_key(size_t n, int rounds, F &&func) {
+    auto start = std::chrono::steady_clock::now();
+    for(int r = 0; r < rounds; ++r) {
+        func();
+    }
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (static_cast<double>(n) * rounds);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 5;
+    if(n == 0 || rounds <= 0) {
+        fprintf(stderr, "usage: %s [num_keys] [num_rounds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    auto keys = make_keys(n);
+    std::vector<std::string_view> views(keys.begin(), keys.end());
+
+    // verify that the codecs agree before timing them
+    std::vector<std::string> encoded(n);
+    std::vector<std::string_view> encoded_views(n);
+    std::vector<std::string_view> decoded_views(n);
+    std::string encode_buffer, decode_buffer, out;
+    mcberepair::encode_keys(views.data(), n, &encode_buffer,
+                            encoded_views.data());
+    for(size_t i = 0; i < n; ++i) {
+        encoded[i] = legacy::encode_key(keys[i]);
+        if(encoded[i] != mcberepair::encode_key(keys[i]) ||
+           encoded[i] != encoded_views[i]) {
+            fprintf(stderr, "ERROR: Encodings of key %zu differ.\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+    size_t bad = mcberepair::decode_keys(encoded_views.data(), n,
+                                         &decode_buffer, decoded_views.data());
+    if(bad != 0) {
+        fprintf(stderr, "ERROR: %zu keys failed to decode.\n", bad);
+        return EXIT_FAILURE;
+    }
+    for(size_t i = 0; i < n; ++i) {
+        if(!legacy::decode_key(encoded[i], &out) || out != keys[i] ||
+           decoded_views[i] != keys[i]) {
+            fprintf(stderr, "ERROR: Decodings of key %zu differ.\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // prevent the compiler from discarding results
+    size_t sink = 0;
+    double old_encode = time_ns_per_key(n, rounds, [&]() {
+        for(auto &&key : views) {
+            sink += legacy::encode_key(key).size();
+        }
+    });
+    double new_encode = time_ns_per_key(n, rounds, [&]() {
+        char buffer[mcberepair::encode_key_max_size(32)];
+        for(auto &&key : views) {
+            if(key.size() <= 32) {
+                sink += mcberepair::encode_key(key, buffer,
+                                               buffer + sizeof(buffer)) -
+                        buffer;
+            } else {
+                sink += mcberepair::encode_key(key).size();
+            }
+        }
+    });
+    double batch_encode = time_ns_per_key(n, rounds, [&]() {
+        mcberepair::encode_keys(views.data(), n, &encode_buffer,
+                                encoded_views.data());
+        sink += encode_buffer.size();
+    });
+    double old_decode = time_ns_per_key(n, rounds, [&]() {
+        for(auto &&key : encoded) {
+            legacy::decode_key(key, &out);
+            sink += out.size();
+        }
+    });
+    double new_decode = time_ns_per_key(n, rounds, [&]() {
+        for(auto &&key : encoded) {
+            mcberepair::decode_key(key, &out);
+            sink += out.size();
+        }
+    });
+    double batch_decode = time_ns_per_key(n, rounds, [&]() {
+        mcberepair::decode_keys(encoded_views.data(), n, &decode_buffer,
+                                decoded_views.data());
+        sink += decode_buffer.size();
+    });
+
+    printf("keys\t%zu\n", n);
+    printf("codec\tencode_ns\tdecode_ns\n");
+    printf("stringstream\t%.1f\t%.1f\n", old_encode, old_decode);
+    printf("buffer\t%.1f\t%.1f\n", new_encode, new_decode);
+    printf("batch\t%.1f\t%.1f\n", batch_encode, batch_decode);
+    printf("speedup\t%.1fx\t%.1fx\n", old_encode / batch_encode,
+           old_decode / batch_decode);
+    printf("checksum\t%zu\n", sink);
+
+    return EXIT_SUCCESS;
+}
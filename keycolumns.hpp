@@ -0,0 +1,290 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+#ifndef MCBEREPAIR_KEYCOLUMNS_HPP
+#define MCBEREPAIR_KEYCOLUMNS_HPP
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "mcbekey.hpp"
+
+// Columnar key listing format
+//
+// A file starts with a 16-byte header: the magic "MCBEKEYC", a uint32
+// version, and the uint32 maximum number of rows per group. Row groups
+// follow, and a group with zero rows ends the file.
+//
+// Each row group begins with a 16-byte header holding the uint32 row count n,
+// the uint32 size of the key blob, the uint32 size of the group body, and a
+// reserved uint32. The body holds these columns, each starting on an 8-byte
+// boundary relative to the start of the file:
+//
+//   int32  x[n], z[n], dimension[n]
+//   uint8  tag[n]        0 for keys that are not chunk keys
+//   uint8  subtag[n]     255 when a chunk key has no subtag
+//   uint32 value_size[n]
+//   uint32 key_offset[n + 1]  offsets of each key in the blob
+//   bytes  blob
+//
+// All integers are little-endian, like the chunk keys themselves. The
+// reader scans the columns in place, so it only reads files on hosts that
+// are little-endian too.
+
+namespace mcberepair {
+
+constexpr char kKeyColumnsMagic[8] = {'M', 'C', 'B', 'E', 'K', 'E', 'Y', 'C'};
+constexpr uint32_t kKeyColumnsVersion = 1;
+constexpr uint32_t kKeyColumnsRowsPerGroup = 65536;
+
+namespace detail {
+inline size_t pad8(size_t n) { return (n + 7) & ~size_t{7}; }
+
+// Append the little-endian bytes of each value, padded to 8 bytes.
+template <typename T>
+void append_column(std::string *out, const std::vector<T> &col) {
+    size_t bytes = col.size() * sizeof(T);
+    size_t start = out->size();
+    out->resize(start + pad8(bytes), '\0');
+    char *p = &(*out)[start];
+    for(T v : col) {
+        auto u = static_cast<std::make_unsigned_t<T>>(v);
+        for(size_t b = 0; b < sizeof(T); ++b) {
+            *p++ = static_cast<char>(u >> (8 * b));
+        }
+    }
+}
+
+inline void append_u32(std::string *out, uint32_t u) {
+    char buffer[4] = {static_cast<char>(u), static_cast<char>(u >> 8),
+                      static_cast<char>(u >> 16), static_cast<char>(u >> 24)};
+    out->append(buffer, 4);
+}
+
+inline uint32_t load_u32(const char *p) {
+    auto q = reinterpret_cast<const unsigned char *>(p);
+    return uint32_t{q[0]} | uint32_t{q[1]} << 8 | uint32_t{q[2]} << 16 |
+           uint32_t{q[3]} << 24;
+}
+
+inline bool host_is_little_endian() {
+    const uint16_t one = 1;
+    unsigned char first;
+    std::memcpy(&first, &one, 1);
+    return first == 1;
+}
+}  // namespace detail
+
+inline void write_key_columns_header(std::string *out) {
+    out->append(kKeyColumnsMagic, 8);
+    detail::append_u32(out, kKeyColumnsVersion);
+    detail::append_u32(out, kKeyColumnsRowsPerGroup);
+}
+
+// The group that ends a file.
+inline void write_key_columns_footer(std::string *out) {
+    out->append(16, '\0');
+}
+
+// Collects keys into a row group and encodes it.
+class KeyColumnWriter {
+   public:
+    void add(std::string_view key, size_t value_size) {
+        if(is_chunk_key(key)) {
+            auto chunk = parse_chunk_key(key);
+            x_.push_back(chunk.x);
+            z_.push_back(chunk.z);
+            dimension_.push_back(chunk.dimension);
+            tag_.push_back(static_cast<uint8_t>(chunk.tag));
+            subtag_.push_back(static_cast<uint8_t>(chunk.subtag));
+        } else {
+            x_.push_back(0);
+            z_.push_back(0);
+            dimension_.push_back(0);
+            tag_.push_back(0);
+            subtag_.push_back(0xFF);
+        }
+        value_size_.push_back(static_cast<uint32_t>(value_size));
+        if(key_offset_.empty()) {
+            key_offset_.push_back(0);
+        }
+        blob_.append(key);
+        key_offset_.push_back(static_cast<uint32_t>(blob_.size()));
+    }
+
+    size_t size() const { return x_.size(); }
+
+    bool full() const { return size() >= kKeyColumnsRowsPerGroup; }
+
+    // Append the encoded row group to `out` and start a new group.
+    void flush(std::string *out) {
+        if(size() == 0) {
+            return;
+        }
+        size_t n = size();
+        size_t body = 3 * detail::pad8(4 * n) + 2 * detail::pad8(n) +
+                      detail::pad8(4 * n) + detail::pad8(4 * (n + 1)) +
+                      detail::pad8(blob_.size());
+        out->reserve(out->size() + 16 + body);
+        detail::append_u32(out, static_cast<uint32_t>(n));
+        detail::append_u32(out, static_cast<uint32_t>(blob_.size()));
+        detail::append_u32(out, static_cast<uint32_t>(body));
+        detail::append_u32(out, 0);
+        detail::append_column(out, x_);
+        detail::append_column(out, z_);
+        detail::append_column(out, dimension_);
+        detail::append_column(out, tag_);
+        detail::append_column(out, subtag_);
+        detail::append_column(out, value_size_);
+        detail::append_column(out, key_offset_);
+        out->append(blob_);
+        out->append(detail::pad8(blob_.size()) - blob_.size(), '\0');
+
+        x_.clear();
+        z_.clear();
+        dimension_.clear();
+        tag_.clear();
+        subtag_.clear();
+        value_size_.clear();
+        key_offset_.clear();
+        blob_.clear();
+    }
+
+   protected:
+    std::vector<int32_t> x_;
+    std::vector<int32_t> z_;
+    std::vector<int32_t> dimension_;
+    std::vector<uint8_t> tag_;
+    std::vector<uint8_t> subtag_;
+    std::vector<uint32_t> value_size_;
+    std::vector<uint32_t> key_offset_;
+    std::string blob_;
+};
+
+// A view of one row group. The columns point into the reader's buffer.
+struct key_row_group_t {
+    uint32_t size;
+    const int32_t *x;
+    const int32_t *z;
+    const int32_t *dimension;
+    const uint8_t *tag;
+    const uint8_t *subtag;
+    const uint32_t *value_size;
+    const uint32_t *key_offset;
+    const char *blob;
+
+    std::string_view key(size_t i) const {
+        return {blob + key_offset[i], key_offset[i + 1] - key_offset[i]};
+    }
+};
+
+// Reads row groups from a complete columnar file held in memory. The buffer
+// must stay alive while groups are in use and be 8-byte aligned. The
+// columns are used in place, so a big-endian host cannot read them.
+class KeyColumnReader {
+   public:
+    explicit KeyColumnReader(std::string_view data) : data_{data} {
+        if(!detail::host_is_little_endian() || data_.size() < 16 ||
+           std::memcmp(data_.data(), kKeyColumnsMagic,
+                       sizeof(kKeyColumnsMagic)) != 0) {
+            return;
+        }
+        uint32_t version = detail::load_u32(data_.data() + 8);
+        if(version != kKeyColumnsVersion) {
+            return;
+        }
+        pos_ = 16;
+        ok_ = true;
+    }
+
+    explicit operator bool() const { return ok_; }
+
+    // Read the next row group. Returns false at the end of the file or if
+    // the file is malformed; check done() to tell them apart.
+    bool next(key_row_group_t *group) {
+        if(!ok_ || done_) {
+            return false;
+        }
+        if(data_.size() - pos_ < 16) {
+            ok_ = false;
+            return false;
+        }
+        size_t n = detail::load_u32(data_.data() + pos_);
+        size_t blob_size = detail::load_u32(data_.data() + pos_ + 4);
+        size_t body = detail::load_u32(data_.data() + pos_ + 8);
+        pos_ += 16;
+        if(n == 0) {
+            done_ = true;
+            return false;
+        }
+        if(data_.size() - pos_ < body) {
+            ok_ = false;
+            return false;
+        }
+        const char *p = data_.data() + pos_;
+        auto take = [&](size_t bytes) {
+            const char *q = p;
+            p += detail::pad8(bytes);
+            return q;
+        };
+        group->size = static_cast<uint32_t>(n);
+        group->x = reinterpret_cast<const int32_t *>(take(4 * n));
+        group->z = reinterpret_cast<const int32_t *>(take(4 * n));
+        group->dimension = reinterpret_cast<const int32_t *>(take(4 * n));
+        group->tag = reinterpret_cast<const uint8_t *>(take(n));
+        group->subtag = reinterpret_cast<const uint8_t *>(take(n));
+        group->value_size = reinterpret_cast<const uint32_t *>(take(4 * n));
+        group->key_offset = reinterpret_cast<const uint32_t *>(take(4 * n + 4));
+        group->blob = take(blob_size);
+        if(static_cast<size_t>(p - (data_.data() + pos_)) != body ||
+           group->key_offset[n] != blob_size) {
+            ok_ = false;
+            return false;
+        }
+        // key() slices the blob by consecutive offsets, so they must be
+        // non-decreasing and stay inside the blob.
+        for(size_t i = 0; i < n; ++i) {
+            if(group->key_offset[i] > group->key_offset[i + 1]) {
+                ok_ = false;
+                return false;
+            }
+        }
+        pos_ += body;
+        return true;
+    }
+
+    bool done() const { return done_; }
+
+   protected:
+    std::string_view data_;
+    size_t pos_{0};
+    bool ok_{false};
+    bool done_{false};
+};
+
+}  // namespace mcberepair
+
+#endif  // MCBEREPAIR_KEYCOLUMNS_HPP
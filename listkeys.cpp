@@ -21,21 +21,201 @@
 */
 
 #include <cassert>
+#include <charconv>
+#include <condition_variable>
 #include <cstdio>
+#include <deque>
+#include <fstream>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "args.hpp"
 #include "db.hpp"
+#include "keycolumns.hpp"
 #include "mcbekey.hpp"
+#include "parallel.hpp"
+#include "seekplan.hpp"
+#include "shard.hpp"
+#include "slurp.hpp"
+
+namespace {
+
+// flush output in pieces of about this size
+constexpr size_t kChunkSize = 1024 * 1024;
+
+// Append one line of listkeys output for a key.
+void append_row(std::string *out, const leveldb::Slice &key,
+                size_t value_size) {
+    std::string_view skey{key.data(), key.size()};
+    // print an encoded key
+    mcberepair::append_encoded_key(skey, out);
+
+    char buffer[96];
+    char *p = buffer;
+    char *end = buffer + sizeof(buffer);
+    *p++ = '\t';
+    p = std::to_chars(p, end, value_size).ptr;
+
+    // Identify keys that might represent chunks
+    if(mcberepair::is_chunk_key(skey)) {
+        // read chunk key
+        auto chunk = mcberepair::parse_chunk_key(skey);
+        // print chunk information
+        for(int v : {chunk.x, chunk.z, chunk.dimension, int{chunk.tag}}) {
+            *p++ = '\t';
+            p = std::to_chars(p, end, v).ptr;
+        }
+        *p++ = '\t';
+        if(chunk.subtag != -1) {
+            p = std::to_chars(p, end, int{chunk.subtag}).ptr;
+        }
+    } else {
+        for(int i = 0; i < 5; ++i) {
+            *p++ = '\t';
+        }
+    }
+    *p++ = '\n';
+    out->append(buffer, p);
+}
+
+// Formats rows as tab-separated text.
+class TsvFormatter {
+   public:
+    void add(const leveldb::Slice &key, size_t value_size) {
+        append_row(&buffer_, key, value_size);
+    }
+    bool full() const { return buffer_.size() >= kChunkSize; }
+    std::string take() {
+        std::string ret = std::move(buffer_);
+        buffer_ = std::string{};
+        buffer_.reserve(kChunkSize + 256);
+        return ret;
+    }
+
+   protected:
+    std::string buffer_;
+};
+
+// Formats rows as self-contained columnar row groups.
+class ColumnarFormatter {
+   public:
+    void add(const leveldb::Slice &key, size_t value_size) {
+        writer_.add({key.data(), key.size()}, value_size);
+    }
+    bool full() const { return writer_.full(); }
+    std::string take() {
+        std::string ret;
+        writer_.flush(&ret);
+        return ret;
+    }
+
+   protected:
+    mcberepair::KeyColumnWriter writer_;
+};
+
+// List the keys in a range, passing output to emit() in large chunks.
+template <typename Formatter, typename F>
+leveldb::Status list_range(leveldb::DB *db, const mcberepair::key_range_t &range,
+                           F &&emit) {
+    // create a reusable memory space for decompression so it allocates less
+    leveldb::ReadOptions readOptions;
+    leveldb::DecompressAllocator decompress_allocator;
+    readOptions.decompress_allocator = &decompress_allocator;
+    readOptions.verify_checksums = true;
+    readOptions.fill_cache = false;
+
+    // create an iterator for the database
+    auto it = std::unique_ptr<leveldb::Iterator>{db->NewIterator(readOptions)};
+
+    Formatter formatter;
+    bool empty = true;
+    uint64_t keys = 0;
+    uint64_t bytes = 0;
+    mcberepair::scan_ranges(it.get(), {range}, [&](leveldb::Iterator *iter) {
+        size_t value_size = iter->value().size();
+        formatter.add(iter->key(), value_size);
+        keys += 1;
+        bytes += iter->key().size() + value_size;
+        empty = false;
+        if(formatter.full()) {
+            emit(formatter.take());
+            empty = true;
+        }
+        return true;
+    });
+    if(!empty) {
+        emit(formatter.take());
+    }
+    mcberepair::stats().AddKeys(keys, bytes);
+    return it->status();
+}
+
+void write_chunk(const std::string &chunk) {
+    fwrite(chunk.data(), 1, chunk.size(), stdout);
+}
+
+// The output of one shard, handed from a worker to the writer.
+struct shard_output_t {
+    std::deque<std::string> chunks;
+    size_t pending = 0;
+    bool done = false;
+    leveldb::Status status;
+};
+
+}  // namespace
 
 int listkeys_main(int argc, char* argv[]) {
-    if(argc < 3 || strcmp("help", argv[1]) == 0) {
+    mcberepair::Args args{argc, argv};
+    if(args.size() < 1 || strcmp("help", argv[1]) == 0) {
         printf("Usage: %s listkeys <minecraft_world_dir> > list.tsv\n",
                argv[0]);
+        printf("\n");
+        printf("Options:\n");
+        printf(
+            "  --threads=N    Split the keyspace into shards and list them "
+            "with N threads.\n"
+            "                 Use 0 for one thread per core (default 1).\n");
+        printf(
+            "  --unordered    Write shards as they finish instead of in key "
+            "order.\n");
+        printf(
+            "  --format=F     Output format: 'tsv' (default) or 'columnar' "
+            "binary row groups.\n"
+            "                 Use '%s catkeys' to read columnar output.\n",
+            argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::string bad_option;
+    if(args.unknown({"threads", "unordered", "format"}, &bad_option)) {
+        fprintf(stderr, "ERROR: Unknown option '--%s'.\n", bad_option.c_str());
         return EXIT_FAILURE;
     }
+    unsigned int threads = 1;
+    if(!args.number("threads", &threads)) {
+        fprintf(stderr, "ERROR: Invalid value for '--threads'.\n");
+        return EXIT_FAILURE;
+    }
+    if(threads == 0) {
+        threads = mcberepair::default_threads();
+    }
+    bool unordered = args.has("unordered");
+    auto format = args.value("format", "tsv");
+    if(format != "tsv" && format != "columnar") {
+        fprintf(stderr, "ERROR: Unknown format '%.*s'.\n",
+                static_cast<int>(format.size()), format.data());
+        return EXIT_FAILURE;
+    }
+    bool columnar = (format == "columnar");
 
     // construct path for Minecraft BE database
-    std::string path = std::string(argv[2]) + "/db";
+    std::string path = std::string(args[0]) + "/db";
 
     // open the database
     mcberepair::DB db{path.c_str()};
@@ -46,41 +226,252 @@ int listkeys_main(int argc, char* argv[]) {
     }
 
     // Print header
+    if(columnar) {
+#ifdef _WIN32
+        fflush(stdout);
+        _setmode(_fileno(stdout), O_BINARY);
+#endif
+        std::string header;
+        mcberepair::write_key_columns_header(&header);
+        write_chunk(header);
+    } else {
+        printf("key\tbytes\tx\tz\tdimension\ttag\tsubtag\n");
+    }
+    auto list = [&](const mcberepair::key_range_t &range, auto &&emit) {
+        return columnar ? list_range<ColumnarFormatter>(&db(), range, emit)
+                        : list_range<TsvFormatter>(&db(), range, emit);
+    };
+
+    mcberepair::ScopedPhase scan_phase{mcberepair::Phase::kScan};
+
+    // use several shards per thread so that uneven shards balance out
+    auto shards = mcberepair::shard_keyspace(&db(), threads > 1 ? threads * 4 : 1);
+
+    leveldb::Status status;
+    if(shards.size() == 1) {
+        status = list(shards[0], write_chunk);
+    } else if(unordered) {
+        // stdio locks the stream, so each chunk is written whole
+        std::vector<leveldb::Status> statuses(shards.size());
+        mcberepair::parallel_for(shards.size(), threads, [&](size_t i) {
+            statuses[i] = list(shards[i], write_chunk);
+        });
+        for(auto &&s : statuses) {
+            if(!s.ok() && status.ok()) {
+                status = s;  // LCOV_EXCL_LINE
+            }
+        }
+    } else {
+        // Workers queue their output per shard, and this thread writes the
+        // shards in key order. A worker waits when its queue is full, so
+        // memory stays bounded while earlier shards are being written.
+        const size_t max_pending = 64 * kChunkSize;
+        std::vector<shard_output_t> outputs(shards.size());
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::condition_variable drained;
+
+        std::thread driver{[&]() {
+            mcberepair::parallel_for(shards.size(), threads, [&](size_t i) {
+                auto &out = outputs[i];
+                auto s = list(shards[i], [&](std::string &&chunk) {
+                    std::unique_lock<std::mutex> lock{mutex};
+                    drained.wait(lock,
+                                 [&]() { return out.pending < max_pending; });
+                    out.pending += chunk.size();
+                    out.chunks.push_back(std::move(chunk));
+                    ready.notify_all();
+                });
+                std::lock_guard<std::mutex> lock{mutex};
+                out.status = s;
+                out.done = true;
+                ready.notify_all();
+            });
+        }};
+
+        for(auto &&out : outputs) {
+            for(;;) {
+                std::unique_lock<std::mutex> lock{mutex};
+                ready.wait(lock,
+                           [&]() { return !out.chunks.empty() || out.done; });
+                if(out.chunks.empty()) {
+                    if(!out.status.ok() && status.ok()) {
+                        status = out.status;  // LCOV_EXCL_LINE
+                    }
+                    break;
+                }
+                std::string chunk = std::move(out.chunks.front());
+                out.chunks.pop_front();
+                out.pending -= chunk.size();
+                drained.notify_all();
+                lock.unlock();
+                write_chunk(chunk);
+            }
+        }
+        driver.join();
+    }
+
+    if(!status.ok()) {
+        // LCOV_EXCL_START
+        fprintf(stderr, "ERROR: Reading '%s' failed: %s\n", path.c_str(),
+                status.ToString().c_str());
+        return EXIT_FAILURE;
+        // LCOV_EXCL_STOP
+    }
+    if(columnar) {
+        std::string footer;
+        mcberepair::write_key_columns_footer(&footer);
+        write_chunk(footer);
+    }
+    return EXIT_SUCCESS;
+}
+
+int catkeys_main(int argc, char* argv[]) {
+    if(argc < 3 || strcmp("help", argv[1]) == 0) {
+        printf("Usage: %s catkeys <columnar_list> > list.tsv\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::ifstream in{argv[2], std::ios::binary};
+    if(!in) {
+        fprintf(stderr, "ERROR: Opening '%s' failed.\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    auto data = mcberepair::slurp_string(in);
+
+    mcberepair::KeyColumnReader reader{data};
+    if(!reader) {
+        fprintf(stderr, "ERROR: '%s' is not a columnar key list.\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    // Print the same table that listkeys prints, built from the columns
     printf("key\tbytes\tx\tz\tdimension\ttag\tsubtag\n");
+    mcberepair::key_row_group_t group;
+    std::string buffer;
+    while(reader.next(&group)) {
+        for(uint32_t i = 0; i < group.size; ++i) {
+            mcberepair::append_encoded_key(group.key(i), &buffer);
+            char row[96];
+            char* p = row;
+            char* end = row + sizeof(row);
+            *p++ = '\t';
+            p = std::to_chars(p, end, group.value_size[i]).ptr;
+            if(group.tag[i] != 0) {
+                for(int v : {group.x[i], group.z[i], group.dimension[i],
+                             int{group.tag[i]}}) {
+                    *p++ = '\t';
+                    p = std::to_chars(p, end, v).ptr;
+                }
+                *p++ = '\t';
+                if(group.subtag[i] != 0xFF) {
+                    p = std::to_chars(p, end,
+                                      int{static_cast<int8_t>(group.subtag[i])})
+                            .ptr;
+                }
+            } else {
+                for(int j = 0; j < 5; ++j) {
+                    *p++ = '\t';
+                }
+            }
+            *p++ = '\n';
+            buffer.append(row, p);
+        }
+        write_chunk(buffer);
+        buffer.clear();
+    }
+    if(!reader.done()) {
+        fprintf(stderr, "ERROR: '%s' is truncated or corrupt.\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
 
-    // create a reusable memory space for decompression so it allocates less
+int query_main(int argc, char* argv[]) {
+    mcberepair::Args args{argc, argv};
+    if(args.size() < 2 || strcmp("help", argv[1]) == 0) {
+        printf("Usage: %s query <minecraft_world_dir> <term>... > list.tsv\n",
+               argv[0]);
+        printf("\n");
+        printf(
+            "List the chunk keys whose fields match every term. A term is "
+            "a field (x, z,\n"
+            "dimension, tag, or subtag), an operator (=, !=, <, <=, >, >=), "
+            "and a value.\n"
+            "= and != take a list of values and ranges, like "
+            "'x=-50..50' or 'tag=45,47'.\n"
+            "A key without a subtag has subtag -1.\n");
+        printf("\n");
+        printf("Options:\n");
+        printf(
+            "  --explain    Describe the plan and count the keys it "
+            "skipped.\n");
+        return EXIT_FAILURE;
+    }
+    std::string bad_option;
+    if(args.unknown({"explain"}, &bad_option)) {
+        fprintf(stderr, "ERROR: Unknown option '--%s'.\n", bad_option.c_str());
+        return EXIT_FAILURE;
+    }
+    mcberepair::chunk_predicate_t predicate;
+    for(size_t i = 1; i < args.size(); ++i) {
+        if(!mcberepair::add_chunk_term(args[i], &predicate)) {
+            fprintf(stderr, "ERROR: Invalid term '%s'.\n", args[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    mcberepair::ChunkSeekPlan plan{predicate};
+    bool explain = args.has("explain");
+    if(explain) {
+        fprintf(stderr, "x is %s.\n",
+                plan.x_listed() ? "listed in key order"
+                                : "checked as keys are reached");
+        fprintf(stderr, "z is %s.\n",
+                plan.z_listed() ? "listed in key order"
+                                : "checked as keys are reached");
+        if(plan.suffix_ranges() > 0) {
+            fprintf(stderr, "Each chunk is read in %zu key ranges.\n",
+                    plan.suffix_ranges());
+        } else {
+            fprintf(stderr, "Each chunk is read whole and filtered.\n");
+        }
+    }
+
+    // construct path for Minecraft BE database
+    std::string path = std::string(args[0]) + "/db";
+
+    // open the database
+    mcberepair::DB db{path.c_str()};
+
+    if(!db) {
+        fprintf(stderr, "ERROR: Opening '%s' failed.\n", path.c_str());
+        return EXIT_FAILURE;
+    }
+
+    mcberepair::ScopedPhase scan_phase{mcberepair::Phase::kScan};
     leveldb::ReadOptions readOptions;
     leveldb::DecompressAllocator decompress_allocator;
     readOptions.decompress_allocator = &decompress_allocator;
     readOptions.verify_checksums = true;
     readOptions.fill_cache = false;
+    auto it =
+        std::unique_ptr<leveldb::Iterator>{db().NewIterator(readOptions)};
 
-    // create an iterator for the database
-    auto it = std::unique_ptr<leveldb::Iterator>{db().NewIterator(readOptions)};
-
-    for(it->SeekToFirst(); it->Valid(); it->Next()) {
-        auto key = it->key();
-        // print an encoded key
-        std::string enckey = mcberepair::encode_key({key.data(), key.size()});
-        printf("%s", enckey.c_str());
-        printf("\t%zu", it->value().size());
-
-        // Identify keys that might represent chunks
-        if(mcberepair::is_chunk_key({key.data(), key.size()})) {
-            // read chunk key
-            auto chunk = mcberepair::parse_chunk_key({key.data(), key.size()});
-            // print chunk information
-            printf("\t%d\t%d\t%d\t%d\t", chunk.x, chunk.z, chunk.dimension,
-                   chunk.tag);
-            if(chunk.subtag != -1) {
-                printf("%d", chunk.subtag);
+    printf("key\tbytes\tx\tz\tdimension\ttag\tsubtag\n");
+    TsvFormatter formatter;
+    uint64_t bytes = 0;
+    auto stats =
+        mcberepair::scan_plan(it.get(), plan, [&](leveldb::Iterator* iter) {
+            size_t value_size = iter->value().size();
+            formatter.add(iter->key(), value_size);
+            bytes += iter->key().size() + value_size;
+            if(formatter.full()) {
+                write_chunk(formatter.take());
             }
-        } else {
-            printf("\t\t\t\t\t");
-        }
-
-        printf("\n");
-    }
+            return true;
+        });
+    write_chunk(formatter.take());
+    mcberepair::stats().AddKeys(stats.visited, bytes);
 
     if(!it->status().ok()) {
         // LCOV_EXCL_START
@@ -89,5 +480,20 @@ int listkeys_main(int argc, char* argv[]) {
         return EXIT_FAILURE;
         // LCOV_EXCL_STOP
     }
+    fprintf(stderr, "Matched %llu keys after visiting %llu keys with %llu "
+                    "seeks.\n",
+            static_cast<unsigned long long>(stats.matched),
+            static_cast<unsigned long long>(stats.visited),
+            static_cast<unsigned long long>(stats.seeks));
+    if(explain) {
+        // count every key, which is what a scan without a plan would read
+        uint64_t total = 0;
+        for(it->SeekToFirst(); it->Valid(); it->Next()) {
+            total += 1;
+        }
+        fprintf(stderr, "The plan skipped %llu of %llu keys.\n",
+                static_cast<unsigned long long>(total - stats.visited),
+                static_cast<unsigned long long>(total));
+    }
     return EXIT_SUCCESS;
 }
@@ -20,18 +20,40 @@
 # SOFTWARE.
 */
 
+#include <algorithm>
+#include <cctype>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
 
+#include "db.hpp"
+#include "iotrace.hpp"
+#include "procstats.hpp"
+#include "stats.hpp"
 #include "version.h"
 
+int blockcount_main(int argc, char *argv[]);
+int catkeys_main(int argc, char *argv[]);
+int census_main(int argc, char *argv[]);
+int chunkindex_main(int argc, char *argv[]);
 int copyall_main(int argc, char *argv[]);
 int dumpkey_main(int argc, char *argv[]);
+int dumpnbt_main(int argc, char *argv[]);
+int extract_main(int argc, char *argv[]);
+int findbiome_main(int argc, char *argv[]);
+int fsck_main(int argc, char *argv[]);
 int listkeys_main(int argc, char *argv[]);
+int patchnbt_main(int argc, char *argv[]);
+int query_main(int argc, char *argv[]);
 int repair_main(int argc, char *argv[]);
 int rmkeys_main(int argc, char *argv[]);
+int search_main(int argc, char *argv[]);
 int writekey_main(int argc, char *argv[]);
+int ioreplay_main(int argc, char *argv[]);
 int help_main(int argc, char *argv[]);
 
 int version_main(int /*argc*/, char * /*argv*/[]) {
@@ -49,19 +71,135 @@ struct command_t {
 
 // clang-format off
 const command_t commands[] = {
-    {"copyall",  copyall_main,  "Copy the entire contents from one world to an empty world."},
-    {"dumpkey",  dumpkey_main,  "Dump the contents of a key to stdout."},
-    {"listkeys", listkeys_main, "List the keys stored in the world."},
-    {"repair",   repair_main,   "Run the database repair process on the world."},
-    {"rmkeys",   rmkeys_main,   "Delete keys from the world."},
-    {"writekey", writekey_main, "Set the contents of a key in the world."},
-    {"help",     help_main,     "Print help information."},
-    {"version",  version_main,  "Print version information."},
+    {"blockcount", blockcount_main, "Count the blocks of every type in the world."},
+    {"catkeys",    catkeys_main,    "Print a columnar key list as tab-separated text."},
+    {"census",     census_main,     "Count entities and block entities by type and location."},
+    {"chunkindex", chunkindex_main, "Index the chunks of a world for lookups without opening it."},
+    {"copyall",    copyall_main,    "Copy the entire contents from one world to an empty world."},
+    {"dumpkey",    dumpkey_main,    "Dump the contents of a key to stdout."},
+    {"dumpnbt",    dumpnbt_main,    "Print the NBT stored in a key as text."},
+    {"extract",    extract_main,    "Copy a region of chunks and global keys to an empty world."},
+    {"findbiome",  findbiome_main,  "Find the nearest column of a biome."},
+    {"fsck",       fsck_main,       "Check every block of the world's tables for corruption."},
+    {"ioreplay",   ioreplay_main,   "Replay an I/O trace against a scratch directory."},
+    {"listkeys",   listkeys_main,   "List the keys stored in the world."},
+    {"patchnbt",   patchnbt_main,   "Set the NBT tags that a path selects in keys."},
+    {"query",      query_main,      "List the chunk keys whose fields match a predicate."},
+    {"repair",     repair_main,     "Run the database repair process on the world."},
+    {"rmkeys",     rmkeys_main,     "Delete keys from the world."},
+    {"search",     search_main,     "Find the coordinates of blocks of some types."},
+    {"writekey",   writekey_main,   "Set the contents of a key in the world."},
+    {"help",       help_main,       "Print help information."},
+    {"version",    version_main,    "Print version information."},
     {nullptr, nullptr, nullptr}
 };
 // clang-format on
 
-int main(int argc, char *argv[]) {
+namespace {
+
+// Settings that apply to every command.
+struct global_options_t {
+    bool peak_rss = false;
+    bool stats = false;
+    bool stats_json = false;
+    bool io_stats = false;
+    std::string_view io_trace;
+};
+
+bool is_db_option(std::string_view name) {
+    for(auto &&opt : mcberepair::kDBOptionNames) {
+        if(name == opt) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Remove global options from argv, so commands never see them, and
+// configure database options. Global options can appear anywhere before a
+// bare `--`. A profile is applied first, then overrides from the
+// environment, then overrides from the command line.
+bool parse_global_options(int *argc, char *argv[], global_options_t *global) {
+    std::string_view profile;
+    if(const char *env = std::getenv("MCBEREPAIR_PROFILE")) {
+        profile = env;
+    }
+    std::vector<std::string_view> overrides;
+    int out = 1;
+    bool options_done = false;
+    for(int i = 1; i < *argc; ++i) {
+        std::string_view arg{argv[i]};
+        if(!options_done && arg == "--") {
+            options_done = true;
+        } else if(!options_done && arg.substr(0, 10) == "--profile=") {
+            profile = arg.substr(10);
+            continue;
+        } else if(!options_done && arg == "--peak-rss") {
+            global->peak_rss = true;
+            continue;
+        } else if(!options_done &&
+                  (arg == "--stats" || arg.substr(0, 8) == "--stats=")) {
+            auto format = arg.substr(std::min<size_t>(arg.size(), 8));
+            if(format != "" && format != "text" && format != "json") {
+                fprintf(stderr, "ERROR: Unknown stats format '%.*s'.\n",
+                        static_cast<int>(format.size()), format.data());
+                return false;
+            }
+            global->stats = true;
+            global->stats_json = (format == "json");
+            continue;
+        } else if(!options_done && arg == "--io-stats") {
+            global->io_stats = true;
+            continue;
+        } else if(!options_done && arg.substr(0, 11) == "--io-trace=") {
+            global->io_stats = true;
+            global->io_trace = arg.substr(11);
+            continue;
+        } else if(!options_done && arg.substr(0, 2) == "--" &&
+                  is_db_option(arg.substr(2, arg.find('=') - 2))) {
+            overrides.push_back(arg.substr(2));
+            continue;
+        }
+        argv[out++] = argv[i];
+    }
+    *argc = out;
+    argv[out] = nullptr;
+
+    auto &options = mcberepair::db_options();
+    if(!profile.empty() && !mcberepair::db_profile(profile, &options)) {
+        fprintf(stderr, "ERROR: Unknown profile '%.*s'.\n",
+                static_cast<int>(profile.size()), profile.data());
+        return false;
+    }
+    for(auto &&name : mcberepair::kDBOptionNames) {
+        // e.g. cache-size is read from MCBEREPAIR_CACHE_SIZE
+        std::string env_name = "MCBEREPAIR_";
+        for(const char *p = name; *p != '\0'; ++p) {
+            env_name += (*p == '-') ? '_' : static_cast<char>(toupper(*p));
+        }
+        const char *env = std::getenv(env_name.c_str());
+        if(env != nullptr && !mcberepair::set_db_option(name, env, &options)) {
+            fprintf(stderr, "ERROR: Invalid value '%s' for %s.\n", env,
+                    env_name.c_str());
+            return false;
+        }
+    }
+    for(auto &&opt : overrides) {
+        auto eq = opt.find('=');
+        auto name = opt.substr(0, eq);
+        auto value = (eq == std::string_view::npos) ? std::string_view{}
+                                                    : opt.substr(eq + 1);
+        if(!mcberepair::set_db_option(name, value, &options)) {
+            fprintf(stderr, "ERROR: Invalid value '%.*s' for --%.*s.\n",
+                    static_cast<int>(value.size()), value.data(),
+                    static_cast<int>(name.size()), name.data());
+            return false;
+        }
+    }
+    return true;
+}
+
+int run_command(int argc, char *argv[]) {
     if(argc < 2) {
         help_main(argc, argv);
         return EXIT_FAILURE;
@@ -78,6 +216,42 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
 }
 
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    global_options_t global;
+    if(!parse_global_options(&argc, argv, &global)) {
+        return EXIT_FAILURE;
+    }
+    if(global.stats) {
+        mcberepair::stats().Start();
+    }
+    if(global.io_stats) {
+        auto &tracer = mcberepair::io_tracer();
+        tracer = std::make_unique<mcberepair::TracingEnv>(
+            leveldb::Env::Default());
+        if(!global.io_trace.empty() &&
+           !tracer->OpenTrace(std::string{global.io_trace}.c_str())) {
+            fprintf(stderr, "ERROR: Unable to open I/O trace '%.*s'.\n",
+                    static_cast<int>(global.io_trace.size()),
+                    global.io_trace.data());
+            return EXIT_FAILURE;
+        }
+    }
+    int ret = run_command(argc, argv);
+    if(global.stats) {
+        mcberepair::stats().Report(stderr, global.stats_json);
+    }
+    if(global.io_stats) {
+        mcberepair::io_tracer()->io_stats().Report(stderr);
+    }
+    if(global.peak_rss) {
+        fprintf(stderr, "Peak RSS: %.1f MB\n",
+                mcberepair::peak_rss_bytes() / (1024.0 * 1024.0));
+    }
+    return ret;
+}
+
 int help_main(int argc, char *argv[]) {
     if(argc < 3 || strcmp("help", argv[2]) == 0) {
         printf("Usage: %s <command> [args]\n", argv[0]);
@@ -86,6 +260,41 @@ int help_main(int argc, char *argv[]) {
         for(int i = 0; commands[i].name != nullptr; ++i) {
             printf("  %-10s %s\n", commands[i].name, commands[i].desc);
         }
+        printf("\n");
+        printf("Global Options:\n");
+        printf(
+            "  --profile=NAME         Database tuning profile: low-memory, "
+            "balanced\n"
+            "                         (default), or throughput.\n");
+        printf(
+            "  --cache-size=N         Block cache size in bytes (K, M, and G "
+            "suffixes).\n");
+        printf("  --write-buffer-size=N  Write buffer size in bytes.\n");
+        printf("  --max-open-files=N     Maximum number of open table files.\n");
+        printf("  --block-size=N         Block size of new table files.\n");
+        printf(
+            "  --bloom-bits=N         Bloom filter bits per key for new "
+            "tables (0 disables).\n");
+        printf("  --peak-rss             Print the peak resident set size at "
+               "exit.\n");
+        printf(
+            "  --stats[=FORMAT]       Print timings, counters, and leveldb "
+            "statistics to\n"
+            "                         stderr at exit as 'text' (default) or "
+            "'json'.\n");
+        printf(
+            "  --io-stats             Print counts, bytes, and latency "
+            "histograms of database\n"
+            "                         file I/O to stderr at exit.\n");
+        printf(
+            "  --io-trace=FILE        Like --io-stats, and also log every "
+            "operation to FILE\n"
+            "                         for 'ioreplay'.\n");
+        printf("\n");
+        printf(
+            "Database options can also be set with environment variables, "
+            "such as\n"
+            "MCBEREPAIR_PROFILE and MCBEREPAIR_CACHE_SIZE.\n");
         return EXIT_SUCCESS;
     }
 
@@ -23,12 +23,15 @@
 #ifndef MCBEKEY_HPP
 #define MCBEKEY_HPP
 
+#include <algorithm>
+#include <cassert>
 #include <cctype>
+#include <charconv>
+#include <cstdint>
 #include <cstring>
-#include <iostream>
-#include <sstream>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include "leveldb/slice.h"
 #include "perenc.hpp"
@@ -102,71 +105,235 @@ inline void create_chunk_key(chunk_t chunk, std::string *out) {
     out->assign(buffer, buffer + off + 1);
 }
 
-inline std::string encode_key(std::string_view key) {
+// Append the eight bytes that begin every key belonging to chunk (x, z).
+// Coordinates are stored little-endian, so chunk keys do not sort in
+// numeric order of x and z.
+inline void append_chunk_prefix(int x, int z, std::string *out) {
+    assert(out != nullptr);
+    char buffer[8];
+    std::memcpy(buffer + 0, &x, 4);
+    std::memcpy(buffer + 4, &z, 4);
+    out->append(buffer, buffer + 8);
+}
+
+// Append the bytes that select a dimension within a chunk prefix. The
+// overworld has no dimension field.
+inline void append_dimension(int dimension, std::string *out) {
+    assert(out != nullptr);
+    if(dimension != 0) {
+        char buffer[4];
+        std::memcpy(buffer, &dimension, 4);
+        out->append(buffer, buffer + 4);
+    }
+}
+
+// The largest number of bytes that encoding a key of `size` bytes can produce.
+// Chunk keys encode to at most 64 bytes.
+constexpr size_t encode_key_max_size(size_t size) {
+    return percent_encode_max_size(size) > 64 ? percent_encode_max_size(size)
+                                              : 64;
+}
+
+// Encode a key into [first, last). Returns a pointer past the last byte
+// written or nullptr if the buffer is too small.
+inline char *encode_key(std::string_view key, char *first, char *last) {
     if(!is_chunk_key(key)) {
-        return percent_encode(key);
+        return percent_encode(key, first, last);
+    }
+    if(last - first < 64) {
+        return nullptr;
     }
     auto chunk = parse_chunk_key(key);
-    std::stringstream str;
-    str << "@" << chunk.x << ":" << chunk.z << ":" << chunk.dimension << ":"
-        << static_cast<unsigned int>(chunk.tag);
-
+    char *p = first;
+    *p++ = '@';
+    p = std::to_chars(p, last, chunk.x).ptr;
+    *p++ = ':';
+    p = std::to_chars(p, last, chunk.z).ptr;
+    *p++ = ':';
+    p = std::to_chars(p, last, chunk.dimension).ptr;
+    *p++ = ':';
+    // tags are written as unsigned integers, as they always have been
+    p = std::to_chars(p, last, static_cast<unsigned int>(chunk.tag)).ptr;
     if(chunk.subtag != -1) {
-        str << "-" << static_cast<unsigned int>(chunk.subtag);
+        *p++ = '-';
+        p = std::to_chars(p, last, static_cast<unsigned int>(chunk.subtag))
+                .ptr;
     }
+    return p;
+}
 
-    return str.str();
+inline std::string encode_key(std::string_view key) {
+    char buffer[encode_key_max_size(0)];
+    if(key.size() <= 16) {
+        char *end = encode_key(key, buffer, buffer + sizeof(buffer));
+        return {buffer, end};
+    }
+    std::string ret(encode_key_max_size(key.size()), '\0');
+    char *end = encode_key(key, ret.data(), ret.data() + ret.size());
+    ret.resize(end - ret.data());
+    return ret;
 }
 
-inline bool decode_key(std::string_view key, std::string *out) {
+// Append the encoding of a key to `out`. This only allocates when `out` has
+// to grow, so it suits loops that encode many keys into one buffer.
+inline void append_encoded_key(std::string_view key, std::string *out) {
     assert(out != nullptr);
-    if(key.empty()) {
-        out->assign(key);
+    size_t size = out->size();
+    out->resize(size + encode_key_max_size(key.size()));
+    char *end = encode_key(key, out->data() + size, out->data() + out->size());
+    out->resize(end - out->data());
+}
+
+// Decode a key into [first, last). Decoding never makes a key longer, except
+// that a chunk key may need up to 14 bytes. Returns a pointer past the last
+// byte written or nullptr if the key is malformed or the buffer is too small.
+inline char *decode_key(std::string_view key, char *first, char *last) {
+    if(key.empty() || key[0] != '@') {
+        return percent_decode(key, first, last);
+    }
+    const char *p = key.data() + 1;
+    const char *end = key.data() + key.size();
+
+    // read an integer that may be preceded by a ':'; whitespace and a '+'
+    // sign are accepted like the stream-based parser this replaced did
+    auto read = [&](auto *value, bool skip_colon) -> bool {
+        if(skip_colon && p != end && *p == ':') {
+            ++p;
+        }
+        while(p != end && std::isspace(static_cast<unsigned char>(*p))) {
+            ++p;
+        }
+        if(p != end && *p == '+') {
+            ++p;
+            if(p != end && *p == '-') {
+                return false;
+            }
+        }
+        auto res = std::from_chars(p, end, *value);
+        if(res.ec != std::errc{}) {
+            return false;
+        }
+        p = res.ptr;
         return true;
+    };
+
+    // tags are read as unsigned integers, which may wrap around when negative
+    auto read_tag = [&](char *tag, bool skip_colon) -> bool {
+        long long value;
+        if(!read(&value, skip_colon) || value > UINT32_MAX ||
+           value < -static_cast<long long>(UINT32_MAX)) {
+            return false;
+        }
+        *tag = static_cast<char>(value);
+        return true;
+    };
+
+    chunk_t chunk;
+    if(!read(&chunk.x, false) || !read(&chunk.z, true) ||
+       !read(&chunk.dimension, true) || !read_tag(&chunk.tag, true)) {
+        return nullptr;
+    }
+    chunk.subtag = -1;
+    if(p != end && *p == '-') {
+        ++p;
+        if(!read_tag(&chunk.subtag, false)) {
+            return nullptr;
+        }
     }
-    if(key[0] != '@') {
-        out->assign(key);
-        return mcberepair::percent_decode(out);
+    if(p != end || last - first < 14) {
+        return nullptr;
     }
-    std::string buf{key.substr(1)};
-    std::stringstream str(buf);
-    chunk_t chunk;
-    if(!(str >> chunk.x)) {
-        return false;
+    std::memcpy(first + 0, &chunk.x, 4);
+    std::memcpy(first + 4, &chunk.z, 4);
+    char *q = first + 8;
+    if(chunk.dimension != 0) {
+        std::memcpy(q, &chunk.dimension, 4);
+        q += 4;
     }
-    if(str.peek() == ':') {
-        str.ignore();
+    *q++ = chunk.tag;
+    if(chunk.subtag != -1) {
+        *q++ = chunk.subtag;
     }
-    if(!(str >> chunk.z)) {
+    return q;
+}
+
+inline bool decode_key(std::string_view key, std::string *out) {
+    assert(out != nullptr);
+    out->resize(std::max<size_t>(key.size(), 14));
+    char *end = decode_key(key, out->data(), out->data() + out->size());
+    if(end == nullptr) {
         return false;
     }
-    if(str.peek() == ':') {
-        str.ignore();
+    out->resize(end - out->data());
+    return true;
+}
+
+// Encode many keys at once. Encoded keys are stored back to back in `buffer`
+// and `encoded[i]` is set to view the encoding of `keys[i]`.
+inline void encode_keys(const std::string_view *keys, size_t n,
+                        std::string *buffer, std::string_view *encoded) {
+    assert(buffer != nullptr);
+    size_t total = 0;
+    for(size_t i = 0; i < n; ++i) {
+        total += encode_key_max_size(keys[i].size());
     }
-    if(!(str >> chunk.dimension)) {
-        return false;
+    buffer->resize(total);
+    char *first = buffer->data();
+    char *last = first + total;
+    // until the buffer is final, each view holds the end offset of its key
+    char *p = first;
+    for(size_t i = 0; i < n; ++i) {
+        p = encode_key(keys[i], p, last);
+        encoded[i] = {first, static_cast<size_t>(p - first)};
     }
-    unsigned int tag;
-    if(str.peek() == ':') {
-        str.ignore();
+    buffer->resize(p - first);
+    // views are made last because the buffer may move when it shrinks
+    size_t begin = 0;
+    for(size_t i = 0; i < n; ++i) {
+        size_t end = encoded[i].size();
+        encoded[i] = {buffer->data() + begin, end - begin};
+        begin = end;
     }
-    if(!(str >> tag)) {
-        return false;
+}
+
+// Decode many keys at once. Decoded keys are stored back to back in `buffer`
+// and `decoded[i]` is set to view the decoding of `keys[i]`. Malformed keys
+// get a default-constructed view, whose data() is null. Returns the number of
+// malformed keys.
+inline size_t decode_keys(const std::string_view *keys, size_t n,
+                          std::string *buffer, std::string_view *decoded) {
+    assert(buffer != nullptr);
+    size_t total = 0;
+    for(size_t i = 0; i < n; ++i) {
+        total += std::max<size_t>(keys[i].size(), 14);
     }
-    chunk.tag = tag;
-    chunk.subtag = -1;
-    if(str.peek() == '-') {
-        str.ignore();
-        if(!(str >> tag)) {
-            return false;
+    buffer->resize(total);
+    char *first = buffer->data();
+    char *last = first + total;
+    // until the buffer is final, each view holds the end offset of its key
+    size_t bad = 0;
+    char *p = first;
+    for(size_t i = 0; i < n; ++i) {
+        char *q = decode_key(keys[i], p, last);
+        if(q == nullptr) {
+            decoded[i] = {};
+            bad += 1;
+            continue;
         }
-        chunk.subtag = tag;
+        p = q;
+        decoded[i] = {first, static_cast<size_t>(p - first)};
     }
-    if(!str.eof()) {
-        return false;
+    buffer->resize(p - first);
+    size_t begin = 0;
+    for(size_t i = 0; i < n; ++i) {
+        if(decoded[i].data() == nullptr) {
+            continue;
+        }
+        size_t end = decoded[i].size();
+        decoded[i] = {buffer->data() + begin, end - begin};
+        begin = end;
     }
-    create_chunk_key(chunk, out);
-    return true;
+    return bad;
 }
 
 }  // namespace mcberepair
@@ -20,338 +20,341 @@
 # SOFTWARE.
 */
 
-#include <cassert>
-#include <vector>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
 #include <cstring>
-#include <stack>
-#include <string>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 
-#include "nbt.hpp"
-
-void read_nbt_impl(char ** const pfirst, char *last, mcberepair::nbt_type type,
-    std::string_view name, std::vector<mcberepair::nbt_t> *v);
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
-mcberepair::nbt_type read_type(char ** const pfirst, char *last) {
-    assert(pfirst != nullptr && *pfirst != nullptr);
-    assert(last != nullptr);
-    assert(*pfirst <= last);
+#include "args.hpp"
+#include "db.hpp"
+#include "mcbekey.hpp"
+#include "nbt.hpp"
+#include "nbtpath.hpp"
+#include "slurp.hpp"
 
-    //std::cerr << "read_type\n";
+namespace {
 
-    using nbt_type = mcberepair::nbt_type;
+using clock_type = std::chrono::steady_clock;
 
-    char *p = *pfirst;
+const char *const type_names[] = {
+    "end",    "byte",   "short", "int",      "long",      "float",     "double",
+    "byte_array", "string", "list", "compound", "int_array", "long_array"};
 
-    if(p == last) {
-        return nbt_type::END;
+template <typename T>
+void append_array(std::string *out, const T *data, int32_t size,
+                  const char *format) {
+    char buffer[32];
+    for(int32_t i = 0; i < size; ++i) {
+        T value;
+        std::memcpy(&value, data + i, sizeof(T));
+        snprintf(buffer, sizeof(buffer), format, value);
+        out->push_back(' ');
+        out->append(buffer);
     }
-    int8_t value;
-    memcpy(&value, p, sizeof(value));
-
-    *pfirst = p + sizeof(value);
-    return nbt_type{value};
 }
 
-std::string_view read_name(char ** const pfirst, char *last) {
-    assert(pfirst != nullptr && *pfirst != nullptr);
-    assert(last != nullptr);
-    assert(*pfirst <= last);
-
-    //std::cerr << "read_name\n";
-
-    char *p = *pfirst;
-
-    // read the size of the name
-    uint16_t name_len;
-    if(last-p < sizeof(name_len)) {
-        return {}; // malformed
-    }
-    memcpy(&name_len, p, sizeof(name_len));
-    p += sizeof(name_len);
-
-    //std::cerr << "    " << name_len << "\n";
-
-    // read the name
-    if(last-p < name_len) {
-        return {};
+// Append a readable version of a tape to `out`, one tag per line. The names
+// of root tags are left out if `names` is false.
+void print_tape(const std::vector<mcberepair::nbt_t> &tape, std::string *out,
+                bool names = true) {
+    using namespace mcberepair;
+    // whether each open container is a list, whose items have no names
+    std::vector<bool> in_list;
+    char buffer[64];
+    for(auto &&tag : tape) {
+        bool is_end = std::holds_alternative<nbt_end_t>(tag.payload) ||
+                      std::holds_alternative<nbt_list_end_t>(tag.payload);
+        if(is_end) {
+            in_list.pop_back();
+        }
+        out->append(2 * in_list.size(), ' ');
+        if(is_end) {
+            out->append(std::holds_alternative<nbt_end_t>(tag.payload) ? "}\n"
+                                                                       : "]\n");
+            continue;
+        }
+        auto label = [&](nbt_type type) {
+            out->append(type_names[static_cast<int>(type)]);
+            if(in_list.empty() ? names : !in_list.back()) {
+                out->append(" '");
+                out->append(tag.name);
+                out->push_back('\'');
+            }
+        };
+        std::visit(
+            [&](auto &&v) {
+                using T = std::decay_t<decltype(v)>;
+                if constexpr(std::is_same_v<T, int8_t>) {
+                    label(nbt_type::BYTE);
+                    snprintf(buffer, sizeof(buffer), ": %d", v);
+                } else if constexpr(std::is_same_v<T, int16_t>) {
+                    label(nbt_type::SHORT);
+                    snprintf(buffer, sizeof(buffer), ": %d", v);
+                } else if constexpr(std::is_same_v<T, int32_t>) {
+                    label(nbt_type::INT);
+                    snprintf(buffer, sizeof(buffer), ": %" PRId32, v);
+                } else if constexpr(std::is_same_v<T, int64_t>) {
+                    label(nbt_type::LONG);
+                    snprintf(buffer, sizeof(buffer), ": %" PRId64, v);
+                } else if constexpr(std::is_same_v<T, float>) {
+                    label(nbt_type::FLOAT);
+                    snprintf(buffer, sizeof(buffer), ": %g", v);
+                } else if constexpr(std::is_same_v<T, double>) {
+                    label(nbt_type::DOUBLE);
+                    snprintf(buffer, sizeof(buffer), ": %g", v);
+                } else if constexpr(std::is_same_v<T, nbt_string_t>) {
+                    label(nbt_type::STRING);
+                    out->append(": \"");
+                    out->append(v.data, v.size);
+                    buffer[0] = '"';
+                    buffer[1] = '\0';
+                } else if constexpr(std::is_same_v<T, nbt_byte_array_t>) {
+                    label(nbt_type::BYTE_ARRAY);
+                    snprintf(buffer, sizeof(buffer), " (%" PRId32 "):", v.size);
+                    out->append(buffer);
+                    append_array(out, v.data, v.size, "%d");
+                    buffer[0] = '\0';
+                } else if constexpr(std::is_same_v<T, nbt_int_array_t>) {
+                    label(nbt_type::INT_ARRAY);
+                    snprintf(buffer, sizeof(buffer), " (%" PRId32 "):", v.size);
+                    out->append(buffer);
+                    append_array(out, v.data, v.size, "%" PRId32);
+                    buffer[0] = '\0';
+                } else if constexpr(std::is_same_v<T, nbt_long_array_t>) {
+                    label(nbt_type::LONG_ARRAY);
+                    snprintf(buffer, sizeof(buffer), " (%" PRId32 "):", v.size);
+                    out->append(buffer);
+                    append_array(out, v.data, v.size, "%" PRId64);
+                    buffer[0] = '\0';
+                } else if constexpr(std::is_same_v<T, nbt_compound_t>) {
+                    label(nbt_type::COMPOUND);
+                    in_list.push_back(false);
+                    snprintf(buffer, sizeof(buffer), " {");
+                } else if constexpr(std::is_same_v<T, nbt_list_t>) {
+                    label(nbt_type::LIST);
+                    in_list.push_back(true);
+                    snprintf(buffer, sizeof(buffer), " (%s x %" PRId32 ") [",
+                             type_names[static_cast<int>(v.type)], v.size);
+                } else {
+                    buffer[0] = '\0';  // LCOV_EXCL_LINE
+                }
+            },
+            tag.payload);
+        out->append(buffer);
+        out->push_back('\n');
     }
-    *pfirst = p + sizeof(char)*name_len;
-    return {p,name_len};
 }
 
-template<typename T>
-inline
-std::enable_if_t<std::is_arithmetic_v<T>,mcberepair::nbt_t::payload_t>
-read_payload_impl(char ** const pfirst, char *last) {
-    assert(pfirst != nullptr && *pfirst != nullptr);
-    assert(last != nullptr);
-    assert(*pfirst <= last);
-    using payload_t = mcberepair::nbt_t::payload_t;
-
-    //std::cerr << "read_payload_impl\n";
-
-    char *p = *pfirst;
-    if(last-p < sizeof(T)) {
-        return {};
+void write_chunk(const std::string &buffer) {
+    if(!buffer.empty()) {
+        fwrite(buffer.data(), buffer.size(), 1, stdout);
     }
-    T value;
-    memcpy(&value, p, sizeof(value));
-
-    *pfirst += sizeof(T);
-
-    return {value};
 }
 
-template<typename T>
-inline
-std::enable_if_t<std::is_member_pointer_v<decltype(&T::data)> &&
-    std::is_member_pointer_v<decltype(&T::size)>, mcberepair::nbt_t::payload_t>
-read_payload_impl(char ** const pfirst, char *last) {
-    assert(pfirst != nullptr && *pfirst != nullptr);
-    assert(last != nullptr);
-    assert(*pfirst <= last);
-    using payload_t = mcberepair::nbt_t::payload_t;
-
-    //std::cerr << "read_payload_impl_array\n";
-
-    char *p = *pfirst;
-
-    using array_size_t = decltype(T::size);
+// Append the tags a path selects, without their names.
+bool print_matches(const std::string &value, const mcberepair::nbt_path_t &path,
+                   std::string *out) {
+    mcberepair::NbtReader reader;
+    std::string tag;
+    return mcberepair::query_nbt(
+        value.data(), value.size(), path,
+        [&](const mcberepair::nbt_value_t &match) {
+            // give the payload an unnamed header so it can be read alone
+            tag.assign(1, static_cast<char>(match.type));
+            tag.append(2, '\0');
+            tag.append(match.data, match.size);
+            reader.Read(tag.data(), tag.size());
+            print_tape(reader.tape(), out, false);
+            return true;
+        });
+}
 
-    if(last-p < sizeof(array_size_t)) {
-        return {};
+// Parse every value stored under a chunk tag and report the parse rate. If
+// `path` is not empty, also query it in every value and report that rate.
+int scan_nbt(leveldb::DB *db, char tag, const mcberepair::nbt_path_t &path) {
+    leveldb::ReadOptions readOptions;
+    leveldb::DecompressAllocator decompress_allocator;
+    readOptions.decompress_allocator = &decompress_allocator;
+    readOptions.verify_checksums = true;
+    readOptions.fill_cache = false;
+    auto it = std::unique_ptr<leveldb::Iterator>{db->NewIterator(readOptions)};
+
+    // the reader and the buffer are reused, so parsing stops allocating
+    // once they have grown to fit the largest value
+    mcberepair::NbtReader reader;
+    std::string buffer;
+    uint64_t values = 0;
+    uint64_t bytes = 0;
+    uint64_t malformed = 0;
+    uint64_t matches = 0;
+    clock_type::duration parsing{};
+    clock_type::duration querying{};
+    auto start = clock_type::now();
+    {
+        mcberepair::ScopedPhase phase{mcberepair::Phase::kScan};
+        for(it->SeekToFirst(); it->Valid(); it->Next()) {
+            auto key = it->key();
+            std::string_view skey{key.data(), key.size()};
+            if(!mcberepair::is_chunk_key(skey) ||
+               mcberepair::parse_chunk_key(skey).tag != tag) {
+                continue;
+            }
+            auto value = it->value();
+            buffer.assign(value.data(), value.size());
+            auto t0 = clock_type::now();
+            if(!reader.Read(buffer.data(), buffer.size())) {
+                malformed += 1;
+            }
+            parsing += clock_type::now() - t0;
+            if(!path.empty()) {
+                t0 = clock_type::now();
+                mcberepair::query_nbt(
+                    buffer.data(), buffer.size(), path,
+                    [&](const mcberepair::nbt_value_t &) {
+                        matches += 1;
+                        return true;
+                    });
+                querying += clock_type::now() - t0;
+            }
+            values += 1;
+            bytes += buffer.size();
+        }
     }
-    array_size_t array_size;
-    memcpy(&array_size, p, sizeof(array_size_t));
-    p += sizeof(array_size_t);
-    size_t len = sizeof(std::remove_pointer_t<decltype(T::data)>)*array_size;
-    if(last-p < len) {
-        return {};
+    if(!it->status().ok()) {
+        // LCOV_EXCL_START
+        fprintf(stderr, "ERROR: Reading the database failed: %s\n",
+                it->status().ToString().c_str());
+        return EXIT_FAILURE;
+        // LCOV_EXCL_STOP
     }
-    *pfirst = p + len;
-    return T{array_size, reinterpret_cast<decltype(T::data)>(p)};
-}
-
-inline
-void
-read_simple_payload(char ** const pfirst, char *last, mcberepair::nbt_type type,
-    std::string_view name, std::vector<mcberepair::nbt_t> *v) {
-    using nbt_type = mcberepair::nbt_type;
-    mcberepair::nbt_t::payload_t payload;
-
-    //std::cerr << "read_simple_payload\n";
-    
-    char *p = *pfirst;
-    switch(type) {
-    case nbt_type::BYTE:
-        payload = read_payload_impl<int8_t>(pfirst, last);
-        break;
-    case nbt_type::SHORT:
-        payload = read_payload_impl<int16_t>(pfirst, last);
-        break;
-    case nbt_type::INT:
-        payload = read_payload_impl<int32_t>(pfirst, last);
-        break;
-    case nbt_type::LONG:
-        payload = read_payload_impl<int64_t>(pfirst, last);
-        break;
-    case nbt_type::FLOAT:
-        payload = read_payload_impl<float>(pfirst, last);
-        break;
-    case nbt_type::DOUBLE:
-        payload = read_payload_impl<double>(pfirst, last);
-        break;
-    case nbt_type::BYTE_ARRAY:
-        payload = read_payload_impl<mcberepair::nbt_byte_array_t>(pfirst, last);
-        break;
-    case nbt_type::STRING:
-        payload = read_payload_impl<mcberepair::nbt_string_t>(pfirst, last);
-        break;
-    case nbt_type::INT_ARRAY:
-        payload = read_payload_impl<mcberepair::nbt_int_array_t>(pfirst, last);
-        break;
-    case nbt_type::LONG_ARRAY:
-        payload = read_payload_impl<mcberepair::nbt_long_array_t>(pfirst, last);
-        break;
-    default:
-        return;
+    mcberepair::stats().AddKeys(values, bytes);
+
+    std::chrono::duration<double> total = clock_type::now() - start;
+    std::chrono::duration<double> parse = parsing;
+    double mb = bytes / (1024.0 * 1024.0);
+    printf("Parsed %llu values (%.1f MB) in %.3f s; %.1f MB/s parsing, "
+           "%.1f MB/s overall.\n",
+           static_cast<unsigned long long>(values), mb, total.count(),
+           parse.count() > 0 ? mb / parse.count() : 0.0,
+           total.count() > 0 ? mb / total.count() : 0.0);
+    if(!path.empty()) {
+        std::chrono::duration<double> query = querying;
+        printf("The path matched %llu tags; %.1f MB/s querying, %.1fx the "
+               "parse rate.\n",
+               static_cast<unsigned long long>(matches),
+               query.count() > 0 ? mb / query.count() : 0.0,
+               query.count() > 0 ? parse.count() / query.count() : 0.0);
     }
-    if(*pfirst != p) {
-        v->emplace_back(name, payload);
+    if(malformed > 0) {
+        printf("%llu values were malformed.\n",
+               static_cast<unsigned long long>(malformed));
     }
+    return EXIT_SUCCESS;
 }
 
-
-inline
-void read_list_payload(char ** const pfirst, char *last, mcberepair::nbt_type type,
-    std::string_view name, std::vector<mcberepair::nbt_t> *v) {
-    assert(pfirst != nullptr && *pfirst != nullptr);
-    assert(last != nullptr);
-    assert(*pfirst <= last);
-    assert(v != nullptr);
-
-    //std::cerr << "read_list_payload\n";
-
-    using nbt_type = mcberepair::nbt_type;
-    using nbt_t = mcberepair::nbt_t;
-    using payload_t = mcberepair::nbt_t::payload_t;
-
-    char *first = *pfirst;
-    char *p = first;
-
-    auto list_type = read_type(&p, last);
-    if(list_type == nbt_type::END) {
-        return; // Malformed
+}  // namespace
+
+int dumpnbt_main(int argc, char *argv[]) {
+    mcberepair::Args args{argc, argv};
+    bool scan = args.has("scan");
+    bool from_stdin = args.size() == 1 && strcmp(args[0], "-") == 0;
+    if((!from_stdin && (scan ? args.size() < 1 : args.size() < 2)) ||
+       strcmp("help", argv[1]) == 0) {
+        printf("Usage: %s dumpnbt <minecraft_world_dir> <key>\n", argv[0]);
+        printf("       %s dumpnbt - < value.bin\n", argv[0]);
+        printf(
+            "       %s dumpnbt <minecraft_world_dir> --scan [--tag=N] "
+            "[--path=PATH]\n",
+            argv[0]);
+        printf("\n");
+        printf("Options:\n");
+        printf(
+            "  --scan            Parse every value with chunk tag N and report "
+            "the parse\n"
+            "                    rate instead of printing values.\n");
+        printf(
+            "  --tag=N           The chunk tag to scan (default 49, block "
+            "entities).\n");
+        printf(
+            "  --path=PATH       Print only the tags PATH selects, such as "
+            "'Pos[1]' or\n"
+            "                    'Items[*].Name'. With --scan, also time "
+            "querying PATH.\n");
+        return EXIT_FAILURE;
     }
-
-    int32_t list_size;
-    if(last-p < sizeof(list_size)) {
-        return; // Malformed
+    std::string bad_option;
+    if(args.unknown({"scan", "tag", "path"}, &bad_option)) {
+        fprintf(stderr, "ERROR: Unknown option '--%s'.\n", bad_option.c_str());
+        return EXIT_FAILURE;
     }
-    memcpy(&list_size, p, sizeof(list_size));
-    p += sizeof(list_size);
-
-    v->emplace_back(name, mcberepair::nbt_list_t{list_size, list_type});
-    for(int i=0;i<list_size;++i) {
-        first = p;
-        read_nbt_impl(&p, last, list_type, {}, v);
-        if(first == p) {
-            return; // Malformed
-        }
+    int tag = 49;
+    if(!args.number("tag", &tag) || tag < 0 || tag > 255) {
+        fprintf(stderr, "ERROR: Invalid value for '--tag'.\n");
+        return EXIT_FAILURE;
+    }
+    mcberepair::nbt_path_t nbt_path;
+    if(args.has("path") &&
+       !mcberepair::parse_nbt_path(args.value("path"), &nbt_path)) {
+        fprintf(stderr, "ERROR: The path '%s' is malformed.\n",
+                std::string{args.value("path")}.c_str());
+        return EXIT_FAILURE;
     }
-    *pfirst = p;
-    v->emplace_back(std::string_view{}, payload_t{mcberepair::nbt_list_end_t{}});
-}
-
-inline
-void read_compound_payload_impl(char ** const pfirst, char *last,
-    std::vector<mcberepair::nbt_t> *v) {
-    assert(pfirst != nullptr && *pfirst != nullptr);
-    assert(last != nullptr);
-    assert(*pfirst <= last);
-    assert(v != nullptr);
-
-    //std::cerr << "read_compound_payload_impl\n";
-
-    using nbt_type = mcberepair::nbt_type;
 
-    char *first = *pfirst;
-    while(first < last) {
-        char *p = first;
-        nbt_type type = read_type(&p, last);
-        if(type == nbt_type::END) {
-            *pfirst = p;
-            return;
+    std::string value;
+    if(from_stdin) {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), O_BINARY);
+#endif
+        value = mcberepair::slurp_string(std::cin);
+    } else {
+        // construct path for Minecraft BE database
+        std::string path = std::string(args[0]) + "/db";
+        mcberepair::DB db{path.c_str()};
+        if(!db) {
+            fprintf(stderr, "ERROR: Opening '%s' failed.\n", path.c_str());
+            return EXIT_FAILURE;
         }
-        first = p;
-        auto name = read_name(&p, last);
-        if(p == first) {
-            break;
+        if(scan) {
+            return scan_nbt(&db(), static_cast<char>(tag), nbt_path);
         }
-        first = p;
 
-        read_nbt_impl(&p, last, type, name, v);
-        if(p == first) {
-            break;
+        std::string key;
+        if(!mcberepair::decode_key(args[1], &key)) {
+            fprintf(stderr, "ERROR: key '%s' is malformed\n", args[1]);
+            return EXIT_FAILURE;
+        }
+        leveldb::ReadOptions readOptions;
+        readOptions.verify_checksums = true;
+        leveldb::Status status = db().Get(readOptions, key, &value);
+        if(!status.ok()) {
+            fprintf(stderr, "ERROR: Reading key '%s' failed --- %s\n", args[1],
+                    status.ToString().c_str());
+            return EXIT_FAILURE;
         }
-        first = p;
     }
-}
-
-inline
-void read_compound_payload(char ** const pfirst, char *last, mcberepair::nbt_type type,
-    std::string_view name, std::vector<mcberepair::nbt_t> *v) {
-    assert(pfirst != nullptr && *pfirst != nullptr);
-    assert(last != nullptr);
-    assert(*pfirst <= last);
-    assert(v != nullptr);
 
-    //std::cerr << "read_compound_payload\n";
-
-    using nbt_type = mcberepair::nbt_type;
-
-    v->emplace_back(name, mcberepair::nbt_compound_t{});
-
-    char *first = *pfirst;
-    read_compound_payload_impl(pfirst, last, v);
-    if(first == *pfirst) {
-        return; // malformed
+    bool ok;
+    std::string out;
+    if(!nbt_path.empty()) {
+        ok = print_matches(value, nbt_path, &out);
+    } else {
+        mcberepair::NbtReader reader;
+        ok = reader.Read(value.data(), value.size());
+        print_tape(reader.tape(), &out);
     }
-    v->emplace_back(std::string_view{}, mcberepair::nbt_end_t{});
-}
-
-
-inline
-void read_nbt_impl(char ** const pfirst, char *last, mcberepair::nbt_type type,
-    std::string_view name, std::vector<mcberepair::nbt_t> *v) {
-
-    //std::cerr << "read_nbt_impl\n";
-
-    using nbt_type = mcberepair::nbt_type;
-
-    switch(type) {
-        case nbt_type::BYTE:
-        case nbt_type::SHORT:
-        case nbt_type::INT:
-        case nbt_type::LONG:
-        case nbt_type::FLOAT:
-        case nbt_type::DOUBLE:
-        case nbt_type::BYTE_ARRAY:
-        case nbt_type::STRING:
-        case nbt_type::INT_ARRAY:
-        case nbt_type::LONG_ARRAY:
-            read_simple_payload(pfirst, last, type, name, v);
-            break;
-        case nbt_type::LIST:
-            read_list_payload(pfirst, last, type, name, v);
-            break;
-        case nbt_type::COMPOUND:
-            read_compound_payload(pfirst, last, type, name, v);
-            break;
-        case nbt_type::END:
-        default:
-            //malformed
-            assert(false);
-            break;
+    write_chunk(out);
+    if(!ok) {
+        fprintf(stderr, "ERROR: The value is not valid NBT.\n");
+        return EXIT_FAILURE;
     }
+    return EXIT_SUCCESS;
 }
-
-bool read_nbt(char *first, size_t length, std::vector<mcberepair::nbt_t> *nbt_data) {
-    assert(first != nullptr);
-    assert(nbt_data != nullptr);
-
-    //std::cerr << "read_nbt\n";
-
-    using nbt_type = mcberepair::nbt_type;
-
-    if(length == 0) {
-        return true;
-    }
-
-    char * last = first+length;
-
-    read_compound_payload_impl(&first, last, nbt_data);
-
-    return (first == last);
-}
-
-const char data[] = "\x09\x0b\0Hello World\x08\x02\0\0\0\x0b\0Hello World\x0b\0Hello_World";
-
-#include "slurp.hpp"
-
-int main(int argc, char *argv[]) {
-    //std::string buffer(&data[0], sizeof(data));
-
-    std::string buffer = mcberepair::slurp_string(std::cin);
-
-    std::vector<mcberepair::nbt_t> result;
-    bool res = read_nbt(buffer.data(),buffer.size(), &result);
-
-    //std::cout << result.size() << "\n";
-    for(auto &&a : result) {
-        std::cout << a.name << " "  << a.payload.index() << "\n";
-    }
-    
-    return res ? EXIT_SUCCESS : EXIT_FAILURE;
-}
\ No newline at end of file
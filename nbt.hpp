@@ -23,8 +23,14 @@
 #ifndef MCBEREPAIR_NBT_HPP
 #define MCBEREPAIR_NBT_HPP
 
-#include <variant>
+#include <cstdint>
+#include <cstring>
+#include <string>
 #include <string_view>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
 
 namespace mcberepair {
 
@@ -60,7 +66,7 @@ struct nbt_long_array_t {
 };
 
 struct nbt_string_t {
-    int16_t size;
+    uint16_t size;
     char *data;
 };
 
@@ -101,6 +107,327 @@ struct nbt_t {
     payload_t payload;
 };
 
+// Minecraft refuses to read NBT nested deeper than this.
+constexpr size_t kNbtMaxDepth = 512;
+
+// Reads little-endian NBT into a flat tape. Compounds and lists are
+// followed by their children and closed by an nbt_end_t or nbt_list_end_t
+// entry. Names, strings, and arrays point into the input buffer, which must
+// outlive the tape.
+//
+// The parser keeps an explicit stack instead of recursing, so deeply nested
+// values cannot overflow the call stack. A reader keeps its tape and stack
+// between calls, so scanning many values allocates only while the largest
+// value seen so far grows.
+class NbtReader {
+   public:
+    // Parse every root tag in [first, first+length). Returns false if the
+    // data is malformed; the tape then holds the tags read before the error.
+    bool Read(char *first, size_t length) {
+        tape_.clear();
+        stack_.clear();
+        // most tags take more than eight bytes
+        if(tape_.capacity() < length / 8) {
+            tape_.reserve(length / 8);
+        }
+        p_ = first;
+        last_ = first + length;
+
+        while(true) {
+            nbt_type type;
+            std::string_view name;
+            if(stack_.empty()) {
+                if(p_ == last_) {
+                    return true;
+                }
+                if(!ReadType(&type) || type == nbt_type::END ||
+                   !ReadName(&name)) {
+                    return false;
+                }
+            } else if(stack_.back().is_list) {
+                auto &frame = stack_.back();
+                if(frame.remaining == 0) {
+                    stack_.pop_back();
+                    tape_.emplace_back(std::string_view{}, nbt_list_end_t{});
+                    continue;
+                }
+                frame.remaining -= 1;
+                type = frame.type;
+            } else {
+                if(!ReadType(&type)) {
+                    return false;
+                }
+                if(type == nbt_type::END) {
+                    stack_.pop_back();
+                    tape_.emplace_back(std::string_view{}, nbt_end_t{});
+                    continue;
+                }
+                if(!ReadName(&name)) {
+                    return false;
+                }
+            }
+            if(!ReadPayload(type, name)) {
+                return false;
+            }
+        }
+    }
+
+    const std::vector<nbt_t> &tape() const { return tape_; }
+
+   protected:
+    struct frame_t {
+        bool is_list;
+        nbt_type type;
+        int32_t remaining;
+    };
+
+    bool Has(size_t n) const { return static_cast<size_t>(last_ - p_) >= n; }
+
+    template<typename T>
+    bool ReadValue(T *value) {
+        if(!Has(sizeof(T))) {
+            return false;
+        }
+        std::memcpy(value, p_, sizeof(T));
+        p_ += sizeof(T);
+        return true;
+    }
+
+    bool ReadType(nbt_type *type) {
+        uint8_t value;
+        if(!ReadValue(&value) || value > static_cast<uint8_t>(nbt_type::LONG_ARRAY)) {
+            return false;
+        }
+        *type = nbt_type{value};
+        return true;
+    }
+
+    bool ReadName(std::string_view *name) {
+        uint16_t size;
+        if(!ReadValue(&size) || !Has(size)) {
+            return false;
+        }
+        *name = {p_, size};
+        p_ += size;
+        return true;
+    }
+
+    template<typename T>
+    bool ReadScalar(std::string_view name) {
+        T value;
+        if(!ReadValue(&value)) {
+            return false;
+        }
+        tape_.emplace_back(name, value);
+        return true;
+    }
+
+    template<typename T>
+    bool ReadArray(std::string_view name) {
+        int32_t size;
+        using elem_t = std::remove_pointer_t<decltype(T::data)>;
+        if(!ReadValue(&size) || size < 0 ||
+           static_cast<size_t>(last_ - p_) / sizeof(elem_t) < static_cast<size_t>(size)) {
+            return false;
+        }
+        tape_.emplace_back(name, T{size, reinterpret_cast<elem_t *>(p_)});
+        p_ += sizeof(elem_t) * size;
+        return true;
+    }
+
+    bool ReadPayload(nbt_type type, std::string_view name) {
+        switch(type) {
+        case nbt_type::BYTE:
+            return ReadScalar<int8_t>(name);
+        case nbt_type::SHORT:
+            return ReadScalar<int16_t>(name);
+        case nbt_type::INT:
+            return ReadScalar<int32_t>(name);
+        case nbt_type::LONG:
+            return ReadScalar<int64_t>(name);
+        case nbt_type::FLOAT:
+            return ReadScalar<float>(name);
+        case nbt_type::DOUBLE:
+            return ReadScalar<double>(name);
+        case nbt_type::BYTE_ARRAY:
+            return ReadArray<nbt_byte_array_t>(name);
+        case nbt_type::INT_ARRAY:
+            return ReadArray<nbt_int_array_t>(name);
+        case nbt_type::LONG_ARRAY:
+            return ReadArray<nbt_long_array_t>(name);
+        case nbt_type::STRING: {
+            uint16_t size;
+            if(!ReadValue(&size) || !Has(size)) {
+                return false;
+            }
+            tape_.emplace_back(name, nbt_string_t{size, p_});
+            p_ += size;
+            return true;
+        }
+        case nbt_type::LIST: {
+            nbt_type elem;
+            int32_t size;
+            if(!ReadType(&elem) || !ReadValue(&size) || size < 0 ||
+               (elem == nbt_type::END && size != 0) ||
+               stack_.size() >= kNbtMaxDepth) {
+                return false;
+            }
+            tape_.emplace_back(name, nbt_list_t{size, elem});
+            stack_.push_back({true, elem, size});
+            return true;
+        }
+        case nbt_type::COMPOUND:
+            if(stack_.size() >= kNbtMaxDepth) {
+                return false;
+            }
+            tape_.emplace_back(name, nbt_compound_t{});
+            stack_.push_back({false, nbt_type::END, 0});
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    std::vector<nbt_t> tape_;
+    std::vector<frame_t> stack_;
+    char *p_{nullptr};
+    char *last_{nullptr};
+};
+
+// Read every tag in [first, first+length) into a flat tape. Returns false if
+// the data is malformed. Use an NbtReader to parse many values.
+inline bool read_nbt(char *first, size_t length, std::vector<nbt_t> *nbt_data) {
+    NbtReader reader;
+    bool ok = reader.Read(first, length);
+    nbt_data->insert(nbt_data->end(), reader.tape().begin(), reader.tape().end());
+    return ok;
+}
+
+namespace detail {
+template<typename T>
+void nbt_put(std::string *out, T value) {
+    char buffer[sizeof(T)];
+    std::memcpy(buffer, &value, sizeof(T));
+    out->append(buffer, sizeof(T));
+}
+
+// The type of tag a payload belongs to; END for end entries.
+inline nbt_type nbt_type_of(const nbt_t::payload_t &payload) {
+    return std::visit([](auto &&v) {
+        using T = std::decay_t<decltype(v)>;
+        if constexpr(std::is_same_v<T, int8_t>) {
+            return nbt_type::BYTE;
+        } else if constexpr(std::is_same_v<T, int16_t>) {
+            return nbt_type::SHORT;
+        } else if constexpr(std::is_same_v<T, int32_t>) {
+            return nbt_type::INT;
+        } else if constexpr(std::is_same_v<T, int64_t>) {
+            return nbt_type::LONG;
+        } else if constexpr(std::is_same_v<T, float>) {
+            return nbt_type::FLOAT;
+        } else if constexpr(std::is_same_v<T, double>) {
+            return nbt_type::DOUBLE;
+        } else if constexpr(std::is_same_v<T, nbt_byte_array_t>) {
+            return nbt_type::BYTE_ARRAY;
+        } else if constexpr(std::is_same_v<T, nbt_string_t>) {
+            return nbt_type::STRING;
+        } else if constexpr(std::is_same_v<T, nbt_list_t>) {
+            return nbt_type::LIST;
+        } else if constexpr(std::is_same_v<T, nbt_compound_t>) {
+            return nbt_type::COMPOUND;
+        } else if constexpr(std::is_same_v<T, nbt_int_array_t>) {
+            return nbt_type::INT_ARRAY;
+        } else if constexpr(std::is_same_v<T, nbt_long_array_t>) {
+            return nbt_type::LONG_ARRAY;
+        } else {
+            return nbt_type::END;
+        }
+    }, payload);
+}
+}
+
+// Append the little-endian NBT that a tape describes to `out`. Writing the
+// tape from a reader reproduces the bytes it read. Returns false if the tape
+// is not well formed: containers must be closed by the matching end entry,
+// and a list must hold as many items of its type as it says.
+inline bool write_nbt(const std::vector<nbt_t> &tape, std::string *out) {
+    using detail::nbt_put;
+    struct frame_t {
+        bool is_list;
+        nbt_type type;
+        int32_t remaining;
+    };
+    std::vector<frame_t> open;
+    for(auto &&tag : tape) {
+        nbt_type type = detail::nbt_type_of(tag.payload);
+
+        if(std::holds_alternative<nbt_end_t>(tag.payload)) {
+            if(open.empty() || open.back().is_list) {
+                return false;
+            }
+            open.pop_back();
+            out->push_back(0);
+            continue;
+        }
+        if(std::holds_alternative<nbt_list_end_t>(tag.payload)) {
+            if(open.empty() || !open.back().is_list || open.back().remaining != 0) {
+                return false;
+            }
+            open.pop_back();
+            continue;
+        }
+        if(type == nbt_type::END) {
+            return false;
+        }
+
+        if(open.empty() || !open.back().is_list) {
+            // a named tag in a compound or at the root
+            if(tag.name.size() > UINT16_MAX) {
+                return false;
+            }
+            out->push_back(static_cast<char>(type));
+            nbt_put(out, static_cast<uint16_t>(tag.name.size()));
+            out->append(tag.name);
+        } else {
+            auto &list = open.back();
+            if(list.type != type || list.remaining == 0) {
+                return false;
+            }
+            list.remaining -= 1;
+        }
+
+        std::visit([&](auto &&v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr(std::is_arithmetic_v<T>) {
+                nbt_put(out, v);
+            } else if constexpr(std::is_same_v<T, nbt_string_t>) {
+                nbt_put(out, v.size);
+                out->append(v.data, v.size);
+            } else if constexpr(std::is_same_v<T, nbt_byte_array_t> ||
+                                std::is_same_v<T, nbt_int_array_t> ||
+                                std::is_same_v<T, nbt_long_array_t>) {
+                nbt_put(out, v.size);
+                out->append(reinterpret_cast<const char *>(v.data),
+                            sizeof(*v.data) * v.size);
+            } else if constexpr(std::is_same_v<T, nbt_list_t>) {
+                out->push_back(static_cast<char>(v.type));
+                nbt_put(out, v.size);
+            }
+        }, tag.payload);
+
+        if(type == nbt_type::COMPOUND) {
+            open.push_back({false, nbt_type::END, 0});
+        } else if(type == nbt_type::LIST) {
+            auto &list = std::get<nbt_list_t>(tag.payload);
+            if(list.size < 0) {
+                return false;
+            }
+            open.push_back({true, list.type, list.size});
+        }
+    }
+    return open.empty();
+}
+
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,651 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+#ifndef MCBEREPAIR_NBTPATH_HPP
+#define MCBEREPAIR_NBTPATH_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "nbt.hpp"
+
+// Path queries over raw NBT
+//
+// A path selects tags inside the root compounds of a value without building
+// a tape. Names select a child of a compound and brackets select items of a
+// list or array:
+//
+//   identifier       the identifier of each root compound
+//   Pos[1]           the second item of Pos
+//   Items[*].Name    the Name of every item in Items
+//
+// Subtrees that a path does not enter are skipped by size: lists and arrays
+// of fixed-width items in one step, and nested compounds with an explicit
+// stack. A query stops as soon as its callback asks it to, and a compound
+// is left as soon as the child a path names has been visited.
+
+namespace mcberepair {
+
+struct nbt_path_step_t {
+    // the child to enter; empty for an index step
+    std::string name;
+    // the item to enter, or -1 for every item
+    int32_t index;
+    bool is_index;
+};
+
+using nbt_path_t = std::vector<nbt_path_step_t>;
+
+// Parse a path. Returns false if it is malformed. Names may not contain
+// '.', '[', or ']'.
+inline bool parse_nbt_path(std::string_view str, nbt_path_t *path) {
+    assert(path != nullptr);
+    path->clear();
+    size_t i = 0;
+    while(i < str.size()) {
+        if(str[i] == '[') {
+            auto close = str.find(']', i);
+            if(close == std::string_view::npos) {
+                return false;
+            }
+            auto inside = str.substr(i + 1, close - i - 1);
+            nbt_path_step_t step{{}, -1, true};
+            if(inside != "*") {
+                auto res = std::from_chars(
+                    inside.data(), inside.data() + inside.size(), step.index);
+                if(inside.empty() || res.ec != std::errc{} ||
+                   res.ptr != inside.data() + inside.size() || step.index < 0) {
+                    return false;
+                }
+            }
+            path->push_back(std::move(step));
+            i = close + 1;
+            if(i < str.size() && str[i] == '.') {
+                i += 1;
+                if(i == str.size()) {
+                    return false;
+                }
+            }
+            continue;
+        }
+        auto end = str.find_first_of(".[]", i);
+        if(end == std::string_view::npos) {
+            end = str.size();
+        }
+        if(end == i || (end < str.size() && str[end] == ']')) {
+            return false;
+        }
+        path->push_back({std::string{str.substr(i, end - i)}, 0, false});
+        i = end;
+        if(i < str.size() && str[i] == '.') {
+            i += 1;
+            if(i == str.size()) {
+                return false;
+            }
+        }
+    }
+    return !path->empty();
+}
+
+// A tag found by a query. `data` points at its payload in the queried buffer.
+struct nbt_value_t {
+    nbt_type type;
+    const char *data;
+    size_t size;
+
+    template <typename T>
+    T as() const {
+        T value;
+        std::memcpy(&value, data, sizeof(T));
+        return value;
+    }
+
+    // The value of a numeric tag as an integer.
+    int64_t as_integer() const {
+        switch(type) {
+            case nbt_type::BYTE:
+                return as<int8_t>();
+            case nbt_type::SHORT:
+                return as<int16_t>();
+            case nbt_type::INT:
+                return as<int32_t>();
+            case nbt_type::LONG:
+                return as<int64_t>();
+            case nbt_type::FLOAT:
+                return static_cast<int64_t>(as<float>());
+            case nbt_type::DOUBLE:
+                return static_cast<int64_t>(as<double>());
+            default:
+                return 0;
+        }
+    }
+
+    // The value of a numeric tag as a floating-point number.
+    double as_double() const {
+        switch(type) {
+            case nbt_type::FLOAT:
+                return as<float>();
+            case nbt_type::DOUBLE:
+                return as<double>();
+            default:
+                return static_cast<double>(as_integer());
+        }
+    }
+
+    // The text of a string tag.
+    std::string_view as_string() const {
+        if(type != nbt_type::STRING) {
+            return {};
+        }
+        return {data + 2, size - 2};
+    }
+};
+
+namespace detail {
+
+// The size of a fixed-width payload, or 0.
+constexpr size_t nbt_fixed_size(nbt_type type) {
+    switch(type) {
+        case nbt_type::BYTE:
+            return 1;
+        case nbt_type::SHORT:
+            return 2;
+        case nbt_type::INT:
+        case nbt_type::FLOAT:
+            return 4;
+        case nbt_type::LONG:
+        case nbt_type::DOUBLE:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+constexpr size_t nbt_array_item_size(nbt_type type) {
+    switch(type) {
+        case nbt_type::BYTE_ARRAY:
+            return 1;
+        case nbt_type::INT_ARRAY:
+            return 4;
+        case nbt_type::LONG_ARRAY:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+inline bool nbt_read_type(const char **p, const char *last, nbt_type *type) {
+    if(*p == last ||
+       static_cast<uint8_t>(**p) > static_cast<uint8_t>(nbt_type::LONG_ARRAY)) {
+        return false;
+    }
+    *type = nbt_type{static_cast<uint8_t>(**p)};
+    *p += 1;
+    return true;
+}
+
+template <typename T>
+bool nbt_read(const char **p, const char *last, T *value) {
+    if(static_cast<size_t>(last - *p) < sizeof(T)) {
+        return false;
+    }
+    std::memcpy(value, *p, sizeof(T));
+    *p += sizeof(T);
+    return true;
+}
+
+inline bool nbt_skip(const char **p, const char *last, size_t n) {
+    if(static_cast<size_t>(last - *p) < n) {
+        return false;
+    }
+    *p += n;
+    return true;
+}
+
+inline bool nbt_read_name(const char **p, const char *last,
+                          std::string_view *name) {
+    uint16_t size;
+    if(!nbt_read(p, last, &size) || static_cast<size_t>(last - *p) < size) {
+        return false;
+    }
+    *name = {*p, size};
+    *p += size;
+    return true;
+}
+
+// Skip one payload that does not contain nested tags. Returns false if
+// `type` is a list or compound or the data is truncated.
+inline bool nbt_skip_flat(const char **p, const char *last, nbt_type type) {
+    if(size_t n = nbt_fixed_size(type)) {
+        return nbt_skip(p, last, n);
+    }
+    if(size_t n = nbt_array_item_size(type)) {
+        int32_t size;
+        return nbt_read(p, last, &size) && size >= 0 &&
+               static_cast<size_t>(last - *p) / n >= static_cast<size_t>(size) &&
+               nbt_skip(p, last, n * size);
+    }
+    if(type == nbt_type::STRING) {
+        uint16_t size;
+        return nbt_read(p, last, &size) && nbt_skip(p, last, size);
+    }
+    return false;
+}
+
+}  // namespace detail
+
+// Skip over the payload of a tag of type `type` starting at *p. Returns false
+// if the data is malformed or nested deeper than kNbtMaxDepth.
+inline bool skip_nbt_payload(const char **p, const char *last, nbt_type type) {
+    using namespace detail;
+    struct frame_t {
+        nbt_type type;
+        int32_t remaining;  // -1 for a compound
+    };
+    // a fixed stack on the call stack, so skipping never allocates
+    frame_t stack[kNbtMaxDepth];
+    size_t depth = 0;
+    auto open = [&](nbt_type t) -> bool {
+        if(depth == kNbtMaxDepth) {
+            return false;
+        }
+        if(t == nbt_type::COMPOUND) {
+            stack[depth++] = {t, -1};
+            return true;
+        }
+        nbt_type item;
+        int32_t size;
+        if(!nbt_read_type(p, last, &item) || !nbt_read(p, last, &size) ||
+           size < 0 || (item == nbt_type::END && size != 0)) {
+            return false;
+        }
+        if(size_t n = nbt_fixed_size(item)) {
+            // lists of numbers are skipped in one step
+            return static_cast<size_t>(last - *p) / n >=
+                       static_cast<size_t>(size) &&
+                   nbt_skip(p, last, n * size);
+        }
+        stack[depth++] = {item, size};
+        return true;
+    };
+    auto skip_one = [&](nbt_type t) -> bool {
+        if(t == nbt_type::COMPOUND || t == nbt_type::LIST) {
+            return open(t);
+        }
+        return nbt_skip_flat(p, last, t);
+    };
+
+    if(!skip_one(type)) {
+        return false;
+    }
+    while(depth > 0) {
+        auto &frame = stack[depth - 1];
+        if(frame.remaining < 0) {
+            nbt_type t;
+            std::string_view name;
+            if(!nbt_read_type(p, last, &t)) {
+                return false;
+            }
+            if(t == nbt_type::END) {
+                depth -= 1;
+                continue;
+            }
+            if(!nbt_read_name(p, last, &name) || !skip_one(t)) {
+                return false;
+            }
+        } else if(frame.remaining == 0) {
+            depth -= 1;
+        } else {
+            frame.remaining -= 1;
+            if(!skip_one(frame.type)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+namespace detail {
+
+// Visit every match of path[step...] in the payload at *p, then leave *p
+// after the payload. Returns false if the data is malformed; sets *stop if
+// the callback asked to stop.
+template <typename F>
+bool nbt_query_payload(const char **p, const char *last, nbt_type type,
+                       const nbt_path_t &path, size_t step, F &visit,
+                       bool *stop) {
+    const char *start = *p;
+    if(step == path.size()) {
+        if(!skip_nbt_payload(p, last, type)) {
+            return false;
+        }
+        *stop = !visit(nbt_value_t{type, start, static_cast<size_t>(*p - start)});
+        return true;
+    }
+    auto &want = path[step];
+    if(!want.is_index) {
+        if(type != nbt_type::COMPOUND) {
+            return skip_nbt_payload(p, last, type);
+        }
+        while(true) {
+            nbt_type t;
+            std::string_view name;
+            if(!nbt_read_type(p, last, &t)) {
+                return false;
+            }
+            if(t == nbt_type::END) {
+                return true;
+            }
+            if(!nbt_read_name(p, last, &name)) {
+                return false;
+            }
+            if(name == want.name) {
+                if(!nbt_query_payload(p, last, t, path, step + 1, visit,
+                                      stop)) {
+                    return false;
+                }
+                if(*stop) {
+                    return true;
+                }
+                // names are unique, so the rest of the compound is skipped
+                // without comparing names
+                while(nbt_read_type(p, last, &t)) {
+                    if(t == nbt_type::END) {
+                        return true;
+                    }
+                    if(!nbt_read_name(p, last, &name) ||
+                       !skip_nbt_payload(p, last, t)) {
+                        return false;
+                    }
+                }
+                return false;
+            }
+            if(!skip_nbt_payload(p, last, t)) {
+                return false;
+            }
+        }
+    }
+
+    nbt_type item;
+    int32_t size;
+    if(size_t n = nbt_array_item_size(type)) {
+        item = n == 1 ? nbt_type::BYTE
+                      : (n == 4 ? nbt_type::INT : nbt_type::LONG);
+    } else if(type == nbt_type::LIST) {
+        if(!nbt_read_type(p, last, &item)) {
+            return false;
+        }
+    } else {
+        return skip_nbt_payload(p, last, type);
+    }
+    if(!nbt_read(p, last, &size) || size < 0) {
+        return false;
+    }
+    const char *items = *p;
+    size_t width = nbt_fixed_size(item);
+    auto skip_items = [&](int32_t count) -> bool {
+        if(width != 0) {
+            return static_cast<size_t>(last - *p) / width >=
+                       static_cast<size_t>(count) &&
+                   nbt_skip(p, last, width * count);
+        }
+        for(int32_t i = 0; i < count; ++i) {
+            if(!skip_nbt_payload(p, last, item)) {
+                return false;
+            }
+        }
+        return true;
+    };
+    int32_t first = want.index < 0 ? 0 : want.index;
+    int32_t end = want.index < 0 || want.index >= size ? size : want.index + 1;
+    // fixed-width items are found by offset
+    if(!skip_items(std::min(first, size))) {
+        return false;
+    }
+    for(int32_t i = first; i < end; ++i) {
+        if(!nbt_query_payload(p, last, item, path, step + 1, visit, stop)) {
+            return false;
+        }
+        if(*stop) {
+            return true;
+        }
+    }
+    if(end < size) {
+        if(width != 0) {
+            // go back to the first item so the whole list is skipped at once
+            *p = items;
+            return skip_items(size);
+        }
+        return skip_items(size - end);
+    }
+    return true;
+}
+
+}  // namespace detail
+
+// Call `visit(nbt_value_t)` for each tag that `path` selects in the root
+// compounds of [first, first+length). `visit` returns false to stop the
+// query. Returns false if the data is malformed.
+template <typename F>
+bool query_nbt(const char *first, size_t length, const nbt_path_t &path,
+               F &&visit) {
+    const char *p = first;
+    const char *last = first + length;
+    bool stop = false;
+    while(p != last && !stop) {
+        nbt_type type;
+        std::string_view name;
+        if(!detail::nbt_read_type(&p, last, &type) ||
+           type == nbt_type::END || !detail::nbt_read_name(&p, last, &name) ||
+           !detail::nbt_query_payload(&p, last, type, path, 0, visit, &stop)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Find the first tag that `path` selects. Returns false if there is none or
+// the data is malformed before one is found.
+inline bool find_nbt(const char *first, size_t length, const nbt_path_t &path,
+                     nbt_value_t *out) {
+    bool found = false;
+    query_nbt(first, length, path, [&](const nbt_value_t &value) {
+        *out = value;
+        found = true;
+        return false;
+    });
+    return found;
+}
+
+// Find the first tag that `path` selects below `parent`, a tag returned by
+// an earlier query. An empty path visits each root, and this looks up the
+// fields of one root at a time.
+inline bool find_nbt(const nbt_value_t &parent, const nbt_path_t &path,
+                     nbt_value_t *out) {
+    const char *p = parent.data;
+    bool found = false;
+    bool stop = false;
+    auto visit = [&](const nbt_value_t &value) {
+        *out = value;
+        found = true;
+        return false;
+    };
+    detail::nbt_query_payload(&p, parent.data + parent.size, parent.type, path,
+                              0, visit, &stop);
+    return found;
+}
+
+// Encode `text` as the payload of a numeric tag of type `type`. Returns the
+// size of the payload, or 0 if `type` is not numeric or cannot hold `text`.
+inline size_t encode_nbt_number(nbt_type type, std::string_view text,
+                                char out[8]) {
+    size_t size = detail::nbt_fixed_size(type);
+    if(size == 0 || text.empty()) {
+        return 0;
+    }
+    if(type == nbt_type::FLOAT || type == nbt_type::DOUBLE) {
+        std::string buf{text};
+        char *end = nullptr;
+        double v = std::strtod(buf.c_str(), &end);
+        if(*end != '\0') {
+            return 0;
+        }
+        if(type == nbt_type::FLOAT) {
+            auto f = static_cast<float>(v);
+            std::memcpy(out, &f, 4);
+        } else {
+            std::memcpy(out, &v, 8);
+        }
+        return size;
+    }
+    long long v;
+    auto res = std::from_chars(text.data(), text.data() + text.size(), v);
+    if(res.ec != std::errc{} || res.ptr != text.data() + text.size()) {
+        return 0;
+    }
+    // the value must fit in the tag
+    int bits = static_cast<int>(8 * size);
+    if(bits < 64 && (v < -(1LL << (bits - 1)) || v >= (1LL << (bits - 1)))) {
+        return 0;
+    }
+    // integers are little-endian, like the host
+    switch(size) {
+        case 1: {
+            auto i = static_cast<int8_t>(v);
+            std::memcpy(out, &i, 1);
+            break;
+        }
+        case 2: {
+            auto i = static_cast<int16_t>(v);
+            std::memcpy(out, &i, 2);
+            break;
+        }
+        case 4: {
+            auto i = static_cast<int32_t>(v);
+            std::memcpy(out, &i, 4);
+            break;
+        }
+        default: {
+            auto i = static_cast<int64_t>(v);
+            std::memcpy(out, &i, 8);
+            break;
+        }
+    }
+    return size;
+}
+
+// Set every tag that `path` selects in `value` to `text`. Numbers are
+// overwritten in place, so the value keeps its size and nothing else is
+// touched. Strings can change size, so if any are selected the value is
+// read into a tape and written again with the new strings.
+//
+// Returns false, leaving `value` unchanged, if it is malformed, a selected
+// tag is not a number or a string, or `text` does not fit a selected tag.
+// Otherwise sets `*changed` to the number of tags whose bytes changed.
+inline bool patch_nbt(std::string *value, const nbt_path_t &path,
+                      std::string_view text, size_t *changed) {
+    assert(value != nullptr && changed != nullptr);
+    struct patch_t {
+        size_t offset;
+        nbt_type type;
+    };
+    std::vector<patch_t> patches;
+    bool ok = query_nbt(value->data(), value->size(), path,
+                        [&](const nbt_value_t &match) {
+                            patches.push_back(
+                                {static_cast<size_t>(match.data - value->data()),
+                                 match.type});
+                            return true;
+                        });
+    if(!ok) {
+        return false;
+    }
+    char number[8];
+    bool has_strings = false;
+    for(auto &&patch : patches) {
+        if(patch.type == nbt_type::STRING) {
+            has_strings = true;
+            if(text.size() > UINT16_MAX) {
+                return false;
+            }
+        } else if(encode_nbt_number(patch.type, text, number) == 0) {
+            return false;
+        }
+    }
+
+    *changed = 0;
+    for(auto &&patch : patches) {
+        size_t size = encode_nbt_number(patch.type, text, number);
+        if(size == 0) {
+            continue;
+        }
+        char *p = value->data() + patch.offset;
+        if(std::memcmp(p, number, size) != 0) {
+            std::memcpy(p, number, size);
+            *changed += 1;
+        }
+    }
+    if(!has_strings) {
+        return true;
+    }
+
+    NbtReader reader;
+    reader.Read(value->data(), value->size());
+    std::vector<nbt_t> tape = reader.tape();
+    size_t next = 0;
+    for(auto &&tag : tape) {
+        auto *str = std::get_if<nbt_string_t>(&tag.payload);
+        if(str == nullptr) {
+            continue;
+        }
+        // the patches are in the same order as the tape
+        auto offset = static_cast<size_t>(str->data - value->data()) - 2;
+        while(next < patches.size() &&
+              (patches[next].offset < offset ||
+               patches[next].type != nbt_type::STRING)) {
+            ++next;
+        }
+        if(next == patches.size() || patches[next].offset != offset) {
+            continue;
+        }
+        if(std::string_view{str->data, str->size} != text) {
+            str->size = static_cast<uint16_t>(text.size());
+            str->data = const_cast<char *>(text.data());
+            *changed += 1;
+        }
+    }
+    std::string out;
+    out.reserve(value->size() + text.size());
+    write_nbt(tape, &out);
+    *value = std::move(out);
+    return true;
+}
+
+}  // namespace mcberepair
+
+#endif  // MCBEREPAIR_NBTPATH_HPP
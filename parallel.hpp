@@ -0,0 +1,79 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+#ifndef MCBEREPAIR_PARALLEL_HPP
+#define MCBEREPAIR_PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace mcberepair {
+
+// the number of threads to use when the user asks for "all of them"
+inline unsigned int default_threads() {
+    unsigned int n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+// Call func(i, worker) for every i in [0, n) using up to `threads` threads.
+// `worker` is in [0, threads) and names the thread that runs the task, so
+// each thread can fill its own state. Tasks are handed out in order, and the
+// calling thread does work too as worker 0.
+template <typename F>
+void parallel_for_workers(size_t n, unsigned int threads, F &&func) {
+    if(threads <= 1 || n <= 1) {
+        for(size_t i = 0; i < n; ++i) {
+            func(i, 0u);
+        }
+        return;
+    }
+    std::atomic<size_t> next{0};
+    auto worker = [&](unsigned int w) {
+        for(size_t i = next++; i < n; i = next++) {
+            func(i, w);
+        }
+    };
+    std::vector<std::thread> pool;
+    size_t extra = std::min<size_t>(threads, n) - 1;
+    pool.reserve(extra);
+    for(size_t t = 0; t < extra; ++t) {
+        pool.emplace_back(worker, static_cast<unsigned int>(t + 1));
+    }
+    worker(0u);
+    for(auto &&t : pool) {
+        t.join();
+    }
+}
+
+// Call func(i) for every i in [0, n) using up to `threads` threads. Tasks are
+// handed out in order, and the calling thread does work too.
+template <typename F>
+void parallel_for(size_t n, unsigned int threads, F &&func) {
+    parallel_for_workers(n, threads,
+                         [&](size_t i, unsigned int) { func(i); });
+}
+
+}  // namespace mcberepair
+
+#endif  // MCBEREPAIR_PARALLEL_HPP
@@ -0,0 +1,269 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "args.hpp"
+#include "db.hpp"
+#include "leveldb/write_batch.h"
+#include "mcbekey.hpp"
+#include "nbtpath.hpp"
+#include "seekplan.hpp"
+
+namespace {
+
+// Patches values and writes the ones that changed back in batches of
+// roughly a fixed size.
+class Patcher {
+   public:
+    Patcher(leveldb::DB *db, const mcberepair::nbt_path_t &path,
+            std::string_view text, size_t batch_size)
+        : db_{db}, path_{path}, text_{text}, batch_size_{batch_size} {}
+
+    // Patch `value`, which is stored under `key`, and queue it to be written
+    // if it changed. Values that cannot be patched are counted and skipped.
+    leveldb::Status Patch(const leveldb::Slice &key, std::string *value) {
+        values_ += 1;
+        size_t changed = 0;
+        if(!mcberepair::patch_nbt(value, path_, text_, &changed)) {
+            failed_ += 1;
+            return {};
+        }
+        if(changed == 0) {
+            return {};
+        }
+        tags_ += changed;
+        patched_ += 1;
+        mcberepair::stats().AddKeys(1, key.size() + value->size());
+        batch_.Put(key, *value);
+        if(batch_.ApproximateSize() >= batch_size_) {
+            return Flush();
+        }
+        return {};
+    }
+
+    leveldb::Status Flush() {
+        if(batch_.ApproximateSize() <= kEmptyBatchSize) {
+            return {};
+        }
+        mcberepair::ScopedPhase phase{mcberepair::Phase::kWrite};
+        leveldb::Status status = db_->Write({}, &batch_);
+        batch_.Clear();
+        return status;
+    }
+
+    uint64_t values() const { return values_; }
+    uint64_t patched() const { return patched_; }
+    uint64_t tags() const { return tags_; }
+    uint64_t failed() const { return failed_; }
+
+   protected:
+    // the size of a WriteBatch header
+    static constexpr size_t kEmptyBatchSize = 12;
+
+    leveldb::DB *db_;
+    const mcberepair::nbt_path_t &path_;
+    std::string_view text_;
+    size_t batch_size_;
+    leveldb::WriteBatch batch_;
+    uint64_t values_{0};
+    uint64_t patched_{0};
+    uint64_t tags_{0};
+    uint64_t failed_{0};
+};
+
+}  // namespace
+
+int patchnbt_main(int argc, char *argv[]) {
+    mcberepair::Args args{argc, argv};
+    if(args.size() < 1 || strcmp("help", argv[1]) == 0) {
+        printf(
+            "Usage: %s patchnbt <minecraft_world_dir> --path=PATH --value=V "
+            "<key> <key> ...\n",
+            argv[0]);
+        printf(
+            "       %s patchnbt <minecraft_world_dir> --path=PATH --value=V "
+            "--tag=N\n",
+            argv[0]);
+        printf(
+            "       %s patchnbt <minecraft_world_dir> --path=PATH --value=V "
+            "--prefix=KEY\n",
+            argv[0]);
+        printf("\n");
+        printf("Options:\n");
+        printf(
+            "  --path=PATH       The tags to set, such as 'Pos[1]' or "
+            "'Items[*].Count'.\n");
+        printf(
+            "  --value=V         The new value. Every selected tag must be a "
+            "number that\n"
+            "                    can hold V or a string.\n");
+        printf(
+            "  --tag=N           Patch every value stored under chunk tag "
+            "N.\n");
+        printf(
+            "  --prefix=KEY      Patch every value whose key starts with the "
+            "encoded key KEY.\n");
+        printf(
+            "  --batch-size=N    Write values in batches of about N bytes "
+            "(default 4 MB).\n");
+        return EXIT_FAILURE;
+    }
+    std::string bad_option;
+    if(args.unknown({"path", "value", "tag", "prefix", "batch-size"},
+                    &bad_option)) {
+        fprintf(stderr, "ERROR: Unknown option '--%s'.\n", bad_option.c_str());
+        return EXIT_FAILURE;
+    }
+    mcberepair::nbt_path_t nbt_path;
+    if(!args.has("path") || !args.has("value")) {
+        fprintf(stderr, "ERROR: --path and --value are required.\n");
+        return EXIT_FAILURE;
+    }
+    if(!mcberepair::parse_nbt_path(args.value("path"), &nbt_path)) {
+        fprintf(stderr, "ERROR: The path '%s' is malformed.\n",
+                std::string{args.value("path")}.c_str());
+        return EXIT_FAILURE;
+    }
+    int tag = -1;
+    if(!args.number("tag", &tag) || (args.has("tag") && (tag < 0 || tag > 255))) {
+        fprintf(stderr, "ERROR: Invalid value for '--tag'.\n");
+        return EXIT_FAILURE;
+    }
+    size_t batch_size = 4 * 1024 * 1024;
+    if(!args.number("batch-size", &batch_size) || batch_size == 0) {
+        fprintf(stderr, "ERROR: --batch-size must be a positive integer.\n");
+        return EXIT_FAILURE;
+    }
+    std::string prefix;
+    bool have_prefix = args.has("prefix");
+    if(have_prefix &&
+       (!mcberepair::decode_key(args.value("prefix"), &prefix) ||
+        prefix.empty())) {
+        fprintf(stderr, "ERROR: The prefix is empty or malformed.\n");
+        return EXIT_FAILURE;
+    }
+    int selections = args.has("tag") + have_prefix + (args.size() > 1);
+    if(selections != 1) {
+        fprintf(stderr,
+                "ERROR: Select values with keys, --tag, or --prefix, and only "
+                "one of them.\n");
+        return EXIT_FAILURE;
+    }
+    std::vector<std::string> keys;
+    for(size_t i = 1; i < args.size(); ++i) {
+        std::string key;
+        if(!mcberepair::decode_key(args[i], &key)) {
+            fprintf(stderr, "ERROR: key '%s' is malformed\n", args[i]);
+            return EXIT_FAILURE;
+        }
+        keys.push_back(std::move(key));
+    }
+
+    // construct path for Minecraft BE database
+    std::string path = std::string(args[0]) + "/db";
+    mcberepair::DB db{path.c_str()};
+    if(!db) {
+        fprintf(stderr, "ERROR: Opening '%s' failed.\n", path.c_str());
+        return EXIT_FAILURE;
+    }
+
+    Patcher patcher{&db(), nbt_path, args.value("value"), batch_size};
+    leveldb::Status status;
+    leveldb::ReadOptions readOptions;
+    leveldb::DecompressAllocator decompress_allocator;
+    readOptions.decompress_allocator = &decompress_allocator;
+    readOptions.verify_checksums = true;
+    readOptions.fill_cache = false;
+    std::string value;
+
+    if(keys.empty()) {
+        // Patched values go into batches while an iterator sweeps the
+        // selection. The iterator reads from an implicit snapshot, so it
+        // does not see the writes.
+        mcberepair::ScopedPhase scan_phase{mcberepair::Phase::kScan};
+        auto it =
+            std::unique_ptr<leveldb::Iterator>{db().NewIterator(readOptions)};
+        std::vector<mcberepair::key_range_t> ranges;
+        if(have_prefix) {
+            ranges.push_back(mcberepair::prefix_range(prefix));
+        } else {
+            ranges.push_back({});
+        }
+        mcberepair::scan_ranges(
+            it.get(), ranges, [&](leveldb::Iterator *iter) -> bool {
+                auto key = iter->key();
+                std::string_view skey{key.data(), key.size()};
+                if(tag >= 0 && (!mcberepair::is_chunk_key(skey) ||
+                                mcberepair::parse_chunk_key(skey).tag !=
+                                    static_cast<char>(tag))) {
+                    return true;
+                }
+                value.assign(iter->value().data(), iter->value().size());
+                status = patcher.Patch(key, &value);
+                return status.ok();
+            });
+        if(status.ok() && !it->status().ok()) {
+            status = it->status();  // LCOV_EXCL_LINE
+        }
+    } else {
+        for(auto &&key : keys) {
+            leveldb::Status read = db().Get(readOptions, key, &value);
+            if(!read.ok()) {
+                std::string encoded;
+                mcberepair::append_encoded_key(key, &encoded);
+                fprintf(stderr, "Skipping missing key '%s'...\n",
+                        encoded.c_str());
+                continue;
+            }
+            status = patcher.Patch(key, &value);
+            if(!status.ok()) {
+                break;  // LCOV_EXCL_LINE
+            }
+        }
+    }
+    if(status.ok()) {
+        status = patcher.Flush();
+    }
+    if(!status.ok()) {
+        // LCOV_EXCL_START
+        fprintf(stderr, "ERROR: Writing '%s' failed: %s\n", path.c_str(),
+                status.ToString().c_str());
+        return EXIT_FAILURE;
+        // LCOV_EXCL_STOP
+    }
+
+    printf("Patched %llu tags in %llu of %llu values.\n",
+           static_cast<unsigned long long>(patcher.tags()),
+           static_cast<unsigned long long>(patcher.patched()),
+           static_cast<unsigned long long>(patcher.values()));
+    if(patcher.failed() > 0) {
+        printf("%llu values were malformed or could not hold '%s'.\n",
+               static_cast<unsigned long long>(patcher.failed()),
+               std::string{args.value("value")}.c_str());
+    }
+    return EXIT_SUCCESS;
+}
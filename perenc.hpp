@@ -24,42 +24,119 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <string>
 #include <string_view>
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MCBEREPAIR_PERENC_SSE2 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define MCBEREPAIR_PERENC_NEON 1
+#endif
+
 namespace mcberepair {
 
 std::string percent_encode(std::string_view str);
 bool percent_decode(std::string *str);
 
-inline std::string percent_encode(std::string_view str) {
-    auto is_notgraph = [](unsigned char c) {
-        return std::isgraph(c) == 0 || c == '%' || c == '@';
-    };
+// Bytes outside of printable ASCII, '%', and '@' are percent encoded.
+inline bool percent_needs_escape(unsigned char c) {
+    return c < 0x21 || c > 0x7E || c == '%' || c == '@';
+}
 
+// Return a pointer to the first byte in [first, last) that must be escaped,
+// or last if there is none. Sixteen bytes are tested at a time where SIMD is
+// available.
+inline const char *percent_find_escape(const char *first, const char *last) {
+#if defined(MCBEREPAIR_PERENC_SSE2)
+    const __m128i lo = _mm_set1_epi8(0x21);
+    const __m128i hi = _mm_set1_epi8(0x7E);
+    const __m128i pct = _mm_set1_epi8('%');
+    const __m128i at = _mm_set1_epi8('@');
+    for(; last - first >= 16; first += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+        // signed compares also catch every byte >= 0x80
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(_mm_cmplt_epi8(v, lo), _mm_cmpgt_epi8(v, hi)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, pct), _mm_cmpeq_epi8(v, at)));
+        int mask = _mm_movemask_epi8(m);
+        if(mask != 0) {
+            int n = 0;
+            while((mask & 1) == 0) {
+                mask >>= 1;
+                ++n;
+            }
+            return first + n;
+        }
+    }
+#elif defined(MCBEREPAIR_PERENC_NEON)
+    const uint8x16_t lo = vdupq_n_u8(0x21);
+    const uint8x16_t hi = vdupq_n_u8(0x7E);
+    const uint8x16_t pct = vdupq_n_u8('%');
+    const uint8x16_t at = vdupq_n_u8('@');
+    for(; last - first >= 16; first += 16) {
+        uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t *>(first));
+        uint8x16_t m =
+            vorrq_u8(vorrq_u8(vcltq_u8(v, lo), vcgtq_u8(v, hi)),
+                     vorrq_u8(vceqq_u8(v, pct), vceqq_u8(v, at)));
+        if(vmaxvq_u8(m) != 0) {
+            break;
+        }
+    }
+#endif
+    for(; first != last; ++first) {
+        if(percent_needs_escape(static_cast<unsigned char>(*first))) {
+            break;
+        }
+    }
+    return first;
+}
+
+// The largest number of bytes that percent encoding `size` bytes can produce.
+constexpr size_t percent_encode_max_size(size_t size) { return 3 * size; }
+
+// Percent encode `str` into [first, last). Returns a pointer past the last
+// byte written or nullptr if the buffer is too small.
+inline char *percent_encode(std::string_view str, char *first, char *last) {
+    static const char hex[] = "0123456789ABCDEF";
+    const char *p = str.data();
+    const char *end = p + str.size();
+    while(p != end) {
+        const char *q = percent_find_escape(p, end);
+        size_t n = q - p;
+        if(static_cast<size_t>(last - first) < n) {
+            return nullptr;
+        }
+        std::memcpy(first, p, n);
+        first += n;
+        if(q == end) {
+            break;
+        }
+        if(last - first < 3) {
+            return nullptr;
+        }
+        auto c = static_cast<unsigned char>(*q);
+        first[0] = '%';
+        first[1] = hex[c >> 4];
+        first[2] = hex[c & 0xF];
+        first += 3;
+        p = q + 1;
+    }
+    return first;
+}
+
+inline std::string percent_encode(std::string_view str) {
     // optimize for situation in which no encoding is needed
-    auto it = std::find_if(str.begin(), str.end(), is_notgraph);
-    if(it == str.end()) {
+    const char *it = percent_find_escape(str.data(), str.data() + str.size());
+    if(it == str.data() + str.size()) {
         return std::string{str};
     }
-    char buffer[8];
-    // setup return value
-    std::string ret;
-    ret.reserve(str.size());
-    auto bit = str.begin();
-    do {
-        // Append sequences and encoded character
-        unsigned char c = *it;
-        std::snprintf(buffer, 8, "%%%02hhX", c);
-        ret.append(bit, it);
-        ret.append(buffer);
-        // Find next character to encode
-        bit = ++it;
-        it = std::find_if(it, str.end(), is_notgraph);
-    } while(it != str.end());
-    // Append tail
-    ret.append(bit, str.end());
-
+    std::string ret(percent_encode_max_size(str.size()), '\0');
+    char *end = percent_encode(str, ret.data(), ret.data() + ret.size());
+    ret.resize(end - ret.data());
     return ret;
 }
 
@@ -76,43 +153,53 @@ inline int hex_decode(char x) {
     return -1;
 }
 
-inline bool percent_decode_core(std::string *str, size_t start) {
-    assert(str != nullptr);
-    assert(start < str->size());
-    assert((*str)[start] == '%');
-    auto p = str->begin() + start;
-    auto q = p;
-    do {
-        assert(*p == '%');
-        if(++p == str->end()) {
-            return false;
+// Percent decode `str` into [first, last). Decoding never makes a string
+// longer. Returns a pointer past the last byte written or nullptr if `str` is
+// malformed or the buffer is too small. The buffer may alias `str`.
+inline char *percent_decode(std::string_view str, char *first, char *last) {
+    const char *p = str.data();
+    const char *end = p + str.size();
+    while(p != end) {
+        auto q = static_cast<const char *>(std::memchr(p, '%', end - p));
+        if(q == nullptr) {
+            q = end;
         }
-        int a = hex_decode(*p);
-        if(++p == str->end()) {
-            return false;
+        size_t n = q - p;
+        if(static_cast<size_t>(last - first) < n) {
+            return nullptr;
         }
-        int b = hex_decode(*p);
-        if(a == -1 || b == -1) {
-            return false;
+        std::memmove(first, p, n);
+        first += n;
+        if(q == end) {
+            break;
         }
-        *q++ = a * 16 + b;
-        for(++p; p != str->end(); ++p) {
-            if(*p == '%') {
-                break;
-            }
-            *q++ = *p;
+        if(end - q < 3 || first == last) {
+            return nullptr;
         }
-    } while(p != str->end());
-    str->erase(q, str->end());
-    return true;
+        int a = hex_decode(q[1]);
+        int b = hex_decode(q[2]);
+        if(a == -1 || b == -1) {
+            return nullptr;
+        }
+        *first++ = static_cast<char>(a * 16 + b);
+        p = q + 3;
+    }
+    return first;
 }
 
 inline bool percent_decode(std::string *str) {
     assert(str != nullptr);
     auto pos = str->find('%');
-    if(pos != std::string::npos) {
-        return percent_decode_core(str, pos);
+    if(pos == std::string::npos) {
+        return true;
+    }
+    char *first = str->data() + pos;
+    char *end = percent_decode({first, str->size() - pos}, first,
+                               str->data() + str->size());
+    if(end == nullptr) {
+        return false;
     }
+    str->resize(end - str->data());
     return true;
 }
 
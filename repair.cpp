@@ -20,38 +20,616 @@
 # SOFTWARE.
 */
 
-#include <cassert>
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstring>
-#include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "args.hpp"
+#include "bulkload.hpp"
 #include "db.hpp"
-#include "mcbekey.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "tablefile.hpp"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// A table or log of the damaged database and what repairing it found.
+struct file_t {
+    uint64_t number;
+    leveldb::FileType type;
+    std::string name;
+    int level{0};
+
+    uint64_t records{0};
+    uint64_t bytes{0};
+    uint64_t blocks{0};
+    uint64_t corrupt_blocks{0};
+    uint64_t salvaged{0};
+    leveldb::SequenceNumber max_sequence{0};
+    leveldb::InternalKey smallest;
+    leveldb::InternalKey largest;
+    // the first problem found, if any
+    leveldb::Status status;
+
+    // The table that holds the records in the repaired database, or 0 if
+    // none were recovered. Intact tables keep their file when repairing in
+    // place.
+    uint64_t out_number{0};
+    uint64_t out_size{0};
+};
+
+struct options_t {
+    std::string path;
+    std::string out_path;
+    bool salvage;
+    unsigned int threads;
+};
+
+// Walk every block of a table and call func(internal_key, value) for the
+// records that can be read, in order. Blocks that fail their checksum or do
+// not decompress are dropped, or with `salvage` searched for entries that
+// are still whole. Returns the first problem found.
+template <typename F>
+leveldb::Status read_table(const mcberepair::TableFiles &files, file_t *f,
+                           bool salvage, F &&func) {
+    std::unique_ptr<leveldb::RandomAccessFile> file;
+    uint64_t size = 0;
+    leveldb::Status status = files.OpenFile(f->number, &file, &size);
+    if(!status.ok()) {
+        return status;  // LCOV_EXCL_LINE
+    }
+    std::vector<mcberepair::table_block_t> blocks;
+    status = files.ReadIndex(file.get(), size, salvage, &blocks);
+    if(!status.ok() && !salvage) {
+        return status;
+    }
+    const auto &icmp = files.comparator();
+    f->records = f->bytes = f->corrupt_blocks = f->salvaged = 0;
+    f->blocks = blocks.size();
+    std::string raw, buffer, last;
+    for(auto &&b : blocks) {
+        auto block = files.ReadBlock(file.get(), b.offset, b.size, salvage,
+                                     &raw, &buffer);
+        if(!block.status.ok()) {
+            f->corrupt_blocks += 1;
+            if(status.ok()) {
+                status = block.status;
+            }
+            if(!salvage) {
+                continue;
+            }
+        }
+        using trust_t = mcberepair::block_trust_t;
+        auto trust = !block.decompressed ? trust_t::kTruncated
+                     : !block.checksum_ok ? trust_t::kDamaged
+                                          : trust_t::kChecked;
+        uint64_t before = f->records;
+        bool clean = mcberepair::parse_block(
+            block.contents, trust,
+            [&](const leveldb::Slice &key, const leveldb::Slice &value) {
+                // Entries of a damaged block may be garbage that happens to
+                // parse, so each must be an internal key that falls in order
+                // and within the bounds the index gives the block.
+                leveldb::ParsedInternalKey ikey;
+                if(!leveldb::ParseInternalKey(key, &ikey) ||
+                   (!last.empty() && icmp.Compare(key, last) <= 0) ||
+                   icmp.Compare(key, b.last_key) > 0) {
+                    return false;
+                }
+                if(last.empty()) {
+                    f->smallest.DecodeFrom(key);
+                }
+                last.assign(key.data(), key.size());
+                f->max_sequence = std::max(f->max_sequence, ikey.sequence);
+                f->records += 1;
+                f->bytes += key.size() + value.size();
+                func(key, value);
+                return true;
+            });
+        if(block.status.ok() && !clean) {
+            f->corrupt_blocks += 1;
+            if(status.ok()) {
+                status = leveldb::Status::Corruption("malformed block");
+            }
+        }
+        if(!block.status.ok()) {
+            f->salvaged += f->records - before;
+        }
+    }
+    if(!last.empty()) {
+        f->largest.DecodeFrom(last);
+    }
+    return status;
+}
+
+// Writes the records of one table of the repaired database.
+class TableWriter {
+   public:
+    TableWriter(const leveldb::Options &options, std::string name)
+        : options_{options}, name_{std::move(name)} {}
+
+    ~TableWriter() {
+        if(builder_) {
+            builder_->Abandon();
+        }
+    }
+
+    leveldb::Status Open() {
+        leveldb::WritableFile *pfile = nullptr;
+        leveldb::Status status = options_.env->NewWritableFile(name_, &pfile);
+        if(!status.ok()) {
+            return status;  // LCOV_EXCL_LINE
+        }
+        file_.reset(pfile);
+        builder_ = std::make_unique<leveldb::TableBuilder>(options_, pfile);
+        return status;
+    }
+
+    void Add(const leveldb::Slice &key, const leveldb::Slice &value) {
+        builder_->Add(key, value);
+    }
+
+    // Finish the table, or remove it if it is empty. Returns its size.
+    leveldb::Status Finish(uint64_t *size) {
+        *size = 0;
+        if(builder_->NumEntries() == 0) {
+            builder_->Abandon();
+            builder_.reset();
+            file_->Close();
+            file_.reset();
+            return options_.env->DeleteFile(name_);
+        }
+        leveldb::Status status = builder_->Finish();
+        *size = builder_->FileSize();
+        builder_.reset();
+        if(status.ok()) {
+            status = file_->Sync();
+        }
+        if(status.ok()) {
+            status = file_->Close();
+        }
+        file_.reset();
+        return status;
+    }
+
+   protected:
+    const leveldb::Options &options_;
+    std::string name_;
+    std::unique_ptr<leveldb::WritableFile> file_;
+    std::unique_ptr<leveldb::TableBuilder> builder_;
+};
+
+leveldb::Status copy_file(leveldb::Env *env, const std::string &from,
+                          const std::string &to) {
+    leveldb::SequentialFile *pin = nullptr;
+    leveldb::Status status = env->NewSequentialFile(from, &pin);
+    if(!status.ok()) {
+        return status;  // LCOV_EXCL_LINE
+    }
+    std::unique_ptr<leveldb::SequentialFile> in{pin};
+    leveldb::WritableFile *pout = nullptr;
+    status = env->NewWritableFile(to, &pout);
+    if(!status.ok()) {
+        return status;  // LCOV_EXCL_LINE
+    }
+    std::unique_ptr<leveldb::WritableFile> out{pout};
+    std::string buffer(1024 * 1024, '\0');
+    leveldb::Slice data;
+    do {
+        status = in->Read(buffer.size(), &data, &buffer[0]);
+        if(status.ok() && !data.empty()) {
+            status = out->Append(data);
+        }
+    } while(status.ok() && !data.empty());
+    if(status.ok()) {
+        status = out->Sync();
+    }
+    if(status.ok()) {
+        status = out->Close();
+    }
+    return status;
+}
+
+// Recover the records of one table. A table that is intact is kept as it
+// is, or copied when salvaging into a new database; any other is rewritten
+// with the records that could be read.
+void repair_table(const mcberepair::TableFiles &files,
+                  const leveldb::Options &out_options,
+                  const options_t &options, file_t *f) {
+    f->status =
+        read_table(files, f, options.salvage,
+                   [](const leveldb::Slice &, const leveldb::Slice &) {});
+    if(f->records == 0) {
+        f->out_number = 0;
+        return;
+    }
+    std::string name = leveldb::TableFileName(options.out_path, f->out_number);
+    if(f->status.ok()) {
+        leveldb::Status s = files.env()->GetFileSize(f->name, &f->out_size);
+        if(options.out_path == options.path) {
+            f->out_number = f->number;
+        } else if(s.ok()) {
+            s = copy_file(files.env(), f->name, name);
+        }
+        if(!s.ok()) {
+            // LCOV_EXCL_START
+            f->status = s;
+            f->out_number = 0;
+            // LCOV_EXCL_STOP
+        }
+        return;
+    }
+    // read the table again and write whatever the first pass recovered
+    TableWriter writer{out_options, name};
+    leveldb::Status s = writer.Open();
+    if(s.ok()) {
+        read_table(files, f, options.salvage,
+                   [&](const leveldb::Slice &key, const leveldb::Slice &value) {
+                       writer.Add(key, value);
+                   });
+        s = writer.Finish(&f->out_size);
+    }
+    if(!s.ok() || f->out_size == 0) {
+        // LCOV_EXCL_START
+        f->out_number = 0;
+        return;
+        // LCOV_EXCL_STOP
+    }
+    // Like leveldb's own repair, a table rewritten in place takes the number
+    // of the one it replaces, which is moved into lost/. Tables that were
+    // kept have their old numbers too, so level 0 still searches them newest
+    // first.
+    if(options.out_path == options.path) {
+        std::string name_in_lost =
+            options.path + "/lost" + f->name.substr(f->name.rfind('/'));
+        s = files.env()->RenameFile(f->name, name_in_lost);
+        if(s.ok()) {
+            s = files.env()->RenameFile(name, f->name);
+        }
+        if(s.ok()) {
+            f->out_number = f->number;
+        } else {
+            f->out_number = 0;  // LCOV_EXCL_LINE
+        }
+    }
+}
+
+// Convert the writes in a log into a table. Records that fail their
+// checksum are dropped by the log reader.
+void repair_log(const mcberepair::TableFiles &files,
+                const leveldb::Options &out_options, const options_t &options,
+                file_t *f) {
+    std::vector<std::pair<std::string, std::string>> records;
+    f->status = files.ForEachLogged(
+        f->number,
+        [&](const leveldb::ParsedInternalKey &ikey,
+            const leveldb::Slice &value) {
+            records.emplace_back();
+            leveldb::AppendInternalKey(&records.back().first, ikey);
+            records.back().second.assign(value.data(), value.size());
+        });
+    const auto &icmp = files.comparator();
+    std::sort(records.begin(), records.end(),
+              [&](const auto &a, const auto &b) {
+                  return icmp.Compare(a.first, b.first) < 0;
+              });
+    TableWriter writer{out_options,
+                       leveldb::TableFileName(options.out_path, f->out_number)};
+    leveldb::Status s = writer.Open();
+    if(!s.ok()) {
+        // LCOV_EXCL_START
+        f->status = s;
+        f->out_number = 0;
+        return;
+        // LCOV_EXCL_STOP
+    }
+    leveldb::ParsedInternalKey ikey;
+    const std::string *last = nullptr;
+    for(auto &&r : records) {
+        // a damaged log can repeat a batch, but a write is only kept once
+        if(last != nullptr && icmp.Compare(r.first, *last) == 0) {
+            continue;
+        }
+        if(last == nullptr) {
+            f->smallest.DecodeFrom(r.first);
+        }
+        last = &r.first;
+        leveldb::ParseInternalKey(r.first, &ikey);
+        f->max_sequence = std::max(f->max_sequence, ikey.sequence);
+        f->records += 1;
+        f->bytes += r.first.size() + r.second.size();
+        writer.Add(r.first, r.second);
+    }
+    if(last != nullptr) {
+        f->largest.DecodeFrom(*last);
+    }
+    s = writer.Finish(&f->out_size);
+    if(!s.ok() || f->out_size == 0) {
+        f->out_number = 0;
+    }
+    if(!s.ok() && f->status.ok()) {
+        f->status = s;  // LCOV_EXCL_LINE
+    }
+}
+
+void print_progress(const file_t &f, size_t done, size_t total) {
+    std::string name = f.name.substr(f.name.rfind('/') + 1);
+    fprintf(stderr, "[%zu/%zu] %s: %llu records", done, total, name.c_str(),
+            static_cast<unsigned long long>(f.records));
+    if(f.corrupt_blocks > 0) {
+        fprintf(stderr, "; %llu of %llu blocks were corrupt",
+                static_cast<unsigned long long>(f.corrupt_blocks),
+                static_cast<unsigned long long>(f.blocks));
+        if(f.salvaged > 0) {
+            fprintf(stderr, " and %llu records were salvaged from them",
+                    static_cast<unsigned long long>(f.salvaged));
+        }
+    }
+    if(!f.status.ok()) {
+        fprintf(stderr, " --- %s", f.status.ToString().c_str());
+    }
+    fprintf(stderr, "\n");
+}
+
+}  // namespace
 
 int repair_main(int argc, char *argv[]) {
-    if(argc < 3 || strcmp("help", argv[1]) == 0) {
+    mcberepair::Args args{argc, argv};
+    if(args.size() < 1 || strcmp("help", argv[1]) == 0) {
         printf("Usage: %s repair <minecraft_world_dir>\n", argv[0]);
+        printf("\n");
+        printf(
+            "Rebuilds the MANIFEST from the tables and logs that can still be "
+            "read. Tables\n"
+            "and logs are checked in parallel, and each is reported to stderr "
+            "when done.\n");
+        printf("\n");
+        printf("Options:\n");
+        printf(
+            "  --threads=N              Check N files at a time. Use 0 for one "
+            "thread per\n"
+            "                           core (default 0).\n");
+        printf(
+            "  --salvage=<new_world>    Leave the world as it is and write the "
+            "records into a\n"
+            "                           new database, keeping the whole "
+            "entries of damaged\n"
+            "                           blocks too.\n");
+        return EXIT_FAILURE;
+    }
+    std::string bad_option;
+    if(args.unknown({"threads", "salvage"}, &bad_option)) {
+        fprintf(stderr, "ERROR: Unknown option '--%s'.\n", bad_option.c_str());
+        return EXIT_FAILURE;
+    }
+    options_t options;
+    options.threads = 0;
+    if(!args.number("threads", &options.threads)) {
+        fprintf(stderr, "ERROR: Invalid value for '--threads'.\n");
+        return EXIT_FAILURE;
+    }
+    if(options.threads == 0) {
+        options.threads = mcberepair::default_threads();
+    }
+    options.salvage = args.has("salvage");
+    std::string salvage_world{args.value("salvage")};
+    if(options.salvage && salvage_world.empty()) {
+        fprintf(stderr, "ERROR: Invalid value for '--salvage'.\n");
         return EXIT_FAILURE;
     }
 
     // construct path for Minecraft BE database
-    std::string path = std::string(argv[2]) + "/db";
+    options.path = std::string(args[0]) + "/db";
+    options.out_path = options.salvage
+                           ? salvage_world + "/db"
+                           : options.path;
 
-    leveldb::ZlibCompressorRaw zlib_raw;
-    leveldb::ZlibCompressor zlib;
+    mcberepair::TableFiles files{options.path};
+    leveldb::Env *env = files.env();
 
-    leveldb::Options options;
-    options.compressors[0] = &zlib_raw;
-    options.compressors[1] = &zlib;
+    std::vector<std::string> children;
+    leveldb::Status status = env->GetChildren(options.path, &children);
+    if(!status.ok()) {
+        fprintf(stderr, "ERROR: Repairing '%s' failed --- %s\n",
+                options.path.c_str(), status.ToString().c_str());
+        return EXIT_FAILURE;
+    }
 
-    leveldb::Status status;
-    status = leveldb::RepairDB(path, options);
+    // If the MANIFEST can still be read, the tables it lists keep their
+    // levels and only the logs it still needs are read. Otherwise, like
+    // leveldb's own repair, every table and log is read and goes in level 0.
+    mcberepair::manifest_t manifest;
+    bool have_manifest =
+        mcberepair::read_manifest(env, options.path, &manifest).ok();
+    std::map<uint64_t, int> levels;
+    for(auto &&t : manifest.tables) {
+        levels[t.number] = t.level;
+    }
+
+    std::vector<file_t> sources;
+    // files that are no longer part of the database and are not read
+    std::vector<std::string> obsolete;
+    uint64_t max_number = 0;
+    for(auto &&child : children) {
+        uint64_t number;
+        leveldb::FileType type;
+        if(!leveldb::ParseFileName(child, &number, &type)) {
+            continue;
+        }
+        max_number = std::max(max_number, number);
+        file_t f;
+        f.number = number;
+        f.type = type;
+        f.name = options.path + "/" + child;
+        if(type == leveldb::kTableFile) {
+            auto it = levels.find(number);
+            if(have_manifest && it == levels.end()) {
+                obsolete.push_back(child);
+                continue;
+            }
+            f.level = have_manifest ? it->second : 0;
+        } else if(type == leveldb::kLogFile) {
+            if(have_manifest && number < manifest.log_number &&
+               number != manifest.prev_log_number) {
+                obsolete.push_back(child);
+                continue;
+            }
+        } else {
+            if(type == leveldb::kDescriptorFile) {
+                obsolete.push_back(child);
+            }
+            continue;
+        }
+        sources.push_back(std::move(f));
+    }
+    // Tables in level 0 are searched newest first by file number, so new
+    // files keep the order of the files they replace, and the logs, which
+    // hold the newest writes, come last. A repair in place gives every table
+    // its old number back, and only the logs take new ones.
+    std::sort(sources.begin(), sources.end(),
+              [](const file_t &a, const file_t &b) {
+                  return std::make_pair(a.type == leveldb::kLogFile,
+                                        a.number) <
+                         std::make_pair(b.type == leveldb::kLogFile,
+                                        b.number);
+              });
+    uint64_t base = max_number + 1;
+    for(size_t i = 0; i < sources.size(); ++i) {
+        sources[i].out_number = base + i;
+    }
+    uint64_t manifest_number = base + sources.size();
+
+    // the game must not be using the database while it is rewritten
+    leveldb::FileLock *lock = nullptr;
+    if(options.salvage) {
+        env->CreateDir(salvage_world);
+        env->CreateDir(options.out_path);
+        if(env->FileExists(leveldb::CurrentFileName(options.out_path))) {
+            fprintf(stderr, "ERROR: '%s' already holds a database.\n",
+                    options.out_path.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    status = env->LockFile(leveldb::LockFileName(options.out_path), &lock);
+    if(!status.ok()) {
+        fprintf(stderr, "ERROR: Repairing '%s' failed --- %s\n",
+                options.path.c_str(), status.ToString().c_str());
+        return EXIT_FAILURE;
+    }
+
+    // tables are written like leveldb writes them
+    leveldb::Options out_options = files.options();
+    std::unique_ptr<const leveldb::FilterPolicy> filter_policy{
+        mcberepair::db_options().bloom_bits > 0
+            ? leveldb::NewBloomFilterPolicy(mcberepair::db_options().bloom_bits)
+            : nullptr};
+    leveldb::InternalFilterPolicy ipolicy{filter_policy.get()};
+    out_options.filter_policy = filter_policy ? &ipolicy : nullptr;
+    out_options.block_size = mcberepair::db_options().block_size;
 
+    // files that are replaced are moved here
+    std::string lost = options.path + "/lost";
+    if(!options.salvage) {
+        env->CreateDir(lost);
+    }
+
+    auto start = clock_type::now();
+    {
+        mcberepair::ScopedPhase phase{mcberepair::Phase::kScan};
+        std::mutex mutex;
+        size_t done = 0;
+        mcberepair::parallel_for(
+            sources.size(), options.threads, [&](size_t i) {
+                file_t &f = sources[i];
+                if(f.type == leveldb::kTableFile) {
+                    repair_table(files, out_options, options, &f);
+                } else {
+                    repair_log(files, out_options, options, &f);
+                }
+                std::lock_guard<std::mutex> guard{mutex};
+                print_progress(f, ++done, sources.size());
+            });
+    }
+
+    // describe the repaired database in a single version edit
+    leveldb::VersionEdit edit;
+    edit.SetComparatorName(leveldb::BytewiseComparator()->Name());
+    edit.SetLogNumber(0);
+    edit.SetNextFile(manifest_number + 1);
+    leveldb::SequenceNumber max_sequence = 0;
+    uint64_t tables = 0, logs = 0, records = 0, bytes = 0, out_tables = 0,
+             blocks = 0, corrupt_blocks = 0, salvaged = 0, damaged = 0;
+    for(auto &&f : sources) {
+        (f.type == leveldb::kTableFile ? tables : logs) += 1;
+        records += f.records;
+        bytes += f.bytes;
+        blocks += f.blocks;
+        corrupt_blocks += f.corrupt_blocks;
+        salvaged += f.salvaged;
+        damaged += f.status.ok() ? 0 : 1;
+        max_sequence = std::max(max_sequence, f.max_sequence);
+        if(f.out_number != 0) {
+            edit.AddFile(f.level, f.out_number, f.out_size, f.smallest,
+                         f.largest);
+            out_tables += 1;
+        }
+    }
+    edit.SetLastSequence(max_sequence);
+    status = mcberepair::write_manifest(env, options.out_path, manifest_number,
+                                        edit);
     if(!status.ok()) {
-        fprintf(stderr, "ERROR: Repairing '%s' failed --- %s\n", path.c_str(),
-                status.ToString().c_str());
+        // LCOV_EXCL_START
+        env->UnlockFile(lock);
+        fprintf(stderr, "ERROR: Writing the MANIFEST of '%s' failed --- %s\n",
+                options.out_path.c_str(), status.ToString().c_str());
         return EXIT_FAILURE;
+        // LCOV_EXCL_STOP
+    }
+
+    // Once the new MANIFEST is current, the files it no longer needs are
+    // moved into lost/ rather than deleted, as leveldb's own repair does.
+    if(!options.salvage) {
+        for(auto &&f : sources) {
+            if(f.out_number != f.number) {
+                env->RenameFile(f.name,
+                                lost + f.name.substr(f.name.rfind('/')));
+            }
+        }
+        for(auto &&name : obsolete) {
+            env->RenameFile(options.path + "/" + name, lost + "/" + name);
+        }
+    }
+    env->UnlockFile(lock);
+    mcberepair::stats().AddKeys(records, bytes);
+
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+    printf(
+        "Wrote %llu tables with %llu records to '%s' in %.3f s. Read %llu "
+        "tables and %llu logs; %llu were damaged.\n",
+        static_cast<unsigned long long>(out_tables),
+        static_cast<unsigned long long>(records), options.out_path.c_str(),
+        elapsed.count(), static_cast<unsigned long long>(tables),
+        static_cast<unsigned long long>(logs),
+        static_cast<unsigned long long>(damaged));
+    if(!obsolete.empty()) {
+        printf("%zu files that were no longer part of the database were %s.\n",
+               obsolete.size(), options.salvage ? "skipped" : "moved to lost/");
+    }
+    if(corrupt_blocks > 0) {
+        printf("%llu of %llu blocks were corrupt; %llu records were salvaged "
+               "from them.\n",
+               static_cast<unsigned long long>(corrupt_blocks),
+               static_cast<unsigned long long>(blocks),
+               static_cast<unsigned long long>(salvaged));
     }
     return EXIT_SUCCESS;
 }
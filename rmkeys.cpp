@@ -20,24 +20,153 @@
 # SOFTWARE.
 */
 
+
 #include <cassert>
 #include <cstdio>
 #include <iostream>
 #include <memory>
 
+#include "args.hpp"
 #include "db.hpp"
+#include "leveldb/write_batch.h"
 #include "mcbekey.hpp"
+#include "seekplan.hpp"
+
+namespace {
+
+// Groups deletes into batches of roughly a fixed size.
+class BatchDeleter {
+   public:
+    BatchDeleter(leveldb::DB *db, size_t batch_size)
+        : db_{db}, batch_size_{batch_size} {}
+
+    leveldb::Status Delete(const leveldb::Slice &key) {
+        batch_.Delete(key);
+        keys_ += 1;
+        if(batch_.ApproximateSize() >= batch_size_) {
+            return Flush();
+        }
+        return {};
+    }
+
+    leveldb::Status Flush() {
+        if(batch_.ApproximateSize() <= kEmptyBatchSize) {
+            return {};
+        }
+        mcberepair::ScopedPhase phase{mcberepair::Phase::kWrite};
+        leveldb::Status status = db_->Write({}, &batch_);
+        batch_.Clear();
+        batches_ += 1;
+        return status;
+    }
+
+    uint64_t keys() const { return keys_; }
+    uint64_t batches() const { return batches_; }
+
+   protected:
+    // the size of a WriteBatch header
+    static constexpr size_t kEmptyBatchSize = 12;
+
+    leveldb::DB *db_;
+    size_t batch_size_;
+    leveldb::WriteBatch batch_;
+    uint64_t keys_{0};
+    uint64_t batches_{0};
+};
+
+}  // namespace
 
 int rmkeys_main(int argc, char *argv[]) {
-    if(argc < 3 || strcmp("help", argv[1]) == 0) {
+    mcberepair::Args args{argc, argv};
+    if(args.size() < 1 || strcmp("help", argv[1]) == 0) {
         printf("Usage: %s rmkeys <minecraft_world_dir> < keys.txt\n", argv[0]);
         printf("       %s rmkeys <minecraft_world_dir> <key> <key> ...\n",
                argv[0]);
+        printf("       %s rmkeys <minecraft_world_dir> [selection options]\n",
+               argv[0]);
+        printf("\n");
+        printf("Options:\n");
+        printf(
+            "  --batch-size=N    Delete keys in batches of about N bytes "
+            "(default 4 MB).\n");
+        printf(
+            "  --quiet           Print a summary instead of a line for each "
+            "key.\n");
+        printf("\nSelection options:\n");
+        printf(
+            "  --xmin=N --xmax=N --zmin=N --zmax=N\n"
+            "                    Delete every chunk key inside this box "
+            "(inclusive).\n");
+        printf(
+            "  --dimension=N     Delete every chunk key of dimension N "
+            "(0=overworld,\n"
+            "                    1=nether, 2=end).\n");
+        printf(
+            "  --prefix=KEY      Delete every key that starts with the "
+            "encoded key KEY.\n");
+        return EXIT_FAILURE;
+    }
+    std::string bad_option;
+    if(args.unknown({"batch-size", "quiet", "xmin", "xmax", "zmin", "zmax",
+                     "dimension", "prefix"},
+                    &bad_option)) {
+        fprintf(stderr, "ERROR: Unknown option '--%s'.\n", bad_option.c_str());
+        return EXIT_FAILURE;
+    }
+    size_t batch_size = 4 * 1024 * 1024;
+    if(!args.number("batch-size", &batch_size) || batch_size == 0) {
+        fprintf(stderr, "ERROR: --batch-size must be a positive integer.\n");
+        return EXIT_FAILURE;
+    }
+    bool quiet = args.has("quiet");
+
+    int bounds = args.has("xmin") + args.has("xmax") + args.has("zmin") +
+                 args.has("zmax");
+    if(bounds != 0 && bounds != 4) {
+        fprintf(stderr,
+                "ERROR: --xmin, --xmax, --zmin, and --zmax must be used "
+                "together.\n");
+        return EXIT_FAILURE;
+    }
+    bool have_box = (bounds == 4);
+    mcberepair::chunk_box_t box{0, 0, 0, 0};
+    int dimension = -1;
+    if(!args.number("xmin", &box.x_min) || !args.number("xmax", &box.x_max) ||
+       !args.number("zmin", &box.z_min) || !args.number("zmax", &box.z_max) ||
+       !args.number("dimension", &dimension)) {
+        fprintf(stderr, "ERROR: Chunk bounds must be integers.\n");
+        return EXIT_FAILURE;
+    }
+    if(have_box && (box.x_min > box.x_max || box.z_min > box.z_max)) {
+        fprintf(stderr, "ERROR: The chunk box is empty.\n");
+        return EXIT_FAILURE;
+    }
+    bool have_chunks = have_box || args.has("dimension");
+    bool have_prefix = args.has("prefix");
+    std::string prefix;
+    // an empty prefix would select the whole database
+    if(have_prefix &&
+       (!mcberepair::decode_key(args.value("prefix"), &prefix) ||
+        prefix.empty())) {
+        fprintf(stderr, "ERROR: The prefix is empty or malformed.\n");
+        return EXIT_FAILURE;
+    }
+    if(have_prefix && have_chunks) {
+        fprintf(stderr,
+                "ERROR: --prefix cannot be combined with a chunk "
+                "selection.\n");
+        return EXIT_FAILURE;
+    }
+    bool have_selection = have_prefix || have_chunks;
+    if(have_selection && args.size() > 1) {
+        fprintf(stderr,
+                "ERROR: Keys cannot be listed together with selection "
+                "options.\n");
         return EXIT_FAILURE;
     }
 
     // construct path for Minecraft BE database
-    std::string path = std::string(argv[2]) + "/db";
+    std::string path = std::string(args[0]) + "/db";
 
     // open the database
     mcberepair::DB db{path.c_str()};
@@ -47,44 +176,129 @@ int rmkeys_main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
+    BatchDeleter deleter{&db(), batch_size};
     leveldb::Status status;
+    uint64_t skipped = 0;
+
+    auto report_failure = [&]() {
+        // LCOV_EXCL_START
+        fprintf(stderr, "ERROR: Writing '%s' failed: %s\n", path.c_str(),
+                status.ToString().c_str());
+        return EXIT_FAILURE;
+        // LCOV_EXCL_STOP
+    };
+
+    auto report_summary = [&]() {
+        mcberepair::stats().AddKeys(deleter.keys(), 0);
+        if(quiet) {
+            printf("Deleted %llu keys in %llu batches",
+                   static_cast<unsigned long long>(deleter.keys()),
+                   static_cast<unsigned long long>(deleter.batches()));
+            if(skipped > 0) {
+                printf(" and skipped %llu malformed keys",
+                       static_cast<unsigned long long>(skipped));
+            }
+            printf(".\n");
+        }
+        return EXIT_SUCCESS;
+    };
+
+    if(have_selection) {
+        // Deletes go into batches while an iterator sweeps the selection.
+        // The iterator reads from an implicit snapshot, so it does not see
+        // the deletes.
+        mcberepair::ScopedPhase scan_phase{mcberepair::Phase::kScan};
+        leveldb::ReadOptions readOptions;
+        readOptions.fill_cache = false;
+        auto it =
+            std::unique_ptr<leveldb::Iterator>{db().NewIterator(readOptions)};
+        std::string encoded;
+
+        auto visit = [&](leveldb::Iterator *iter) -> bool {
+            auto key = iter->key();
+            if(have_chunks) {
+                std::string_view skey{key.data(), key.size()};
+                if(!mcberepair::is_chunk_key(skey)) {
+                    return true;
+                }
+                auto chunk = mcberepair::parse_chunk_key(skey);
+                if((dimension >= 0 && chunk.dimension != dimension) ||
+                   (have_box && !box.contains(chunk.x, chunk.z))) {
+                    return true;
+                }
+            }
+            if(!quiet) {
+                encoded.clear();
+                mcberepair::append_encoded_key({key.data(), key.size()},
+                                               &encoded);
+                printf("Deleting key '%s'...\n", encoded.c_str());
+            }
+            status = deleter.Delete(key);
+            return status.ok();
+        };
+
+        // A box is turned into seeks over the chunks it covers. Very large
+        // boxes and a dimension-only selection are cheaper to handle with
+        // one scan.
+        const uint64_t max_box_chunks = 4 * 1024 * 1024;
+        std::vector<mcberepair::key_range_t> ranges;
+        if(have_prefix) {
+            ranges.push_back(mcberepair::prefix_range(prefix));
+        } else if(have_box && box.size() <= max_box_chunks) {
+            ranges = mcberepair::plan_chunk_box(box, dimension);
+        } else {
+            ranges.push_back({});
+        }
+        mcberepair::scan_ranges(it.get(), ranges, visit);
+
+        if(status.ok() && !it->status().ok()) {
+            status = it->status();  // LCOV_EXCL_LINE
+        }
+        if(status.ok()) {
+            status = deleter.Flush();
+        }
+        if(!status.ok()) {
+            return report_failure();  // LCOV_EXCL_LINE
+        }
+        return report_summary();
+    }
 
     // Create a function that deletes the key.
+    std::string key;
     auto delete_key = [&](const std::string &line) -> bool {
-        std::string key;
         if(!mcberepair::decode_key(line, &key)) {
-            printf("Skipping malformed key '%s'...\n", line.c_str());
+            if(!quiet) {
+                printf("Skipping malformed key '%s'...\n", line.c_str());
+            }
+            skipped += 1;
             return true;
         }
-        printf("Deleting key '%s'...\n", line.c_str());
-        status = db().Delete({}, key);
-        if(!status.ok()) {
-            // LCOV_EXCL_START
-            fprintf(stderr, "ERROR: Writing '%s' failed: %s\n", path.c_str(),
-                    status.ToString().c_str());
-            return false;
-            // LCOV_EXCL_STOP
+        if(!quiet) {
+            printf("Deleting key '%s'...\n", line.c_str());
         }
-        return true;
+        status = deleter.Delete(key);
+        return status.ok();
     };
 
-    // handle keys passed as arguments
-    if(argc > 3) {
-        for(int i = 3; i < argc; ++i) {
-            if(!delete_key(argv[i])) {
-                return EXIT_FAILURE;  // LCOV_EXCL_LINE
+    if(args.size() > 1) {
+        // handle keys passed as arguments
+        for(size_t i = 1; i < args.size(); ++i) {
+            if(!delete_key(args[i])) {
+                return report_failure();  // LCOV_EXCL_LINE
             }
         }
-        return EXIT_SUCCESS;
-    }
-
-    // Or handle keys passed on stdin.
-    std::string line;
-    while(std::getline(std::cin, line)) {
-        if(!delete_key(line)) {
-            return EXIT_FAILURE;  // LCOV_EXCL_LINE
+    } else {
+        // Or handle keys passed on stdin.
+        std::string line;
+        while(std::getline(std::cin, line)) {
+            if(!delete_key(line)) {
+                return report_failure();  // LCOV_EXCL_LINE
+            }
         }
     }
-
-    return EXIT_SUCCESS;
+    status = deleter.Flush();
+    if(!status.ok()) {
+        return report_failure();  // LCOV_EXCL_LINE
+    }
+    return report_summary();
 }
@@ -0,0 +1,321 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "args.hpp"
+#include "db.hpp"
+#include "mcbekey.hpp"
+#include "parallel.hpp"
+#include "shard.hpp"
+#include "subchunk.hpp"
+
+namespace {
+
+// flush output in pieces of about this size
+constexpr size_t kChunkSize = 1024 * 1024;
+
+struct options_t {
+    std::vector<std::string> targets;
+    int dimension;
+    bool all_layers;
+};
+
+// A block matches a target without states if the names are equal, and a
+// target with states only if the whole state is equal.
+bool matches(std::string_view state, std::string_view target) {
+    if(target.find('[') != std::string_view::npos) {
+        return state == target;
+    }
+    return state.substr(0, state.find('[')) == target;
+}
+
+// What one thread learns about the palette entries it sees. Entries are
+// keyed by their raw bytes, so each distinct entry is read once.
+class PaletteMatcher {
+   public:
+    explicit PaletteMatcher(const options_t &options) : options_{options} {}
+
+    struct entry_t {
+        bool match;
+        std::string state;
+    };
+
+    const entry_t &Lookup(std::string_view raw) {
+        key_.assign(raw);
+        auto it = entries_.find(key_);
+        if(it != entries_.end()) {
+            return it->second;
+        }
+        entry_t entry{false, {}};
+        // An entry holds the name of its block as a string, so one that
+        // does not contain any target name cannot match and is not read.
+        bool maybe = false;
+        for(auto &&target : options_.targets) {
+            std::string_view name{target};
+            name = name.substr(0, name.find('['));
+            if(raw.find(name) != std::string_view::npos) {
+                maybe = true;
+                break;
+            }
+        }
+        if(maybe &&
+           mcberepair::block_state_name(raw, &reader_, &buffer_,
+                                        &entry.state)) {
+            for(auto &&target : options_.targets) {
+                entry.match = entry.match || matches(entry.state, target);
+            }
+        }
+        return entries_.emplace(key_, std::move(entry)).first->second;
+    }
+
+   protected:
+    const options_t &options_;
+    std::unordered_map<std::string, entry_t> entries_;
+    mcberepair::NbtReader reader_;
+    std::string buffer_;
+    std::string key_;
+};
+
+struct counts_t {
+    std::atomic<uint64_t> subchunks{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> skipped{0};
+    std::atomic<uint64_t> unpacked{0};
+    std::atomic<uint64_t> found{0};
+    std::atomic<uint64_t> malformed{0};
+};
+
+void write_chunk(const std::string &chunk) {
+    fwrite(chunk.data(), 1, chunk.size(), stdout);
+}
+
+leveldb::Status search_range(leveldb::DB *db,
+                             const mcberepair::key_range_t &range,
+                             const options_t &options, counts_t *counts) {
+    leveldb::ReadOptions readOptions;
+    leveldb::DecompressAllocator decompress_allocator;
+    readOptions.decompress_allocator = &decompress_allocator;
+    readOptions.verify_checksums = true;
+    readOptions.fill_cache = false;
+    auto it = std::unique_ptr<leveldb::Iterator>{db->NewIterator(readOptions)};
+
+    PaletteMatcher matcher{options};
+    mcberepair::subchunk_t subchunk;
+    std::vector<uint16_t> indices(mcberepair::kSubchunkBlocks);
+    // the matching palette entry of each index, or null
+    std::vector<const PaletteMatcher::entry_t *> hits;
+    std::string out;
+    char line[64];
+    uint64_t subchunks = 0, bytes = 0, skipped = 0, unpacked = 0, found = 0,
+             malformed = 0;
+
+    mcberepair::scan_ranges(it.get(), {range}, [&](leveldb::Iterator *iter) {
+        auto key = iter->key();
+        std::string_view skey{key.data(), key.size()};
+        if(!mcberepair::is_chunk_key(skey)) {
+            return true;
+        }
+        auto chunk = mcberepair::parse_chunk_key(skey);
+        if(chunk.tag != 47 ||
+           (options.dimension >= 0 && chunk.dimension != options.dimension)) {
+            return true;
+        }
+        auto value = iter->value();
+        subchunks += 1;
+        bytes += key.size() + value.size();
+        if(!mcberepair::parse_subchunk(value.data(), value.size(),
+                                       &subchunk)) {
+            malformed += 1;
+            return true;
+        }
+        size_t layers = options.all_layers ? subchunk.layers.size() : 1;
+        bool any = false;
+        for(size_t i = 0; i < layers && i < subchunk.layers.size(); ++i) {
+            auto &layer = subchunk.layers[i];
+            // the palette decides whether the blocks need to be unpacked
+            hits.assign(layer.palette.size(), nullptr);
+            bool hit = false;
+            for(size_t p = 0; p < layer.palette.size(); ++p) {
+                auto &entry = matcher.Lookup(layer.palette[p]);
+                if(entry.match) {
+                    hits[p] = &entry;
+                    hit = true;
+                }
+            }
+            if(!hit) {
+                continue;
+            }
+            any = true;
+            mcberepair::unpack_block_indices(layer, indices.data());
+            for(int b = 0; b < mcberepair::kSubchunkBlocks; ++b) {
+                uint16_t index = indices[b];
+                if(index >= hits.size() || hits[index] == nullptr) {
+                    continue;
+                }
+                // blocks are stored in xzy order
+                int x = chunk.x * 16 + (b >> 8);
+                int z = chunk.z * 16 + ((b >> 4) & 15);
+                int y = static_cast<int8_t>(chunk.subtag) * 16 + (b & 15);
+                snprintf(line, sizeof(line), "%d\t%d\t%d\t%d\t", x, y, z,
+                         chunk.dimension);
+                out.append(line);
+                out.append(hits[index]->state);
+                out.push_back('\n');
+                found += 1;
+            }
+            if(out.size() >= kChunkSize) {
+                write_chunk(out);
+                out.clear();
+            }
+        }
+        if(any) {
+            unpacked += 1;
+        } else {
+            skipped += 1;
+        }
+        return true;
+    });
+    write_chunk(out);
+    counts->subchunks += subchunks;
+    counts->bytes += bytes;
+    counts->skipped += skipped;
+    counts->unpacked += unpacked;
+    counts->found += found;
+    counts->malformed += malformed;
+    return it->status();
+}
+
+}  // namespace
+
+int search_main(int argc, char *argv[]) {
+    mcberepair::Args args{argc, argv};
+    if(args.size() < 2 || strcmp("help", argv[1]) == 0) {
+        printf("Usage: %s search <minecraft_world_dir> <block> <block> ... > "
+               "found.tsv\n",
+               argv[0]);
+        printf("\n");
+        printf(
+            "Blocks are names such as 'minecraft:tnt', which match every "
+            "state, or states\n"
+            "such as 'minecraft:stone[stone_type=granite]'.\n");
+        printf("\n");
+        printf("Options:\n");
+        printf(
+            "  --threads=N      Split the keyspace into shards and search them "
+            "with N threads.\n"
+            "                   Use 0 for one thread per core (default 0).\n");
+        printf("  --dimension=N    Only search dimension N.\n");
+        printf(
+            "  --all-layers     Also search the extra layers of subchunks.\n");
+        return EXIT_FAILURE;
+    }
+    std::string bad_option;
+    if(args.unknown({"threads", "dimension", "all-layers"}, &bad_option)) {
+        fprintf(stderr, "ERROR: Unknown option '--%s'.\n", bad_option.c_str());
+        return EXIT_FAILURE;
+    }
+    unsigned int threads = 0;
+    if(!args.number("threads", &threads)) {
+        fprintf(stderr, "ERROR: Invalid value for '--threads'.\n");
+        return EXIT_FAILURE;
+    }
+    if(threads == 0) {
+        threads = mcberepair::default_threads();
+    }
+    options_t options{{}, -1, args.has("all-layers")};
+    if(!args.number("dimension", &options.dimension) ||
+       (args.has("dimension") && options.dimension < 0)) {
+        fprintf(stderr, "ERROR: Invalid value for '--dimension'.\n");
+        return EXIT_FAILURE;
+    }
+    for(size_t i = 1; i < args.size(); ++i) {
+        if(args[i][0] == '\0') {
+            fprintf(stderr, "ERROR: Block names cannot be empty.\n");
+            return EXIT_FAILURE;
+        }
+        options.targets.emplace_back(args[i]);
+    }
+
+    // construct path for Minecraft BE database
+    std::string path = std::string(args[0]) + "/db";
+
+    // open the database
+    mcberepair::DB db{path.c_str()};
+
+    if(!db) {
+        fprintf(stderr, "ERROR: Opening '%s' failed.\n", path.c_str());
+        return EXIT_FAILURE;
+    }
+
+    printf("x\ty\tz\tdimension\tblock\n");
+    // rows are written by several threads from here on
+    fflush(stdout);
+
+    counts_t counts;
+    {
+        mcberepair::ScopedPhase scan_phase{mcberepair::Phase::kScan};
+
+        // use several shards per thread so that uneven shards balance out
+        auto shards =
+            mcberepair::shard_keyspace(&db(), threads > 1 ? threads * 4 : 1);
+
+        // Each shard streams its rows as it finds them. stdio locks the
+        // stream, so each chunk of rows is written whole.
+        std::vector<leveldb::Status> statuses(shards.size());
+        mcberepair::parallel_for(shards.size(), threads, [&](size_t i) {
+            statuses[i] = search_range(&db(), shards[i], options, &counts);
+        });
+        for(auto &&s : statuses) {
+            if(!s.ok()) {
+                // LCOV_EXCL_START
+                fprintf(stderr, "ERROR: Reading '%s' failed: %s\n",
+                        path.c_str(), s.ToString().c_str());
+                return EXIT_FAILURE;
+                // LCOV_EXCL_STOP
+            }
+        }
+    }
+    mcberepair::stats().AddKeys(counts.subchunks, counts.bytes);
+
+    // the summary goes to stderr so stdout holds only rows
+    fprintf(stderr,
+            "Found %llu blocks in %llu subchunks; %llu of %llu subchunks were "
+            "skipped by their palette.\n",
+            static_cast<unsigned long long>(counts.found),
+            static_cast<unsigned long long>(counts.unpacked),
+            static_cast<unsigned long long>(counts.skipped),
+            static_cast<unsigned long long>(counts.subchunks));
+    if(counts.malformed > 0) {
+        fprintf(stderr,
+                "%llu subchunks were malformed or in an older format.\n",
+                static_cast<unsigned long long>(counts.malformed));
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,702 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+#ifndef MCBEREPAIR_SEEKPLAN_HPP
+#define MCBEREPAIR_SEEKPLAN_HPP
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "leveldb/iterator.h"
+#include "mcbekey.hpp"
+
+namespace mcberepair {
+
+// A half-open range of keys [start, limit). An empty limit is unbounded.
+struct key_range_t {
+    std::string start;
+    std::string limit;
+};
+
+// A box of chunk coordinates, inclusive on both ends.
+struct chunk_box_t {
+    int x_min;
+    int x_max;
+    int z_min;
+    int z_max;
+
+    uint64_t size() const {
+        return static_cast<uint64_t>(int64_t{x_max} - x_min + 1) *
+               static_cast<uint64_t>(int64_t{z_max} - z_min + 1);
+    }
+
+    bool contains(int x, int z) const {
+        return x_min <= x && x <= x_max && z_min <= z && z <= z_max;
+    }
+};
+
+// Return the smallest string that is greater than every string beginning
+// with `prefix`. Returns an empty string if no such string exists.
+inline std::string prefix_successor(std::string prefix) {
+    while(!prefix.empty()) {
+        auto c = static_cast<unsigned char>(prefix.back());
+        if(c != 0xFF) {
+            prefix.back() = static_cast<char>(c + 1);
+            return prefix;
+        }
+        prefix.pop_back();
+    }
+    return prefix;
+}
+
+inline key_range_t prefix_range(std::string prefix) {
+    std::string limit = prefix_successor(prefix);
+    return {std::move(prefix), std::move(limit)};
+}
+
+// Set `out` to the keys that are in both `a` and `b`. Returns false if
+// there are none.
+inline bool intersect_ranges(const key_range_t &a, const key_range_t &b,
+                             key_range_t *out) {
+    assert(out != nullptr);
+    out->start = std::max(a.start, b.start);
+    if(a.limit.empty() || b.limit.empty()) {
+        out->limit = a.limit.empty() ? b.limit : a.limit;
+    } else {
+        out->limit = std::min(a.limit, b.limit);
+    }
+    return out->limit.empty() || out->start < out->limit;
+}
+
+// Sort ranges into key order and merge ranges that overlap or touch, so they
+// can be visited with a single forward pass of an iterator.
+inline void normalize_ranges(std::vector<key_range_t> *ranges) {
+    assert(ranges != nullptr);
+    auto &r = *ranges;
+    std::sort(r.begin(), r.end(),
+              [](const key_range_t &a, const key_range_t &b) {
+                  return a.start < b.start;
+              });
+    size_t out = 0;
+    for(size_t i = 0; i < r.size(); ++i) {
+        if(out > 0 && (r[out - 1].limit.empty() ||
+                       r[i].start <= r[out - 1].limit)) {
+            auto &last = r[out - 1];
+            if(!last.limit.empty() &&
+               (r[i].limit.empty() || r[i].limit > last.limit)) {
+                last.limit = r[i].limit;
+            }
+            continue;
+        }
+        if(out != i) {
+            r[out] = std::move(r[i]);
+        }
+        ++out;
+    }
+    r.resize(out);
+}
+
+// Append the ranges that hold every chunk key of chunk (x, z) in `dimension`.
+// A negative dimension selects all dimensions.
+inline void append_chunk_ranges(int x, int z, int dimension,
+                                std::vector<key_range_t> *ranges) {
+    std::string prefix;
+    append_chunk_prefix(x, z, &prefix);
+    if(dimension < 0) {
+        ranges->push_back(prefix_range(std::move(prefix)));
+        return;
+    }
+    append_dimension(dimension, &prefix);
+    // chunk tags lie between 33 and 118
+    std::string start = prefix + '\x21';
+    std::string limit = prefix + '\x77';
+    ranges->push_back({std::move(start), std::move(limit)});
+}
+
+// Plan the ranges that hold every chunk key in a box of chunks.
+inline std::vector<key_range_t> plan_chunk_box(const chunk_box_t &box,
+                                               int dimension) {
+    std::vector<key_range_t> ranges;
+    ranges.reserve(box.size());
+    for(int64_t x = box.x_min; x <= box.x_max; ++x) {
+        for(int64_t z = box.z_min; z <= box.z_max; ++z) {
+            append_chunk_ranges(static_cast<int>(x), static_cast<int>(z),
+                                dimension, &ranges);
+        }
+    }
+    normalize_ranges(&ranges);
+    return ranges;
+}
+
+// Visit every key in a set of normalized ranges with one forward pass of
+// `it`, seeking over the gaps between ranges. `func(it)` is called for each
+// key and should return false to stop the scan. Returns the number of seeks
+// that were issued.
+template <typename F>
+uint64_t scan_ranges(leveldb::Iterator *it,
+                     const std::vector<key_range_t> &ranges, F &&func) {
+    uint64_t seeks = 0;
+    for(auto &&range : ranges) {
+        // only seek when the iterator is not already inside the range
+        if(!it->Valid() || it->key().compare(range.start) < 0) {
+            it->Seek(range.start);
+            seeks += 1;
+        }
+        for(; it->Valid(); it->Next()) {
+            if(!range.limit.empty() && it->key().compare(range.limit) >= 0) {
+                break;
+            }
+            if(!func(it)) {
+                return seeks;
+            }
+        }
+        if(!it->Valid()) {
+            break;
+        }
+    }
+    return seeks;
+}
+
+// A set of integers stored as sorted, disjoint, inclusive intervals.
+struct int_set_t {
+    std::vector<std::pair<int64_t, int64_t>> intervals;
+
+    static int_set_t range(int64_t lo, int64_t hi) {
+        int_set_t ret;
+        if(lo <= hi) {
+            ret.intervals.emplace_back(lo, hi);
+        }
+        return ret;
+    }
+
+    bool empty() const { return intervals.empty(); }
+
+    uint64_t size() const {
+        uint64_t n = 0;
+        for(auto &&i : intervals) {
+            n += static_cast<uint64_t>(i.second - i.first) + 1;
+        }
+        return n;
+    }
+
+    bool contains(int64_t v) const {
+        auto it = std::upper_bound(
+            intervals.begin(), intervals.end(), v,
+            [](int64_t a, const std::pair<int64_t, int64_t> &b) {
+                return a < b.first;
+            });
+        return it != intervals.begin() && v <= std::prev(it)->second;
+    }
+
+    // Sort and merge intervals that overlap or touch.
+    void normalize() {
+        std::sort(intervals.begin(), intervals.end());
+        size_t out = 0;
+        for(size_t i = 0; i < intervals.size(); ++i) {
+            if(out > 0 && intervals[i].first <= intervals[out - 1].second + 1) {
+                intervals[out - 1].second =
+                    std::max(intervals[out - 1].second, intervals[i].second);
+                continue;
+            }
+            intervals[out++] = intervals[i];
+        }
+        intervals.resize(out);
+    }
+
+    int_set_t intersect(const int_set_t &other) const {
+        int_set_t ret;
+        size_t i = 0, j = 0;
+        while(i < intervals.size() && j < other.intervals.size()) {
+            auto &a = intervals[i];
+            auto &b = other.intervals[j];
+            int64_t lo = std::max(a.first, b.first);
+            int64_t hi = std::min(a.second, b.second);
+            if(lo <= hi) {
+                ret.intervals.emplace_back(lo, hi);
+            }
+            if(a.second < b.second) {
+                ++i;
+            } else {
+                ++j;
+            }
+        }
+        return ret;
+    }
+
+    // The members of [lo, hi] that are not in this set.
+    int_set_t complement(int64_t lo, int64_t hi) const {
+        int_set_t ret;
+        for(auto &&i : intervals) {
+            if(lo < i.first) {
+                ret.intervals.emplace_back(lo, i.first - 1);
+            }
+            lo = std::max(lo, i.second + 1);
+        }
+        if(lo <= hi) {
+            ret.intervals.emplace_back(lo, hi);
+        }
+        return ret;
+    }
+};
+
+// Constraints on the fields of chunk_t. Only chunk keys can match. A key
+// without a subtag has subtag -1, like parse_chunk_key() reports, and tags
+// are compared as unsigned bytes.
+struct chunk_predicate_t {
+    static constexpr int64_t kIntMin = std::numeric_limits<int32_t>::min();
+    static constexpr int64_t kIntMax = std::numeric_limits<int32_t>::max();
+
+    int_set_t x{int_set_t::range(kIntMin, kIntMax)};
+    int_set_t z{int_set_t::range(kIntMin, kIntMax)};
+    int_set_t dimension{int_set_t::range(kIntMin, kIntMax)};
+    int_set_t tag{int_set_t::range(0, 255)};
+    int_set_t subtag{int_set_t::range(-128, 127)};
+
+    bool matches(std::string_view key) const {
+        if(!is_chunk_key(key)) {
+            return false;
+        }
+        chunk_t chunk = parse_chunk_key(key);
+        return x.contains(chunk.x) && z.contains(chunk.z) &&
+               dimension.contains(chunk.dimension) &&
+               tag.contains(static_cast<unsigned char>(chunk.tag)) &&
+               subtag.contains(static_cast<signed char>(chunk.subtag));
+    }
+};
+
+// Add one term such as "x=-50..50", "tag=45,47", "z>=0", or "dimension!=0"
+// to a predicate. Terms combine with AND. Returns false if the term is
+// malformed.
+inline bool add_chunk_term(std::string_view term, chunk_predicate_t *out) {
+    assert(out != nullptr);
+    size_t n = term.find_first_of("<>=!");
+    if(n == std::string_view::npos) {
+        return false;
+    }
+    std::string_view field = term.substr(0, n);
+    term.remove_prefix(n);
+    std::string_view op = term.substr(0, 1);
+    if(term.size() > 1 && term[1] == '=') {
+        op = term.substr(0, 2);
+    }
+    term.remove_prefix(op.size());
+    if(op == "!") {
+        return false;
+    }
+
+    int_set_t *set;
+    int64_t lo = chunk_predicate_t::kIntMin;
+    int64_t hi = chunk_predicate_t::kIntMax;
+    if(field == "x") {
+        set = &out->x;
+    } else if(field == "z") {
+        set = &out->z;
+    } else if(field == "dimension") {
+        set = &out->dimension;
+    } else if(field == "tag") {
+        set = &out->tag;
+        lo = 0;
+        hi = 255;
+    } else if(field == "subtag") {
+        set = &out->subtag;
+        lo = -128;
+        hi = 127;
+    } else {
+        return false;
+    }
+
+    auto number = [](std::string_view str, int64_t *v) {
+        auto [p, ec] = std::from_chars(str.data(), str.data() + str.size(), *v);
+        return ec == std::errc{} && p == str.data() + str.size();
+    };
+    int_set_t values;
+    if(op == "=" || op == "!=") {
+        // a comma-separated list of values and inclusive a..b ranges
+        while(true) {
+            size_t comma = term.find(',');
+            std::string_view item = term.substr(0, comma);
+            size_t dots = item.find("..");
+            int64_t a, b;
+            if(dots == std::string_view::npos) {
+                if(!number(item, &a)) {
+                    return false;
+                }
+                b = a;
+            } else if(!number(item.substr(0, dots), &a) ||
+                      !number(item.substr(dots + 2), &b)) {
+                return false;
+            }
+            a = std::max(a, lo);
+            b = std::min(b, hi);
+            if(a <= b) {
+                values.intervals.emplace_back(a, b);
+            }
+            if(comma == std::string_view::npos) {
+                break;
+            }
+            term.remove_prefix(comma + 1);
+        }
+        values.normalize();
+        if(op == "!=") {
+            values = values.complement(lo, hi);
+        }
+    } else {
+        int64_t v;
+        if(!number(term, &v)) {
+            return false;
+        }
+        v = std::clamp(v, lo - 1, hi + 1);
+        if(op == "<") {
+            values = int_set_t::range(lo, std::min(v - 1, hi));
+        } else if(op == "<=") {
+            values = int_set_t::range(lo, std::min(v, hi));
+        } else if(op == ">") {
+            values = int_set_t::range(std::max(v + 1, lo), hi);
+        } else if(op == ">=") {
+            values = int_set_t::range(std::max(v, lo), hi);
+        } else {
+            return false;
+        }
+    }
+    *set = set->intersect(values);
+    return true;
+}
+
+// Plans the seeks that visit every key a chunk_predicate_t can match.
+//
+// Chunk keys sort bytewise by x, then z, then the dimension, tag, and
+// subtag, and the coordinates are little-endian, so numeric ranges of x and
+// z are scattered through the keyspace. Each coordinate is therefore
+// handled in key order: small sets of values are listed in the order their
+// bytes sort, and larger ones are checked as keys are reached. After the
+// eight coordinate bytes, the dimension, tag, and subtag become a few key
+// ranges, unless every dimension is allowed, in which case the rest of each
+// chunk is visited and filtered.
+//
+// Next() gives the smallest key at or after a key that could match, so a
+// scan only moves forward: it calls Next() on every key it lands on and
+// seeks when the answer is a later key.
+class ChunkSeekPlan {
+   public:
+    // Sets with at most this many values are listed in key order.
+    static constexpr uint64_t kMaxListed = 65536;
+    static constexpr uint64_t kMaxDimensions = 64;
+
+    explicit ChunkSeekPlan(const chunk_predicate_t &predicate)
+        : predicate_{predicate},
+          x_{predicate.x},
+          z_{predicate.z},
+          empty_{predicate.x.empty() || predicate.z.empty() ||
+                 predicate.dimension.empty() || predicate.tag.empty() ||
+                 predicate.subtag.empty()} {
+        PlanSuffixes();
+        empty_ = empty_ || suffixes_.empty();
+        if(!empty_) {
+            empty_ = !z_.Next(0, &z_first_);
+        }
+    }
+
+    const chunk_predicate_t &predicate() const { return predicate_; }
+
+    bool x_listed() const { return x_.listed; }
+    bool z_listed() const { return z_.listed; }
+    // The ranges of each chunk that are visited, or 0 if all of it is.
+    size_t suffix_ranges() const {
+        return suffixes_.size() == 1 && suffixes_[0].start.empty() &&
+                       suffixes_[0].limit.empty()
+                   ? 0
+                   : suffixes_.size();
+    }
+
+    bool Matches(std::string_view key) const {
+        return predicate_.matches(key);
+    }
+
+    // Set `target` to the smallest key at or after `key` that could match.
+    // Returns false if no key at or after `key` can.
+    bool Next(std::string_view key, std::string *target) const {
+        if(empty_) {
+            return false;
+        }
+        // read the coordinate bytes, padding short keys with zeros
+        unsigned char bytes[8] = {0};
+        std::memcpy(bytes, key.data(), std::min<size_t>(key.size(), 8));
+        uint32_t xo = load_order(bytes);
+        uint32_t zo = load_order(bytes + 4);
+
+        uint32_t x, z;
+        if(!x_.Next(xo, &x)) {
+            return false;
+        }
+        if(x != xo) {
+            Target(x, z_first_, suffixes_.front().start, target);
+            return true;
+        }
+        if(z_.Next(zo, &z)) {
+            if(z != zo) {
+                Target(x, z, suffixes_.front().start, target);
+                return true;
+            }
+            std::string_view rest = key.size() > 8 ? key.substr(8) : "";
+            for(auto &&r : suffixes_) {
+                if(!r.limit.empty() && rest >= r.limit) {
+                    continue;
+                }
+                if(rest >= r.start) {
+                    target->assign(key.data(), key.size());
+                } else {
+                    Target(x, z, r.start, target);
+                }
+                return true;
+            }
+        }
+        // nothing more in this chunk; move to the next z, then the next x
+        if(zo < UINT32_MAX && z_.Next(zo + 1, &z)) {
+            Target(x, z, suffixes_.front().start, target);
+            return true;
+        }
+        if(xo < UINT32_MAX && x_.Next(xo + 1, &x)) {
+            Target(x, z_first_, suffixes_.front().start, target);
+            return true;
+        }
+        return false;
+    }
+
+   protected:
+    // A coordinate in key order: the big-endian reading of its
+    // little-endian bytes.
+    struct coordinate_t {
+        int_set_t set;
+        bool listed;
+        std::vector<uint32_t> order;
+
+        explicit coordinate_t(const int_set_t &values)
+            : set{values}, listed{values.size() <= kMaxListed} {
+            if(!listed) {
+                return;
+            }
+            for(auto &&i : set.intervals) {
+                for(int64_t v = i.first; v <= i.second; ++v) {
+                    order.push_back(to_order(static_cast<int32_t>(v)));
+                }
+            }
+            std::sort(order.begin(), order.end());
+        }
+
+        // The smallest member at or after `o` in key order. Large sets are
+        // not listed, so for them the answer may be a lower bound that is
+        // not a member.
+        bool Next(uint64_t o, uint32_t *out) const {
+            if(listed) {
+                auto it = std::lower_bound(order.begin(), order.end(), o);
+                if(it == order.end()) {
+                    return false;
+                }
+                *out = *it;
+                return true;
+            }
+            if(o > UINT32_MAX) {
+                return false;
+            }
+            *out = static_cast<uint32_t>(o);
+            if(!set.contains(from_order(*out))) {
+                if(o == UINT32_MAX) {
+                    return false;
+                }
+                *out += 1;
+            }
+            return true;
+        }
+    };
+
+    static uint32_t to_order(int32_t v) {
+        unsigned char b[4];
+        std::memcpy(b, &v, 4);
+        return load_order(b);
+    }
+
+    static int32_t from_order(uint32_t o) {
+        unsigned char b[4] = {static_cast<unsigned char>(o >> 24),
+                              static_cast<unsigned char>(o >> 16),
+                              static_cast<unsigned char>(o >> 8),
+                              static_cast<unsigned char>(o)};
+        int32_t v;
+        std::memcpy(&v, b, 4);
+        return v;
+    }
+
+    static uint32_t load_order(const unsigned char *b) {
+        return (uint32_t{b[0]} << 24) | (uint32_t{b[1]} << 16) |
+               (uint32_t{b[2]} << 8) | uint32_t{b[3]};
+    }
+
+    static void append_order(uint32_t o, std::string *out) {
+        for(int shift = 24; shift >= 0; shift -= 8) {
+            out->push_back(static_cast<char>((o >> shift) & 0xFF));
+        }
+    }
+
+    static void Target(uint32_t x, uint32_t z, const std::string &suffix,
+                       std::string *target) {
+        target->clear();
+        append_order(x, target);
+        append_order(z, target);
+        target->append(suffix);
+    }
+
+    // Turn the dimension, tag, and subtag into ranges of the bytes after
+    // the coordinates.
+    void PlanSuffixes() {
+        const auto &p = predicate_;
+        if(p.dimension.size() > kMaxDimensions) {
+            suffixes_.push_back({});
+            return;
+        }
+        // subtags are single bytes, so negative subtags sort last
+        int_set_t bytes;
+        for(auto &&i : p.subtag.intervals) {
+            if(i.second < 0) {
+                bytes.intervals.emplace_back(i.first + 256, i.second + 256);
+            } else if(i.first >= 0) {
+                bytes.intervals.push_back(i);
+            } else {
+                bytes.intervals.emplace_back(0, i.second);
+                bytes.intervals.emplace_back(i.first + 256, 255);
+            }
+        }
+        bytes.normalize();
+        bool any_subtag = p.subtag.size() == 256;
+
+        for(auto &&d : p.dimension.intervals) {
+            for(int64_t dim = d.first; dim <= d.second; ++dim) {
+                std::string prefix;
+                if(dim != 0) {
+                    append_dimension(static_cast<int>(dim), &prefix);
+                }
+                for(auto &&t : p.tag.intervals) {
+                    if(any_subtag) {
+                        std::string limit =
+                            t.second == 255
+                                ? prefix_successor(prefix)
+                                : prefix + static_cast<char>(t.second + 1);
+                        suffixes_.push_back(
+                            {prefix + static_cast<char>(t.first), limit});
+                        continue;
+                    }
+                    for(int64_t tag = t.first; tag <= t.second; ++tag) {
+                        std::string tp = prefix + static_cast<char>(tag);
+                        // a key with no subtag ends at its tag
+                        if(p.subtag.contains(-1)) {
+                            suffixes_.push_back({tp, tp + '\0'});
+                        }
+                        for(auto &&b : bytes.intervals) {
+                            std::string limit =
+                                b.second == 255
+                                    ? prefix_successor(tp)
+                                    : tp + static_cast<char>(b.second + 1);
+                            suffixes_.push_back(
+                                {tp + static_cast<char>(b.first), limit});
+                        }
+                    }
+                }
+            }
+        }
+        normalize_ranges(&suffixes_);
+    }
+
+    chunk_predicate_t predicate_;
+    coordinate_t x_;
+    coordinate_t z_;
+    bool empty_;
+    uint32_t z_first_{0};
+    std::vector<key_range_t> suffixes_;
+};
+
+// Counts of the work a planned scan did.
+struct plan_stats_t {
+    uint64_t visited{0};
+    uint64_t matched{0};
+    uint64_t seeks{0};
+};
+
+// How many keys scan_plan() steps over before it seeks instead.
+constexpr int kPlanSteps = 4;
+
+// Visit every key that matches a plan with one forward pass of `it`.
+// `func(it)` is called for each matching key and should return false to stop
+// the scan. Every key the iterator reads is counted as visited, whether it
+// matches or not.
+template <typename F>
+plan_stats_t scan_plan(leveldb::Iterator *it, const ChunkSeekPlan &plan,
+                       F &&func) {
+    plan_stats_t stats;
+    std::string target;
+    if(!plan.Next({}, &target)) {
+        return stats;
+    }
+    it->Seek(target);
+    stats.seeks += 1;
+    while(it->Valid()) {
+        leveldb::Slice key = it->key();
+        std::string_view skey{key.data(), key.size()};
+        stats.visited += 1;
+        if(!plan.Next(skey, &target)) {
+            break;
+        }
+        if(target != skey) {
+            // stepping over a few keys is cheaper than a seek, which has to
+            // search the index of every level again
+            bool reached = false;
+            for(int step = 0; step < kPlanSteps; ++step) {
+                it->Next();
+                if(!it->Valid() || it->key().compare(target) >= 0) {
+                    reached = true;
+                    break;
+                }
+                stats.visited += 1;
+            }
+            if(!reached) {
+                it->Seek(target);
+                stats.seeks += 1;
+            }
+            continue;
+        }
+        if(plan.Matches(skey)) {
+            stats.matched += 1;
+            if(!func(it)) {
+                break;
+            }
+        }
+        it->Next();
+    }
+    return stats;
+}
+
+}  // namespace mcberepair
+
+#endif  // MCBEREPAIR_SEEKPLAN_HPP
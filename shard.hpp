@@ -0,0 +1,121 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+#ifndef MCBEREPAIR_SHARD_HPP
+#define MCBEREPAIR_SHARD_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "leveldb/db.h"
+#include "seekplan.hpp"
+
+namespace mcberepair {
+
+namespace detail {
+// map the first eight bytes of a key to an integer that sorts the same way
+inline uint64_t key_to_point(const leveldb::Slice &key) {
+    uint64_t u = 0;
+    for(size_t i = 0; i < 8; ++i) {
+        u <<= 8;
+        if(i < key.size()) {
+            u |= static_cast<unsigned char>(key[i]);
+        }
+    }
+    return u;
+}
+
+inline std::string point_to_key(uint64_t u) {
+    std::string key(8, '\0');
+    for(size_t i = 0; i < 8; ++i) {
+        key[7 - i] = static_cast<char>(u & 0xFF);
+        u >>= 8;
+    }
+    return key;
+}
+}  // namespace detail
+
+// Split the keyspace of a database into at most `n` shards holding roughly
+// the same number of bytes. Boundaries are found by bisecting over the first
+// eight bytes of the key with GetApproximateSizes, which only consults table
+// indexes. The shards are returned in key order and together cover every key;
+// the first shard has an empty start and the last an empty limit.
+inline std::vector<key_range_t> shard_keyspace(leveldb::DB *db, size_t n) {
+    std::vector<key_range_t> shards;
+    if(n <= 1) {
+        shards.push_back({});
+        return shards;
+    }
+    auto it = std::unique_ptr<leveldb::Iterator>{db->NewIterator({})};
+    it->SeekToFirst();
+    if(!it->Valid()) {
+        shards.push_back({});
+        return shards;
+    }
+    std::string first = it->key().ToString();
+    it->SeekToLast();
+    std::string last = it->key().ToString() + '\0';
+
+    auto size_before = [&](const std::string &key) {
+        uint64_t size = 0;
+        leveldb::Range range{first, key};
+        db->GetApproximateSizes(&range, 1, &size);
+        return size;
+    };
+    uint64_t total = size_before(last);
+    uint64_t lo_point = detail::key_to_point(first);
+    uint64_t hi_point = detail::key_to_point(last);
+    if(total == 0 || lo_point >= hi_point) {
+        // everything is still in the log or shares one prefix
+        shards.push_back({});
+        return shards;
+    }
+
+    std::string start;
+    for(size_t i = 1; i < n; ++i) {
+        uint64_t target = total / n * i;
+        // find the smallest point whose prefix has `target` bytes before it
+        uint64_t lo = lo_point;
+        uint64_t hi = hi_point;
+        while(lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            if(size_before(detail::point_to_key(mid)) < target) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        std::string boundary = detail::point_to_key(lo);
+        if(boundary <= start || boundary <= first) {
+            continue;
+        }
+        shards.push_back({start, boundary});
+        start = boundary;
+    }
+    shards.push_back({start, {}});
+    return shards;
+}
+
+}  // namespace mcberepair
+
+#endif  // MCBEREPAIR_SHARD_HPP
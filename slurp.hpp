@@ -42,10 +42,11 @@ std::basic_string<CharT, Traits, Allocator> slurp_string(
     std::size_t g = in.gcount();
     sz += g;
     while(!in.eof()) {
-        // allocate more space
-        buffer.resize(buffer.size() + 8192);
+        // allocate more space, doubling so large inputs are not copied
+        // over and over
+        buffer.resize(buffer.size() * 2);
         // Keep reading
-        in.read(buffer.data() + sz, 8192);
+        in.read(buffer.data() + sz, buffer.size() - sz);
         // count how many values we read
         g = in.gcount();
         sz += g;
@@ -0,0 +1,217 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+#ifndef MCBEREPAIR_STATS_HPP
+#define MCBEREPAIR_STATS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "procstats.hpp"
+
+namespace mcberepair {
+
+// The phases that time is attributed to. Time that is not spent in any
+// other phase is counted as "other".
+enum class Phase { kOther, kOpen, kScan, kWrite, kCompaction, kClose, kCount };
+
+constexpr const char* kPhaseNames[] = {"other", "open",       "scan",
+                                       "write", "compaction", "close"};
+
+// Process-wide statistics collected for --stats. Phases are tracked on the
+// thread that runs the command; counters may be updated from any thread.
+class Stats {
+   public:
+    bool enabled() const { return enabled_; }
+
+    // Start collecting statistics. Everything is a no-op until this is called.
+    void Start() {
+        enabled_ = true;
+        last_wall_ = std::chrono::steady_clock::now();
+        last_cpu_ = process_cpu_seconds();
+    }
+
+    // Attribute the time since the last switch to the current phase and make
+    // `phase` current. Returns the phase that was current.
+    Phase Enter(Phase phase) {
+        if(!enabled_) {
+            return phase;
+        }
+        auto now = std::chrono::steady_clock::now();
+        double cpu = process_cpu_seconds();
+        auto i = static_cast<int>(current_);
+        wall_[i] += std::chrono::duration<double>(now - last_wall_).count();
+        cpu_[i] += cpu - last_cpu_;
+        last_wall_ = now;
+        last_cpu_ = cpu;
+        return std::exchange(current_, phase);
+    }
+
+    void AddKeys(uint64_t keys, uint64_t bytes) {
+        if(enabled_) {
+            keys_ += keys;
+            bytes_ += bytes;
+        }
+    }
+
+    void AddDecompressed(uint64_t bytes) {
+        if(enabled_) {
+            decompressed_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+        }
+    }
+
+    // Record a leveldb property of a database, captured before it closes.
+    void AddProperty(const std::string& db, const char* name,
+                     std::string value) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        properties_.push_back({db, name, std::move(value)});
+    }
+
+    void Report(FILE* out, bool json) {
+        Enter(current_);
+        double wall = 0.0, cpu = 0.0;
+        for(int i = 0; i < kNumPhases; ++i) {
+            wall += wall_[i];
+            cpu += cpu_[i];
+        }
+        if(json) {
+            ReportJson(out, wall, cpu);
+        } else {
+            ReportText(out, wall, cpu);
+        }
+    }
+
+   protected:
+    static constexpr int kNumPhases = static_cast<int>(Phase::kCount);
+
+    struct property_t {
+        std::string db;
+        const char* name;
+        std::string value;
+    };
+
+    void ReportText(FILE* out, double wall, double cpu) {
+        fprintf(out, "Statistics:\n");
+        fprintf(out, "  %-12s %10s %10s\n", "phase", "wall (s)", "cpu (s)");
+        for(int i = 0; i < kNumPhases; ++i) {
+            fprintf(out, "  %-12s %10.3f %10.3f\n", kPhaseNames[i], wall_[i],
+                    cpu_[i]);
+        }
+        fprintf(out, "  %-12s %10.3f %10.3f\n", "total", wall, cpu);
+        fprintf(out, "  keys: %llu\n", static_cast<unsigned long long>(keys_));
+        fprintf(out, "  bytes: %llu\n",
+                static_cast<unsigned long long>(bytes_));
+        fprintf(out, "  decompressed bytes: %llu\n",
+                static_cast<unsigned long long>(decompressed_bytes_));
+        fprintf(out, "  peak RSS: %.1f MB\n",
+                peak_rss_bytes() / (1024.0 * 1024.0));
+        for(auto&& prop : properties_) {
+            fprintf(out, "%s (%s):\n%s\n", prop.name, prop.db.c_str(),
+                    prop.value.c_str());
+        }
+    }
+
+    void ReportJson(FILE* out, double wall, double cpu) {
+        fprintf(out, "{\"phases\": {");
+        for(int i = 0; i < kNumPhases; ++i) {
+            fprintf(out, "%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f}",
+                    i == 0 ? "" : ", ", kPhaseNames[i], wall_[i], cpu_[i]);
+        }
+        fprintf(out, "}, \"wall\": %.6f, \"cpu\": %.6f", wall, cpu);
+        fprintf(out, ", \"keys\": %llu, \"bytes\": %llu",
+                static_cast<unsigned long long>(keys_),
+                static_cast<unsigned long long>(bytes_));
+        fprintf(out, ", \"decompressed_bytes\": %llu",
+                static_cast<unsigned long long>(decompressed_bytes_));
+        fprintf(out, ", \"peak_rss\": %llu",
+                static_cast<unsigned long long>(peak_rss_bytes()));
+        fprintf(out, ", \"properties\": [");
+        for(size_t i = 0; i < properties_.size(); ++i) {
+            auto& prop = properties_[i];
+            fprintf(out, "%s{\"db\": \"%s\", \"name\": \"%s\", \"value\": \"%s\"}",
+                    i == 0 ? "" : ", ", JsonEscape(prop.db).c_str(), prop.name,
+                    JsonEscape(prop.value).c_str());
+        }
+        fprintf(out, "]}\n");
+    }
+
+    static std::string JsonEscape(const std::string& str) {
+        std::string ret;
+        ret.reserve(str.size());
+        for(char c : str) {
+            auto u = static_cast<unsigned char>(c);
+            if(c == '"' || c == '\\') {
+                ret += '\\';
+                ret += c;
+            } else if(c == '\n') {
+                ret += "\\n";
+            } else if(u < 0x20) {
+                char buffer[8];
+                snprintf(buffer, sizeof(buffer), "\\u%04x", u);
+                ret += buffer;
+            } else {
+                ret += c;
+            }
+        }
+        return ret;
+    }
+
+    bool enabled_{false};
+    Phase current_{Phase::kOther};
+    std::chrono::steady_clock::time_point last_wall_;
+    double last_cpu_{0.0};
+    double wall_[kNumPhases] = {};
+    double cpu_[kNumPhases] = {};
+    std::atomic<uint64_t> keys_{0};
+    std::atomic<uint64_t> bytes_{0};
+    std::atomic<uint64_t> decompressed_bytes_{0};
+    std::mutex mutex_;
+    std::vector<property_t> properties_;
+};
+
+inline Stats& stats() {
+    static Stats stats;
+    return stats;
+}
+
+// Attributes time to a phase for the lifetime of the object. Phases nest:
+// the enclosing phase stops accruing time until the inner one ends.
+class ScopedPhase {
+   public:
+    explicit ScopedPhase(Phase phase) : previous_{stats().Enter(phase)} {}
+    ~ScopedPhase() { stats().Enter(previous_); }
+
+    ScopedPhase(const ScopedPhase&) = delete;
+    ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+   protected:
+    Phase previous_;
+};
+
+}  // namespace mcberepair
+
+#endif  // MCBEREPAIR_STATS_HPP
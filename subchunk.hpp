@@ -0,0 +1,373 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+#ifndef MCBEREPAIR_SUBCHUNK_HPP
+#define MCBEREPAIR_SUBCHUNK_HPP
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MCBEREPAIR_SUBCHUNK_SSE2 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define MCBEREPAIR_SUBCHUNK_NEON 1
+#endif
+
+#include "nbt.hpp"
+#include "nbtpath.hpp"
+
+// Decoding of SubChunkPrefix values (chunk tag 47) in the paletted formats
+// 1, 8, and 9. A subchunk is a 16x16x16 cube of blocks stored in one or more
+// layers; the second layer, if present, usually holds water in waterlogged
+// blocks. Each layer packs a palette index for every block into 32-bit
+// little-endian words, with as many indices per word as fit, followed by a
+// palette of NBT block states.
+//
+// See https://minecraft.gamepedia.com/Bedrock_Edition_level_format
+
+namespace mcberepair {
+
+constexpr int kSubchunkBlocks = 4096;
+
+// The index of the block at (x, y, z) inside a subchunk, which is the order
+// indices are stored and unpacked in.
+constexpr int subchunk_block_index(int x, int y, int z) {
+    return (x * 16 + z) * 16 + y;
+}
+
+// One layer of a subchunk. Pointers refer to the value it was parsed from.
+struct block_storage_t {
+    // bits per block; 0 means every block is the first palette entry
+    int bits;
+    const char *words;
+    size_t word_count;
+    // the raw NBT of each palette entry
+    std::vector<std::string_view> palette;
+};
+
+struct subchunk_t {
+    int version;
+    // only stored by version 9; otherwise use the subtag of the key
+    int y;
+    std::vector<block_storage_t> layers;
+};
+
+namespace detail {
+
+inline bool subchunk_valid_bits(int bits) {
+    return (0 <= bits && bits <= 6) || bits == 8 || bits == 16;
+}
+
+inline size_t subchunk_word_count(int bits) {
+    if(bits == 0) {
+        return 0;
+    }
+    size_t per_word = 32 / bits;
+    return (kSubchunkBlocks + per_word - 1) / per_word;
+}
+
+// Unpack the indices of `words` one at a time. Knowing `Bits` at compile time
+// turns every shift and mask into a constant.
+template <int Bits>
+void unpack_indices_scalar(const char *words, int first, uint16_t *out) {
+    constexpr int per_word = 32 / Bits;
+    constexpr uint32_t mask = (uint32_t{1} << Bits) - 1;
+    for(int n = first; n < kSubchunkBlocks; ++n) {
+        uint32_t word;
+        std::memcpy(&word, words + 4 * (n / per_word), 4);
+        out[n] = static_cast<uint16_t>((word >> ((n % per_word) * Bits)) & mask);
+    }
+}
+
+// Unpack the indices of `words`, four words or four indices at a time where
+// SIMD is available.
+template <int Bits>
+void unpack_indices(const char *words, uint16_t *out) {
+    constexpr int per_word = 32 / Bits;
+    int n = 0;
+#if defined(MCBEREPAIR_SUBCHUNK_SSE2)
+    if constexpr(per_word >= 4) {
+        // Four words are loaded into the lanes of a register. One shift
+        // extracts the same index from each word, and a 4x4 transpose puts
+        // four indices of each word next to each other for the store.
+        constexpr int groups = kSubchunkBlocks / (4 * per_word);
+        constexpr int in_vector = per_word - per_word % 4;
+        const __m128i mask = _mm_set1_epi32((1 << Bits) - 1);
+        for(int g = 0; g < groups; ++g) {
+            __m128i x = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(words + 16 * g));
+            uint16_t *row = out + 4 * per_word * g;
+            for(int j = 0; j < in_vector; j += 4) {
+                __m128i a = _mm_and_si128(_mm_srli_epi32(x, j * Bits), mask);
+                __m128i b =
+                    _mm_and_si128(_mm_srli_epi32(x, (j + 1) * Bits), mask);
+                __m128i c =
+                    _mm_and_si128(_mm_srli_epi32(x, (j + 2) * Bits), mask);
+                __m128i d =
+                    _mm_and_si128(_mm_srli_epi32(x, (j + 3) * Bits), mask);
+                __m128i ab_lo = _mm_unpacklo_epi32(a, b);
+                __m128i ab_hi = _mm_unpackhi_epi32(a, b);
+                __m128i cd_lo = _mm_unpacklo_epi32(c, d);
+                __m128i cd_hi = _mm_unpackhi_epi32(c, d);
+                // indices fit in 8 bits, so packing never saturates
+                __m128i w01 = _mm_packs_epi32(_mm_unpacklo_epi64(ab_lo, cd_lo),
+                                              _mm_unpackhi_epi64(ab_lo, cd_lo));
+                __m128i w23 = _mm_packs_epi32(_mm_unpacklo_epi64(ab_hi, cd_hi),
+                                              _mm_unpackhi_epi64(ab_hi, cd_hi));
+                _mm_storel_epi64(reinterpret_cast<__m128i *>(row + j), w01);
+                _mm_storel_epi64(
+                    reinterpret_cast<__m128i *>(row + per_word + j),
+                    _mm_srli_si128(w01, 8));
+                _mm_storel_epi64(
+                    reinterpret_cast<__m128i *>(row + 2 * per_word + j), w23);
+                _mm_storel_epi64(
+                    reinterpret_cast<__m128i *>(row + 3 * per_word + j),
+                    _mm_srli_si128(w23, 8));
+            }
+            for(int j = in_vector; j < per_word; ++j) {
+                alignas(16) uint32_t lanes[4];
+                _mm_store_si128(
+                    reinterpret_cast<__m128i *>(lanes),
+                    _mm_and_si128(_mm_srli_epi32(x, j * Bits), mask));
+                for(int i = 0; i < 4; ++i) {
+                    row[i * per_word + j] = static_cast<uint16_t>(lanes[i]);
+                }
+            }
+        }
+        n = groups * 4 * per_word;
+    }
+#elif defined(MCBEREPAIR_SUBCHUNK_NEON)
+    if constexpr(per_word >= 4) {
+        // NEON shifts each lane by its own amount, so four neighboring
+        // indices of one word are extracted at once.
+        constexpr int in_vector = per_word - per_word % 4;
+        constexpr int words_in_vector = kSubchunkBlocks / per_word;
+        const uint32x4_t mask = vdupq_n_u32((1u << Bits) - 1);
+        const int32_t lane_shifts[4] = {0, -Bits, -2 * Bits, -3 * Bits};
+        const int32x4_t shifts = vld1q_s32(lane_shifts);
+        for(int w = 0; w < words_in_vector; ++w) {
+            uint32_t word;
+            std::memcpy(&word, words + 4 * w, 4);
+            uint16_t *row = out + per_word * w;
+            for(int j = 0; j < in_vector; j += 4) {
+                uint32x4_t v = vshlq_u32(vdupq_n_u32(word >> (j * Bits)),
+                                         shifts);
+                vst1_u16(row + j, vmovn_u32(vandq_u32(v, mask)));
+            }
+            for(int j = in_vector; j < per_word; ++j) {
+                row[j] = static_cast<uint16_t>((word >> (j * Bits)) &
+                                               ((1u << Bits) - 1));
+            }
+        }
+        n = words_in_vector * per_word;
+    }
+#endif
+    unpack_indices_scalar<Bits>(words, n, out);
+}
+
+}  // namespace detail
+
+// Parse one layer at *p and leave *p after it. Returns false if the data is
+// malformed or the layer uses runtime ids, which are never saved.
+inline bool parse_block_storage(const char **p, const char *last,
+                                block_storage_t *out) {
+    using namespace detail;
+    uint8_t header;
+    if(!nbt_read(p, last, &header) || (header & 1) != 0) {
+        return false;
+    }
+    out->bits = header >> 1;
+    if(!subchunk_valid_bits(out->bits)) {
+        return false;
+    }
+    out->word_count = subchunk_word_count(out->bits);
+    out->words = *p;
+    int32_t size;
+    if(!nbt_skip(p, last, 4 * out->word_count) || !nbt_read(p, last, &size) ||
+       size < 1) {
+        return false;
+    }
+    out->palette.clear();
+    for(int32_t i = 0; i < size; ++i) {
+        const char *start = *p;
+        nbt_type type;
+        std::string_view name;
+        if(!nbt_read_type(p, last, &type) || type != nbt_type::COMPOUND ||
+           !nbt_read_name(p, last, &name) ||
+           !skip_nbt_payload(p, last, type)) {
+            return false;
+        }
+        out->palette.emplace_back(start, *p - start);
+    }
+    return true;
+}
+
+// Parse a subchunk value of version 1, 8, or 9. `out` can be reused between
+// calls to avoid allocating. Returns false if the value is malformed or in an
+// older format.
+inline bool parse_subchunk(const char *data, size_t size, subchunk_t *out) {
+    using namespace detail;
+    assert(out != nullptr);
+    const char *p = data;
+    const char *last = data + size;
+    uint8_t version;
+    uint8_t count = 1;
+    int8_t y = 0;
+    if(!nbt_read(&p, last, &version)) {
+        return false;
+    }
+    if(version == 8 || version == 9) {
+        if(!nbt_read(&p, last, &count) ||
+           (version == 9 && !nbt_read(&p, last, &y))) {
+            return false;
+        }
+    } else if(version != 1) {
+        return false;
+    }
+    out->version = version;
+    out->y = y;
+    // resizing keeps the palettes of reused layers allocated
+    out->layers.resize(count);
+    for(auto &&layer : out->layers) {
+        if(!parse_block_storage(&p, last, &layer)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Unpack 4096 indices of `bits` bits each from `words` into `out`, in the
+// order of subchunk_block_index(). Biomes in Data3D are packed the same way
+// as blocks.
+inline void unpack_packed_indices(int bits, const char *words,
+                                  uint16_t out[kSubchunkBlocks]) {
+    using namespace detail;
+    switch(bits) {
+        case 0:
+            std::memset(out, 0, kSubchunkBlocks * sizeof(uint16_t));
+            break;
+        case 1:
+            unpack_indices<1>(words, out);
+            break;
+        case 2:
+            unpack_indices<2>(words, out);
+            break;
+        case 3:
+            unpack_indices<3>(words, out);
+            break;
+        case 4:
+            unpack_indices<4>(words, out);
+            break;
+        case 5:
+            unpack_indices<5>(words, out);
+            break;
+        case 6:
+            unpack_indices<6>(words, out);
+            break;
+        case 8:
+            unpack_indices<8>(words, out);
+            break;
+        default:
+            assert(bits == 16);
+            unpack_indices<16>(words, out);
+            break;
+    }
+}
+
+// Unpack the palette index of every block in a layer into `out`, in the
+// order of subchunk_block_index(). Indices are not checked against the size
+// of the palette.
+inline void unpack_block_indices(const block_storage_t &layer,
+                                 uint16_t out[kSubchunkBlocks]) {
+    unpack_packed_indices(layer.bits, layer.words, out);
+}
+
+// Read a palette entry with `reader` and name it like a block state in
+// commands, such as "minecraft:stone[stone_type=granite]". Blocks from before
+// named states keep their data value as "[val=N]". `buffer` holds a copy of
+// the entry for the reader. Returns false if the entry is malformed.
+inline bool block_state_name(std::string_view entry, NbtReader *reader,
+                             std::string *buffer, std::string *out) {
+    buffer->assign(entry);
+    out->clear();
+    if(!reader->Read(buffer->data(), buffer->size())) {
+        return false;
+    }
+    std::string states;
+    size_t depth = 0;
+    bool in_states = false;
+    auto add_state = [&](std::string_view name, const std::string &value) {
+        states += states.empty() ? '[' : ',';
+        states.append(name);
+        states += '=';
+        states += value;
+    };
+    for(auto &&tag : reader->tape()) {
+        auto &v = tag.payload;
+        if(std::holds_alternative<nbt_end_t>(v) ||
+           std::holds_alternative<nbt_list_end_t>(v)) {
+            depth -= 1;
+            in_states = in_states && depth >= 2;
+            continue;
+        }
+        bool opens = std::holds_alternative<nbt_compound_t>(v) ||
+                     std::holds_alternative<nbt_list_t>(v);
+        // the fields of the entry are at depth 1, its states at depth 2
+        if(depth == 1 && tag.name == "name") {
+            if(auto *s = std::get_if<nbt_string_t>(&v)) {
+                out->assign(s->data, s->size);
+            }
+        } else if(depth == 1 && tag.name == "states" &&
+                  std::holds_alternative<nbt_compound_t>(v)) {
+            in_states = true;
+        } else if((depth == 2 && in_states) ||
+                  (depth == 1 && tag.name == "val")) {
+            if(auto *s = std::get_if<nbt_string_t>(&v)) {
+                add_state(tag.name, std::string{s->data, s->size});
+            } else if(auto *b = std::get_if<int8_t>(&v)) {
+                add_state(tag.name, std::to_string(*b));
+            } else if(auto *h = std::get_if<int16_t>(&v)) {
+                add_state(tag.name, std::to_string(*h));
+            } else if(auto *i = std::get_if<int32_t>(&v)) {
+                add_state(tag.name, std::to_string(*i));
+            }
+        }
+        if(opens) {
+            depth += 1;
+        }
+    }
+    if(!states.empty()) {
+        states += ']';
+    }
+    out->append(states);
+    return true;
+}
+
+}  // namespace mcberepair
+
+#endif  // MCBEREPAIR_SUBCHUNK_HPP
@@ -0,0 +1,610 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+#ifndef MCBEREPAIR_TABLEFILE_HPP
+#define MCBEREPAIR_TABLEFILE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Reading the files of a database without opening it needs a few of
+// leveldb's internal headers, like the bulk loader does.
+#include "db/dbformat.h"
+#include "db/filename.h"
+#include "db/log_reader.h"
+#include "db/write_batch_internal.h"
+#include "leveldb/env.h"
+#include "leveldb/iterator.h"
+#include "leveldb/table.h"
+#include "leveldb/write_batch.h"
+#include "leveldb/zlib_compressor.h"
+#include "crc32c.hpp"
+#include "iotrace.hpp"
+#include "table/format.h"
+#include "util/coding.h"
+
+namespace mcberepair {
+
+// A table that the MANIFEST lists as part of the current version.
+struct table_file_t {
+    uint64_t number;
+    uint64_t size;
+    int level;
+};
+
+// The parts of a database's current version that tools reading its files
+// directly need. Tables are sorted by file number.
+struct manifest_t {
+    std::vector<table_file_t> tables;
+    uint64_t log_number{0};
+    uint64_t prev_log_number{0};
+    uint64_t last_sequence{0};
+};
+
+namespace detail {
+// Apply one encoded VersionEdit to a map of live tables. Only the fields
+// that manifest_t keeps are decoded; the rest are skipped.
+inline bool apply_version_edit(leveldb::Slice input,
+                               std::map<uint64_t, table_file_t>* tables,
+                               manifest_t* out) {
+    // tags from leveldb's db/version_edit.cc
+    enum : uint32_t {
+        kComparator = 1,
+        kLogNumber = 2,
+        kNextFileNumber = 3,
+        kLastSequence = 4,
+        kCompactPointer = 5,
+        kDeletedFile = 6,
+        kNewFile = 7,
+        kPrevLogNumber = 9
+    };
+    auto skip_slice = [](leveldb::Slice* in) {
+        uint32_t len;
+        if(!leveldb::GetVarint32(in, &len) || in->size() < len) {
+            return false;
+        }
+        in->remove_prefix(len);
+        return true;
+    };
+    uint32_t tag, level;
+    uint64_t number, size;
+    while(!input.empty()) {
+        if(!leveldb::GetVarint32(&input, &tag)) {
+            return false;
+        }
+        switch(tag) {
+            case kComparator:
+                if(!skip_slice(&input)) {
+                    return false;
+                }
+                break;
+            case kLogNumber:
+                if(!leveldb::GetVarint64(&input, &out->log_number)) {
+                    return false;
+                }
+                break;
+            case kPrevLogNumber:
+                if(!leveldb::GetVarint64(&input, &out->prev_log_number)) {
+                    return false;
+                }
+                break;
+            case kNextFileNumber:
+                if(!leveldb::GetVarint64(&input, &number)) {
+                    return false;
+                }
+                break;
+            case kLastSequence:
+                if(!leveldb::GetVarint64(&input, &out->last_sequence)) {
+                    return false;
+                }
+                break;
+            case kCompactPointer:
+                if(!leveldb::GetVarint32(&input, &level) ||
+                   !skip_slice(&input)) {
+                    return false;
+                }
+                break;
+            case kDeletedFile:
+                if(!leveldb::GetVarint32(&input, &level) ||
+                   !leveldb::GetVarint64(&input, &number)) {
+                    return false;
+                }
+                tables->erase(number);
+                break;
+            case kNewFile:
+                if(!leveldb::GetVarint32(&input, &level) ||
+                   !leveldb::GetVarint64(&input, &number) ||
+                   !leveldb::GetVarint64(&input, &size) ||
+                   !skip_slice(&input) || !skip_slice(&input)) {
+                    return false;
+                }
+                (*tables)[number] = {number, size, static_cast<int>(level)};
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+class LogReporter : public leveldb::log::Reader::Reporter {
+   public:
+    void Corruption(size_t bytes, const leveldb::Status& status) override {
+        dropped_bytes += bytes;
+        if(this->status.ok()) {
+            this->status = status;
+        }
+    }
+    uint64_t dropped_bytes{0};
+    leveldb::Status status;
+};
+
+// Whether a block and its trailer end at or before `end`. Nothing is added
+// to the handle, so a corrupt handle cannot overflow into range.
+inline bool block_in_range(const leveldb::BlockHandle& handle, uint64_t end) {
+    return end >= leveldb::kBlockTrailerSize &&
+           handle.offset() <= end - leveldb::kBlockTrailerSize &&
+           handle.size() <=
+               end - leveldb::kBlockTrailerSize - handle.offset();
+}
+}  // namespace detail
+
+// A data block of a table, as its index describes it. Every key in the
+// block is at most `last_key`, and greater than the previous block's.
+struct table_block_t {
+    uint64_t offset;
+    uint64_t size;
+    std::string last_key;
+};
+
+// What reading one block found. `contents` holds as much of the block as
+// could be recovered, which for a block that did not decompress is the
+// part that did.
+struct block_read_t {
+    leveldb::Status status;
+    bool checksum_ok{false};
+    bool decompressed{false};
+    leveldb::Slice contents;
+};
+
+// How far the contents of a block can be trusted when parsing them.
+enum class block_trust_t {
+    kChecked,    // the checksum matched, so any malformed entry is an error
+    kDamaged,    // skip malformed entries by resuming at restart points
+    kTruncated,  // a prefix without its restart array; stop at the damage
+};
+
+// Call func(key, value) for every entry of a block in order. func returns
+// false to reject an entry, which is then treated like a malformed one.
+// Returns true if every entry of the block was parsed and accepted.
+template <typename F>
+bool parse_block(leveldb::Slice contents, block_trust_t trust, F&& func) {
+    const char* data = contents.data();
+    size_t limit = contents.size();
+    // a block ends with the offsets of its restart points and their count
+    uint32_t num_restarts = 0;
+    bool trailer = false;
+    if(trust != block_trust_t::kTruncated && limit >= 4) {
+        num_restarts = leveldb::DecodeFixed32(data + limit - 4);
+        if(num_restarts <= (limit - 4) / 4) {
+            limit -= 4 + 4 * size_t{num_restarts};
+            trailer = true;
+        }
+    }
+    if(!trailer) {
+        if(trust == block_trust_t::kChecked) {
+            return false;
+        }
+        num_restarts = 0;
+    }
+
+    bool clean = true;
+    std::string key;
+    size_t offset = 0;
+    while(offset < limit) {
+        leveldb::Slice in{data + offset, limit - offset};
+        uint32_t shared, non_shared, value_size;
+        if(leveldb::GetVarint32(&in, &shared) &&
+           leveldb::GetVarint32(&in, &non_shared) &&
+           leveldb::GetVarint32(&in, &value_size) && shared <= key.size() &&
+           uint64_t{non_shared} + value_size <= in.size()) {
+            key.resize(shared);
+            key.append(in.data(), non_shared);
+            if(func(leveldb::Slice{key},
+                    leveldb::Slice{in.data() + non_shared, value_size})) {
+                offset = in.data() + non_shared + value_size - data;
+                continue;
+            }
+        }
+        clean = false;
+        if(trust != block_trust_t::kDamaged) {
+            break;
+        }
+        // Keys are stored whole at restart points, so parsing can resume
+        // at the first one past the damage.
+        size_t resume = limit;
+        for(uint32_t r = 0; r < num_restarts; ++r) {
+            size_t o = leveldb::DecodeFixed32(data + limit + 4 * r);
+            if(o > offset && o < resume) {
+                resume = o;
+            }
+        }
+        key.clear();
+        offset = resume;
+    }
+    return clean;
+}
+
+// Read the current version of the database at `path` from its MANIFEST.
+// The database is not opened or locked, so a running game may replace the
+// MANIFEST while it is read; callers should retry if that happens.
+inline leveldb::Status read_manifest(leveldb::Env* env,
+                                     const std::string& path,
+                                     manifest_t* out) {
+    std::string current;
+    leveldb::Status status = leveldb::ReadFileToString(
+        env, leveldb::CurrentFileName(path), &current);
+    if(!status.ok()) {
+        return status;
+    }
+    if(current.empty() || current.back() != '\n') {
+        return leveldb::Status::Corruption("CURRENT file is malformed");
+    }
+    current.pop_back();
+
+    leveldb::SequentialFile* pfile = nullptr;
+    status = env->NewSequentialFile(path + "/" + current, &pfile);
+    if(!status.ok()) {
+        return status;
+    }
+    std::unique_ptr<leveldb::SequentialFile> file{pfile};
+
+    *out = {};
+    std::map<uint64_t, table_file_t> tables;
+    detail::LogReporter reporter;
+    leveldb::log::Reader reader{file.get(), &reporter, true, 0};
+    leveldb::Slice record;
+    std::string scratch;
+    while(reader.ReadRecord(&record, &scratch)) {
+        if(!detail::apply_version_edit(record, &tables, out)) {
+            return leveldb::Status::Corruption("malformed version edit",
+                                               current);
+        }
+    }
+    if(!reporter.status.ok()) {
+        return reporter.status;
+    }
+    for(auto&& t : tables) {
+        out->tables.push_back(t.second);
+    }
+    return status;
+}
+
+// The numbers of the logs that hold writes not yet in any table.
+inline leveldb::Status live_log_files(leveldb::Env* env,
+                                      const std::string& path,
+                                      const manifest_t& manifest,
+                                      std::vector<uint64_t>* out) {
+    std::vector<std::string> children;
+    leveldb::Status status = env->GetChildren(path, &children);
+    if(!status.ok()) {
+        return status;
+    }
+    out->clear();
+    uint64_t number;
+    leveldb::FileType type;
+    for(auto&& child : children) {
+        if(leveldb::ParseFileName(child, &number, &type) &&
+           type == leveldb::kLogFile &&
+           (number >= manifest.log_number ||
+            number == manifest.prev_log_number)) {
+            out->push_back(number);
+        }
+    }
+    std::sort(out->begin(), out->end());
+    return status;
+}
+
+// Opens table files for reading with the options leveldb itself would use:
+// internal keys and Minecraft's zlib compressors.
+class TableFiles {
+   public:
+    explicit TableFiles(std::string path, leveldb::Env* env = db_env())
+        : path_{std::move(path)},
+          env_{env},
+          icmp_{leveldb::BytewiseComparator()} {
+        options_.comparator = &icmp_;
+        options_.compressors[0] = &zlib_raw_;
+        options_.compressors[1] = &zlib_;
+        options_.env = env_;
+    }
+
+    TableFiles(const TableFiles&) = delete;
+    TableFiles& operator=(const TableFiles&) = delete;
+
+    // Tables are named *.ldb, but older worlds may still hold *.sst files.
+    std::string FileName(uint64_t number) const {
+        std::string name = leveldb::TableFileName(path_, number);
+        if(!env_->FileExists(name)) {
+            std::string old = leveldb::SSTTableFileName(path_, number);
+            if(env_->FileExists(old)) {
+                return old;
+            }
+        }
+        return name;
+    }
+
+    // A table and the file it reads from, which must outlive it.
+    struct table_t {
+        std::unique_ptr<leveldb::RandomAccessFile> file;
+        std::unique_ptr<leveldb::Table> table;
+    };
+
+    // Open the file of a table without parsing it.
+    leveldb::Status OpenFile(
+        uint64_t number, std::unique_ptr<leveldb::RandomAccessFile>* out,
+        uint64_t* size) const {
+        std::string name = FileName(number);
+        leveldb::Status status = env_->GetFileSize(name, size);
+        if(!status.ok()) {
+            return status;
+        }
+        leveldb::RandomAccessFile* pfile = nullptr;
+        status = env_->NewRandomAccessFile(name, &pfile);
+        out->reset(pfile);
+        return status;
+    }
+
+    leveldb::Status Open(uint64_t number, table_t* out) const {
+        uint64_t size = 0;
+        leveldb::Status status = OpenFile(number, &out->file, &size);
+        if(!status.ok()) {
+            return status;
+        }
+        leveldb::Table* ptable = nullptr;
+        status =
+            leveldb::Table::Open(options_, out->file.get(), size, &ptable);
+        out->table.reset(ptable);
+        return status;
+    }
+
+    // Call func(parsed_key, value) for every entry of a table in order.
+    // Keys are internal keys, so deletions and overwritten values are seen
+    // too; their sequence numbers tell which is newest.
+    template <typename F>
+    leveldb::Status ForEach(uint64_t number, F&& func) const {
+        table_t t;
+        leveldb::Status status = Open(number, &t);
+        if(!status.ok()) {
+            return status;
+        }
+        leveldb::ReadOptions read_options;
+        read_options.verify_checksums = true;
+        read_options.fill_cache = false;
+        std::unique_ptr<leveldb::Iterator> it{
+            t.table->NewIterator(read_options)};
+        leveldb::ParsedInternalKey ikey;
+        for(it->SeekToFirst(); it->Valid(); it->Next()) {
+            if(!leveldb::ParseInternalKey(it->key(), &ikey)) {
+                return leveldb::Status::Corruption("malformed internal key",
+                                                   FileName(number));
+            }
+            func(ikey, it->value());
+        }
+        return it->status();
+    }
+
+    // Call func(parsed_key, value) for every write in a log, in the order
+    // they were made. Records that fail their checksum are skipped, and the
+    // first error is returned after the rest of the log is read.
+    template <typename F>
+    leveldb::Status ForEachLogged(uint64_t number, F&& func) const {
+        leveldb::SequentialFile* pfile = nullptr;
+        leveldb::Status status = env_->NewSequentialFile(
+            leveldb::LogFileName(path_, number), &pfile);
+        if(!status.ok()) {
+            return status;
+        }
+        std::unique_ptr<leveldb::SequentialFile> file{pfile};
+
+        struct handler_t : leveldb::WriteBatch::Handler {
+            std::remove_reference_t<F>* func;
+            leveldb::SequenceNumber sequence;
+            void Put(const leveldb::Slice& key,
+                     const leveldb::Slice& value) override {
+                (*func)(leveldb::ParsedInternalKey{key, sequence++,
+                                                   leveldb::kTypeValue},
+                        value);
+            }
+            void Delete(const leveldb::Slice& key) override {
+                (*func)(leveldb::ParsedInternalKey{key, sequence++,
+                                                   leveldb::kTypeDeletion},
+                        leveldb::Slice{});
+            }
+        } handler;
+        handler.func = &func;
+
+        detail::LogReporter reporter;
+        leveldb::log::Reader reader{file.get(), &reporter, true, 0};
+        leveldb::Slice record;
+        std::string scratch;
+        leveldb::WriteBatch batch;
+        while(reader.ReadRecord(&record, &scratch)) {
+            // a batch starts with a 12-byte header
+            if(record.size() < 12) {
+                reporter.Corruption(record.size(),
+                                    leveldb::Status::Corruption(
+                                        "log record too small"));
+                continue;
+            }
+            leveldb::WriteBatchInternal::SetContents(&batch, record);
+            handler.sequence = leveldb::WriteBatchInternal::Sequence(&batch);
+            leveldb::Status s = batch.Iterate(&handler);
+            if(!s.ok() && reporter.status.ok()) {
+                reporter.status = s;
+            }
+        }
+        return reporter.status;
+    }
+
+    // Read one block and its trailer, verify its checksum, and decompress
+    // it. `raw` and `buffer` hold the data that `contents` points into. A
+    // block whose checksum does not match is only decompressed if
+    // `salvage` is set.
+    block_read_t ReadBlock(leveldb::RandomAccessFile* file, uint64_t offset,
+                           uint64_t size, bool salvage, std::string* raw,
+                           std::string* buffer) const {
+        block_read_t out;
+        size_t n = static_cast<size_t>(size);
+        raw->resize(n + leveldb::kBlockTrailerSize);
+        leveldb::Slice data;
+        out.status = file->Read(offset, n + leveldb::kBlockTrailerSize,
+                                &data, &(*raw)[0]);
+        if(!out.status.ok()) {
+            return out;  // LCOV_EXCL_LINE
+        }
+        if(data.size() != n + leveldb::kBlockTrailerSize) {
+            out.status = leveldb::Status::Corruption("truncated block read");
+            return out;
+        }
+        return CheckBlock(data, salvage, buffer);
+    }
+
+    // Verify and decompress a block whose bytes, trailer included, are
+    // already in memory. `contents` points into `data` or `buffer`.
+    block_read_t CheckBlock(leveldb::Slice data, bool salvage,
+                            std::string* buffer) const {
+        block_read_t out;
+        size_t n = data.size() - leveldb::kBlockTrailerSize;
+        // the checksum covers the block and its compression type
+        uint32_t expected =
+            crc32c::Unmask(leveldb::DecodeFixed32(data.data() + n + 1));
+        out.checksum_ok = crc32c::Value(data.data(), n + 1) == expected;
+        if(!out.checksum_ok) {
+            out.status = leveldb::Status::Corruption("block checksum mismatch");
+            if(!salvage) {
+                return out;
+            }
+        }
+        char type = data[n];
+        if(type == 0) {
+            out.decompressed = true;
+            out.contents = leveldb::Slice{data.data(), n};
+            return out;
+        }
+        const leveldb::Compressor* compressor = nullptr;
+        for(auto* c : options_.compressors) {
+            if(c != nullptr && c->uniqueCompressionID == type) {
+                compressor = c;
+                break;
+            }
+        }
+        buffer->clear();
+        out.decompressed = compressor != nullptr &&
+                           compressor->decompress(data.data(), n, *buffer);
+        if(!out.decompressed && out.status.ok()) {
+            out.status = leveldb::Status::Corruption(
+                "corrupted compressed block contents");
+        }
+        out.contents = leveldb::Slice{*buffer};
+        return out;
+    }
+
+    // Read the footer and index block of a table to find its data blocks.
+    // With `salvage`, whatever entries of a damaged index can be parsed are
+    // used, and the error is still returned.
+    leveldb::Status ReadIndex(leveldb::RandomAccessFile* file,
+                              uint64_t file_size, bool salvage,
+                              std::vector<table_block_t>* out) const {
+        out->clear();
+        if(file_size < leveldb::Footer::kEncodedLength) {
+            return leveldb::Status::Corruption("file is too short to be a "
+                                               "table");
+        }
+        char footer_space[leveldb::Footer::kEncodedLength];
+        leveldb::Slice input;
+        leveldb::Status status =
+            file->Read(file_size - leveldb::Footer::kEncodedLength,
+                       leveldb::Footer::kEncodedLength, &input, footer_space);
+        if(!status.ok()) {
+            return status;  // LCOV_EXCL_LINE
+        }
+        leveldb::Footer footer;
+        status = footer.DecodeFrom(&input);
+        if(!status.ok()) {
+            return status;
+        }
+        const leveldb::BlockHandle& index = footer.index_handle();
+        if(!detail::block_in_range(index, file_size)) {
+            return leveldb::Status::Corruption("index block is out of range");
+        }
+        std::string raw, buffer;
+        block_read_t block = ReadBlock(file, index.offset(), index.size(),
+                                       salvage, &raw, &buffer);
+        if(!block.status.ok() && !salvage) {
+            return block.status;
+        }
+        block_trust_t trust = !block.decompressed ? block_trust_t::kTruncated
+                              : !block.checksum_ok ? block_trust_t::kDamaged
+                                                   : block_trust_t::kChecked;
+        uint64_t end = file_size - leveldb::Footer::kEncodedLength;
+        bool clean = parse_block(
+            block.contents, trust,
+            [&](const leveldb::Slice& key, leveldb::Slice value) {
+                leveldb::BlockHandle handle;
+                if(!handle.DecodeFrom(&value).ok() ||
+                   !detail::block_in_range(handle, end) ||
+                   (!out->empty() && handle.offset() <= out->back().offset)) {
+                    return false;
+                }
+                out->push_back(
+                    {handle.offset(), handle.size(), key.ToString()});
+                return true;
+            });
+        if(block.status.ok() && !clean) {
+            block.status = leveldb::Status::Corruption("malformed index block");
+        }
+        return block.status;
+    }
+
+    const leveldb::Options& options() const { return options_; }
+    const leveldb::InternalKeyComparator& comparator() const { return icmp_; }
+    const std::string& path() const { return path_; }
+    leveldb::Env* env() const { return env_; }
+
+   protected:
+    std::string path_;
+    leveldb::Env* env_;
+    leveldb::InternalKeyComparator icmp_;
+    leveldb::ZlibCompressorRaw zlib_raw_;
+    leveldb::ZlibCompressor zlib_;
+    leveldb::Options options_;
+};
+
+}  // namespace mcberepair
+
+#endif  // MCBEREPAIR_TABLEFILE_HPP
@@ -0,0 +1,17 @@
+include(RunMCBERepair)
+
+set(test_db "${RunMCBERepair_BINARY_DIR}/TestWorld")
+
+extract_world("${test_db}"
+    "${RunMCBERepair_SOURCE_DIR}/../minecraftWorlds/TestWorld01.mcworld")
+
+run_mcberepair(Help help blockcount)
+run_mcberepair(NoArgs blockcount)
+run_mcberepair(World blockcount "${test_db}" --threads=1)
+run_mcberepair(Threads blockcount "${test_db}" --threads=4 --all-layers)
+run_mcberepair(Nether blockcount "${test_db}" --dimension=1)
+run_mcberepair(BadDimension blockcount "${test_db}" --dimension=x)
+run_mcberepair(BadThreads blockcount "${test_db}" --threads=x)
+run_mcberepair(BadCommand blockcount noexist)
+
+file(REMOVE_RECURSE "${test_db}")
@@ -0,0 +1,16 @@
+include(RunMCBERepair)
+
+set(test_db "${RunMCBERepair_BINARY_DIR}/TestWorld")
+
+extract_world("${test_db}"
+    "${RunMCBERepair_SOURCE_DIR}/../minecraftWorlds/TestWorld01.mcworld")
+
+run_mcberepair(Help help census)
+run_mcberepair(NoArgs census)
+run_mcberepair(World census "${test_db}" --threads=1)
+run_mcberepair(Threads census "${test_db}" --threads=4 --top=1)
+run_mcberepair(BadThreads census "${test_db}" --threads=x)
+run_mcberepair(BadTop census "${test_db}" --top=x)
+run_mcberepair(BadCommand census noexist)
+
+file(REMOVE_RECURSE "${test_db}")
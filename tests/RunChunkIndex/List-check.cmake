@@ -0,0 +1,38 @@
+# every chunk of dimension 0 with subchunks must be listed with as many
+# subchunks as listkeys prints for it
+execute_process(
+    COMMAND "${RunMCBERepair_EXE}" listkeys "${test_db}"
+    OUTPUT_VARIABLE keys_stdout
+)
+string(REPLACE ";" "%3B" key_rows "${keys_stdout}")
+string(REPLACE "\n" ";" key_rows "${key_rows}")
+set(chunk_count 0)
+foreach(row IN LISTS key_rows)
+  if(row MATCHES "^[^\t]*\t[0-9]+\t(-?[0-9]+)\t(-?[0-9]+)\t0\t47\t")
+    set(chunk "${CMAKE_MATCH_1}_${CMAKE_MATCH_2}")
+    if(NOT DEFINED subchunks_${chunk})
+      set(subchunks_${chunk} 0)
+      math(EXPR chunk_count "${chunk_count} + 1")
+    endif()
+    math(EXPR subchunks_${chunk} "${subchunks_${chunk}} + 1")
+  endif()
+endforeach()
+string(REPLACE "\n" ";" list_rows "${actual_stdout}")
+list(REMOVE_AT list_rows 0)
+list(LENGTH list_rows row_count)
+if(NOT row_count EQUAL chunk_count)
+  set(RunMCBERepair_TEST_FAILED
+    "Listed ${row_count} chunks, but listkeys has ${chunk_count} with subchunks.")
+endif()
+foreach(row IN LISTS list_rows)
+  if(row MATCHES "^(-?[0-9]+)\t(-?[0-9]+)\t0\t([0-9]+)$")
+    set(listed "${CMAKE_MATCH_3}")
+    set(chunk "${CMAKE_MATCH_1}_${CMAKE_MATCH_2}")
+  else()
+    set(listed "malformed")
+    set(chunk "")
+  endif()
+  if(NOT listed STREQUAL "${subchunks_${chunk}}")
+    set(RunMCBERepair_TEST_FAILED "'${row}' differs from listkeys.")
+  endif()
+endforeach()
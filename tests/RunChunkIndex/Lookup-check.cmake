@@ -0,0 +1,18 @@
+# the records of chunk 0,0 must be the keys that listkeys prints for it
+execute_process(
+    COMMAND "${RunMCBERepair_EXE}" listkeys "${test_db}"
+    OUTPUT_VARIABLE keys_stdout
+)
+string(REPLACE ";" "%3B" key_rows "${keys_stdout}")
+string(REPLACE "\n" ";" key_rows "${key_rows}")
+set(expected "tag\tsubtag\tbytes")
+foreach(row IN LISTS key_rows)
+  if(row MATCHES "^[^\t]*\t([0-9]+)\t0\t0\t0\t([0-9]+)\t(-?[0-9]*)$")
+    string(APPEND expected
+      "\n${CMAKE_MATCH_2}\t${CMAKE_MATCH_3}\t${CMAKE_MATCH_1}")
+  endif()
+endforeach()
+if(NOT actual_stdout STREQUAL expected)
+  set(RunMCBERepair_TEST_FAILED
+    "The records of chunk 0,0 differ from listkeys, which expects:\n${expected}")
+endif()
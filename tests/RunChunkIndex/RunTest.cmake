@@ -0,0 +1,32 @@
+include(RunMCBERepair)
+
+set(test_db "${RunMCBERepair_BINARY_DIR}/TestWorld")
+
+extract_world("${test_db}"
+    "${RunMCBERepair_SOURCE_DIR}/../minecraftWorlds/TestWorld01.mcworld")
+
+run_mcberepair(Help help chunkindex)
+run_mcberepair(NoArgs chunkindex)
+run_mcberepair(NoIndex chunkindex "${test_db}" --list)
+run_mcberepair(Build chunkindex "${test_db}" --threads=1)
+run_mcberepair(Lookup chunkindex "${test_db}" --x=0 --z=0)
+run_mcberepair(List chunkindex "${test_db}" --list --dimension=0 --tag=47)
+
+# add a subchunk, delete a key, and overwrite a key of chunk 0,0, so the
+# refresh has new tables and a log to read
+run_mcberepair(WriteSubchunk writekey "${test_db}" "@0:0:0:47-4")
+run_mcberepair(Delete rmkeys "${test_db}" "@0:0:0:50")
+run_mcberepair(Overwrite writekey "${test_db}" "@0:0:0:54")
+run_mcberepair(Refresh chunkindex "${test_db}")
+run_mcberepair(RefreshLookup chunkindex "${test_db}" --x=0 --z=0)
+run_mcberepair(RefreshList chunkindex "${test_db}" --list --dimension=0
+    --tag=47)
+run_mcberepair(Rebuild chunkindex "${test_db}" --rebuild --threads=4)
+
+run_mcberepair(Missing chunkindex "${test_db}" --x=100000 --z=100000
+    --dimension=1)
+run_mcberepair(BadTag chunkindex "${test_db}" --list --tag=200)
+run_mcberepair(BadMode chunkindex "${test_db}" --list --x=0)
+run_mcberepair(BadCommand chunkindex noexist)
+
+file(REMOVE_RECURSE "${test_db}")
@@ -0,0 +1,3 @@
+if(EXISTS "${copy_db}/copyall.checkpoint")
+  set(RunMCBERepair_TEST_FAILED "Checkpoint was not removed after the copy finished.")
+endif()
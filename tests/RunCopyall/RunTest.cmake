@@ -14,11 +14,27 @@ extract_world("${test_db}"
     "${RunMCBERepair_SOURCE_DIR}/../minecraftWorlds/TestWorld01.mcworld")
 
 run_mcberepair(BadCommand2 copyall "${test_db}" noexist)
+run_mcberepair(NegativeBatchSize copyall --batch-size=-1 "${test_db}" noexist)
 
 file(MAKE_DIRECTORY "${copy_db}/db") 
 
 run_mcberepair(TwoArgs copyall "${test_db}" "${copy_db}")
 run_mcberepair(TwoArgsPostTest listkeys "${copy_db}")
 
+# simulate an interrupted copy by leaving a checkpoint behind
+file(WRITE "${copy_db}/copyall.checkpoint" "@0:0:0:47-1\n")
+run_mcberepair(Interrupted copyall "${test_db}" "${copy_db}")
+run_mcberepair(Resume copyall --resume --progress "${test_db}" "${copy_db}")
+run_mcberepair(ResumePostTest listkeys "${copy_db}")
+run_mcberepair(BulkResume copyall --bulk --resume "${test_db}" "${copy_db}")
 
-file(REMOVE_RECURSE "${test_db}" "${copy_db}")
+set(bulk_db "${RunMCBERepair_BINARY_DIR}/BulkWorld")
+
+run_mcberepair(Bulk copyall --bulk "${test_db}" "${bulk_db}")
+run_mcberepair(BulkPostTest listkeys "${bulk_db}")
+run_mcberepair(BulkExists copyall --bulk "${test_db}" "${bulk_db}")
+
+run_mcberepair(BadOption copyall --noexist "${test_db}" "${bulk_db}")
+
+
+file(REMOVE_RECURSE "${test_db}" "${copy_db}" "${bulk_db}")
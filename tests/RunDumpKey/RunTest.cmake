@@ -17,4 +17,30 @@ run_mcberepair(UnknownKey dumpkey "${test_db}" "%40missing")
 
 run_mcberepair(BadKey dumpkey "${test_db}" "@")
 
+run_mcberepair(BatchBadKey dumpkey "${test_db}" --batch HelloWorld "@")
+
+# batch output is a binary archive, so capture it in a file and check its bytes
+set(archive "${RunMCBERepair_BINARY_DIR}/values.mckv")
+execute_process(
+    COMMAND "${RunMCBERepair_EXE}" dumpkey "${test_db}" --batch
+        "%40missing" "HelloWorld" "HelloWorld"
+    OUTPUT_FILE "${archive}"
+    ERROR_VARIABLE batch_stderr
+    RESULT_VARIABLE batch_result
+)
+file(READ "${archive}" archive_hex HEX)
+# header, one HelloWorld record with an 11-byte value, and the end record
+set(expect_hex "^4d4342454b5641520100000000000000")
+string(APPEND expect_hex "0a0000000b00000048656c6c6f576f726c64[0-9a-f]+")
+string(APPEND expect_hex "ffffffff00000000$")
+if(NOT batch_result EQUAL 0)
+  message(FATAL_ERROR "dumpkey --batch failed with result ${batch_result}.")
+endif()
+if(NOT batch_stderr MATCHES "^Skipping missing key '%40missing'...\n$")
+  message(FATAL_ERROR "dumpkey --batch printed unexpected errors: ${batch_stderr}")
+endif()
+if(NOT archive_hex MATCHES "${expect_hex}")
+  message(FATAL_ERROR "dumpkey --batch wrote an unexpected archive: ${archive_hex}")
+endif()
+
 file(REMOVE_RECURSE "${test_db}")
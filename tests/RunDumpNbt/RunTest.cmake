@@ -0,0 +1,24 @@
+include(RunMCBERepair)
+
+set(test_db "${RunMCBERepair_BINARY_DIR}/TestWorld")
+
+extract_world("${test_db}"
+    "${RunMCBERepair_SOURCE_DIR}/../minecraftWorlds/TestWorld01.mcworld")
+
+run_mcberepair(Help help dumpnbt)
+run_mcberepair(NoArgs dumpnbt)
+run_mcberepair(Player dumpnbt "${test_db}" "~local_player")
+run_mcberepair(Stdin dumpnbt -)
+run_mcberepair(NotNbt dumpnbt "${test_db}" HelloWorld)
+run_mcberepair(Scan dumpnbt "${test_db}" --scan)
+run_mcberepair(ScanEntities dumpnbt "${test_db}" --scan --tag=50)
+run_mcberepair(PathStdin dumpnbt - --path=b)
+run_mcberepair(PathIndex dumpnbt - --path=l[0])
+run_mcberepair(PathMaxIndex dumpnbt - --path=l[2147483647])
+run_mcberepair(ScanPath dumpnbt "${test_db}" --scan --tag=50 --path=identifier)
+run_mcberepair(BadPath dumpnbt "${test_db}" "~local_player" --path=a[)
+run_mcberepair(BadTag dumpnbt "${test_db}" --scan --tag=x)
+run_mcberepair(BadCommand dumpnbt noexist "~local_player")
+run_mcberepair(UnknownKey dumpnbt "${test_db}" "%40missing")
+
+file(REMOVE_RECURSE "${test_db}")
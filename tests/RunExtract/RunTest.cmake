@@ -0,0 +1,22 @@
+include(RunMCBERepair)
+
+run_mcberepair(Help help extract)
+run_mcberepair(NoArgs extract)
+
+run_mcberepair(BadCommand extract noexist noexist)
+
+set(test_db "${RunMCBERepair_BINARY_DIR}/TestWorld")
+set(box_db "${RunMCBERepair_BINARY_DIR}/BoxWorld")
+
+extract_world("${test_db}"
+    "${RunMCBERepair_SOURCE_DIR}/../minecraftWorlds/TestWorld01.mcworld")
+
+run_mcberepair(PartialBox extract "${test_db}" "${box_db}" --xmin=0)
+
+file(MAKE_DIRECTORY "${box_db}/db")
+
+run_mcberepair(Box extract "${test_db}" "${box_db}"
+    --xmin=0 --xmax=0 --zmin=0 --zmax=0 --dimension=0)
+run_mcberepair(BoxPostTest listkeys "${box_db}")
+
+file(REMOVE_RECURSE "${test_db}" "${box_db}")
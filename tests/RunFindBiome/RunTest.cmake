@@ -0,0 +1,23 @@
+include(RunMCBERepair)
+
+set(test_db "${RunMCBERepair_BINARY_DIR}/TestWorld")
+
+extract_world("${test_db}"
+    "${RunMCBERepair_SOURCE_DIR}/../minecraftWorlds/TestWorld01.mcworld")
+
+run_mcberepair(Help help findbiome)
+run_mcberepair(NoArgs findbiome)
+run_mcberepair(Plains findbiome "${test_db}" plains --x=8 --z=-8)
+run_mcberepair(Number findbiome "${test_db}" 1 --radius=4)
+run_mcberepair(River findbiome "${test_db}" river --x=8 --z=-8)
+run_mcberepair(Hills findbiome "${test_db}" 18 --radius=4)
+run_mcberepair(Missing findbiome "${test_db}" cherry_grove --radius=2
+    --dimension=0)
+run_mcberepair(BadBiome findbiome "${test_db}" nothing)
+run_mcberepair(BadRadius findbiome "${test_db}" plains --radius=-1)
+run_mcberepair(HugeRadius findbiome "${test_db}" river --x=8 --z=-8
+    --radius=2147483647)
+run_mcberepair(BadX findbiome "${test_db}" plains --x=30000001)
+run_mcberepair(BadCommand findbiome noexist plains)
+
+file(REMOVE_RECURSE "${test_db}")
@@ -0,0 +1,27 @@
+include(RunMCBERepair)
+
+set(test_db "${RunMCBERepair_BINARY_DIR}/TestWorld")
+
+extract_world("${test_db}"
+    "${RunMCBERepair_SOURCE_DIR}/../minecraftWorlds/TestWorld01.mcworld")
+
+run_mcberepair(Help help fsck)
+run_mcberepair(NoArgs fsck)
+run_mcberepair(OneArg fsck "${test_db}")
+run_mcberepair(Threads fsck "${test_db}" --threads=4)
+run_mcberepair(BadThreads fsck "${test_db}" --threads=x)
+run_mcberepair(BadOption fsck "${test_db}" --bogus)
+run_mcberepair(BadCommand fsck noexist)
+
+# without a MANIFEST every table in the directory is checked
+file(REMOVE "${test_db}/db/CURRENT")
+run_mcberepair(NoManifest fsck "${test_db}")
+
+# one block of the corrupt world has a flipped byte and fails its checksum,
+# and the compressed stream of the next stops partway
+set(corrupt_db "${RunMCBERepair_BINARY_DIR}/CorruptWorld")
+extract_world("${corrupt_db}"
+    "${RunMCBERepair_SOURCE_DIR}/../minecraftWorlds/CorruptWorld01.mcworld")
+run_mcberepair(Corrupt fsck "${corrupt_db}")
+
+file(REMOVE_RECURSE "${test_db}" "${corrupt_db}")
@@ -0,0 +1,21 @@
+# the copy writes its CURRENT in one directory and reads the source's in
+# another
+file(STRINGS "${copy_trace}" current_renames
+  REGEX " rename [0-9]+/[0-9]+\\.dbtmp [0-9]+ [0-9]+ [0-9]+ [0-9]+/CURRENT$")
+file(STRINGS "${copy_trace}" current_reads REGEX " read [0-9]+/CURRENT ")
+if(NOT current_renames MATCHES "([0-9]+)/CURRENT$")
+  set(RunMCBERepair_TEST_FAILED "The trace has no rename to CURRENT.")
+else()
+  set(copy_dir "${CMAKE_MATCH_1}")
+  set(source_read FALSE)
+  foreach(line IN LISTS current_reads)
+    if(line MATCHES " read ([0-9]+)/CURRENT " AND
+       NOT CMAKE_MATCH_1 STREQUAL copy_dir)
+      set(source_read TRUE)
+    endif()
+  endforeach()
+  if(NOT source_read)
+    set(RunMCBERepair_TEST_FAILED
+      "The source CURRENT is not apart from the copy's in the trace.")
+  endif()
+endif()
@@ -0,0 +1,30 @@
+include(RunMCBERepair)
+
+set(test_db "${RunMCBERepair_BINARY_DIR}/TestWorld")
+set(trace "${RunMCBERepair_BINARY_DIR}/io.trace")
+
+extract_world("${test_db}"
+    "${RunMCBERepair_SOURCE_DIR}/../minecraftWorlds/TestWorld01.mcworld")
+
+run_mcberepair(NoArgs ioreplay)
+run_mcberepair(IoStats --io-stats listkeys "${test_db}")
+run_mcberepair(Record --io-trace=${trace} listkeys "${test_db}")
+run_mcberepair(Replay ioreplay "${trace}" "${RunMCBERepair_BINARY_DIR}/scratch")
+
+# copyall opens two databases, whose files must not share names in the trace
+set(copy_db "${RunMCBERepair_BINARY_DIR}/CopyWorld")
+set(copy_trace "${RunMCBERepair_BINARY_DIR}/copy.trace")
+file(REMOVE_RECURSE "${copy_db}")
+file(MAKE_DIRECTORY "${copy_db}/db")
+run_mcberepair(RecordCopy --io-trace=${copy_trace} copyall "${test_db}"
+    "${copy_db}")
+run_mcberepair(ReplayCopy ioreplay "${copy_trace}"
+    "${RunMCBERepair_BINARY_DIR}/copy_scratch")
+
+run_mcberepair(BadTrace ioreplay "${RunMCBERepair_SOURCE_DIR}/RunTest.cmake"
+    "${RunMCBERepair_BINARY_DIR}/scratch")
+run_mcberepair(NoTrace ioreplay noexist "${RunMCBERepair_BINARY_DIR}/scratch")
+run_mcberepair(BadTraceFile --io-trace=noexist/io.trace version)
+
+file(REMOVE_RECURSE "${test_db}" "${trace}" "${RunMCBERepair_BINARY_DIR}/scratch"
+    "${copy_db}" "${copy_trace}" "${RunMCBERepair_BINARY_DIR}/copy_scratch")
@@ -7,9 +7,33 @@ extract_world("${test_db}"
 
 run_mcberepair(NoArgs listkeys)
 run_mcberepair(OneArg listkeys "${test_db}")
+run_mcberepair(Threads listkeys --threads=4 "${test_db}")
+run_mcberepair(Unordered listkeys --threads=4 --unordered "${test_db}")
+run_mcberepair(LowMemory --profile=low-memory listkeys "${test_db}" --bloom-bits=0)
+run_mcberepair(Stats listkeys "${test_db}" --stats=json --threads=2)
+run_mcberepair(BadThreads listkeys --threads=x "${test_db}")
+run_mcberepair(NegativeThreads listkeys --threads=-1 "${test_db}")
+run_mcberepair(BadFormat listkeys --format=xml "${test_db}")
+
+# columnar output is binary, so capture it in a file and read it back
+set(columnar_list "${RunMCBERepair_BINARY_DIR}/list.keys")
+execute_process(
+    COMMAND "${RunMCBERepair_EXE}" listkeys --format=columnar "${test_db}"
+    OUTPUT_FILE "${columnar_list}"
+)
+run_mcberepair(Columnar catkeys "${columnar_list}")
+execute_process(
+    COMMAND "${RunMCBERepair_EXE}" listkeys --format=columnar --threads=4
+        "${test_db}"
+    OUTPUT_FILE "${columnar_list}"
+)
+run_mcberepair(ColumnarThreads catkeys "${columnar_list}")
+run_mcberepair(CatNoFile catkeys noexist)
+run_mcberepair(CatNotColumnar catkeys "${RunMCBERepair_SOURCE_DIR}/RunTest.cmake")
+run_mcberepair(CatHelp help catkeys)
 
 run_mcberepair(BadCommand listkeys noexist)
 
 run_mcberepair(Help help listkeys)
 
-file(REMOVE_RECURSE "${test_db}")
+file(REMOVE_RECURSE "${test_db}" "${columnar_list}")
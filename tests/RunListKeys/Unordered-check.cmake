@@ -0,0 +1,18 @@
+# the unordered rows must be exactly the rows of the ordered listing
+execute_process(
+    COMMAND "${RunMCBERepair_EXE}" listkeys "${test_db}"
+    OUTPUT_VARIABLE ordered_stdout
+)
+string(REGEX REPLACE "\n+$" "" ordered_stdout "${ordered_stdout}")
+foreach(v actual_stdout ordered_stdout)
+  string(REPLACE ";" "%3B" rows "${${v}}")
+  string(REPLACE "\n" ";" rows "${rows}")
+  list(SORT rows)
+  set(${v}_rows "${rows}")
+endforeach()
+list(LENGTH actual_stdout_rows row_count)
+if(NOT row_count EQUAL 1569)
+  set(RunMCBERepair_TEST_FAILED "Expected 1568 keys, not ${row_count} rows.")
+elseif(NOT actual_stdout_rows STREQUAL ordered_stdout_rows)
+  set(RunMCBERepair_TEST_FAILED "The unordered rows differ from the ordered listing.")
+endif()
@@ -2,3 +2,19 @@ include(RunMCBERepair)
 
 run_mcberepair(NoArgs)
 run_mcberepair(BadCommand noexist)
+
+run_mcberepair(Profile --profile=throughput --cache-size=1M version)
+run_mcberepair(PeakRss --peak-rss version)
+run_mcberepair(Stats --stats version)
+run_mcberepair(StatsJson version --stats=json)
+run_mcberepair(BadStats --stats=xml version)
+run_mcberepair(BadProfile --profile=huge version)
+run_mcberepair(BadOverride version --cache-size=lots)
+run_mcberepair(HugeSize version --cache-size=20000000000G)
+run_mcberepair(HugeCount version --max-open-files=3000000000)
+run_mcberepair(CountSuffix version --bloom-bits=10K)
+
+set(RunMCBERepair_TEST_COMMAND "${CMAKE_COMMAND}" -E env
+    MCBEREPAIR_BLOOM_BITS=x "${RunMCBERepair_EXE}" version)
+run_mcberepair(BadEnv)
+unset(RunMCBERepair_TEST_COMMAND)
@@ -0,0 +1,66 @@
+include(RunMCBERepair)
+
+set(test_db "${RunMCBERepair_BINARY_DIR}/TestWorld")
+
+extract_world("${test_db}"
+    "${RunMCBERepair_SOURCE_DIR}/../minecraftWorlds/TestWorld01.mcworld")
+
+run_mcberepair(Help help patchnbt)
+run_mcberepair(NoArgs patchnbt)
+run_mcberepair(Player patchnbt "${test_db}" --path=Pos[1] --value=100
+    "~local_player")
+run_mcberepair(PlayerPostTest dumpnbt "${test_db}" "~local_player"
+    --path=Pos[1])
+run_mcberepair(Unchanged patchnbt "${test_db}" --path=Pos[1] --value=100
+    "~local_player")
+run_mcberepair(WrongType patchnbt "${test_db}" --path=Pos --value=100
+    "~local_player")
+
+# a string patch writes the whole value again, so patching a string and
+# patching it back must restore the original bytes
+set(work_dir "${RunMCBERepair_BINARY_DIR}/RoundTrip")
+file(REMOVE_RECURSE "${work_dir}")
+file(MAKE_DIRECTORY "${work_dir}")
+execute_process(
+    COMMAND "${RunMCBERepair_EXE}" dumpkey "${test_db}" "@0:0:0:50"
+    OUTPUT_FILE "${work_dir}/before.bin"
+)
+run_mcberepair(RoundTripOut patchnbt "${test_db}" --path=identifier
+    --value=minecraft:pig "@0:0:0:50")
+run_mcberepair(RoundTripOutPostTest dumpnbt "${test_db}" "@0:0:0:50"
+    --path=identifier)
+run_mcberepair(RoundTripBack patchnbt "${test_db}" --path=identifier
+    --value=minecraft:drowned "@0:0:0:50")
+execute_process(
+    COMMAND "${RunMCBERepair_EXE}" dumpkey "${test_db}" "@0:0:0:50"
+    OUTPUT_FILE "${work_dir}/after.bin"
+)
+execute_process(
+    COMMAND ${CMAKE_COMMAND} -E compare_files
+        "${work_dir}/before.bin" "${work_dir}/after.bin"
+    RESULT_VARIABLE compare_result
+)
+file(READ "${work_dir}/before.bin" before_hex HEX)
+string(LENGTH "${before_hex}" before_size)
+if(NOT before_size EQUAL 3842 OR NOT compare_result EQUAL 0)
+  message(FATAL_ERROR "Patching a string back did not restore the value.")
+endif()
+
+run_mcberepair(Entities patchnbt "${test_db}" --path=identifier
+    --value=minecraft:pig --tag=50)
+run_mcberepair(EntitiesPostTest dumpnbt "${test_db}" --scan --tag=50
+    --path=identifier)
+run_mcberepair(EntitiesKeyPostTest dumpnbt "${test_db}" "@-2:0:0:50"
+    --path=identifier)
+run_mcberepair(MissingKey patchnbt "${test_db}" --path=Pos[1] --value=1
+    "%40missing")
+run_mcberepair(NoValue patchnbt "${test_db}" --path=Pos[1] "~local_player")
+run_mcberepair(BadPath patchnbt "${test_db}" --path=a[ --value=1
+    "~local_player")
+run_mcberepair(BadSelection patchnbt "${test_db}" --path=Pos[1] --value=1
+    --tag=50 "~local_player")
+run_mcberepair(BadCommand patchnbt noexist --path=Pos[1] --value=1
+    "~local_player")
+
+file(REMOVE_RECURSE "${work_dir}")
+file(REMOVE_RECURSE "${test_db}")
@@ -0,0 +1,19 @@
+include(RunMCBERepair)
+
+set(test_db "${RunMCBERepair_BINARY_DIR}/TestWorld")
+
+extract_world("${test_db}"
+    "${RunMCBERepair_SOURCE_DIR}/../minecraftWorlds/TestWorld01.mcworld")
+
+run_mcberepair(Help help query)
+run_mcberepair(NoArgs query)
+run_mcberepair(Region query "${test_db}" dimension=0 tag=47 x=-2..2 z=-2..2)
+run_mcberepair(Explain query "${test_db}" tag=47 z>=0 --explain)
+run_mcberepair(Subtags query "${test_db}" dimension=0 x=0 z=0 subtag!=-1)
+run_mcberepair(None query "${test_db}" x=1000000 dimension=1)
+run_mcberepair(Empty query "${test_db}" x>5 x<3)
+run_mcberepair(BadTerm query "${test_db}" y=1)
+run_mcberepair(BadValue query "${test_db}" x=1..)
+run_mcberepair(BadCommand query noexist tag=47)
+
+file(REMOVE_RECURSE "${test_db}")
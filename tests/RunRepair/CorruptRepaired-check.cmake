@@ -0,0 +1,10 @@
+# the damaged table was rewritten under its own number and the files it
+# replaced were moved into lost/
+foreach(name 000005.ldb 000007.ldb 000012.ldb lost/000005.ldb lost/000009.log)
+  if(NOT EXISTS "${corrupt_db}/db/${name}")
+    set(RunMCBERepair_TEST_FAILED "'${name}' is missing after the repair.")
+  endif()
+endforeach()
+if(EXISTS "${corrupt_db}/db/000010.ldb")
+  set(RunMCBERepair_TEST_FAILED "The damaged table was given a new number.")
+endif()
@@ -4,12 +4,41 @@ run_mcberepair(Help help repair)
 
 run_mcberepair(NoArgs repair)
 run_mcberepair(BadCommand repair noexist)
+run_mcberepair(BadThreads repair noexist --threads=x)
+run_mcberepair(BadOption repair noexist --bogus)
 
 set(test_db "${RunMCBERepair_BINARY_DIR}/TestWorld")
+set(salvage_db "${RunMCBERepair_BINARY_DIR}/SalvagedWorld")
 
 extract_world("${test_db}"
     "${RunMCBERepair_SOURCE_DIR}/../minecraftWorlds/TestWorld01.mcworld")
+file(REMOVE_RECURSE "${salvage_db}")
 
 run_mcberepair(OneArg repair "${test_db}")
+run_mcberepair(Repaired listkeys "${test_db}")
+run_mcberepair(Salvage repair "${test_db}" --salvage=${salvage_db}
+    --threads=2)
+run_mcberepair(Salvaged listkeys "${salvage_db}")
+run_mcberepair(SalvageExists repair "${test_db}" --salvage=${salvage_db})
 
-file(REMOVE_RECURSE "${test_db}")
+# The corrupt world has no CURRENT, so every file goes in level 0. Its
+# oldest table has a block with a flipped byte and a block whose compressed
+# stream stops partway, and a newer table and the log overwrite its keys.
+set(corrupt_db "${RunMCBERepair_BINARY_DIR}/CorruptWorld")
+set(corrupt_salvage_db "${RunMCBERepair_BINARY_DIR}/SalvagedCorruptWorld")
+
+extract_world("${corrupt_db}"
+    "${RunMCBERepair_SOURCE_DIR}/../minecraftWorlds/CorruptWorld01.mcworld")
+file(REMOVE_RECURSE "${corrupt_salvage_db}")
+
+run_mcberepair(CorruptSalvage repair "${corrupt_db}"
+    --salvage=${corrupt_salvage_db} --threads=1)
+run_mcberepair(CorruptSalvaged listkeys "${corrupt_salvage_db}")
+run_mcberepair(CorruptSalvagedTable dumpkey "${corrupt_salvage_db}" key60)
+run_mcberepair(CorruptRepair repair "${corrupt_db}" --threads=1)
+run_mcberepair(CorruptRepaired listkeys "${corrupt_db}")
+run_mcberepair(CorruptTable dumpkey "${corrupt_db}" key60)
+run_mcberepair(CorruptLog dumpkey "${corrupt_db}" key03)
+
+file(REMOVE_RECURSE "${test_db}" "${salvage_db}" "${corrupt_db}"
+    "${corrupt_salvage_db}")
@@ -0,0 +1,3 @@
+if(actual_stdout MATCHES "@-?[0-9]+:-?[0-9]+:1:")
+  set(RunMCBERepair_TEST_FAILED "Chunk keys of dimension 1 were not deleted.")
+endif()
@@ -30,3 +30,24 @@ run_mcberepair(BadKeys rmkeys "${test_db}"
 )
 
 file(REMOVE_RECURSE "${test_db}")
+
+# range and prefix deletion on a fresh copy of the world
+extract_world("${test_db}"
+    "${RunMCBERepair_SOURCE_DIR}/../minecraftWorlds/TestWorld01.mcworld")
+
+run_mcberepair(Quiet rmkeys "${test_db}" --quiet "@-5:0:0:53" "@a")
+
+run_mcberepair(RangeBox rmkeys "${test_db}" --quiet
+    --xmin=0 --xmax=0 --zmin=0 --zmax=0 --dimension=1)
+run_mcberepair(RangeBoxPostTest listkeys "${test_db}")
+
+run_mcberepair(RangePrefix rmkeys "${test_db}" --prefix=Test --batch-size=1)
+
+run_mcberepair(RangeDimension rmkeys "${test_db}" --dimension=1 --quiet)
+run_mcberepair(RangeDimensionPostTest listkeys "${test_db}")
+
+run_mcberepair(RangeMixed rmkeys "${test_db}" --dimension=1 "@0:0:0:45")
+run_mcberepair(EmptyPrefix rmkeys "${test_db}" --prefix=)
+run_mcberepair(BadBatchSize rmkeys "${test_db}" --batch-size=0)
+
+file(REMOVE_RECURSE "${test_db}")
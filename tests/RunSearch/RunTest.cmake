@@ -0,0 +1,18 @@
+include(RunMCBERepair)
+
+set(test_db "${RunMCBERepair_BINARY_DIR}/TestWorld")
+
+extract_world("${test_db}"
+    "${RunMCBERepair_SOURCE_DIR}/../minecraftWorlds/TestWorld01.mcworld")
+
+run_mcberepair(Help help search)
+run_mcberepair(NoArgs search)
+run_mcberepair(Bedrock search "${test_db}" minecraft:bedrock --threads=1
+    --dimension=0)
+run_mcberepair(Threads search "${test_db}" minecraft:bedrock --threads=4)
+run_mcberepair(NotFound search "${test_db}" minecraft:nothing)
+run_mcberepair(EmptyBlock search "${test_db}" "")
+run_mcberepair(BadDimension search "${test_db}" minecraft:tnt --dimension=x)
+run_mcberepair(BadCommand search noexist minecraft:tnt)
+
+file(REMOVE_RECURSE "${test_db}")
@@ -18,4 +18,69 @@ run_mcberepair(BigKey writekey "${test_db}" "test_record")
 
 run_mcberepair(BadKey writekey "${test_db}" "@")
 
+# batch import from a list of files
+set(work_dir "${RunMCBERepair_BINARY_DIR}/Batch")
+file(REMOVE_RECURSE "${work_dir}")
+file(MAKE_DIRECTORY "${work_dir}")
+file(WRITE "${work_dir}/value_a.bin" "ValueA")
+file(WRITE "${work_dir}/value_b.bin" "ValueB")
+file(WRITE "${work_dir}/files.tsv"
+    "batch_a\t${work_dir}/value_a.bin\nbatch_b\t${work_dir}/value_b.bin\n")
+execute_process(
+    COMMAND "${RunMCBERepair_EXE}" writekey "${test_db}" --list --batch-size=1
+    INPUT_FILE "${work_dir}/files.tsv"
+    OUTPUT_VARIABLE list_stdout
+    RESULT_VARIABLE list_result
+)
+if(NOT list_result EQUAL 0 OR
+   NOT list_stdout MATCHES "^Wrote 2 keys in 2 batches.\n$")
+  message(FATAL_ERROR "writekey --list failed: ${list_result} ${list_stdout}")
+endif()
+run_mcberepair(ListPostTest dumpkey "${test_db}" "batch_b")
+
+# a list with Windows line endings
+file(WRITE "${work_dir}/value_c.bin" "ValueC")
+file(WRITE "${work_dir}/crlf.tsv" "batch_c\t${work_dir}/value_c.bin\r\n")
+execute_process(
+    COMMAND "${RunMCBERepair_EXE}" writekey "${test_db}" --list
+    INPUT_FILE "${work_dir}/crlf.tsv"
+    OUTPUT_VARIABLE crlf_stdout
+    RESULT_VARIABLE crlf_result
+)
+if(NOT crlf_result EQUAL 0 OR
+   NOT crlf_stdout MATCHES "^Wrote 1 keys in 1 batches.\n$")
+  message(FATAL_ERROR "writekey --list failed: ${crlf_result} ${crlf_stdout}")
+endif()
+run_mcberepair(CRLFListPostTest dumpkey "${test_db}" "batch_c")
+
+# round trip through an archive
+execute_process(
+    COMMAND "${RunMCBERepair_EXE}" dumpkey "${test_db}" --batch
+        "batch_a" "batch_b"
+    OUTPUT_FILE "${work_dir}/values.mckv"
+)
+execute_process(
+    COMMAND "${RunMCBERepair_EXE}" rmkeys "${test_db}" --quiet
+        "batch_a" "batch_b"
+    OUTPUT_QUIET
+)
+execute_process(
+    COMMAND "${RunMCBERepair_EXE}" writekey "${test_db}" --archive --atomic
+    INPUT_FILE "${work_dir}/values.mckv"
+    OUTPUT_VARIABLE archive_stdout
+    RESULT_VARIABLE archive_result
+)
+if(NOT archive_result EQUAL 0 OR
+   NOT archive_stdout MATCHES "^Wrote 2 keys in 1 batches.\n$")
+  message(FATAL_ERROR
+    "writekey --archive failed: ${archive_result} ${archive_stdout}")
+endif()
+run_mcberepair(ArchivePostTest dumpkey "${test_db}" "batch_a")
+
+run_mcberepair(NotArchive writekey "${test_db}" --archive)
+run_mcberepair(TruncatedArchive writekey "${test_db}" --archive)
+run_mcberepair(BadList writekey "${test_db}" --list)
+run_mcberepair(BadBatchOptions writekey "${test_db}" --list --archive)
+
+file(REMOVE_RECURSE "${work_dir}")
 file(REMOVE_RECURSE "${test_db}")
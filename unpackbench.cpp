@@ -0,0 +1,175 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+
+// Microbenchmark for unpacking the palette indices of subchunks and Data3D.
+// It checks that the vectorized unpacking in subchunk.hpp matches the scalar
+// loop for every width, then reports nanoseconds per subchunk for each.
+//
+//   mcberepair_unpackbench [num_subchunks] [num_rounds]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "subchunk.hpp"
+
+namespace {
+
+using mcberepair::kSubchunkBlocks;
+
+template <int Bits>
+void unpack_scalar(const char *words, uint16_t *out) {
+    mcberepair::detail::unpack_indices_scalar<Bits>(words, 0, out);
+}
+
+// the scalar loop, chosen by the number of bits like unpack_packed_indices
+void unpack_scalar(int bits, const char *words, uint16_t *out) {
+    switch(bits) {
+        case 1:
+            unpack_scalar<1>(words, out);
+            break;
+        case 2:
+            unpack_scalar<2>(words, out);
+            break;
+        case 3:
+            unpack_scalar<3>(words, out);
+            break;
+        case 4:
+            unpack_scalar<4>(words, out);
+            break;
+        case 5:
+            unpack_scalar<5>(words, out);
+            break;
+        case 6:
+            unpack_scalar<6>(words, out);
+            break;
+        case 8:
+            unpack_scalar<8>(words, out);
+            break;
+        default:
+            unpack_scalar<16>(words, out);
+            break;
+    }
+}
+
+// Layers of random words. Widths that do not divide 32 leave padding bits at
+// the top of each word, and a last word that is only partly used; both are
+// filled with ones so that unpacking them by mistake changes the result.
+std::vector<std::string> make_layers(int bits, size_t n) {
+    std::mt19937 rng{static_cast<unsigned int>(bits)};
+    size_t word_count = mcberepair::detail::subchunk_word_count(bits);
+    int per_word = 32 / bits;
+    uint32_t padding = per_word * bits == 32 ? 0 : ~0u << (per_word * bits);
+    std::vector<std::string> layers(n);
+    for(auto &&layer : layers) {
+        layer.resize(4 * word_count);
+        for(size_t w = 0; w < word_count; ++w) {
+            uint32_t word = static_cast<uint32_t>(rng()) | padding;
+            std::memcpy(&layer[4 * w], &word, 4);
+        }
+        uint32_t last;
+        std::memcpy(&last, &layer[4 * (word_count - 1)], 4);
+        int used = kSubchunkBlocks - static_cast<int>(word_count - 1) * per_word;
+        if(used < per_word) {
+            last |= ~0u << (used * bits);
+            std::memcpy(&layer[4 * (word_count - 1)], &last, 4);
+        }
+    }
+    return layers;
+}
+
+template <typename F>
+double time_ns_per_layer(size_t n, int rounds, F &&func) {
+    auto start = std::chrono::steady_clock::now();
+    for(int r = 0; r < rounds; ++r) {
+        func();
+    }
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (static_cast<double>(n) * rounds);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 5;
+    if(n == 0 || rounds <= 0) {
+        fprintf(stderr, "usage: %s [num_subchunks] [num_rounds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const int widths[] = {1, 2, 3, 4, 5, 6, 8, 16};
+    std::vector<uint16_t> expected(kSubchunkBlocks);
+    std::vector<uint16_t> actual(kSubchunkBlocks);
+    // prevent the compiler from discarding results
+    size_t sink = 0;
+    printf("subchunks\t%zu\n", n);
+    printf("bits\tscalar_ns\tunpack_ns\tspeedup\n");
+    for(int bits : widths) {
+        auto layers = make_layers(bits, n);
+
+        // verify that both agree on every index before timing them
+        for(size_t i = 0; i < n; ++i) {
+            unpack_scalar(bits, layers[i].data(), expected.data());
+            mcberepair::unpack_packed_indices(bits, layers[i].data(),
+                                              actual.data());
+            if(expected != actual) {
+                int at = static_cast<int>(
+                    std::mismatch(expected.begin(), expected.end(),
+                                  actual.begin())
+                        .first -
+                    expected.begin());
+                fprintf(stderr,
+                        "ERROR: Unpacking %d bits differs at index %d of "
+                        "subchunk %zu.\n",
+                        bits, at, i);
+                return EXIT_FAILURE;
+            }
+        }
+
+        double scalar = time_ns_per_layer(n, rounds, [&]() {
+            for(auto &&layer : layers) {
+                unpack_scalar(bits, layer.data(), actual.data());
+                sink += actual[kSubchunkBlocks - 1];
+            }
+        });
+        double unpack = time_ns_per_layer(n, rounds, [&]() {
+            for(auto &&layer : layers) {
+                mcberepair::unpack_packed_indices(bits, layer.data(),
+                                                  actual.data());
+                sink += actual[kSubchunkBlocks - 1];
+            }
+        });
+        printf("%d\t%.1f\t%.1f\t%.1fx\n", bits, scalar, unpack,
+               scalar / unpack);
+    }
+    printf("checksum\t%zu\n", sink);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,452 @@
+/*
+# Copyright (c) 2020 Reed A. Cartwright <reed@cartwright.ht>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+*/
+#ifndef MCBEREPAIR_WORLDGEN_HPP
+#define MCBEREPAIR_WORLDGEN_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "db.hpp"
+#include "leveldb/write_batch.h"
+#include "mcbekey.hpp"
+
+// Deterministic synthetic worlds for benchmarks
+//
+// A world holds `chunks` chunks spread over the three dimensions (about 85%
+// overworld, 10% nether, 5% end), each laid out as a square around the
+// origin. Every chunk has a version, Data3D, finalized state, and a stack of
+// subchunks in the current paletted format; some also have block entities,
+// entities, and pending ticks. Global keys such as ~local_player, maps,
+// actorprefix entities, and digp lists are added in proportion. Payloads are
+// built like the real ones, so they compress about as well.
+//
+// The same seed always produces the same keys and values on every platform.
+
+namespace mcberepair {
+
+struct world_spec_t {
+    uint64_t chunks = 1000;
+    uint64_t seed = 1;
+};
+
+// What was written, for use by benchmarks.
+struct world_summary_t {
+    uint64_t keys = 0;
+    uint64_t bytes = 0;
+    // chunk keys chosen uniformly from the world
+    std::vector<std::string> sample_keys;
+    // the NBT payloads of block entities, entities, and players
+    std::vector<std::string> nbt_values;
+};
+
+namespace worldgen {
+
+// splitmix64; unlike the <random> distributions its output is portable
+class Rng {
+   public:
+    explicit Rng(uint64_t seed) : state_{seed} {}
+
+    uint64_t operator()() {
+        uint64_t z = (state_ += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // a number in [0, n)
+    uint32_t below(uint32_t n) {
+        return static_cast<uint32_t>(((*this)() >> 32) * n >> 32);
+    }
+
+    // a number in [lo, hi]
+    int range(int lo, int hi) {
+        return lo + static_cast<int>(below(static_cast<uint32_t>(hi - lo + 1)));
+    }
+
+   protected:
+    uint64_t state_;
+};
+
+// Append the little-endian bytes of an integer or float.
+template <typename T>
+void put(std::string* out, T value) {
+    static_assert(sizeof(T) <= sizeof(uint64_t));
+    uint64_t bits = 0;
+    if constexpr(sizeof(T) == 2) {
+        uint16_t u;
+        std::memcpy(&u, &value, 2);
+        bits = u;
+    } else if constexpr(sizeof(T) == 4) {
+        uint32_t u;
+        std::memcpy(&u, &value, 4);
+        bits = u;
+    } else if constexpr(sizeof(T) == 8) {
+        std::memcpy(&bits, &value, 8);
+    } else {
+        uint8_t u;
+        std::memcpy(&u, &value, 1);
+        bits = u;
+    }
+    char buffer[sizeof(T)];
+    for(size_t i = 0; i < sizeof(T); ++i) {
+        buffer[i] = static_cast<char>(bits >> (8 * i));
+    }
+    out->append(buffer, sizeof(T));
+}
+
+// Little-endian NBT, as used by Bedrock.
+enum : char {
+    kEnd = 0,
+    kByte = 1,
+    kShort = 2,
+    kInt = 3,
+    kLong = 4,
+    kFloat = 5,
+    kString = 8,
+    kList = 9,
+    kCompound = 10
+};
+
+inline void tag(std::string* out, char type, std::string_view name) {
+    out->push_back(type);
+    put(out, static_cast<uint16_t>(name.size()));
+    out->append(name);
+}
+
+inline void str(std::string* out, std::string_view value) {
+    put(out, static_cast<uint16_t>(value.size()));
+    out->append(value);
+}
+
+inline void list(std::string* out, std::string_view name, char type,
+                 int32_t size) {
+    tag(out, kList, name);
+    out->push_back(type);
+    put(out, size);
+}
+
+const char* const kBlocks[] = {
+    "minecraft:bedrock", "minecraft:deepslate", "minecraft:stone",
+    "minecraft:dirt",    "minecraft:grass",     "minecraft:water",
+    "minecraft:air"};
+const char* const kItems[] = {"minecraft:cobblestone", "minecraft:torch",
+                              "minecraft:iron_ingot", "minecraft:bread",
+                              "minecraft:oak_planks"};
+const char* const kMobs[] = {"minecraft:cow", "minecraft:sheep",
+                             "minecraft:zombie", "minecraft:skeleton",
+                             "minecraft:chicken"};
+
+// A subchunk in format 9 with one block storage of 4 bits per block.
+inline void subchunk(Rng& rng, int8_t y, int surface, std::string* out) {
+    out->push_back(9);
+    out->push_back(1);
+    out->push_back(static_cast<char>(y));
+    out->push_back(4 << 1);
+    // blocks are stored in xzy order, eight per word
+    uint32_t word = 0;
+    for(int i = 0; i < 4096; ++i) {
+        int block_y = y * 16 + (i & 15);
+        int b;
+        if(block_y == -64) {
+            b = 0;
+        } else if(block_y < 0) {
+            b = rng.below(16) == 0 ? 2 : 1;
+        } else if(block_y < surface - 4) {
+            b = 2;
+        } else if(block_y < surface) {
+            b = 3;
+        } else if(block_y == surface) {
+            b = 4;
+        } else if(block_y <= 62) {
+            b = 5;
+        } else {
+            b = 6;
+        }
+        word |= static_cast<uint32_t>(b) << (4 * (i % 8));
+        if(i % 8 == 7) {
+            put(out, word);
+            word = 0;
+        }
+    }
+    put(out, int32_t{7});
+    for(const char* name : kBlocks) {
+        tag(out, kCompound, "");
+        tag(out, kString, "name");
+        str(out, name);
+        tag(out, kCompound, "states");
+        out->push_back(kEnd);
+        tag(out, kInt, "version");
+        put(out, int32_t{17959425});
+        out->push_back(kEnd);
+    }
+}
+
+// 256 height values followed by one biome palette per subchunk.
+inline void data3d(Rng& rng, int surface, std::string* out) {
+    for(int i = 0; i < 256; ++i) {
+        put(out, static_cast<int16_t>(surface + 64 + rng.below(3)));
+    }
+    for(int i = 0; i < 24; ++i) {
+        // a single biome needs no index words
+        out->push_back(1);
+        put(out, static_cast<int32_t>(i < 4 ? 1 : 4));
+    }
+}
+
+inline void block_entity(Rng& rng, int x, int y, int z, std::string* out) {
+    tag(out, kCompound, "");
+    tag(out, kString, "id");
+    str(out, "Chest");
+    tag(out, kInt, "x");
+    put(out, x);
+    tag(out, kInt, "y");
+    put(out, y);
+    tag(out, kInt, "z");
+    put(out, z);
+    tag(out, kByte, "isMovable");
+    out->push_back(1);
+    int items = rng.range(0, 27);
+    list(out, "Items", kCompound, items);
+    for(int i = 0; i < items; ++i) {
+        tag(out, kByte, "Count");
+        out->push_back(static_cast<char>(rng.range(1, 64)));
+        tag(out, kShort, "Damage");
+        put(out, int16_t{0});
+        tag(out, kString, "Name");
+        str(out, kItems[rng.below(5)]);
+        tag(out, kByte, "Slot");
+        out->push_back(static_cast<char>(i));
+        tag(out, kByte, "WasPickedUp");
+        out->push_back(0);
+        out->push_back(kEnd);
+    }
+    out->push_back(kEnd);
+}
+
+inline void entity(Rng& rng, float x, float y, float z, std::string* out) {
+    tag(out, kCompound, "");
+    tag(out, kString, "identifier");
+    str(out, kMobs[rng.below(5)]);
+    tag(out, kLong, "UniqueID");
+    put(out, static_cast<int64_t>(rng()));
+    list(out, "Pos", kFloat, 3);
+    put(out, x);
+    put(out, y);
+    put(out, z);
+    list(out, "Rotation", kFloat, 2);
+    put(out, static_cast<float>(rng.below(360)));
+    put(out, 0.0f);
+    list(out, "definitions", kString, 2);
+    str(out, "+minecraft:cow");
+    str(out, "+minecraft:cow_adult");
+    list(out, "Attributes", kCompound, 2);
+    for(const char* name : {"minecraft:health", "minecraft:movement"}) {
+        tag(out, kFloat, "Base");
+        put(out, 10.0f);
+        tag(out, kFloat, "Current");
+        put(out, 10.0f);
+        tag(out, kString, "Name");
+        str(out, name);
+        out->push_back(kEnd);
+    }
+    tag(out, kShort, "Air");
+    put(out, int16_t{300});
+    tag(out, kByte, "OnGround");
+    out->push_back(1);
+    out->push_back(kEnd);
+}
+
+inline void player(Rng& rng, std::string* out) {
+    entity(rng, 0.5f, 70.0f, 0.5f, out);
+}
+
+}  // namespace worldgen
+
+// Write a synthetic world into the leveldb database at `path`, which must
+// not exist yet.
+inline leveldb::Status generate_world(const char* path,
+                                      const world_spec_t& spec,
+                                      world_summary_t* summary) {
+    using namespace worldgen;
+    DB db{path, true, true};
+    if(!db) {
+        return leveldb::Status::IOError(path, "unable to create database");
+    }
+    Rng rng{spec.seed};
+    leveldb::WriteOptions write_options;
+    leveldb::WriteBatch batch;
+    std::string key, value;
+    uint64_t sample_every = spec.chunks / 64 + 1;
+
+    auto flush = [&]() {
+        leveldb::Status s = db().Write(write_options, &batch);
+        batch.Clear();
+        return s;
+    };
+    auto add = [&](const std::string& k, const std::string& v) {
+        batch.Put(k, v);
+        summary->keys += 1;
+        summary->bytes += k.size() + v.size();
+    };
+
+    // split chunks between dimensions, then lay each out as a square
+    const uint64_t share[3] = {85, 10, 5};
+    uint64_t chunk_index = 0;
+    for(int dim = 0; dim < 3; ++dim) {
+        uint64_t n = dim == 2 ? spec.chunks - chunk_index
+                              : spec.chunks * share[dim] / 100;
+        if(dim == 0 && n == 0) {
+            n = spec.chunks;
+        }
+        auto side = static_cast<int64_t>(std::ceil(std::sqrt(double(n))));
+        for(uint64_t i = 0; i < n; ++i, ++chunk_index) {
+            chunk_t chunk{dim, static_cast<int>(int64_t(i % side) - side / 2),
+                          static_cast<int>(int64_t(i / side) - side / 2), 0,
+                          -1};
+            int surface = dim == 0 ? rng.range(56, 90) : rng.range(30, 60);
+            auto put_chunk = [&](char tag, char subtag, std::string v) {
+                chunk.tag = tag;
+                chunk.subtag = subtag;
+                create_chunk_key(chunk, &key);
+                add(key, v);
+            };
+
+            put_chunk(44, -1, std::string(1, 40));
+            value.clear();
+            data3d(rng, surface, &value);
+            put_chunk(43, -1, value);
+            std::string finalized;
+            put(&finalized, int32_t{2});
+            put_chunk(54, -1, finalized);
+
+            int y_min = dim == 0 ? -4 : 0;
+            int y_max = dim == 1 ? 7 : (surface >> 4) + (dim == 0 ? 1 : 0);
+            for(int y = y_min; y <= y_max; ++y) {
+                value.clear();
+                subchunk(rng, static_cast<int8_t>(y), surface, &value);
+                put_chunk(47, static_cast<char>(y), value);
+            }
+            if(rng.below(5) == 0) {
+                value.clear();
+                int count = rng.range(1, 4);
+                for(int j = 0; j < count; ++j) {
+                    block_entity(rng, chunk.x * 16 + rng.range(0, 15),
+                                 surface + 1, chunk.z * 16 + rng.range(0, 15),
+                                 &value);
+                }
+                summary->nbt_values.push_back(value);
+                put_chunk(49, -1, value);
+            }
+            if(rng.below(10) == 0) {
+                value.clear();
+                entity(rng, chunk.x * 16.0f + 8, surface + 1.0f,
+                       chunk.z * 16.0f + 8, &value);
+                summary->nbt_values.push_back(value);
+                put_chunk(50, -1, value);
+            }
+            if(rng.below(20) == 0) {
+                value.clear();
+                tag(&value, kCompound, "");
+                tag(&value, kInt, "currentTick");
+                put(&value, static_cast<int32_t>(rng.below(100000)));
+                list(&value, "tickList", kCompound, 0);
+                value.push_back(kEnd);
+                put_chunk(51, -1, value);
+            }
+            if(chunk_index % sample_every == 0) {
+                chunk.tag = 47;
+                chunk.subtag = static_cast<char>(y_min);
+                create_chunk_key(chunk, &key);
+                summary->sample_keys.push_back(key);
+            }
+            // modern worlds keep entities in actorprefix keys listed by digp
+            if(dim == 0 && rng.below(10) == 0) {
+                std::string uid;
+                put(&uid, static_cast<int64_t>(rng()));
+                value.clear();
+                entity(rng, chunk.x * 16.0f + 4, surface + 1.0f,
+                       chunk.z * 16.0f + 4, &value);
+                summary->nbt_values.push_back(value);
+                add("actorprefix" + uid, value);
+                std::string digp = "digp";
+                append_chunk_prefix(chunk.x, chunk.z, &digp);
+                add(digp, uid);
+            }
+            if(batch.ApproximateSize() >= 4 * 1024 * 1024) {
+                leveldb::Status s = flush();
+                if(!s.ok()) {
+                    return s;
+                }
+            }
+        }
+    }
+
+    // global keys
+    value.clear();
+    player(rng, &value);
+    summary->nbt_values.push_back(value);
+    add("~local_player", value);
+    for(const char* name :
+        {"AutonomousEntities", "BiomeData", "Overworld", "Nether", "TheEnd",
+         "mobevents", "scoreboard", "portals", "schedulerWT"}) {
+        value.clear();
+        tag(&value, kCompound, "");
+        tag(&value, kString, "name");
+        str(&value, name);
+        tag(&value, kLong, "seed");
+        put(&value, static_cast<int64_t>(rng()));
+        value.push_back(kEnd);
+        add(name, value);
+    }
+    for(uint64_t i = 0; i < spec.chunks / 100; ++i) {
+        value.clear();
+        tag(&value, kCompound, "");
+        tag(&value, kByte, "scale");
+        value.push_back(static_cast<char>(rng.below(5)));
+        // map colors are mostly runs of the same color
+        tag(&value, kList, "colors");
+        value.push_back(kByte);
+        put(&value, int32_t{65536});
+        for(int j = 0; j < 65536; ++j) {
+            value.push_back(static_cast<char>(j / 512 % 7));
+        }
+        value.push_back(kEnd);
+        add("map_-" + std::to_string(rng() >> 1), value);
+    }
+
+    leveldb::Status s = flush();
+    if(!s.ok()) {
+        return s;
+    }
+    // settle everything into sorted tables, as in a world that has been
+    // played for a while
+    db().CompactRange(nullptr, nullptr);
+    return s;
+}
+
+}  // namespace mcberepair
+
+#endif  // MCBEREPAIR_WORLDGEN_HPP
@@ -22,6 +22,7 @@
 
 #include <cassert>
 #include <cstdio>
+#include <fstream>
 #include <iostream>
 #include <memory>
 #include <sstream>
@@ -31,27 +32,206 @@
 #include <io.h>
 #endif
 
+#include "archive.hpp"
+#include "args.hpp"
 #include "db.hpp"
+#include "leveldb/write_batch.h"
 #include "mcbekey.hpp"
 #include "slurp.hpp"
 
+namespace {
+
+// Applies a stream of puts in batches of roughly a fixed size, so that
+// memory use does not depend on the size of the import.
+class BatchWriter {
+   public:
+    BatchWriter(leveldb::DB* db, size_t batch_size)
+        : db_{db}, batch_size_{batch_size} {}
+
+    leveldb::Status Put(const leveldb::Slice& key,
+                        const leveldb::Slice& value) {
+        batch_.Put(key, value);
+        keys_ += 1;
+        bytes_ += key.size() + value.size();
+        if(batch_.ApproximateSize() >= batch_size_) {
+            return Flush();
+        }
+        return {};
+    }
+
+    leveldb::Status Flush() {
+        if(batch_.ApproximateSize() <= kEmptyBatchSize) {
+            return {};
+        }
+        mcberepair::ScopedPhase phase{mcberepair::Phase::kWrite};
+        leveldb::WriteOptions writeOptions;
+        writeOptions.sync = true;
+        leveldb::Status status = db_->Write(writeOptions, &batch_);
+        batch_.Clear();
+        batches_ += 1;
+        return status;
+    }
+
+    uint64_t keys() const { return keys_; }
+    uint64_t bytes() const { return bytes_; }
+    uint64_t batches() const { return batches_; }
+
+   protected:
+    // the size of a WriteBatch header
+    static constexpr size_t kEmptyBatchSize = 12;
+
+    leveldb::DB* db_;
+    size_t batch_size_;
+    leveldb::WriteBatch batch_;
+    uint64_t keys_{0};
+    uint64_t bytes_{0};
+    uint64_t batches_{0};
+};
+
+}  // namespace
+
 int writekey_main(int argc, char* argv[]) {
-    if(argc < 4 || strcmp("help", argv[1]) == 0) {
+    mcberepair::Args args{argc, argv};
+    bool archive = args.has("archive");
+    bool list = args.has("list");
+    bool batch = archive || list;
+    if((batch ? args.size() < 1 : args.size() < 2) ||
+       strcmp("help", argv[1]) == 0) {
         printf("Usage: %s writekey <minecraft_world_dir> <key> < input.bin\n",
                argv[0]);
+        printf(
+            "       %s writekey <minecraft_world_dir> --archive [options] < "
+            "values.mckv\n",
+            argv[0]);
+        printf(
+            "       %s writekey <minecraft_world_dir> --list [options] < "
+            "files.tsv\n",
+            argv[0]);
+        printf("\n");
+        printf("Options:\n");
+        printf(
+            "  --archive         Read (key, value) records from an archive "
+            "written by\n"
+            "                    'dumpkey --batch'.\n");
+        printf(
+            "  --list            Read lines of '<key><TAB><file>' and write "
+            "the contents\n"
+            "                    of each file to its key.\n");
+        printf(
+            "  --batch-size=N    Commit keys in batches of about N bytes "
+            "(default 4 MB).\n");
+        printf(
+            "  --atomic          Commit every key in one batch, so either "
+            "all keys are\n"
+            "                    written or none are.\n");
+        return EXIT_FAILURE;
+    }
+    std::string bad_option;
+    if(args.unknown({"archive", "list", "batch-size", "atomic"},
+                    &bad_option)) {
+        fprintf(stderr, "ERROR: Unknown option '--%s'.\n", bad_option.c_str());
+        return EXIT_FAILURE;
+    }
+    if(archive && list) {
+        fprintf(stderr, "ERROR: --archive and --list cannot be combined.\n");
+        return EXIT_FAILURE;
+    }
+    size_t batch_size = 4 * 1024 * 1024;
+    if(!args.number("batch-size", &batch_size) || batch_size == 0) {
+        fprintf(stderr, "ERROR: --batch-size must be a positive integer.\n");
         return EXIT_FAILURE;
     }
+    if(args.has("atomic")) {
+        batch_size = SIZE_MAX;
+    }
 
 #ifdef _WIN32
     _setmode(_fileno(stdin), O_BINARY);
 #endif
 
+    // construct path for Minecraft BE database
+    std::string path = std::string(args[0]) + "/db";
+
+    if(batch) {
+        // records are applied while stdin is still being read
+        mcberepair::DB db{path.c_str()};
+
+        if(!db) {
+            fprintf(stderr, "ERROR: Opening '%s' failed.\n", path.c_str());
+            return EXIT_FAILURE;
+        }
+
+        BatchWriter writer{&db(), batch_size};
+        leveldb::Status status;
+        std::string key, value;
+
+        if(archive) {
+            mcberepair::ArchiveReader reader{std::cin};
+            if(!reader) {
+                fprintf(stderr, "ERROR: stdin is not an archive.\n");
+                return EXIT_FAILURE;
+            }
+            while(status.ok() && reader.next(&key, &value)) {
+                status = writer.Put(key, value);
+            }
+            if(status.ok() && !reader.done()) {
+                fprintf(stderr,
+                        "ERROR: The archive is truncated or corrupt. %llu "
+                        "batches were committed before the error.\n",
+                        static_cast<unsigned long long>(writer.batches()));
+                return EXIT_FAILURE;
+            }
+        } else {
+            std::string line;
+            while(status.ok() && std::getline(std::cin, line)) {
+                // accept lists with Windows line endings
+                if(!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                auto tab = line.find('\t');
+                if(tab == std::string::npos ||
+                   !mcberepair::decode_key(line.substr(0, tab), &key)) {
+                    fprintf(stderr,
+                            "ERROR: line '%s' is malformed. %llu batches "
+                            "were committed before the error.\n",
+                            line.c_str(),
+                            static_cast<unsigned long long>(writer.batches()));
+                    return EXIT_FAILURE;
+                }
+                std::string file = line.substr(tab + 1);
+                std::ifstream in{file, std::ios::binary};
+                if(!in) {
+                    fprintf(stderr,
+                            "ERROR: Opening '%s' failed. %llu batches were "
+                            "committed before the error.\n",
+                            file.c_str(),
+                            static_cast<unsigned long long>(writer.batches()));
+                    return EXIT_FAILURE;
+                }
+                value = mcberepair::slurp_string(in);
+                status = writer.Put(key, value);
+            }
+        }
+        if(status.ok()) {
+            status = writer.Flush();
+        }
+        if(!status.ok()) {
+            // LCOV_EXCL_START
+            fprintf(stderr, "ERROR: Writing '%s' failed: %s\n", path.c_str(),
+                    status.ToString().c_str());
+            return EXIT_FAILURE;
+            // LCOV_EXCL_STOP
+        }
+        mcberepair::stats().AddKeys(writer.keys(), writer.bytes());
+        printf("Wrote %llu keys in %llu batches.\n",
+               static_cast<unsigned long long>(writer.keys()),
+               static_cast<unsigned long long>(writer.batches()));
+        return EXIT_SUCCESS;
+    }
+
     // slurp from stdin into value before we open db
     auto value = mcberepair::slurp_string(std::cin);
 
-    // construct path for Minecraft BE database
-    std::string path = std::string(argv[2]) + "/db";
-
     // open the database
     mcberepair::DB db{path.c_str()};
 
@@ -61,8 +241,8 @@ int writekey_main(int argc, char* argv[]) {
     }
 
     std::string key;
-    if(!mcberepair::decode_key(argv[3], &key)) {
-        fprintf(stderr, "ERROR: key '%s' is malformed\n", argv[3]);
+    if(!mcberepair::decode_key(args[1], &key)) {
+        fprintf(stderr, "ERROR: key '%s' is malformed\n", args[1]);
         return EXIT_FAILURE;
     }
 
@@ -70,7 +250,7 @@ int writekey_main(int argc, char* argv[]) {
 
     if(!status.ok()) {
         // LCOV_EXCL_START
-        fprintf(stderr, "ERROR: Reading key '%s' failed: %s\n", argv[3],
+        fprintf(stderr, "ERROR: Reading key '%s' failed: %s\n", args[1],
                 status.ToString().c_str());
         return EXIT_FAILURE;
         // LCOV_EXCL_STOP